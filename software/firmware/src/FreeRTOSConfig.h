@@ -57,9 +57,14 @@ extern uint32_t SystemCoreClock;
 #define configUSE_TICK_HOOK                      0
 #define configCPU_CLOCK_HZ                       ( SystemCoreClock )
 #define configTICK_RATE_HZ                       ((TickType_t)1000)
-#define configMAX_PRIORITIES                     ( 56 )
-#define configMINIMAL_STACK_SIZE                 ((uint16_t)128)
-#define configTOTAL_HEAP_SIZE                    ((size_t)9472)
+/*
+ * Sized to fit the 20KB of RAM: tasks only use priorities up to
+ * osPriorityNormal2, and the heap holds the task stacks and kernel objects
+ * created at startup (about 9000 bytes) with a little room to spare.
+ */
+#define configMAX_PRIORITIES                     ( 32 )
+#define configMINIMAL_STACK_SIZE                 ((uint16_t)64)
+#define configTOTAL_HEAP_SIZE                    ((size_t)9088)
 #define configMAX_TASK_NAME_LEN                  ( 16 )
 #define configUSE_TRACE_FACILITY                 1
 #define configUSE_16_BIT_TICKS                   0
@@ -85,8 +90,8 @@ extern uint32_t SystemCoreClock;
 /* Software timer definitions. */
 #define configUSE_TIMERS                         1
 #define configTIMER_TASK_PRIORITY                ( 2 )
-#define configTIMER_QUEUE_LENGTH                 10
-#define configTIMER_TASK_STACK_DEPTH             256
+#define configTIMER_QUEUE_LENGTH                 5
+#define configTIMER_TASK_STACK_DEPTH             128
 
 /* The following flag must be enabled only when using newlib */
 #define configUSE_NEWLIB_REENTRANT          1
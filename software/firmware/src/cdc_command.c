@@ -0,0 +1,260 @@
+#include "cdc_command.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define LOG_TAG "cdc_command"
+#include <elog.h>
+
+static bool cdc_command_parse_line(cdc_command_t *cmd, char *buf, size_t len);
+static int cdc_command_compare(cmd_category_t category, cmd_type_t type, const char *action, const cdc_command_entry_t *entry);
+static size_t cdc_append_str(char *buf, size_t buf_len, size_t n, const char *str);
+
+bool cdc_command_parse(cdc_command_t *cmd, char *buf, size_t len)
+{
+    if (!cmd || !buf) {
+        return false;
+    }
+
+    cmd->request_id = 0;
+    cmd->has_request_id = false;
+
+    /*
+     * Commands may be prefixed with a request ID, in the form "#nnn ".
+     * The digit check keeps strtoul from accepting a sign or leading spaces.
+     */
+    if (len > 0 && buf[0] == '#') {
+        char *p = NULL;
+        unsigned long request_id = isdigit((unsigned char)buf[1]) ? strtoul(buf + 1, &p, 10) : 0;
+        if (!p || *p != ' ' || request_id > UINT16_MAX) {
+            log_w("Invalid request ID");
+            return false;
+        }
+        cmd->request_id = (uint16_t)request_id;
+        cmd->has_request_id = true;
+        len -= (p + 1) - buf;
+        buf = p + 1;
+    }
+
+    if (len == 0 || buf[0] == '\0') {
+        return false;
+    }
+
+    return cdc_command_parse_line(cmd, buf, len);
+}
+
+bool cdc_command_parse_line(cdc_command_t *cmd, char *buf, size_t len)
+{
+    cmd_type_t type;
+    cmd_category_t category;
+
+    if (!cmd || !buf || len < 2 || buf[0] == '\0') {
+        return false;
+    }
+
+    switch (buf[0]) {
+    case 'S':
+        type = CMD_TYPE_SET;
+        break;
+    case 'G':
+        type = CMD_TYPE_GET;
+        break;
+    case 'I':
+        type = CMD_TYPE_INVOKE;
+        break;
+    default:
+        return false;
+    }
+
+    switch (buf[1]) {
+    case 'S':
+        category = CMD_CATEGORY_SYSTEM;
+        break;
+    case 'M':
+        category = CMD_CATEGORY_MEASUREMENT;
+        break;
+    case 'C':
+        category = CMD_CATEGORY_CALIBRATION;
+        break;
+    case 'D':
+        category = CMD_CATEGORY_DIAGNOSTICS;
+        break;
+    default:
+        return false;
+    }
+
+    if (len > 2 && buf[2] != ' ') {
+        return false;
+    }
+
+    cmd->type = type;
+    cmd->category = category;
+
+    /* Split the action from the arguments in place, without copying */
+    if (len > 3) {
+        char *p = strchr(buf + 3, ',');
+        cmd->action = buf + 3;
+        if (p) {
+            *p = '\0';
+            cmd->args = p + 1;
+        } else {
+            cmd->args = "";
+        }
+    } else {
+        cmd->action = "";
+        cmd->args = "";
+    }
+
+    log_i("Command: [%c][%c] {%s},\"%s\"", buf[0], buf[1], cmd->action, cmd->args);
+
+    return true;
+}
+
+int cdc_command_compare(cmd_category_t category, cmd_type_t type, const char *action, const cdc_command_entry_t *entry)
+{
+    if (category != entry->category) {
+        return (category < entry->category) ? -1 : 1;
+    }
+    if (type != entry->type) {
+        return (type < entry->type) ? -1 : 1;
+    }
+    return strcmp(action, entry->action);
+}
+
+bool cdc_command_table_check(const cdc_command_entry_t *table, size_t count)
+{
+    for (size_t i = 1; i < count; i++) {
+        const cdc_command_entry_t *prev = &table[i - 1];
+        const cdc_command_entry_t *entry = &table[i];
+        int result = cdc_command_compare(prev->category, prev->type, prev->action, entry);
+        if (result == 0) {
+            /* Entries that share an action must all have distinct, sorted sub-actions */
+            if (!prev->sub || !entry->sub || strcmp(prev->sub, entry->sub) >= 0) {
+                log_e("Command table error: %s,%s", entry->action, entry->sub ? entry->sub : "");
+                return false;
+            }
+        } else if (result > 0) {
+            log_e("Command table error: %s", entry->action);
+            return false;
+        }
+    }
+    return true;
+}
+
+const cdc_command_entry_t *cdc_command_lookup(const cdc_command_entry_t *table, size_t count, cdc_command_t *cmd)
+{
+    size_t lo = 0;
+    size_t hi = count;
+
+    /* Binary search for the first entry matching the command */
+    while (lo < hi) {
+        const size_t mid = lo + ((hi - lo) / 2);
+        if (cdc_command_compare(cmd->category, cmd->type, cmd->action, &table[mid]) > 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (size_t i = lo; i < count; i++) {
+        const cdc_command_entry_t *entry = &table[i];
+        if (cdc_command_compare(cmd->category, cmd->type, cmd->action, entry) != 0) {
+            break;
+        }
+        if (!entry->sub) {
+            return entry;
+        }
+
+        const size_t len = strlen(entry->sub);
+        if (strncmp(cmd->args, entry->sub, len) == 0 && (cmd->args[len] == '\0' || cmd->args[len] == ',')) {
+            cmd->args += len;
+            if (*cmd->args == ',') { cmd->args++; }
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+size_t cdc_command_format_response(char *buf, size_t buf_len, const cdc_command_t *cmd, const char *str)
+{
+    char t_ch;
+    char c_ch;
+    if (!cmd || !str) { return 0; }
+
+    switch (cmd->type) {
+    case CMD_TYPE_SET:
+        t_ch = 'S';
+        break;
+    case CMD_TYPE_GET:
+        t_ch = 'G';
+        break;
+    case CMD_TYPE_INVOKE:
+        t_ch = 'I';
+        break;
+    default:
+        return 0;
+    }
+
+    switch (cmd->category) {
+    case CMD_CATEGORY_SYSTEM:
+        c_ch = 'S';
+        break;
+    case CMD_CATEGORY_MEASUREMENT:
+        c_ch = 'M';
+        break;
+    case CMD_CATEGORY_CALIBRATION:
+        c_ch = 'C';
+        break;
+    case CMD_CATEGORY_DIAGNOSTICS:
+        c_ch = 'D';
+        break;
+    default:
+        return 0;
+    }
+
+    /*
+     * This is assembled by hand, rather than with snprintf, since every
+     * command response comes through here. That includes responses sent
+     * from the progress updates of a queued command, which are the deepest
+     * calls on the CDC task's stack.
+     */
+    char prefix[12];
+    size_t p = 0;
+    if (cmd->has_request_id) {
+        char digits[5];
+        size_t d = 0;
+        uint16_t request_id = cmd->request_id;
+        do {
+            digits[d++] = (char)('0' + (request_id % 10));
+            request_id /= 10;
+        } while (request_id > 0);
+
+        prefix[p++] = '#';
+        while (d > 0) {
+            prefix[p++] = digits[--d];
+        }
+        prefix[p++] = ' ';
+    }
+    prefix[p++] = t_ch;
+    prefix[p++] = c_ch;
+    prefix[p++] = ' ';
+    prefix[p] = '\0';
+
+    size_t n = cdc_append_str(buf, buf_len, 0, prefix);
+    n = cdc_append_str(buf, buf_len, n, cmd->action);
+    n = cdc_append_str(buf, buf_len, n, ",");
+    n = cdc_append_str(buf, buf_len, n, str);
+    n = cdc_append_str(buf, buf_len, n, "\r\n");
+    return n;
+}
+
+size_t cdc_append_str(char *buf, size_t buf_len, size_t n, const char *str)
+{
+    while (*str && n + 1 < buf_len) {
+        buf[n++] = *str++;
+    }
+    buf[n] = '\0';
+    return n;
+}
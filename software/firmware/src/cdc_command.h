@@ -0,0 +1,137 @@
+/*
+ * Command parsing and dispatch table lookup for the text protocol of the
+ * CDC interface.
+ *
+ * Each command line has the form "TC ACTION,ARGS", where T is the command
+ * type and C is the command category, and may be prefixed with a request
+ * ID in the form "#nnn ". Commands are looked up in a table sorted by
+ * category, type, action, and then sub-action, with any sub-action
+ * matched against the first argument.
+ */
+
+#ifndef CDC_COMMAND_H
+#define CDC_COMMAND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef enum {
+    CMD_TYPE_SET,
+    CMD_TYPE_GET,
+    CMD_TYPE_INVOKE
+} cmd_type_t;
+
+typedef enum {
+    CMD_CATEGORY_SYSTEM,
+    CMD_CATEGORY_MEASUREMENT,
+    CMD_CATEGORY_CALIBRATION,
+    CMD_CATEGORY_DIAGNOSTICS
+} cmd_category_t;
+
+/*
+ * Parsed command, where the action and arguments point directly into
+ * the command buffer.
+ */
+typedef struct {
+    cmd_type_t type;
+    cmd_category_t category;
+    const char *action;
+    const char *args;
+    uint16_t request_id;   /*!< Optional request ID, echoed in all responses */
+    bool has_request_id;
+} cdc_command_t;
+
+typedef enum {
+    CDC_ARGS_NONE,   /*!< Command takes no arguments */
+    CDC_ARGS_STRING, /*!< Arguments are interpreted by the handler */
+    CDC_ARGS_U16,    /*!< Comma separated list of integers */
+    CDC_ARGS_F32     /*!< Comma separated list of hex encoded floats */
+} cdc_args_format_t;
+
+#define CDC_ARGS_MAX 10
+
+typedef union {
+    uint16_t u16[CDC_ARGS_MAX];
+    float f32[CDC_ARGS_MAX];
+} cdc_args_t;
+
+/* Command requires remote control mode to be active */
+#define CDC_CMD_REMOTE      0x01
+/* Command requires that the sensor is not in use by streaming or continuous measurement */
+#define CDC_CMD_SENSOR_IDLE 0x02
+/* Command is queued to run once the CDC task is otherwise idle */
+#define CDC_CMD_ASYNC       0x04
+/* Command changes sensor, light, or settings state, so it cannot run while queued commands are pending */
+#define CDC_CMD_EXCLUSIVE   0x08
+/* Command manages the queue, so it can run between the progress updates of a queued command */
+#define CDC_CMD_JOB_CONTROL 0x10
+
+typedef bool (*cdc_command_handler_t)(const cdc_command_t *cmd, const cdc_args_t *args);
+
+typedef struct {
+    cmd_type_t type;
+    cmd_category_t category;
+    const char *action;
+    const char *sub;              /*!< Required first argument, or NULL */
+    uint8_t flags;
+    cdc_args_format_t arg_format;
+    uint8_t arg_count;            /*!< Number of required numeric arguments */
+    cdc_command_handler_t handler;
+} cdc_command_entry_t;
+
+/**
+ * Parse a command line, along with its optional request ID prefix.
+ *
+ * The action is split from the arguments in place, so the parsed
+ * command points into the buffer and remains valid only as long as
+ * the buffer is unchanged.
+ *
+ * @param cmd Parsed command
+ * @param buf Null terminated command line, without the line ending
+ * @param len Length of the command line
+ * @return True if the line is a well-formed command, false if it is
+ *         empty or malformed, or has an invalid request ID
+ */
+bool cdc_command_parse(cdc_command_t *cmd, char *buf, size_t len);
+
+/**
+ * Check that a command table is correctly sorted for lookups.
+ *
+ * Entries that share an action must all have distinct sub-actions,
+ * in sorted order.
+ *
+ * @return True if the table is valid
+ */
+bool cdc_command_table_check(const cdc_command_entry_t *table, size_t count);
+
+/**
+ * Find the table entry for a parsed command.
+ *
+ * If the entry has a sub-action, it is consumed from the start of the
+ * command's arguments.
+ *
+ * @param table Command table, which must pass 'cdc_command_table_check()'
+ * @param count Number of entries in the table
+ * @param cmd Parsed command
+ * @return Matching table entry, or NULL if there is none
+ */
+const cdc_command_entry_t *cdc_command_lookup(const cdc_command_entry_t *table, size_t count, cdc_command_t *cmd);
+
+/**
+ * Format a response line to a command.
+ *
+ * The response is the request ID prefix, if the command had one, then the
+ * command type, category, and action, followed by the response text and
+ * a line ending.
+ *
+ * @param buf Buffer to format the response into, which is always null terminated
+ * @param buf_len Size of the buffer
+ * @param cmd Command being responded to
+ * @param str Response text
+ * @return Length of the response, which is truncated to fit the buffer,
+ *         or zero if the command is invalid
+ */
+size_t cdc_command_format_response(char *buf, size_t buf_len, const cdc_command_t *cmd, const char *str);
+
+#endif /* CDC_COMMAND_H */
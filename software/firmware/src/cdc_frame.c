@@ -0,0 +1,73 @@
+#include "cdc_frame.h"
+
+#include <string.h>
+
+uint16_t cdc_frame_crc16(const uint8_t *buf, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)buf[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            if (crc & 0x8000) {
+                crc = (crc << 1) ^ 0x1021;
+            } else {
+                crc = crc << 1;
+            }
+        }
+    }
+
+    return crc;
+}
+
+size_t cdc_frame_cobs_encode(const uint8_t *in, size_t len, uint8_t *out)
+{
+    size_t code_pos = 0;
+    size_t out_pos = 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < len; i++) {
+        if (in[i] == 0) {
+            out[code_pos] = code;
+            code_pos = out_pos++;
+            code = 1;
+        } else {
+            out[out_pos++] = in[i];
+            code++;
+            if (code == 0xFF) {
+                out[code_pos] = code;
+                code_pos = out_pos++;
+                code = 1;
+            }
+        }
+    }
+    out[code_pos] = code;
+
+    return out_pos;
+}
+
+size_t cdc_frame_encode(cdc_frame_type_t type, uint16_t seq, const uint8_t *body, size_t len, uint8_t *out)
+{
+    uint8_t buf[CDC_FRAME_OVERHEAD + CDC_FRAME_MAX_BODY];
+
+    if (len > CDC_FRAME_MAX_BODY || (len > 0 && !body) || !out) {
+        return 0;
+    }
+
+    buf[0] = (uint8_t)type;
+    buf[1] = (seq >> 8) & 0xFF;
+    buf[2] = seq & 0xFF;
+    if (len > 0) {
+        memcpy(buf + 3, body, len);
+    }
+
+    const uint16_t crc = cdc_frame_crc16(buf, len + 3);
+    buf[len + 3] = (crc >> 8) & 0xFF;
+    buf[len + 4] = crc & 0xFF;
+
+    out[0] = 0x00;
+    size_t n = 1 + cdc_frame_cobs_encode(buf, len + CDC_FRAME_OVERHEAD, out + 1);
+    out[n++] = 0x00;
+
+    return n;
+}
@@ -0,0 +1,99 @@
+/*
+ * Packet framing for the binary streaming mode of the CDC interface.
+ *
+ * Each packet consists of a type byte, a 16-bit sequence number, a
+ * type-specific body, and a CRC-16 over all of the preceding bytes.
+ * Multi-byte fields are big-endian, consistent with the hex encoded
+ * values used by the text protocol.
+ *
+ * The packet is COBS encoded, so it contains no zero bytes, and is then
+ * wrapped in a zero byte on each side. This allows a receiver to separate
+ * binary packets from interleaved text lines, and to resynchronize after
+ * any lost data.
+ */
+
+#ifndef CDC_FRAME_H
+#define CDC_FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Binary packet types
+ */
+typedef enum {
+    CDC_FRAME_RAW_READING = 0x01, /*!< Raw sensor reading, from diagnostic sensor streaming */
+    CDC_FRAME_DENSITY = 0x02,     /*!< Density measurement result */
+    CDC_FRAME_STATUS = 0x03       /*!< Connection status */
+} cdc_frame_type_t;
+
+/* Size of the type, sequence, and CRC fields */
+#define CDC_FRAME_OVERHEAD 5
+
+/* Largest supported packet body */
+#define CDC_FRAME_MAX_BODY 48
+
+/* Largest encoded packet, including COBS overhead and both delimiters */
+#define CDC_FRAME_MAX_SIZE (CDC_FRAME_OVERHEAD + CDC_FRAME_MAX_BODY + 1 + 2)
+
+/**
+ * Size of the raw sensor reading packet body
+ *
+ * MOD0 data (4), gain (1), result (1),
+ * MOD1 data (4), gain (1), result (1),
+ * sample time (2), sample count (2), reading ticks (4),
+ * elapsed ticks (4), light ticks (4), reading count (4)
+ */
+#define CDC_FRAME_RAW_READING_SIZE 32
+
+/**
+ * Size of the density packet body
+ *
+ * Prefix character (1), density (4), zero offset (4), basic counts (4)
+ */
+#define CDC_FRAME_DENSITY_SIZE 13
+
+/**
+ * Size of the status packet body
+ *
+ * Flags (1), transmit queue bytes dropped (4)
+ */
+#define CDC_FRAME_STATUS_SIZE 5
+
+#define CDC_FRAME_STATUS_REMOTE 0x01 /*!< Remote control mode is active */
+#define CDC_FRAME_STATUS_SENSOR 0x02 /*!< Diagnostic sensor streaming is active */
+
+/**
+ * Calculate the CRC-16/CCITT-FALSE of a buffer.
+ *
+ * This is done in software, so it can be safely called from any task
+ * without sharing the CRC peripheral.
+ */
+uint16_t cdc_frame_crc16(const uint8_t *buf, size_t len);
+
+/**
+ * Encode a buffer using Consistent Overhead Byte Stuffing.
+ *
+ * The output buffer must have space for at least (len + len / 254 + 1)
+ * bytes. No delimiter is appended.
+ *
+ * @param in Data to encode
+ * @param len Length of the data to encode
+ * @param out Buffer for the encoded data
+ * @return Length of the encoded data
+ */
+size_t cdc_frame_cobs_encode(const uint8_t *in, size_t len, uint8_t *out);
+
+/**
+ * Build a complete delimited packet, ready to be written out.
+ *
+ * @param type Packet type
+ * @param seq Packet sequence number
+ * @param body Packet body
+ * @param len Length of the packet body, up to CDC_FRAME_MAX_BODY
+ * @param out Output buffer, of at least CDC_FRAME_MAX_SIZE bytes
+ * @return Length of the packet, or 0 if the body is too large
+ */
+size_t cdc_frame_encode(cdc_frame_type_t type, uint16_t seq, const uint8_t *body, size_t len, uint8_t *out);
+
+#endif /* CDC_FRAME_H */
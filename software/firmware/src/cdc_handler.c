@@ -27,34 +27,35 @@
 #include "app_descriptor.h"
 #include "util.h"
 #include "keypad.h"
+#include "cdc_frame.h"
+#include "cdc_command.h"
+#include "cdc_tx_ring.h"
 
 #define CMD_DATA_SIZE 104
+#define CDC_JOB_QUEUE_SIZE 2
+#define CDC_JOB_ARGS_SIZE 32
+#define CDC_SEQ_MAX_STEPS 8
 #define CDC_TX_TIMEOUT 200
 #define CDC_MIN_BIT_RATE 9600
 
-typedef enum {
-    CMD_TYPE_SET,
-    CMD_TYPE_GET,
-    CMD_TYPE_INVOKE
-} cmd_type_t;
-
-typedef enum {
-    CMD_CATEGORY_SYSTEM,
-    CMD_CATEGORY_MEASUREMENT,
-    CMD_CATEGORY_CALIBRATION,
-    CMD_CATEGORY_DIAGNOSTICS
-} cmd_category_t;
+static const char cmd_type_chars[] = { 'S', 'G', 'I' };
+static const char cmd_category_chars[] = { 'S', 'M', 'C', 'D' };
 
+/*
+ * Queued asynchronous command, with its arguments copied out of the
+ * command buffer so it can be reused for the next command.
+ */
 typedef struct {
-    cmd_type_t type;
-    cmd_category_t category;
-    char action[8];
-    char args[96];
-} cdc_command_t;
+    const cdc_command_entry_t *entry;
+    uint16_t request_id;
+    bool has_request_id;
+    char args[CDC_JOB_ARGS_SIZE];
+} cdc_job_t;
 
 typedef enum {
     READING_FORMAT_BASIC,
-    READING_FORMAT_EXT
+    READING_FORMAT_EXT,
+    READING_FORMAT_BIN
 } cdc_reading_format_t;
 
 static volatile bool cdc_initialized = false;
@@ -65,7 +66,26 @@ static size_t cmd_buffer_len = 0;
 static bool cdc_remote_enabled = false;
 static volatile bool cdc_remote_active = false;
 static volatile bool cdc_remote_sensor_active = false;
+static uint32_t cdc_continuous_cursor = 0;
 static cdc_reading_format_t reading_format = READING_FORMAT_BASIC;
+static uint16_t cdc_frame_seq = 0;
+
+/* Transmit ring buffer, where all access is guarded by the CDC write mutex */
+static cdc_tx_ring_t cdc_tx_ring = {0};
+_Static_assert(CDC_TX_RING_SIZE >= CDC_FRAME_MAX_SIZE, "Transmit ring must hold a full binary frame");
+static cdc_tx_overflow_policy_t cdc_tx_policy = CDC_TX_OVERFLOW_DROP_NEWEST;
+
+/*
+ * Command response in progress on the CDC task, which runs all the
+ * command handlers.
+ */
+typedef struct {
+    osThreadId_t thread_id;
+    const cdc_command_t *cmd;
+    bool aborted;
+} cdc_tx_response_t;
+
+static cdc_tx_response_t cdc_tx_response = {0};
 
 /* Semaphore used to unblock the task when new data is available */
 static osSemaphoreId_t cdc_rx_semaphore = NULL;
@@ -73,7 +93,29 @@ static const osSemaphoreAttr_t cdc_rx_semaphore_attrs = {
     .name = "cdc_rx_semaphore"
 };
 
-/* Semaphore used to synchronize data writing */
+/*
+ * Queue of asynchronous commands, which the CDC task runs one at a time
+ * once it has handled all the pending input. Each entry is 40 bytes, and
+ * the running command is already off the queue, so two entries keep the
+ * next commands lined up without much heap.
+ */
+static osMessageQueueId_t cdc_job_queue = NULL;
+static const osMessageQueueAttr_t cdc_job_queue_attrs = {
+    .name = "cdc_job_queue"
+};
+static volatile bool cdc_job_running = false;
+static volatile bool cdc_job_cancel = false;
+static volatile uint16_t cdc_job_request_id = 0;
+
+/*
+ * Steps for the measurement sequence, which may only change while no jobs
+ * are pending. Each step is 20 bytes, so the sequence costs 160 bytes.
+ * Longer sweeps are run as several sequences from the host.
+ */
+static sensor_raw_step_t cdc_seq_steps[CDC_SEQ_MAX_STEPS];
+static size_t cdc_seq_count = 0;
+
+/* Semaphore used to wake the CDC task when transmit queue space is freed */
 static osSemaphoreId_t cdc_tx_semaphore = NULL;
 static const osSemaphoreAttr_t cdc_tx_semaphore_attrs = {
     .name = "cdc_tx_semaphore"
@@ -87,16 +129,26 @@ static const osMutexAttr_t cdc_mutex_attrs = {
 
 static void cdc_task_loop();
 static void cdc_set_connected(bool connected);
-static void cdc_process_command(const char *buf, size_t len);
-static bool cdc_parse_command(cdc_command_t *cmd, const char *buf, size_t len);
-static bool cdc_process_command_system(const cdc_command_t *cmd);
-static bool cdc_process_command_measurement(const cdc_command_t *cmd);
-static bool cdc_process_command_calibration(const cdc_command_t *cmd);
+static cdc_tx_response_t *cdc_tx_response_get();
+static void cdc_tx_drain();
+static void cdc_process_command(char *buf, size_t len);
+static bool cdc_check_command_table();
+static bool cdc_command_execute(const cdc_command_entry_t *entry, cdc_command_t *cmd);
+static bool cdc_job_submit(const cdc_command_entry_t *entry, const cdc_command_t *cmd);
+static bool cdc_job_run_next();
+static void cdc_job_poll();
+static bool cdc_job_is_idle();
+static bool cdc_sensor_is_idle();
+static bool cdc_cmd_gs_cmds(const cdc_command_t *cmd, const cdc_args_t *args);
 static bool cdc_invoke_gain_calibration_callback(sensor_gain_calibration_status_t status, int param, void *user_data);
-static bool cdc_process_command_diagnostics(const cdc_command_t *cmd);
+static void cdc_invoke_read_callback(void *user_data);
+static bool cdc_invoke_sequence_callback(size_t index, uint32_t als_reading, void *user_data);
+static bool cdc_parse_raw_step(const char *args, sensor_raw_step_t *step);
 
 static void cdc_send_response(const char *str);
 static void cdc_send_command_response(const cdc_command_t *cmd, const char *str);
+static void cdc_send_status_frame();
+static void cdc_write_frame(cdc_frame_type_t type, const uint8_t *body, size_t len);
 
 static size_t encode_f32_array_response(char *buf, const float *array, size_t len);
 static size_t encode_f32(char *out, float value);
@@ -120,6 +172,13 @@ void task_cdc_run(void *argument)
         return;
     }
 
+    /* Create the asynchronous command queue */
+    cdc_job_queue = osMessageQueueNew(CDC_JOB_QUEUE_SIZE, sizeof(cdc_job_t), &cdc_job_queue_attrs);
+    if (!cdc_job_queue) {
+        log_e("Unable to create cdc_job_queue");
+        return;
+    }
+
     /* Create the CDC TX semaphore */
     cdc_tx_semaphore = osSemaphoreNew(1, 0, &cdc_tx_semaphore_attrs);
     if (!cdc_tx_semaphore) {
@@ -134,6 +193,11 @@ void task_cdc_run(void *argument)
         return;
     }
 
+    if (!cdc_check_command_table()) {
+        return;
+    }
+
+    cdc_tx_response.thread_id = osThreadGetId();
     cdc_initialized = true;
 
     /* Release the startup semaphore */
@@ -146,6 +210,11 @@ void task_cdc_run(void *argument)
         /* Process data */
         cdc_task_loop();
 
+        /* Run the next queued command, now that all input has been handled */
+        if (cdc_job_run_next()) {
+            continue;
+        }
+
         /* Block for new data */
         if (osSemaphoreAcquire(cdc_rx_semaphore, portMAX_DELAY) != osOK) {
             log_e("Unable to acquire cdc_rx_semaphore");
@@ -186,6 +255,13 @@ void tud_cdc_tx_complete_cb(uint8_t itf)
 {
     /* log_d("tud_cdc_tx_complete_cb: itf=%d", itf); */
     if (!cdc_initialized) { return; }
+
+    /* Refill the USB FIFO from the transmit ring */
+    osMutexAcquire(cdc_mutex, portMAX_DELAY);
+    if (cdc_host_connected) {
+        cdc_tx_drain();
+    }
+    osMutexRelease(cdc_mutex);
     osSemaphoreRelease(cdc_tx_semaphore);
 }
 
@@ -228,7 +304,7 @@ void cdc_task_loop()
             if ((buf[i] == '\r' || buf[i] == '\n') && cmd_buffer_len > 0) {
                 /* Accept command */
                 cmd_buffer[cmd_buffer_len] = '\0';
-                cdc_process_command((const char *)cmd_buffer, cmd_buffer_len);
+                cdc_process_command((char *)cmd_buffer, cmd_buffer_len);
 
                 /* Clear command buffer */
                 memset(cmd_buffer, 0, sizeof(cmd_buffer));
@@ -253,6 +329,18 @@ void cdc_set_connected(bool connected)
             }
             reading_format = READING_FORMAT_BASIC;
             densitometer_set_allow_uncalibrated_measurements(false);
+
+            /* Abandon any queued commands */
+            osMessageQueueReset(cdc_job_queue);
+            if (cdc_job_running) {
+                cdc_job_cancel = true;
+            }
+            cdc_seq_count = 0;
+
+            /* Discard anything still waiting to be sent */
+            cdc_tx_ring_clear(&cdc_tx_ring);
+            cdc_tx_policy = CDC_TX_OVERFLOW_DROP_NEWEST;
+            tud_cdc_write_clear();
         }
         cdc_host_connected = connected;
     }
@@ -263,807 +351,1338 @@ bool cdc_is_connected()
     return cdc_host_connected;
 }
 
-void cdc_process_command(const char *buf, size_t len)
+void cdc_set_tx_overflow_policy(cdc_tx_overflow_policy_t policy)
 {
-    cdc_command_t cmd = {0};
+    osMutexAcquire(cdc_mutex, portMAX_DELAY);
+    cdc_tx_policy = policy;
+    osMutexRelease(cdc_mutex);
+}
 
-    if (len == 0 || buf[0] == '\0') {
-        return;
-    }
+void cdc_get_tx_stats(cdc_tx_stats_t *stats)
+{
+    if (!stats) { return; }
+    osMutexAcquire(cdc_mutex, portMAX_DELAY);
+    stats->bytes_queued = cdc_tx_ring.bytes_queued;
+    stats->bytes_dropped = cdc_tx_ring.bytes_dropped;
+    stats->bytes_pending = cdc_tx_ring_pending(&cdc_tx_ring);
+    stats->policy = cdc_tx_policy;
+    osMutexRelease(cdc_mutex);
+}
 
-    if (cdc_parse_command(&cmd, buf, len)) {
-        bool result = false;
-        switch (cmd.category) {
-        case CMD_CATEGORY_SYSTEM:
-            result = cdc_process_command_system(&cmd);
-            break;
-        case CMD_CATEGORY_MEASUREMENT:
-            result = cdc_process_command_measurement(&cmd);
-            break;
-        case CMD_CATEGORY_CALIBRATION:
-            result = cdc_process_command_calibration(&cmd);
-            break;
-        case CMD_CATEGORY_DIAGNOSTICS:
-            result = cdc_process_command_diagnostics(&cmd);
-            break;
-        default:
-            break;
+/*
+ * System Commands
+ */
+
+static bool cdc_cmd_ss_disp(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /* "SS DISP,\"text\"" -> Write text to the display */
+    /* "SS DISP,n" -> Enable or disable the display (enable = 1, disable = 0) */
+    if (cmd->args[0] == '"') {
+        char buf[64];
+        uint8_t j = 0;
+        memset(buf, 0, sizeof(buf));
+        for (uint8_t i = 1; i < 56 && cmd->args[i] != '\0'; i++) {
+            if (cmd->args[i] == '\\' && cmd->args[i + 1] == 'n') {
+                buf[j++] = '\n';
+                i++;
+            } else if (cmd->args[i] == '\\' && cmd->args[i + 1] == '\\') {
+                buf[j++] = '\\';
+                i++;
+            } else {
+                buf[j++] = cmd->args[i];
+            }
         }
-        if (!result) {
-            cdc_send_command_response(&cmd, "NAK");
+
+        size_t len = strlen(buf);
+        if (len > 0 && buf[len - 1] == '"') {
+            buf[len - 1] = '\0';
         }
+
+        display_static_message(buf);
+    } else if (strcmp(cmd->args, "0") == 0) {
+        display_enable(false);
+    } else if (strcmp(cmd->args, "1") == 0) {
+        display_enable(true);
+    } else {
+        return false;
     }
+
+    cdc_send_command_response(cmd, "OK");
+    return true;
 }
 
-bool cdc_parse_command(cdc_command_t *cmd, const char *buf, size_t len)
+static bool cdc_cmd_gs_b(const cdc_command_t *cmd, const cdc_args_t *args)
 {
-    cmd_type_t type;
-    cmd_category_t category;
-
-    if (!cmd || !buf || len < 2 || buf[0] == '\0') {
-        return false;
-    }
+    /*
+     * Output format:
+     * Build date, Build describe, Checksum
+     */
+    const app_descriptor_t *app_descriptor = app_descriptor_get();
+    char buf[128];
+    sprintf(buf, "\"%s\",\"%s\",%08lX",
+        app_descriptor->build_date,
+        app_descriptor->build_describe,
+        __bswap32(app_descriptor->crc32));
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
 
-    switch (buf[0]) {
-    case 'S':
-        type = CMD_TYPE_SET;
-        break;
-    case 'G':
-        type = CMD_TYPE_GET;
-        break;
-    case 'I':
-        type = CMD_TYPE_INVOKE;
-        break;
-    default:
-        return false;
-    }
+static bool cdc_cmd_gs_jobs(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /*
+     * Output format:
+     * Running (0 or 1), Request ID of the running command, Queued command count
+     */
+    char buf[32];
+    const bool running = cdc_job_running;
+    sprintf(buf, "%d,%d,%lu", running, running ? cdc_job_request_id : 0,
+        osMessageQueueGetCount(cdc_job_queue));
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
 
-    switch (buf[1]) {
-    case 'S':
-        category = CMD_CATEGORY_SYSTEM;
-        break;
-    case 'M':
-        category = CMD_CATEGORY_MEASUREMENT;
-        break;
-    case 'C':
-        category = CMD_CATEGORY_CALIBRATION;
-        break;
-    case 'D':
-        category = CMD_CATEGORY_DIAGNOSTICS;
-        break;
-    default:
-        return false;
-    }
+static bool cdc_cmd_gs_dev(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /*
+     * Output format:
+     * HAL Version, MCU Device ID, MCU Revision ID, SysClock Frequency
+     */
+    char buf[64];
+    uint32_t hal_ver = HAL_GetHalVersion();
+    uint8_t hal_ver_code = ((uint8_t)(hal_ver)) & 0x0F;
+
+    sprintf(buf, "%d.%d.%d%c,0x%lX,0x%lX,%ldMHz",
+        ((uint8_t)(hal_ver >> 24)) & 0x0F,
+        ((uint8_t)(hal_ver >> 16)) & 0x0F,
+        ((uint8_t)(hal_ver >> 8)) & 0x0F,
+        (hal_ver_code > 0 ? (char)hal_ver_code : ' '),
+        HAL_GetDEVID(),
+        HAL_GetREVID(),
+        HAL_RCC_GetSysClockFreq() / 1000000);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
 
-    if (len > 2 && buf[2] != ' ') {
-        return false;
-    }
+static bool cdc_cmd_gs_isen(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /*
+     * Output format:
+     * VDDA, Temperature (MCU), Temperature (Sensor)
+     */
+    char buf[48];
+    adc_readings_t readings = {0};
+    float sensor_temp_c = 0;
 
-    cmd->type = type;
-    cmd->category = category;
+    adc_read(&readings);
+    sensor_read_temperature(&sensor_temp_c);
 
-    if (len > 3) {
-        char *p = strchr(buf + 3, ',');
-        if (p) {
-            strncpy(cmd->action, buf + 3, MIN(p - (buf + 3), sizeof(cmd->action) - 1));
-            strncpy(cmd->args, p + 1, MIN(len - ((p + 1) - buf), sizeof(cmd->args) - 1));
-        } else {
-            strncpy(cmd->action, buf + 3, MIN(len - 3, sizeof(cmd->action) - 1));
-            memset(cmd->args, 0, sizeof(cmd->args));
-        }
-    } else {
-        memset(cmd->action, 0, sizeof(cmd->action));
-        memset(cmd->args, 0, sizeof(cmd->args));
-    }
+    sprintf_(buf, "%dmV,%.1fC,%.1fC", readings.vdda_mv, readings.temp_c, sensor_temp_c);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
 
-    log_i("Command: [%c][%c] {%s},\"%s\"", buf[0], buf[1], cmd->action, cmd->args);
+static bool cdc_cmd_gs_rtos(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /*
+     * Output format:
+     * FreeRTOS Version, Heap Free, Heap Watermark, Task Count
+     */
+    char buf[48];
+    sprintf(buf, "%s,%d,%d,%ld",
+        tskKERNEL_VERSION_NUMBER,
+        xPortGetFreeHeapSize(), xPortGetMinimumEverFreeHeapSize(),
+        uxTaskGetNumberOfTasks());
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
 
+static bool cdc_cmd_gs_uid(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    char buf[32];
+    sprintf(buf, "%08lX%08lX%08lX",
+        __bswap32(HAL_GetUIDw0()),
+        __bswap32(HAL_GetUIDw1()),
+        __bswap32(HAL_GetUIDw2()));
+    cdc_send_command_response(cmd, buf);
     return true;
 }
 
-bool cdc_process_command_system(const cdc_command_t *cmd)
+static bool cdc_cmd_gs_v(const cdc_command_t *cmd, const cdc_args_t *args)
 {
     /*
-     * System Commands
-     * "GS V"    -> Get project name and version
-     * "GS B"    -> Get firmware build information
-     * "GS DEV"  -> Get device information (HAL version, MCU Rev ID, MCU Dev ID, SysClock)
-     * "GS RTOS" -> Get FreeRTOS information
-     * "GS UID"  -> Get device unique ID
-     * "GS ISEN" -> Internal sensor readings
-     * "IS REMOTE,n" -> Invoke remote control mode (enable = 1, disable = 0)
-     * "SS DISP,\"text\"" -> Write text to the display [remote]
-     * "SS DISP,n" -> Enable or disable the display (enable = 1, disable = 0) [remote]
+     * Output format:
+     * Project name, Version
      */
     const app_descriptor_t *app_descriptor = app_descriptor_get();
     char buf[128];
+    sprintf(buf, "\"%s\",\"%s\"", app_descriptor->project_name, app_descriptor->version);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
 
-    if (!cmd) { return false; }
-
-    if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "V") == 0) {
-        /*
-         * Output format:
-         * Project name, Version
-         */
-        sprintf(buf, "\"%s\",\"%s\"", app_descriptor->project_name, app_descriptor->version);
-        cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "B") == 0) {
-        /*
-         * Output format:
-         * Build date, Build describe, Checksum
-         */
-        sprintf(buf, "\"%s\",\"%s\",%08lX",
-            app_descriptor->build_date,
-            app_descriptor->build_describe,
-            __bswap32(app_descriptor->crc32));
-        cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "DEV") == 0) {
-        /*
-         * Output format:
-         * HAL Version, MCU Device ID, MCU Revision ID, SysClock Frequency
-         */
-        uint32_t hal_ver = HAL_GetHalVersion();
-        uint8_t hal_ver_code = ((uint8_t)(hal_ver)) & 0x0F;
-
-        sprintf(buf, "%d.%d.%d%c,0x%lX,0x%lX,%ldMHz",
-            ((uint8_t)(hal_ver >> 24)) & 0x0F,
-            ((uint8_t)(hal_ver >> 16)) & 0x0F,
-            ((uint8_t)(hal_ver >> 8)) & 0x0F,
-            (hal_ver_code > 0 ? (char)hal_ver_code : ' '),
-            HAL_GetDEVID(),
-            HAL_GetREVID(),
-            HAL_RCC_GetSysClockFreq() / 1000000);
-        cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "RTOS") == 0) {
-        /*
-         * Output format:
-         * FreeRTOS Version, Heap Free, Heap Watermark, Task Count
-         */
-        sprintf(buf, "%s,%d,%d,%ld",
-            tskKERNEL_VERSION_NUMBER,
-            xPortGetFreeHeapSize(), xPortGetMinimumEverFreeHeapSize(),
-            uxTaskGetNumberOfTasks());
-        cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "UID") == 0) {
-        sprintf(buf, "%08lX%08lX%08lX",
-            __bswap32(HAL_GetUIDw0()),
-            __bswap32(HAL_GetUIDw1()),
-            __bswap32(HAL_GetUIDw2()));
-        cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "ISEN") == 0) {
-        /*
-         * Output format:
-         * VDDA, Temperature (MCU), Temperature (Sensor)
-         */
-        adc_readings_t readings = {0};
-        float sensor_temp_c = 0;
-
-        adc_read(&readings);
-        sensor_read_temperature(&sensor_temp_c);
-
-        sprintf_(buf, "%dmV,%.1fC,%.1fC", readings.vdda_mv, readings.temp_c, sensor_temp_c);
-        cdc_send_command_response(cmd, buf);
-
-        return true;
-    } else if (cmd->type == CMD_TYPE_INVOKE && strcmp(cmd->action, "REMOTE") == 0) {
-        bool enable;
-        if (cmd->args[0] == '0' && cmd->args[1] == '\0') {
-            enable = false;
-        } else if (cmd->args[0] == '1' && cmd->args[1] == '\0') {
-            enable = true;
-        } else {
-            return false;
+static bool cdc_cmd_is_cancel(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /* "IS CANCEL" -> Cancel all queued commands */
+    /* "IS CANCEL,id" -> Cancel the queued command with the matching request ID */
+    cdc_job_t job;
+    const bool cancel_all = (cmd->args[0] == '\0');
+    const uint16_t request_id = cancel_all ? 0 : (uint16_t)atoi(cmd->args);
+
+    /* Cycle once through the queue, putting back anything that is kept */
+    const uint32_t count = osMessageQueueGetCount(cdc_job_queue);
+    for (uint32_t i = 0; i < count; i++) {
+        if (osMessageQueueGet(cdc_job_queue, &job, NULL, 0) != osOK) {
+            break;
         }
-
-        log_i("Set remote control mode: %d", enable);
-        if (enable) {
-            cdc_remote_enabled = true;
-            task_main_force_state(STATE_REMOTE);
+        if (cancel_all || (job.has_request_id && job.request_id == request_id)) {
+            const cdc_command_t job_cmd = {
+                .type = job.entry->type,
+                .category = job.entry->category,
+                .action = job.entry->action,
+                .request_id = job.request_id,
+                .has_request_id = job.has_request_id
+            };
+            cdc_send_command_response(&job_cmd, "CANCEL");
         } else {
-            task_main_force_state(STATE_HOME);
-            cdc_remote_enabled = false;
+            osMessageQueuePut(cdc_job_queue, &job, 0, 0);
         }
+    }
 
-        return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "DISP") == 0 && cdc_remote_active) {
-        if (cmd->args[0] == '"') {
-            memset(buf, 0, sizeof(buf));
-            uint8_t j = 0;
-            for (uint8_t i = 1; i < 56; i++) {
-                if (i < 55 && cmd->args[i] == '\\' && cmd->args[i + 1] == 'n') {
-                    buf[j++] = '\n';
-                    i++;
-                } else if (i < 55 && cmd->args[i] == '\\' && cmd->args[i + 1] == '\\') {
-                    buf[j++] = '\\';
-                    i++;
-                } else {
-                    buf[j++] = cmd->args[i];
-                }
-            }
-
-            size_t len = strlen(buf);
-            if (len > 0 && buf[len - 1] == '"') {
-                buf[len - 1] = '\0';
-            }
+    /* Only commands that report progress can be interrupted once running */
+    if (cdc_job_running && (cancel_all || cdc_job_request_id == request_id)) {
+        cdc_job_cancel = true;
+    }
 
-            display_static_message(buf);
-        } else if (cmd->args[0] == '0' && cmd->args[1] == '\0') {
-            display_enable(false);
-        } else if (cmd->args[0] == '1' && cmd->args[1] == '\0') {
-            display_enable(true);
-        } else {
-            return false;
-        }
+    cdc_send_command_response(cmd, "OK");
+    return true;
+}
 
-        cdc_send_command_response(cmd, "OK");
-        return true;
+static bool cdc_cmd_is_remote(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    bool enable;
+    if (strcmp(cmd->args, "0") == 0) {
+        enable = false;
+    } else if (strcmp(cmd->args, "1") == 0) {
+        enable = true;
     } else {
         return false;
     }
+
+    log_i("Set remote control mode: %d", enable);
+    if (enable) {
+        cdc_remote_enabled = true;
+        task_main_force_state(STATE_REMOTE);
+    } else {
+        task_main_force_state(STATE_HOME);
+        cdc_remote_enabled = false;
+    }
+
+    return true;
 }
 
-bool cdc_process_command_measurement(const cdc_command_t *cmd)
+/*
+ * Measurement Commands
+ */
+
+static densitometer_t *cdc_densitometer_from_arg(const char *arg)
 {
-    /*
-     * Measurement Commands
-     * "GM REFL" -> Get last reflection measurement
-     * "GM TRAN" -> Get last transmission measurement
-     * "SM FORMAT,x" -> Set measurement data format ("BASIC", "EXT")
-     * "SM UNCAL,x" -> Allow uncalibrated readings (0=false, 1=true)
-     */
-    if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "REFL") == 0) {
-        char buf[32];
-        float reading = densitometer_get_display_d(densitometer_vis_reflection());
-        encode_f32(buf, reading);
-        cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "TRAN") == 0) {
-        char buf[32];
-        float reading = densitometer_get_display_d(densitometer_vis_transmission());
-        encode_f32(buf, reading);
-        cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "UVTR") == 0) {
-        char buf[32];
-        float reading = densitometer_get_display_d(densitometer_uv_transmission());
-        encode_f32(buf, reading);
-        cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "FORMAT") == 0) {
-        if (strcmp(cmd->args, "BASIC") == 0) {
-            reading_format = READING_FORMAT_BASIC;
-        } else if (strcmp(cmd->args, "EXT") == 0) {
-            reading_format = READING_FORMAT_EXT;
-        } else {
-            return false;
-        }
+    if (strcmp(arg, "R") == 0) {
+        return densitometer_vis_reflection();
+    } else if (strcmp(arg, "T") == 0) {
+        return densitometer_vis_transmission();
+    } else if (strcmp(arg, "U") == 0) {
+        return densitometer_uv_transmission();
+    } else {
+        return NULL;
+    }
+}
+
+static bool cdc_cmd_sm_conv(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /* Tolerance is in 0.001D units, with 0 for fixed length readings */
+    if (args->u16[1] > UINT8_MAX || args->u16[2] > UINT8_MAX) {
+        return false;
+    }
+    sensor_read_convergence_t convergence = {
+        .tolerance_d = (float)args->u16[0] / 1000.0F,
+        .min_cycles = (uint8_t)args->u16[1],
+        .max_cycles = (uint8_t)args->u16[2]
+    };
+    if (sensor_set_read_convergence(&convergence) == osOK) {
         cdc_send_command_response(cmd, "OK");
-        return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "UNCAL") == 0) {
-        if (strcmp(cmd->args, "0") == 0) {
-            densitometer_set_allow_uncalibrated_measurements(false);
-        } else if (strcmp(cmd->args, "1") == 0) {
-            densitometer_set_allow_uncalibrated_measurements(true);
-        } else {
-            return false;
-        }
+    } else {
+        cdc_send_command_response(cmd, "ERR");
+    }
+    return true;
+}
+
+static bool cdc_cmd_sm_format(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    if (strcmp(cmd->args, "BASIC") == 0) {
+        reading_format = READING_FORMAT_BASIC;
+    } else if (strcmp(cmd->args, "EXT") == 0) {
+        reading_format = READING_FORMAT_EXT;
+    } else if (strcmp(cmd->args, "BIN") == 0) {
         cdc_send_command_response(cmd, "OK");
+        osMutexAcquire(cdc_mutex, portMAX_DELAY);
+        reading_format = READING_FORMAT_BIN;
+        cdc_frame_seq = 0;
+        osMutexRelease(cdc_mutex);
+
+        /* The first packet confirms the switch to the receiver */
+        cdc_send_status_frame();
         return true;
+    } else {
+        return false;
     }
-    return false;
+    cdc_send_command_response(cmd, "OK");
+    return true;
 }
 
-bool cdc_process_command_calibration(const cdc_command_t *cmd)
+static bool cdc_cmd_sm_uncal(const cdc_command_t *cmd, const cdc_args_t *args)
 {
-    /*
-     * Calibration Commands
-     * "IC GAIN" -> Invoke the sensor gain calibration process [remote]
-     * "GC GAIN" -> Get sensor gain calibration values
-     * "SC GAIN" -> Set sensor gain calibration values
-     * "GC SLOPE" -> Get sensor slope calibration values
-     * "SC SLOPE" -> Set sensor slope calibration values
-     * "GC VTEMP" -> Get VIS sensor temperature calibration values
-     * "SC VTEMP" -> Set VIS sensor temperature calibration values
-     * "GC UTEMP" -> Get VIS sensor temperature calibration values
-     * "SC UTEMP" -> Set VIS sensor temperature calibration values
-     * "GC REFL" -> Get VIS reflection density calibration values
-     * "SC REFL" -> Set VIS reflection density calibration values
-     * "GC TRAN" -> Get VIS transmission density calibration values
-     * "SC TRAN" -> Set VIS transmission density calibration values
-     * "GC UVTR" -> Get UV transmission density calibration values
-     * "SC UVTR" -> Set UV transmission density calibration values
-     */
-    if (cmd->type == CMD_TYPE_INVOKE && strcmp(cmd->action, "GAIN") == 0 && cdc_remote_active) {
-        osStatus_t result = sensor_gain_calibration(cdc_invoke_gain_calibration_callback, (void *)cmd);
-        if (result == osOK) {
-            cdc_send_command_response(cmd, "OK");
-        } else {
-            cdc_send_command_response(cmd, "ERR");
-        }
-        return true;
+    if (strcmp(cmd->args, "0") == 0) {
+        densitometer_set_allow_uncalibrated_measurements(false);
+    } else if (strcmp(cmd->args, "1") == 0) {
+        densitometer_set_allow_uncalibrated_measurements(true);
+    } else {
+        return false;
     }
-#ifdef TEST_LIGHT_CAL
-    else if (cmd->type == CMD_TYPE_INVOKE && strcmp(cmd->action, "LR") == 0 && cdc_remote_active) {
-        /* This command is only enabled for development and testing purposes */
-        osStatus_t result = sensor_light_calibration(SENSOR_LIGHT_VIS_REFLECTION);
-        if (result == osOK) {
-            cdc_send_command_response(cmd, "OK");
-        } else {
-            cdc_send_command_response(cmd, "ERR");
-        }
-        return true;
-    } else if (cmd->type == CMD_TYPE_INVOKE && strcmp(cmd->action, "LT") == 0 && cdc_remote_active) {
-        /* This command is only enabled for development and testing purposes */
-        osStatus_t result = sensor_light_calibration(SENSOR_LIGHT_VIS_TRANSMISSION);
-        if (result == osOK) {
-            cdc_send_command_response(cmd, "OK");
-        } else {
-            cdc_send_command_response(cmd, "ERR");
-        }
-        return true;
-    } else if (cmd->type == CMD_TYPE_INVOKE && strcmp(cmd->action, "LTU") == 0 && cdc_remote_active) {
-        /* This command is only enabled for development and testing purposes */
-        osStatus_t result = sensor_light_calibration(SENSOR_LIGHT_UV_TRANSMISSION);
-        if (result == osOK) {
-            cdc_send_command_response(cmd, "OK");
-        } else {
-            cdc_send_command_response(cmd, "ERR");
+    cdc_send_command_response(cmd, "OK");
+    return true;
+}
+
+static bool cdc_cmd_gm_cont(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    char buf[96];
+    size_t offset = 0;
+    densitometer_continuous_reading_t reading;
+    int count = 0;
+
+    /* Each response carries the index of its first reading, followed by the densities */
+    while (count < 8 && densitometer_continuous_read(&cdc_continuous_cursor, &reading)) {
+        if (count == 0) {
+            offset += sprintf(buf, "%lu", reading.index);
         }
-        return true;
+        offset += sprintf(buf + offset, ",%.2f", reading.d);
+        count++;
     }
-#endif
-    else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "GAIN") == 0) {
-        char buf[128];
-        settings_cal_gain_t cal_gain;
+    if (count == 0) {
+        sprintf(buf, "%lu", cdc_continuous_cursor);
+    }
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
 
-        settings_get_cal_gain(&cal_gain);
+static bool cdc_cmd_gm_conv(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    char buf[32];
+    sensor_read_convergence_t convergence;
+    sensor_get_read_convergence(&convergence);
+    sprintf(buf, "%ld,%d,%d",
+        lroundf(convergence.tolerance_d * 1000.0F),
+        convergence.min_cycles, convergence.max_cycles);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
 
-        encode_f32_array_response(buf, cal_gain.values, TSL2585_GAIN_256X + 1);
+static bool cdc_cmd_gm_refl(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    char buf[16];
+    encode_f32(buf, densitometer_get_display_d(densitometer_vis_reflection()));
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
 
-        cdc_send_command_response(cmd, buf);
+static bool cdc_cmd_gm_tran(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    char buf[16];
+    encode_f32(buf, densitometer_get_display_d(densitometer_vis_transmission()));
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+static bool cdc_cmd_gm_uvtr(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    char buf[16];
+    encode_f32(buf, densitometer_get_display_d(densitometer_uv_transmission()));
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+static bool cdc_cmd_im_cont(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /* L = R, T, U to start, or 0 to stop */
+    densitometer_t *densitometer;
+    if (strcmp(cmd->args, "0") == 0) {
+        densitometer_continuous_stop();
+        cdc_send_command_response(cmd, "OK");
         return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "GAIN") == 0) {
-        float gain_val[10] = {0};
-        size_t n = decode_f32_array_args(cmd->args, gain_val, 10);
-        if (n == 10) {
-            settings_cal_gain_t cal_gain = {0};
-
-            for (size_t i = 0; i < 10; i++) {
-                cal_gain.values[i] = gain_val[i];
-            }
+    }
 
-            if (settings_set_cal_gain(&cal_gain)) {
-                cdc_send_command_response(cmd, "OK");
-            } else {
-                cdc_send_command_response(cmd, "ERR");
-            }
+    /* Starting requires the sensor, so it is subject to the same rules as CDC_CMD_SENSOR_IDLE */
+    if (!cdc_sensor_is_idle() || !cdc_job_is_idle()) {
+        return false;
+    }
+
+    densitometer = cdc_densitometer_from_arg(cmd->args);
+    if (!densitometer) {
+        return false;
+    }
+
+    cdc_continuous_cursor = 0;
+    if (densitometer_continuous_start(densitometer) == DENSITOMETER_OK) {
+        cdc_send_command_response(cmd, "OK");
+    } else {
+        cdc_send_command_response(cmd, "ERR");
+    }
+    return true;
+}
 
+static bool cdc_cmd_im_scan(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /* L = R, T, U to start, or 0 to stop and get the steps that were found */
+    densitometer_t *densitometer;
+    if (strcmp(cmd->args, "0") == 0) {
+        if (!densitometer_scan_is_running()) {
+            cdc_send_command_response(cmd, "ERR");
             return true;
         }
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "VTEMP") == 0) {
-        char buf[64];
-        settings_cal_temperature_t cal_temperature;
-        float temp_val[3] = {0};
-
-        settings_get_cal_vis_temperature(&cal_temperature);
-        temp_val[0] = cal_temperature.b0;
-        temp_val[1] = cal_temperature.b1;
-        temp_val[2] = cal_temperature.b2;
-        encode_f32_array_response(buf, temp_val, 3);
+        densitometer_scan_step_t steps[DENSITOMETER_SCAN_MAX_STEPS];
+        size_t count = densitometer_scan_stop(steps, DENSITOMETER_SCAN_MAX_STEPS);
 
-        cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "VTEMP") == 0) {
-        float temp_val[3] = {0};
-        const size_t n = decode_f32_array_args(cmd->args, temp_val, 3);
-        if (n == 3) {
-            settings_cal_temperature_t cal_temperature = {0};
-            cal_temperature.b0 = temp_val[0];
-            cal_temperature.b1 = temp_val[1];
-            cal_temperature.b2 = temp_val[2];
-
-            if (settings_set_cal_vis_temperature(&cal_temperature)) {
-                cdc_send_command_response(cmd, "OK");
-            } else {
-                cdc_send_command_response(cmd, "ERR");
-            }
-            return true;
+        cdc_send_command_response(cmd, "[[");
+        for (size_t i = 0; i < count; i++) {
+            char buf[32];
+            sprintf(buf, "%.2f,%d\r\n", steps[i].d, steps[i].count);
+            cdc_send_response(buf);
         }
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "UTEMP") == 0) {
-        char buf[64];
-        settings_cal_temperature_t cal_temperature;
-        float temp_val[3] = {0};
+        cdc_send_response("]]\r\n");
+        return true;
+    }
+
+    /* Starting requires the sensor, so it is subject to the same rules as CDC_CMD_SENSOR_IDLE */
+    if (!cdc_sensor_is_idle() || !cdc_job_is_idle()) {
+        return false;
+    }
 
-        settings_get_cal_uv_temperature(&cal_temperature);
-        temp_val[0] = cal_temperature.b0;
-        temp_val[1] = cal_temperature.b1;
-        temp_val[2] = cal_temperature.b2;
-        encode_f32_array_response(buf, temp_val, 3);
+    densitometer = cdc_densitometer_from_arg(cmd->args);
+    if (!densitometer) {
+        return false;
+    }
 
-        cdc_send_command_response(cmd, buf);
+    if (densitometer_scan_start(densitometer) == DENSITOMETER_OK) {
+        cdc_send_command_response(cmd, "OK");
+    } else {
+        cdc_send_command_response(cmd, "ERR");
+    }
+    return true;
+}
+
+/*
+ * Calibration Commands
+ */
+
+static bool cdc_cmd_sc_drift(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    settings_cal_light_drift_t cal_light_drift = {
+        .vis_reflection = args->f32[0],
+        .vis_transmission = args->f32[1],
+        .uv_transmission = args->f32[2]
+    };
+    cdc_send_command_response(cmd, settings_set_cal_light_drift(&cal_light_drift) ? "OK" : "ERR");
+    return true;
+}
+
+static bool cdc_cmd_sc_gain(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    settings_cal_gain_t cal_gain = {0};
+    for (size_t i = 0; i < 10; i++) {
+        cal_gain.values[i] = args->f32[i];
+    }
+    cdc_send_command_response(cmd, settings_set_cal_gain(&cal_gain) ? "OK" : "ERR");
+    return true;
+}
+
+static bool cdc_cmd_sc_refl(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    settings_cal_reflection_t cal_reflection = {
+        .lo_d = args->f32[0],
+        .lo_value = args->f32[1],
+        .hi_d = args->f32[2],
+        .hi_value = args->f32[3]
+    };
+    cdc_send_command_response(cmd, settings_set_cal_vis_reflection(&cal_reflection) ? "OK" : "ERR");
+    return true;
+}
+
+static bool cdc_cmd_sc_tran(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /* The low density value is always zero */
+    if (args->f32[0] >= 0.001F) {
+        return false;
+    }
+    settings_cal_transmission_t cal_transmission = {
+        .zero_value = args->f32[1],
+        .hi_d = args->f32[2],
+        .hi_value = args->f32[3]
+    };
+    cdc_send_command_response(cmd, settings_set_cal_vis_transmission(&cal_transmission) ? "OK" : "ERR");
+    return true;
+}
+
+static bool cdc_cmd_sc_utemp(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    settings_cal_temperature_t cal_temperature = {
+        .b0 = args->f32[0],
+        .b1 = args->f32[1],
+        .b2 = args->f32[2]
+    };
+    cdc_send_command_response(cmd, settings_set_cal_uv_temperature(&cal_temperature) ? "OK" : "ERR");
+    return true;
+}
+
+static bool cdc_cmd_sc_uvtr(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /* The low density value is always zero */
+    if (args->f32[0] >= 0.001F) {
+        return false;
+    }
+    settings_cal_transmission_t cal_transmission = {
+        .zero_value = args->f32[1],
+        .hi_d = args->f32[2],
+        .hi_value = args->f32[3]
+    };
+    cdc_send_command_response(cmd, settings_set_cal_uv_transmission(&cal_transmission) ? "OK" : "ERR");
+    return true;
+}
+
+static bool cdc_cmd_sc_vtemp(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    settings_cal_temperature_t cal_temperature = {
+        .b0 = args->f32[0],
+        .b1 = args->f32[1],
+        .b2 = args->f32[2]
+    };
+    cdc_send_command_response(cmd, settings_set_cal_vis_temperature(&cal_temperature) ? "OK" : "ERR");
+    return true;
+}
+
+static bool cdc_cmd_gc_drift(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    char buf[64];
+    settings_cal_light_drift_t cal_light_drift;
+    settings_get_cal_light_drift(&cal_light_drift);
+
+    const float drift_val[3] = {
+        cal_light_drift.vis_reflection,
+        cal_light_drift.vis_transmission,
+        cal_light_drift.uv_transmission
+    };
+    encode_f32_array_response(buf, drift_val, 3);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+static bool cdc_cmd_gc_gain(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    char buf[128];
+    settings_cal_gain_t cal_gain;
+    settings_get_cal_gain(&cal_gain);
+    encode_f32_array_response(buf, cal_gain.values, TSL2585_GAIN_256X + 1);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+static bool cdc_cmd_gc_refl(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    char buf[64];
+    settings_cal_reflection_t cal_reflection;
+    settings_get_cal_vis_reflection(&cal_reflection);
+
+    const float refl_val[4] = {
+        cal_reflection.lo_d,
+        cal_reflection.lo_value,
+        cal_reflection.hi_d,
+        cal_reflection.hi_value
+    };
+    encode_f32_array_response(buf, refl_val, 4);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+static bool cdc_cmd_gc_tran(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    char buf[64];
+    settings_cal_transmission_t cal_transmission;
+    settings_get_cal_vis_transmission(&cal_transmission);
+
+    const float tran_val[4] = {
+        0.0F,
+        cal_transmission.zero_value,
+        cal_transmission.hi_d,
+        cal_transmission.hi_value
+    };
+    encode_f32_array_response(buf, tran_val, 4);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+static bool cdc_cmd_gc_utemp(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    char buf[64];
+    settings_cal_temperature_t cal_temperature;
+    settings_get_cal_uv_temperature(&cal_temperature);
+
+    const float temp_val[3] = { cal_temperature.b0, cal_temperature.b1, cal_temperature.b2 };
+    encode_f32_array_response(buf, temp_val, 3);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+static bool cdc_cmd_gc_uvtr(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    char buf[64];
+    settings_cal_transmission_t cal_transmission;
+    settings_get_cal_uv_transmission(&cal_transmission);
+
+    const float tran_val[4] = {
+        0.0F,
+        cal_transmission.zero_value,
+        cal_transmission.hi_d,
+        cal_transmission.hi_value
+    };
+    encode_f32_array_response(buf, tran_val, 4);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+static bool cdc_cmd_gc_vtemp(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    char buf[64];
+    settings_cal_temperature_t cal_temperature;
+    settings_get_cal_vis_temperature(&cal_temperature);
+
+    const float temp_val[3] = { cal_temperature.b0, cal_temperature.b1, cal_temperature.b2 };
+    encode_f32_array_response(buf, temp_val, 3);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+static bool cdc_cmd_ic_gain(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    osStatus_t result = sensor_gain_calibration(cdc_invoke_gain_calibration_callback, (void *)cmd);
+    cdc_send_command_response(cmd, (result == osOK) ? "OK" : "ERR");
+    return true;
+}
+
+bool cdc_invoke_gain_calibration_callback(sensor_gain_calibration_status_t status, int param, void *user_data)
+{
+    const cdc_command_t *cmd = (const cdc_command_t *)user_data;
+    char buf[32];
+    sprintf(buf, "STATUS,%d,%d", status, param);
+    cdc_send_command_response(cmd, buf);
+
+    cdc_job_poll();
+
+    return keypad_is_detect() && !cdc_job_cancel;
+}
+
+#ifdef TEST_LIGHT_CAL
+/* These commands are only enabled for development and testing purposes */
+
+static bool cdc_cmd_ic_lr(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    osStatus_t result = sensor_light_calibration(SENSOR_LIGHT_VIS_REFLECTION);
+    cdc_send_command_response(cmd, (result == osOK) ? "OK" : "ERR");
+    return true;
+}
+
+static bool cdc_cmd_ic_lt(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    osStatus_t result = sensor_light_calibration(SENSOR_LIGHT_VIS_TRANSMISSION);
+    cdc_send_command_response(cmd, (result == osOK) ? "OK" : "ERR");
+    return true;
+}
+
+static bool cdc_cmd_ic_ltu(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    osStatus_t result = sensor_light_calibration(SENSOR_LIGHT_UV_TRANSMISSION);
+    cdc_send_command_response(cmd, (result == osOK) ? "OK" : "ERR");
+    return true;
+}
+#endif
+
+/*
+ * Diagnostics Commands
+ */
+
+static bool cdc_cmd_sd_log(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /* "U" for the USB CDC device, "D" for the debug port UART */
+    if (strcmp(cmd->args, "U") == 0) {
+        cdc_send_command_response(cmd, "OK");
+        cdc_logging_redirected = true;
+        elog_set_text_color_enabled(false);
+        elog_port_redirect(cdc_write);
         return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "UTEMP") == 0) {
-        float temp_val[3] = {0};
-        const size_t n = decode_f32_array_args(cmd->args, temp_val, 3);
-        if (n == 3) {
-            settings_cal_temperature_t cal_temperature = {0};
-            cal_temperature.b0 = temp_val[0];
-            cal_temperature.b1 = temp_val[1];
-            cal_temperature.b2 = temp_val[2];
-
-            if (settings_set_cal_uv_temperature(&cal_temperature)) {
-                cdc_send_command_response(cmd, "OK");
-            } else {
-                cdc_send_command_response(cmd, "ERR");
-            }
-            return true;
-        }
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "REFL") == 0) {
-        char buf[64];
-        settings_cal_reflection_t cal_reflection;
-        float refl_val[4] = {0};
+    } else if (strcmp(cmd->args, "D") == 0) {
+        cdc_send_command_response(cmd, "OK");
+        elog_port_redirect(NULL);
+        elog_set_text_color_enabled(true);
+        cdc_logging_redirected = false;
+        return true;
+    }
+    return false;
+}
+
+static bool cdc_set_light_duty(const cdc_command_t *cmd, sensor_light_t light)
+{
+    const uint16_t light_max = light_get_max_value();
+    uint16_t value = atoi(cmd->args);
+    if (value > light_max) { value = light_max; }
+
+    osStatus_t result = sensor_set_light_mode(light, false, value);
+    cdc_send_command_response(cmd, (result == osOK) ? "OK" : "ERR");
+    return true;
+}
+
+static bool cdc_cmd_sd_lr(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    return cdc_set_light_duty(cmd, SENSOR_LIGHT_VIS_REFLECTION);
+}
+
+static bool cdc_cmd_sd_lt(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    return cdc_set_light_duty(cmd, SENSOR_LIGHT_VIS_TRANSMISSION);
+}
+
+static bool cdc_cmd_sd_ltu(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    return cdc_set_light_duty(cmd, SENSOR_LIGHT_UV_TRANSMISSION);
+}
+
+static bool cdc_cmd_sd_s_agcdis(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    cdc_send_command_response(cmd, (sensor_set_agc_disabled() == osOK) ? "OK" : "ERR");
+    return true;
+}
+
+static bool cdc_cmd_sd_s_agcen(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /* AGC sample count, c = [0-2047] */
+    if (args->u16[0] >= 2048) {
+        return false;
+    }
+    cdc_send_command_response(cmd, (sensor_set_agc_enabled(args->u16[0]) == osOK) ? "OK" : "ERR");
+    return true;
+}
+
+static bool cdc_cmd_sd_s_batch(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /* Integration cycles read out of the sensor FIFO at once, n = [1-4] */
+    if (args->u16[0] < 1 || args->u16[0] > 4) {
+        return false;
+    }
+    cdc_send_command_response(cmd, (sensor_set_fifo_batch((uint8_t)args->u16[0]) == osOK) ? "OK" : "ERR");
+    return true;
+}
+
+static bool cdc_cmd_sd_s_cfg(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /* Gain g = [0-13], sample time t = [0-2047], sample count c = [0-2047] */
+    const tsl2585_gain_t gain_val = (tsl2585_gain_t)args->u16[0];
+    const uint16_t sample_time = args->u16[1];
+    const uint16_t sample_count = args->u16[2];
+    if (gain_val >= TSL2585_GAIN_MAX || sample_time >= 2048 || sample_count >= 2048) {
+        return false;
+    }
+    osStatus_t result = sensor_set_config(gain_val, sample_time, sample_count);
+    cdc_send_command_response(cmd, (result == osOK) ? "OK" : "ERR");
+    return true;
+}
+
+static bool cdc_cmd_sd_s_mode(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    osStatus_t result = sensor_set_mode((sensor_mode_t)args->u16[0]);
+    cdc_send_command_response(cmd, (result == osOK) ? "OK" : "ERR");
+    return true;
+}
+
+static bool cdc_cmd_sd_seq_add(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /* "L,nnn,M,g,t,c" -> Same as the arguments to ID READ */
+    if (!cdc_job_is_idle() || cdc_seq_count >= CDC_SEQ_MAX_STEPS) {
+        return false;
+    }
+    if (!cdc_parse_raw_step(cmd->args, &cdc_seq_steps[cdc_seq_count])) {
+        return false;
+    }
+    cdc_seq_count++;
+
+    char buf[16];
+    sprintf(buf, "%d", (int)cdc_seq_count);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+static bool cdc_cmd_sd_seq_clr(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    if (!cdc_job_is_idle()) {
+        return false;
+    }
+    cdc_seq_count = 0;
+    cdc_send_command_response(cmd, "OK");
+    return true;
+}
+
+static bool cdc_cmd_sd_txq(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /* p = [O]ldest, [N]ewest */
+    if (strcmp(cmd->args, "O") == 0) {
+        cdc_set_tx_overflow_policy(CDC_TX_OVERFLOW_DROP_OLDEST);
+    } else if (strcmp(cmd->args, "N") == 0) {
+        cdc_set_tx_overflow_policy(CDC_TX_OVERFLOW_DROP_NEWEST);
+    } else {
+        return false;
+    }
+    cdc_send_command_response(cmd, "OK");
+    return true;
+}
+
+static bool cdc_cmd_gd_disp(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    cdc_send_command_response(cmd, "[[");
+    display_capture_screenshot();
+    cdc_send_response("]]\r\n");
+    return true;
+}
+
+static bool cdc_cmd_gd_i2c(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    char buf[32];
+    sprintf(buf, "%lu", tsl2585_get_saved_transactions());
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+static bool cdc_cmd_gd_lmax(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    char buf[32];
+    sprintf(buf, "%d", light_get_max_value());
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+static bool cdc_cmd_gd_sctl(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    char buf[48];
+    sensor_control_stats_t stats;
+    sensor_get_control_stats(&stats);
+    sprintf(buf, "%lu,%lu,%lu", stats.call_count, stats.latency_avg_us, stats.latency_max_us);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+static bool cdc_cmd_gd_seq(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    char buf[16];
+    sprintf(buf, "%d,%d", (int)cdc_seq_count, CDC_SEQ_MAX_STEPS);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+static bool cdc_cmd_gd_sint(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    char buf[48];
+    sensor_interrupt_stats_t stats;
+    sensor_get_interrupt_stats(&stats);
+    sprintf(buf, "%lu,%lu,%lu", stats.blackout_max_us, stats.capture_max_us, stats.latency_max_ticks);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+static bool cdc_cmd_gd_sread(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    char buf[48];
+    sensor_read_info_t info;
+    sensor_get_last_read_info(&info);
+    sprintf(buf, "%d,%d,%d,%d",
+        info.gain, info.sample_time, info.sample_count, info.adjustments);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+static bool cdc_cmd_gd_sring(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    char buf[32];
+    sensor_reading_stats_t stats;
+    sensor_get_reading_stats(&stats);
+    sprintf(buf, "%lu,%lu", stats.published, stats.overruns);
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
+
+static bool cdc_cmd_gd_stk(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /*
+     * Output format, one line per task:
+     * Name, Stack Size, Stack Free (smallest seen so far)
+     */
+    const char *name;
+    uint32_t stack_size;
+    uint32_t stack_free;
+
+    cdc_send_command_response(cmd, "[[");
+    for (size_t i = 0; task_main_get_stack_info(i, &name, &stack_size, &stack_free); i++) {
+        char buf[48];
+        sprintf(buf, "%s,%lu,%lu\r\n", name, stack_size, stack_free);
+        cdc_send_response(buf);
+    }
+    cdc_send_response("]]\r\n");
+    return true;
+}
+
+static bool cdc_cmd_gd_txq(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    char buf[48];
+    cdc_tx_stats_t stats;
+    cdc_get_tx_stats(&stats);
+    sprintf(buf, "%lu,%lu,%lu,%c", stats.bytes_queued, stats.bytes_dropped, stats.bytes_pending,
+        (stats.policy == CDC_TX_OVERFLOW_DROP_OLDEST) ? 'O' : 'N');
+    cdc_send_command_response(cmd, buf);
+    return true;
+}
 
-        settings_get_cal_vis_reflection(&cal_reflection);
-        refl_val[0] = cal_reflection.lo_d;
-        refl_val[1] = cal_reflection.lo_value;
-        refl_val[2] = cal_reflection.hi_d;
-        refl_val[3] = cal_reflection.hi_value;
+static bool cdc_cmd_id_meas(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /* "L,nnn" -> Light source (L = R, T, U) and brightness */
+    sensor_light_t light_source;
+    float als_result;
+
+    if (cmd->args[0] == 'R') {
+        light_source = SENSOR_LIGHT_VIS_REFLECTION;
+    } else if (cmd->args[0] == 'T') {
+        light_source = SENSOR_LIGHT_VIS_TRANSMISSION;
+    } else if (cmd->args[0] == 'U') {
+        light_source = SENSOR_LIGHT_UV_TRANSMISSION;
+    } else {
+        return false;
+    }
+    if (cmd->args[1] != ',') {
+        return false;
+    }
 
-        encode_f32_array_response(buf, refl_val, 4);
+    const uint16_t light_max = light_get_max_value();
+    uint16_t light_value = atoi(cmd->args + 2);
+    if (light_value > light_max) { light_value = light_max; }
 
+    osStatus_t result = sensor_read_target(light_source, light_value, &als_result, cdc_invoke_read_callback, NULL);
+    if (result == osOK) {
+        char buf[16];
+        encode_f32(buf, als_result);
         cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "REFL") == 0) {
-        float refl_val[4] = {0};
-        size_t n = decode_f32_array_args(cmd->args, refl_val, 4);
-        if (n == 4) {
-            settings_cal_reflection_t cal_reflection = {0};
-            cal_reflection.lo_d = refl_val[0];
-            cal_reflection.lo_value = refl_val[1];
-            cal_reflection.hi_d = refl_val[2];
-            cal_reflection.hi_value = refl_val[3];
-
-            if (settings_set_cal_vis_reflection(&cal_reflection)) {
-                cdc_send_command_response(cmd, "OK");
-            } else {
-                cdc_send_command_response(cmd, "ERR");
-            }
+    } else {
+        cdc_send_command_response(cmd, "ERR");
+    }
+    return true;
+}
 
-            return true;
-        }
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "TRAN") == 0) {
-        char buf[64];
-        settings_cal_transmission_t cal_transmission;
-        float tran_val[4] = {0};
+static bool cdc_cmd_id_read(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /* "L,nnn,M,g,t,c" -> Light source (L = 0, R, T, U), brightness, mode, gain, sample time, sample count */
+    sensor_raw_step_t step;
+    uint32_t als_reading;
 
-        settings_get_cal_vis_transmission(&cal_transmission);
-        tran_val[0] = 0.0F;
-        tran_val[1] = cal_transmission.zero_value;
-        tran_val[2] = cal_transmission.hi_d;
-        tran_val[3] = cal_transmission.hi_value;
+    if (!cdc_parse_raw_step(cmd->args, &step)) {
+        return false;
+    }
 
-        encode_f32_array_response(buf, tran_val, 4);
+    osStatus_t result = sensor_read_target_raw(
+        step.light, step.light_value, step.mode, step.gain, step.sample_time, step.sample_count,
+        &als_reading);
 
+    if (result == osOK) {
+        char buf[16];
+        sprintf(buf, "%lu", als_reading);
         cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "TRAN") == 0) {
-        float tran_val[4] = {0};
-        size_t n = decode_f32_array_args(cmd->args, tran_val, 4);
-        if (n == 4 && tran_val[0] < 0.001F) {
-            settings_cal_transmission_t cal_transmission = {0};
-            cal_transmission.zero_value = tran_val[1];
-            cal_transmission.hi_d = tran_val[2];
-            cal_transmission.hi_value = tran_val[3];
-
-            if (settings_set_cal_vis_transmission(&cal_transmission)) {
-                cdc_send_command_response(cmd, "OK");
-            } else {
-                cdc_send_command_response(cmd, "ERR");
-            }
+    } else {
+        cdc_send_command_response(cmd, "ERR");
+    }
+    return true;
+}
 
-            return true;
-        }
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "UVTR") == 0) {
-        char buf[64];
-        settings_cal_transmission_t cal_transmission;
-        float tran_val[4] = {0};
+bool cdc_parse_raw_step(const char *args, sensor_raw_step_t *step)
+{
+    uint16_t values[5] = {0};
+
+    if (args[0] == 'R') {
+        step->light = SENSOR_LIGHT_VIS_REFLECTION;
+    } else if (args[0] == 'T') {
+        step->light = SENSOR_LIGHT_VIS_TRANSMISSION;
+    } else if (args[0] == 'U') {
+        step->light = SENSOR_LIGHT_UV_TRANSMISSION;
+    } else if (args[0] == '0') {
+        step->light = SENSOR_LIGHT_OFF;
+    } else {
+        return false;
+    }
+    if (args[1] != ',' || decode_u16_array_args(args + 2, values, 5) < 5) {
+        return false;
+    }
 
-        settings_get_cal_uv_transmission(&cal_transmission);
-        tran_val[0] = 0.0F;
-        tran_val[1] = cal_transmission.zero_value;
-        tran_val[2] = cal_transmission.hi_d;
-        tran_val[3] = cal_transmission.hi_value;
+    step->light_value = values[0];
+    step->mode = (sensor_mode_t)values[1];
+    step->gain = (tsl2585_gain_t)values[2];
+    step->sample_time = values[3];
+    step->sample_count = values[4];
+    return true;
+}
 
-        encode_f32_array_response(buf, tran_val, 4);
+static bool cdc_cmd_id_seq(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    if (cdc_seq_count == 0) {
+        return false;
+    }
 
-        cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "UVTR") == 0) {
-        float tran_val[4] = {0};
-        size_t n = decode_f32_array_args(cmd->args, tran_val, 4);
-        if (n == 4 && tran_val[0] < 0.001F) {
-            settings_cal_transmission_t cal_transmission = {0};
-            cal_transmission.zero_value = tran_val[1];
-            cal_transmission.hi_d = tran_val[2];
-            cal_transmission.hi_value = tran_val[3];
-
-            if (settings_set_cal_uv_transmission(&cal_transmission)) {
-                cdc_send_command_response(cmd, "OK");
-            } else {
-                cdc_send_command_response(cmd, "ERR");
-            }
+    osStatus_t result = sensor_read_target_raw_sequence(cdc_seq_steps, cdc_seq_count,
+        cdc_invoke_sequence_callback, (void *)cmd);
 
-            return true;
-        }
+    if (result != osOK) {
+        cdc_send_command_response(cmd, "ERR");
+    } else if (cdc_job_cancel) {
+        cdc_send_command_response(cmd, "CANCEL");
+    } else {
+        cdc_send_command_response(cmd, "OK");
     }
-
-    return false;
+    return true;
 }
 
-bool cdc_invoke_gain_calibration_callback(sensor_gain_calibration_status_t status, int param, void *user_data)
+bool cdc_invoke_sequence_callback(size_t index, uint32_t als_reading, void *user_data)
 {
     const cdc_command_t *cmd = (const cdc_command_t *)user_data;
     char buf[32];
-    sprintf(buf, "STATUS,%d,%d", status, param);
+    sprintf(buf, "%d,%lu", (int)index, als_reading);
     cdc_send_command_response(cmd, buf);
 
-    return keypad_is_detect();
+    cdc_job_poll();
+
+    return cdc_remote_active && !cdc_job_cancel;
 }
 
-bool cdc_process_command_diagnostics(const cdc_command_t *cmd)
+void cdc_invoke_read_callback(void *user_data)
 {
-    /*
-     * Diagnostics Commands
-     * "GD DISP" -> Get display screenshot (multi-line response)
-     *
-     * "GD LMAX" -> Get maximum light duty cycle value
-     * "SD LR,nnn" -> Set VIS reflection light duty cycle (nnn/LMAX) [remote]
-     * "SD LT,nnn" -> Set VIS transmission light duty cycle (nnn/LMAX) [remote]
-     * "SD LTU,nnn" -> Set UV transmission light duty cycle (nnn/LMAX) [remote]
-     *
-     * "ID S,START"   -> Invoke sensor start [remote]
-     * "ID S,STOP"    -> Invoke sensor stop [remote]
-     * "SD S,MODE,m"  -> Set sensor smux mode (s = [0-2]) [remote]
-     * "SD S,CFG,g,t,c" -> Set sensor gain (g = [0-13]), sample time (t = [0-2047]), and sample count (c=[0-2047]) [remote]
-     * "SD S,AGCEN,c" -> Enable the sensor's automatic gain control, and set AGC sample count (c=[0-2047]) [remote]
-     * "SD S,AGCDIS"  -> Disable the sensor's automatic gain control [remote]
-     * "GD S,READING" -> Get next sensor reading [remote]
-     *
-     * "ID READ,L,nnn,M,g,t,c" -> Perform controlled sensor target read [remote]
-     * "ID MEAS,L,nnn" -> Perform normal density measurement read cycle [remote]
-     *
-     * "ID WIPE,UIDw2,CKSUM" -> Factory reset of configuration EEPROM
-     *
-     * "SD LOG,U" -> Set logging output to USB CDC device
-     * "SD LOG,D" -> Set logging output to debug port UART
-     */
+    cdc_job_poll();
+}
 
-    if (!cmd) { return false; }
+static bool cdc_cmd_id_s_start(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    cdc_remote_sensor_active = true;
+    cdc_send_command_response(cmd, (sensor_start() == osOK) ? "OK" : "ERR");
+    return true;
+}
 
-    if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "DISP") == 0) {
-        cdc_send_command_response(cmd, "[[");
-        display_capture_screenshot();
-        cdc_send_response("]]\r\n");
-        return true;
-    } else if (cmd->type == CMD_TYPE_GET && strcmp(cmd->action, "LMAX") == 0) {
+static bool cdc_cmd_id_s_stop(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    cdc_remote_sensor_active = false;
+    cdc_send_command_response(cmd, (sensor_stop() == osOK) ? "OK" : "ERR");
+    return true;
+}
+
+static bool cdc_cmd_id_wipe(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /* "UIDw2,CKSUM" -> Factory reset of configuration EEPROM */
+    char exp_buf[32];
+    const app_descriptor_t *app_descriptor = app_descriptor_get();
+    sprintf(exp_buf, "%08lX,%08lX",
+        __bswap32(HAL_GetUIDw2()),
+        __bswap32(app_descriptor->crc32));
+    if (strncasecmp(exp_buf, cmd->args, sizeof(exp_buf)) == 0) {
+        cdc_send_command_response(cmd, "OK");
+        log_w("Factory EEPROM wipe requested");
+        settings_wipe();
+        osDelay(50);
+        NVIC_SystemReset();
+    } else {
+        cdc_send_command_response(cmd, "ERR");
+    }
+    return true;
+}
+
+/*
+ * Command table, which must be sorted by category, type, action, and
+ * then sub-action, in that order. This is checked at startup.
+ * Sub-actions are matched against the first argument, which is then
+ * consumed before the remaining arguments are parsed.
+ */
+#define CMD(t, c, a, s, f, af, an, h) { CMD_TYPE_##t, CMD_CATEGORY_##c, a, s, f, af, an, h }
+static const cdc_command_entry_t cdc_command_table[] = {
+    CMD(SET,    SYSTEM,      "DISP",   NULL,     CDC_CMD_REMOTE, CDC_ARGS_STRING, 0, cdc_cmd_ss_disp),
+    CMD(GET,    SYSTEM,      "B",      NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gs_b),
+    CMD(GET,    SYSTEM,      "CMDS",   NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gs_cmds),
+    CMD(GET,    SYSTEM,      "DEV",    NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gs_dev),
+    CMD(GET,    SYSTEM,      "ISEN",   NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gs_isen),
+    CMD(GET,    SYSTEM,      "JOBS",   NULL,     CDC_CMD_JOB_CONTROL, CDC_ARGS_NONE, 0, cdc_cmd_gs_jobs),
+    CMD(GET,    SYSTEM,      "RTOS",   NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gs_rtos),
+    CMD(GET,    SYSTEM,      "UID",    NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gs_uid),
+    CMD(GET,    SYSTEM,      "V",      NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gs_v),
+    CMD(INVOKE, SYSTEM,      "CANCEL", NULL,     CDC_CMD_JOB_CONTROL, CDC_ARGS_STRING, 0, cdc_cmd_is_cancel),
+    CMD(INVOKE, SYSTEM,      "REMOTE", NULL,     CDC_CMD_EXCLUSIVE, CDC_ARGS_STRING, 0, cdc_cmd_is_remote),
+
+    CMD(SET,    MEASUREMENT, "CONV",   NULL,     CDC_CMD_EXCLUSIVE, CDC_ARGS_U16, 3, cdc_cmd_sm_conv),
+    CMD(SET,    MEASUREMENT, "FORMAT", NULL,     0, CDC_ARGS_STRING, 0, cdc_cmd_sm_format),
+    CMD(SET,    MEASUREMENT, "UNCAL",  NULL,     0, CDC_ARGS_STRING, 0, cdc_cmd_sm_uncal),
+    CMD(GET,    MEASUREMENT, "CONT",   NULL,     CDC_CMD_REMOTE, CDC_ARGS_NONE, 0, cdc_cmd_gm_cont),
+    CMD(GET,    MEASUREMENT, "CONV",   NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gm_conv),
+    CMD(GET,    MEASUREMENT, "REFL",   NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gm_refl),
+    CMD(GET,    MEASUREMENT, "TRAN",   NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gm_tran),
+    CMD(GET,    MEASUREMENT, "UVTR",   NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gm_uvtr),
+    CMD(INVOKE, MEASUREMENT, "CONT",   NULL,     CDC_CMD_REMOTE, CDC_ARGS_STRING, 0, cdc_cmd_im_cont),
+    CMD(INVOKE, MEASUREMENT, "SCAN",   NULL,     CDC_CMD_REMOTE, CDC_ARGS_STRING, 0, cdc_cmd_im_scan),
+
+    CMD(SET,    CALIBRATION, "DRIFT",  NULL,     CDC_CMD_EXCLUSIVE, CDC_ARGS_F32, 3, cdc_cmd_sc_drift),
+    CMD(SET,    CALIBRATION, "GAIN",   NULL,     CDC_CMD_EXCLUSIVE, CDC_ARGS_F32, 10, cdc_cmd_sc_gain),
+    CMD(SET,    CALIBRATION, "REFL",   NULL,     CDC_CMD_EXCLUSIVE, CDC_ARGS_F32, 4, cdc_cmd_sc_refl),
+    CMD(SET,    CALIBRATION, "TRAN",   NULL,     CDC_CMD_EXCLUSIVE, CDC_ARGS_F32, 4, cdc_cmd_sc_tran),
+    CMD(SET,    CALIBRATION, "UTEMP",  NULL,     CDC_CMD_EXCLUSIVE, CDC_ARGS_F32, 3, cdc_cmd_sc_utemp),
+    CMD(SET,    CALIBRATION, "UVTR",   NULL,     CDC_CMD_EXCLUSIVE, CDC_ARGS_F32, 4, cdc_cmd_sc_uvtr),
+    CMD(SET,    CALIBRATION, "VTEMP",  NULL,     CDC_CMD_EXCLUSIVE, CDC_ARGS_F32, 3, cdc_cmd_sc_vtemp),
+    CMD(GET,    CALIBRATION, "DRIFT",  NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gc_drift),
+    CMD(GET,    CALIBRATION, "GAIN",   NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gc_gain),
+    CMD(GET,    CALIBRATION, "REFL",   NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gc_refl),
+    CMD(GET,    CALIBRATION, "TRAN",   NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gc_tran),
+    CMD(GET,    CALIBRATION, "UTEMP",  NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gc_utemp),
+    CMD(GET,    CALIBRATION, "UVTR",   NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gc_uvtr),
+    CMD(GET,    CALIBRATION, "VTEMP",  NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gc_vtemp),
+    CMD(INVOKE, CALIBRATION, "GAIN",   NULL,     CDC_CMD_REMOTE | CDC_CMD_SENSOR_IDLE | CDC_CMD_ASYNC, CDC_ARGS_NONE, 0, cdc_cmd_ic_gain),
+#ifdef TEST_LIGHT_CAL
+    CMD(INVOKE, CALIBRATION, "LR",     NULL,     CDC_CMD_REMOTE | CDC_CMD_EXCLUSIVE, CDC_ARGS_NONE, 0, cdc_cmd_ic_lr),
+    CMD(INVOKE, CALIBRATION, "LT",     NULL,     CDC_CMD_REMOTE | CDC_CMD_EXCLUSIVE, CDC_ARGS_NONE, 0, cdc_cmd_ic_lt),
+    CMD(INVOKE, CALIBRATION, "LTU",    NULL,     CDC_CMD_REMOTE | CDC_CMD_EXCLUSIVE, CDC_ARGS_NONE, 0, cdc_cmd_ic_ltu),
+#endif
+
+    CMD(SET,    DIAGNOSTICS, "LOG",    NULL,     0, CDC_ARGS_STRING, 0, cdc_cmd_sd_log),
+    CMD(SET,    DIAGNOSTICS, "LR",     NULL,     CDC_CMD_REMOTE | CDC_CMD_EXCLUSIVE, CDC_ARGS_STRING, 0, cdc_cmd_sd_lr),
+    CMD(SET,    DIAGNOSTICS, "LT",     NULL,     CDC_CMD_REMOTE | CDC_CMD_EXCLUSIVE, CDC_ARGS_STRING, 0, cdc_cmd_sd_lt),
+    CMD(SET,    DIAGNOSTICS, "LTU",    NULL,     CDC_CMD_REMOTE | CDC_CMD_EXCLUSIVE, CDC_ARGS_STRING, 0, cdc_cmd_sd_ltu),
+    CMD(SET,    DIAGNOSTICS, "S",      "AGCDIS", CDC_CMD_REMOTE | CDC_CMD_EXCLUSIVE, CDC_ARGS_NONE, 0, cdc_cmd_sd_s_agcdis),
+    CMD(SET,    DIAGNOSTICS, "S",      "AGCEN",  CDC_CMD_REMOTE | CDC_CMD_EXCLUSIVE, CDC_ARGS_U16, 1, cdc_cmd_sd_s_agcen),
+    CMD(SET,    DIAGNOSTICS, "S",      "BATCH",  CDC_CMD_REMOTE | CDC_CMD_EXCLUSIVE, CDC_ARGS_U16, 1, cdc_cmd_sd_s_batch),
+    CMD(SET,    DIAGNOSTICS, "S",      "CFG",    CDC_CMD_REMOTE | CDC_CMD_EXCLUSIVE, CDC_ARGS_U16, 3, cdc_cmd_sd_s_cfg),
+    CMD(SET,    DIAGNOSTICS, "S",      "MODE",   CDC_CMD_REMOTE | CDC_CMD_EXCLUSIVE, CDC_ARGS_U16, 1, cdc_cmd_sd_s_mode),
+    CMD(SET,    DIAGNOSTICS, "SEQ",    "ADD",    0, CDC_ARGS_STRING, 0, cdc_cmd_sd_seq_add),
+    CMD(SET,    DIAGNOSTICS, "SEQ",    "CLR",    0, CDC_ARGS_NONE, 0, cdc_cmd_sd_seq_clr),
+    CMD(SET,    DIAGNOSTICS, "TXQ",    NULL,     0, CDC_ARGS_STRING, 0, cdc_cmd_sd_txq),
+    CMD(GET,    DIAGNOSTICS, "DISP",   NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gd_disp),
+    CMD(GET,    DIAGNOSTICS, "I2C",    NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gd_i2c),
+    CMD(GET,    DIAGNOSTICS, "LMAX",   NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gd_lmax),
+    CMD(GET,    DIAGNOSTICS, "SCTL",   NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gd_sctl),
+    CMD(GET,    DIAGNOSTICS, "SEQ",    NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gd_seq),
+    CMD(GET,    DIAGNOSTICS, "SINT",   NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gd_sint),
+    CMD(GET,    DIAGNOSTICS, "SREAD",  NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gd_sread),
+    CMD(GET,    DIAGNOSTICS, "SRING",  NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gd_sring),
+    CMD(GET,    DIAGNOSTICS, "STK",    NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gd_stk),
+    CMD(GET,    DIAGNOSTICS, "TXQ",    NULL,     0, CDC_ARGS_NONE, 0, cdc_cmd_gd_txq),
+    CMD(INVOKE, DIAGNOSTICS, "MEAS",   NULL,     CDC_CMD_REMOTE | CDC_CMD_SENSOR_IDLE | CDC_CMD_ASYNC, CDC_ARGS_STRING, 0, cdc_cmd_id_meas),
+    CMD(INVOKE, DIAGNOSTICS, "READ",   NULL,     CDC_CMD_REMOTE | CDC_CMD_SENSOR_IDLE | CDC_CMD_ASYNC, CDC_ARGS_STRING, 0, cdc_cmd_id_read),
+    CMD(INVOKE, DIAGNOSTICS, "S",      "START",  CDC_CMD_REMOTE | CDC_CMD_SENSOR_IDLE | CDC_CMD_EXCLUSIVE, CDC_ARGS_NONE, 0, cdc_cmd_id_s_start),
+    CMD(INVOKE, DIAGNOSTICS, "S",      "STOP",   CDC_CMD_REMOTE | CDC_CMD_EXCLUSIVE, CDC_ARGS_NONE, 0, cdc_cmd_id_s_stop),
+    CMD(INVOKE, DIAGNOSTICS, "SEQ",    NULL,     CDC_CMD_REMOTE | CDC_CMD_SENSOR_IDLE | CDC_CMD_ASYNC, CDC_ARGS_NONE, 0, cdc_cmd_id_seq),
+    CMD(INVOKE, DIAGNOSTICS, "WIPE",   NULL,     CDC_CMD_REMOTE | CDC_CMD_EXCLUSIVE, CDC_ARGS_STRING, 0, cdc_cmd_id_wipe)
+};
+#undef CMD
+
+#define CDC_COMMAND_COUNT (sizeof(cdc_command_table) / sizeof(cdc_command_entry_t))
+
+bool cdc_check_command_table()
+{
+    return cdc_command_table_check(cdc_command_table, CDC_COMMAND_COUNT);
+}
+
+static bool cdc_cmd_gs_cmds(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    /*
+     * Output format, one line per command:
+     * Command, Flags (R = remote mode, I = sensor idle, A = asynchronous, X = exclusive, J = job control)
+     */
+    cdc_send_command_response(cmd, "[[");
+    for (size_t i = 0; i < CDC_COMMAND_COUNT; i++) {
+        const cdc_command_entry_t *entry = &cdc_command_table[i];
         char buf[32];
-        sprintf(buf, "%d", light_get_max_value());
-        cdc_send_command_response(cmd, buf);
-        return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "LR") == 0 && cdc_remote_active) {
-        const uint16_t light_max = light_get_max_value();
-        uint16_t value = atoi(cmd->args);
-        if (value > light_max) { value = light_max; }
-
-        osStatus_t result = sensor_set_light_mode(SENSOR_LIGHT_VIS_REFLECTION, false, value);
-        if (result == osOK) {
-            cdc_send_command_response(cmd, "OK");
-        } else {
-            cdc_send_command_response(cmd, "ERR");
+        size_t n = sprintf(buf, "%c%c %s",
+            cmd_type_chars[entry->type], cmd_category_chars[entry->category], entry->action);
+        if (entry->sub) {
+            n += sprintf(buf + n, ",%s", entry->sub);
         }
+        buf[n++] = ':';
+        if (entry->flags & CDC_CMD_REMOTE) { buf[n++] = 'R'; }
+        if (entry->flags & CDC_CMD_SENSOR_IDLE) { buf[n++] = 'I'; }
+        if (entry->flags & CDC_CMD_ASYNC) { buf[n++] = 'A'; }
+        if (entry->flags & CDC_CMD_EXCLUSIVE) { buf[n++] = 'X'; }
+        if (entry->flags & CDC_CMD_JOB_CONTROL) { buf[n++] = 'J'; }
+        buf[n++] = '\r';
+        buf[n++] = '\n';
+        buf[n] = '\0';
+        cdc_send_response(buf);
+    }
+    cdc_send_response("]]\r\n");
+    return true;
+}
 
+static bool cdc_command_parse_args(const cdc_command_entry_t *entry, const cdc_command_t *cmd, cdc_args_t *args)
+{
+    switch (entry->arg_format) {
+    case CDC_ARGS_U16:
+        return decode_u16_array_args(cmd->args, args->u16, entry->arg_count) >= entry->arg_count;
+    case CDC_ARGS_F32:
+        return decode_f32_array_args(cmd->args, args->f32, entry->arg_count) >= entry->arg_count;
+    case CDC_ARGS_NONE:
+    case CDC_ARGS_STRING:
+    default:
         return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "LT") == 0 && cdc_remote_active) {
-        const uint16_t light_max = light_get_max_value();
-        uint16_t value = atoi(cmd->args);
-        if (value > light_max) { value = light_max; }
-
-        osStatus_t result = sensor_set_light_mode(SENSOR_LIGHT_VIS_TRANSMISSION, false, value);
-        if (result == osOK) {
-            cdc_send_command_response(cmd, "OK");
-        } else {
-            cdc_send_command_response(cmd, "ERR");
-        }
+    }
+}
 
-        return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "LTU") == 0 && cdc_remote_active) {
-        const uint16_t light_max = light_get_max_value();
-        uint16_t value = atoi(cmd->args);
-        if (value > light_max) { value = light_max; }
-
-        osStatus_t result = sensor_set_light_mode(SENSOR_LIGHT_UV_TRANSMISSION, false, value);
-        if (result == osOK) {
-            cdc_send_command_response(cmd, "OK");
-        } else {
-            cdc_send_command_response(cmd, "ERR");
-        }
+bool cdc_command_execute(const cdc_command_entry_t *entry, cdc_command_t *cmd)
+{
+    cdc_args_t args;
 
-        return true;
-    } else if (strcmp(cmd->action, "S") == 0 && cdc_remote_active) {
-        osStatus_t result;
-        if (cmd->type == CMD_TYPE_INVOKE && strcmp(cmd->args, "START") == 0) {
-            cdc_remote_sensor_active = true;
-            result = sensor_start();
-            if (result == osOK) {
-                cdc_send_command_response(cmd, "OK");
-            } else {
-                cdc_send_command_response(cmd, "ERR");
-            }
-            return true;
-        } else if (cmd->type == CMD_TYPE_INVOKE && strcmp(cmd->args, "STOP") == 0) {
-            cdc_remote_sensor_active = false;
-            result = sensor_stop();
-            if (result == osOK) {
-                cdc_send_command_response(cmd, "OK");
-            } else {
-                cdc_send_command_response(cmd, "ERR");
-            }
-            return true;
-        } else if (cmd->type == CMD_TYPE_SET && strncmp(cmd->args, "MODE,", 5) == 0) {
-            sensor_mode_t mode = (sensor_mode_t)atoi(cmd->args + 5);
-            result = sensor_set_mode(mode);
-            if (result == osOK) {
-                cdc_send_command_response(cmd, "OK");
-            } else {
-                cdc_send_command_response(cmd, "ERR");
-            }
-            return true;
-        } else if (cmd->type == CMD_TYPE_SET && strncmp(cmd->args, "CFG,", 4) == 0) {
-            uint16_t args[3] = {0};
-            size_t n = decode_u16_array_args(cmd->args + 4, args, 3);
-            if (n >= 3) {
-                tsl2585_gain_t gain_val = (tsl2585_gain_t)args[0];
-                uint16_t sample_time = args[1];
-                uint16_t sample_count = args[2];
-                if (gain_val < TSL2585_GAIN_MAX && sample_time < 2048 && sample_count < 2048) {
-                    result = sensor_set_config(gain_val, sample_time, sample_count);
-                    if (result == osOK) {
-                        cdc_send_command_response(cmd, "OK");
-                    } else {
-                        cdc_send_command_response(cmd, "ERR");
-                    }
-                    return true;
-                }
-            }
-        } else if (cmd->type == CMD_TYPE_SET && strncmp(cmd->args, "AGCEN,", 6) == 0) {
-            uint8_t sample_count = atoi(cmd->args + 6);
-            if (sample_count < 2048) {
-                result = sensor_set_agc_enabled(sample_count);
-                if (result == osOK) {
-                    cdc_send_command_response(cmd, "OK");
-                } else {
-                    cdc_send_command_response(cmd, "ERR");
-                }
-                return true;
-            }
-        } else if (cmd->type == CMD_TYPE_SET && strncmp(cmd->args, "AGCDIS", 6) == 0) {
-            result = sensor_set_agc_disabled();
-            if (result == osOK) {
-                cdc_send_command_response(cmd, "OK");
-            } else {
-                cdc_send_command_response(cmd, "ERR");
-            }
-        }
-        return true;
-    } else if (cmd->type == CMD_TYPE_INVOKE && strcmp(cmd->action, "READ") == 0 && cdc_remote_active && !cdc_remote_sensor_active) {
-        if ((cmd->args[0] == '0' || cmd->args[0] == 'R' || cmd->args[0] == 'T' || cmd->args[0] == 'U')
-            && cmd->args[1] == ',') {
-            uint16_t args[5] = {0};
-            size_t n = decode_u16_array_args(cmd->args + 2, args, 5);
-            if (n >= 5) {
-                uint32_t als_reading;
-                sensor_light_t light;
-                uint16_t light_value = (uint16_t)args[0];
-                sensor_mode_t mode = (sensor_mode_t)args[1];
-                tsl2585_gain_t gain = (tsl2585_gain_t)args[2];
-                uint16_t sample_time = args[3];
-                uint16_t sample_count = args[4];
-
-                if (cmd->args[0] == 'R') {
-                    light = SENSOR_LIGHT_VIS_REFLECTION;
-                } else if (cmd->args[0] == 'T') {
-                    light = SENSOR_LIGHT_VIS_TRANSMISSION;
-                } else if (cmd->args[0] == 'U') {
-                    light = SENSOR_LIGHT_UV_TRANSMISSION;
-                } else {
-                    light = SENSOR_LIGHT_OFF;
-                }
+    if ((entry->flags & CDC_CMD_REMOTE) && !cdc_remote_active) {
+        return false;
+    }
+    if ((entry->flags & CDC_CMD_SENSOR_IDLE) && !cdc_sensor_is_idle()) {
+        return false;
+    }
+    if (!cdc_command_parse_args(entry, cmd, &args)) {
+        return false;
+    }
+
+    /*
+     * Track the response, so it can be abandoned as a whole if the host stops
+     * reading. Commands run from the progress updates of a queued command
+     * restore its response state when they finish.
+     */
+    cdc_tx_response_t *response = cdc_tx_response_get();
+    const cdc_command_t *outer_cmd = NULL;
+    bool outer_aborted = false;
+    if (response) {
+        outer_cmd = response->cmd;
+        outer_aborted = response->aborted;
+        response->cmd = cmd;
+        response->aborted = false;
+    }
 
-                osStatus_t result = sensor_read_target_raw(
-                    light, light_value, mode, gain, sample_time, sample_count,
-                    &als_reading);
+    const bool result = entry->handler(cmd, &args);
 
-                if (result == osOK) {
-                    char buf[64];
-                    sprintf(buf, "%lu", als_reading);
-                    cdc_send_command_response(cmd, buf);
-                } else {
-                    cdc_send_command_response(cmd, "ERR");
-                }
-                return true;
-            }
-        }
-    } else if (cmd->type == CMD_TYPE_INVOKE && strcmp(cmd->action, "MEAS") == 0 && cdc_remote_active && !cdc_remote_sensor_active) {
-        if ((cmd->args[0] == 'R' || cmd->args[0] == 'T' || cmd->args[0] == 'U')
-            && cmd->args[1] == ',') {
-            float als_result;
-
-            const uint16_t light_max = light_get_max_value();
-            uint16_t light_value = atoi(cmd->args + 2);
-            if (light_value > light_max) { light_value = light_max; }
-
-            sensor_light_t light_source;
-            if (cmd->args[0] == 'R') {
-                light_source = SENSOR_LIGHT_VIS_REFLECTION;
-            } else if (cmd->args[0] == 'T') {
-                light_source = SENSOR_LIGHT_VIS_TRANSMISSION;
-            } else if (cmd->args[0] == 'U') {
-                light_source = SENSOR_LIGHT_UV_TRANSMISSION;
-            } else {
-                cdc_send_command_response(cmd, "ERR");
-                return true;
-            }
+    if (response) {
+        response->cmd = outer_cmd;
+        response->aborted = outer_aborted;
+    }
 
-            osStatus_t result = sensor_read_target(
-                light_source, light_value, &als_result, NULL, NULL);
+    return result;
+}
 
-            if (result == osOK) {
-                char buf[16];
-                encode_f32(buf, als_result);
-                cdc_send_command_response(cmd, buf);
-            } else {
-                cdc_send_command_response(cmd, "ERR");
-            }
-            return true;
-        }
-    } else if (cmd->type == CMD_TYPE_INVOKE && strcmp(cmd->action, "WIPE") == 0 && cdc_remote_active) {
-        char exp_buf[32];
-        const app_descriptor_t *app_descriptor = app_descriptor_get();
-        sprintf(exp_buf, "%08lX,%08lX",
-            __bswap32(HAL_GetUIDw2()),
-            __bswap32(app_descriptor->crc32));
-        if (strncasecmp(exp_buf, cmd->args, sizeof(exp_buf)) == 0) {
-            cdc_send_command_response(cmd, "OK");
-            log_w("Factory EEPROM wipe requested");
-            settings_wipe();
-            osDelay(50);
-            NVIC_SystemReset();
-        } else {
-            cdc_send_command_response(cmd, "ERR");
+bool cdc_job_submit(const cdc_command_entry_t *entry, const cdc_command_t *cmd)
+{
+    cdc_job_t job = {
+        .entry = entry,
+        .request_id = cmd->request_id,
+        .has_request_id = cmd->has_request_id
+    };
+
+    /* Reject anything that would fail when run, so the host finds out right away */
+    if ((entry->flags & CDC_CMD_REMOTE) && !cdc_remote_active) {
+        return false;
+    }
+    if ((entry->flags & CDC_CMD_SENSOR_IDLE) && !cdc_sensor_is_idle()) {
+        return false;
+    }
+    if (strlen(cmd->args) >= sizeof(job.args)) {
+        return false;
+    }
+    strcpy(job.args, cmd->args);
+
+    if (osMessageQueuePut(cdc_job_queue, &job, 0, 0) != osOK) {
+        cdc_send_command_response(cmd, "BUSY");
+    }
+    return true;
+}
+
+bool cdc_job_run_next()
+{
+    cdc_job_t job;
+
+    if (osMessageQueueGet(cdc_job_queue, &job, NULL, 0) != osOK) {
+        return false;
+    }
+
+    cdc_command_t cmd = {
+        .type = job.entry->type,
+        .category = job.entry->category,
+        .action = job.entry->action,
+        .args = job.args,
+        .request_id = job.request_id,
+        .has_request_id = job.has_request_id
+    };
+
+    cdc_job_cancel = false;
+    cdc_job_request_id = job.request_id;
+    cdc_job_running = true;
+
+    /* Permissions are checked again, since the state may have changed while queued */
+    if (!cdc_command_execute(job.entry, &cmd)) {
+        cdc_send_command_response(&cmd, "NAK");
+    }
+
+    cdc_job_running = false;
+    return true;
+}
+
+void cdc_job_poll()
+{
+    /*
+     * Handle new input from the progress updates of the running command,
+     * so the host can queue more commands or cancel them in the meantime.
+     * This runs on top of the command's own stack usage, which is why only
+     * the small job control commands are allowed to run from here.
+     */
+    cdc_task_loop();
+}
+
+bool cdc_job_is_idle()
+{
+    return !cdc_job_running && osMessageQueueGetCount(cdc_job_queue) == 0;
+}
+
+bool cdc_sensor_is_idle()
+{
+    return !cdc_remote_sensor_active && !densitometer_continuous_is_running();
+}
+
+void cdc_process_command(char *buf, size_t len)
+{
+    cdc_command_t cmd = {0};
+
+    if (cdc_command_parse(&cmd, buf, len)) {
+        bool result = false;
+        const cdc_command_entry_t *entry = cdc_command_lookup(cdc_command_table, CDC_COMMAND_COUNT, &cmd);
+        if (entry && (entry->flags & CDC_CMD_ASYNC)) {
+            result = cdc_job_submit(entry, &cmd);
+        } else if (entry && cdc_job_running && !(entry->flags & CDC_CMD_JOB_CONTROL)) {
+            /* Only reached from the progress updates of a running queued command */
+            cdc_send_command_response(&cmd, "BUSY");
+            result = true;
+        } else if (entry && (entry->flags & CDC_CMD_EXCLUSIVE) && !cdc_job_is_idle()) {
+            /* Queued commands depend on the state this would change, so it has to wait for them */
+            cdc_send_command_response(&cmd, "BUSY");
+            result = true;
+        } else if (entry) {
+            result = cdc_command_execute(entry, &cmd);
         }
-        return true;
-    } else if (cmd->type == CMD_TYPE_SET && strcmp(cmd->action, "LOG") == 0) {
-        if (strcmp(cmd->args, "U") == 0) {
-            cdc_send_command_response(cmd, "OK");
-            cdc_logging_redirected = true;
-            elog_set_text_color_enabled(false);
-            elog_port_redirect(cdc_write);
-            return true;
-        } else if (strcmp(cmd->args, "D") == 0) {
-            cdc_send_command_response(cmd, "OK");
-            elog_port_redirect(NULL);
-            elog_set_text_color_enabled(true);
-            cdc_logging_redirected = false;
-            return true;
+        if (!result) {
+            cdc_send_command_response(&cmd, "NAK");
         }
     }
-
-    return false;
 }
 
 void cdc_send_response(const char *str)
@@ -1075,43 +1694,10 @@ void cdc_send_response(const char *str)
 void cdc_send_command_response(const cdc_command_t *cmd, const char *str)
 {
     char buf[128];
-    char t_ch;
-    char c_ch;
-    if (!cmd || !str) { return; }
-
-    switch (cmd->type) {
-    case CMD_TYPE_SET:
-        t_ch = 'S';
-        break;
-    case CMD_TYPE_GET:
-        t_ch = 'G';
-        break;
-    case CMD_TYPE_INVOKE:
-        t_ch = 'I';
-        break;
-    default:
-        return;
-    }
-
-    switch (cmd->category) {
-    case CMD_CATEGORY_SYSTEM:
-        c_ch = 'S';
-        break;
-    case CMD_CATEGORY_MEASUREMENT:
-        c_ch = 'M';
-        break;
-    case CMD_CATEGORY_CALIBRATION:
-        c_ch = 'C';
-        break;
-    case CMD_CATEGORY_DIAGNOSTICS:
-        c_ch = 'D';
-        break;
-    default:
-        return;
+    const size_t n = cdc_command_format_response(buf, sizeof(buf), cmd, str);
+    if (n > 0) {
+        cdc_write(buf, n);
     }
-
-    size_t n = snprintf(buf, sizeof(buf), "%c%c %s,%s\r\n", t_ch, c_ch, cmd->action, str);
-    cdc_write(buf, n);
 }
 
 void cdc_send_density_reading(char prefix, float d_value, float d_zero, float raw_value)
@@ -1120,6 +1706,16 @@ void cdc_send_density_reading(char prefix, float d_value, float d_zero, float ra
     char buf[16];
     char sign;
 
+    if (reading_format == READING_FORMAT_BIN) {
+        uint8_t body[CDC_FRAME_DENSITY_SIZE];
+        body[0] = (uint8_t)prefix;
+        copy_from_f32(body + 1, d_value);
+        copy_from_f32(body + 5, d_zero);
+        copy_from_f32(body + 9, raw_value);
+        cdc_write_frame(CDC_FRAME_DENSITY, body, sizeof(body));
+        return;
+    }
+
     /* Force any invalid values to be zero */
     if (isnan(d_value) || isinf(d_value)) {
         d_value = 0.0F;
@@ -1173,6 +1769,26 @@ void cdc_send_raw_sensor_reading(const sensor_reading_t *reading)
 {
     if (!cdc_remote_sensor_active || !reading) { return; }
 
+    if (reading_format == READING_FORMAT_BIN) {
+        uint8_t body[CDC_FRAME_RAW_READING_SIZE];
+        copy_from_u32(body, reading->mod0.als_data);
+        body[4] = (uint8_t)reading->mod0.gain;
+        body[5] = (uint8_t)reading->mod0.result;
+        copy_from_u32(body + 6, reading->mod1.als_data);
+        body[10] = (uint8_t)reading->mod1.gain;
+        body[11] = (uint8_t)reading->mod1.result;
+        body[12] = (reading->sample_time >> 8) & 0xFF;
+        body[13] = reading->sample_time & 0xFF;
+        body[14] = (reading->sample_count >> 8) & 0xFF;
+        body[15] = reading->sample_count & 0xFF;
+        copy_from_u32(body + 16, reading->reading_ticks);
+        copy_from_u32(body + 20, reading->elapsed_ticks);
+        copy_from_u32(body + 24, reading->light_ticks);
+        copy_from_u32(body + 28, reading->reading_count);
+        cdc_write_frame(CDC_FRAME_RAW_READING, body, sizeof(body));
+        return;
+    }
+
     static const cdc_command_t cmd = {
         .type = CMD_TYPE_GET,
         .category = CMD_CATEGORY_DIAGNOSTICS,
@@ -1197,39 +1813,126 @@ void cdc_send_remote_state(bool enabled)
         .action = "REMOTE"
     };
     cdc_send_command_response(&cmd, enabled ? "1" : "0");
+
+    if (reading_format == READING_FORMAT_BIN) {
+        cdc_send_status_frame();
+    }
+}
+
+void cdc_send_status_frame()
+{
+    uint8_t body[CDC_FRAME_STATUS_SIZE];
+    body[0] = (cdc_remote_active ? CDC_FRAME_STATUS_REMOTE : 0)
+        | (cdc_remote_sensor_active ? CDC_FRAME_STATUS_SENSOR : 0);
+    copy_from_u32(body + 1, cdc_tx_ring.bytes_dropped);
+    cdc_write_frame(CDC_FRAME_STATUS, body, sizeof(body));
+}
+
+void cdc_write_frame(cdc_frame_type_t type, const uint8_t *body, size_t len)
+{
+    uint8_t buf[CDC_FRAME_MAX_SIZE];
+
+    osMutexAcquire(cdc_mutex, portMAX_DELAY);
+    if (cdc_host_connected) {
+        const size_t n = cdc_frame_encode(type, cdc_frame_seq, body, len, buf);
+        if (n > 0) {
+            /* Sequence numbers advance even if the packet is dropped, so the receiver can see the gap */
+            cdc_frame_seq++;
+            cdc_tx_ring_enqueue(&cdc_tx_ring, buf, n, cdc_tx_policy);
+            cdc_tx_drain();
+        }
+    }
+    osMutexRelease(cdc_mutex);
 }
 
 void cdc_write(const char *buf, size_t len)
 {
+    /*
+     * Writes from the tasks that run command handlers are responses the
+     * host is waiting for, and may be much longer than the transmit queue.
+     * These wait for queue space rather than being dropped.
+     */
+    cdc_tx_response_t *response = cdc_tx_response_get();
+
     osMutexAcquire(cdc_mutex, portMAX_DELAY);
-    if (cdc_host_connected && len > 0) {
-        uint32_t n = 0;
-        uint32_t offset = 0;
-        do {
-            n = tud_cdc_write(buf + offset, len - offset);
-            if (n == 0) {
-                if (!cdc_logging_redirected) {
-                    log_w("Write error");
-                }
-                break;
-            }
-            tud_cdc_write_flush();
-            offset += n;
 
-            if (osSemaphoreAcquire(cdc_tx_semaphore, CDC_TX_TIMEOUT) != osOK) {
-                if (!cdc_logging_redirected) {
-                    log_e("Unable to acquire cdc_tx_semaphore");
+    /* Discard the remainder of a response that has been abandoned */
+    if (response && response->aborted) {
+        cdc_tx_ring.bytes_dropped += len;
+        len = 0;
+    }
+
+    while (cdc_host_connected && len > 0) {
+        const size_t n = response ? MIN(len, CDC_TX_RING_SIZE) : len;
+
+        if (response && cdc_tx_ring_available(&cdc_tx_ring) < n) {
+            const uint32_t tail = cdc_tx_ring.tail;
+            osMutexRelease(cdc_mutex);
+            osStatus_t result = osSemaphoreAcquire(cdc_tx_semaphore, CDC_TX_TIMEOUT);
+            osMutexAcquire(cdc_mutex, portMAX_DELAY);
+
+            /* A wakeup may be left over from an earlier wait, so check for progress too */
+            if (result == osOK || cdc_tx_ring.tail != tail) { continue; }
+
+            if (response->cmd) {
+                /*
+                 * The host has stopped reading partway through a command
+                 * response. Rather than splicing the rest of the response
+                 * around dropped data, abandon it and end it with an error
+                 * line on a line of its own. That line displaces the oldest
+                 * unsent data, since the host would otherwise never see it.
+                 */
+                char marker[48] = "\r\n";
+                const size_t marker_len = cdc_command_format_response(marker + 2, sizeof(marker) - 2, response->cmd, "ERR");
+                response->aborted = true;
+                cdc_tx_ring.bytes_dropped += len;
+                if (marker_len > 0) {
+                    cdc_tx_ring_enqueue(&cdc_tx_ring, (const uint8_t *)marker, marker_len + 2, CDC_TX_OVERFLOW_DROP_OLDEST);
+                    cdc_tx_drain();
                 }
-                tud_cdc_write_clear();
-                tud_cdc_abort_transfer();
-                cdc_set_connected(false);
                 break;
             }
-        } while (offset < len);
+
+            /* Not part of a command response, so fall back to the overflow policy */
+        }
+
+        cdc_tx_ring_enqueue(&cdc_tx_ring, (const uint8_t *)buf, n, cdc_tx_policy);
+        cdc_tx_drain();
+        buf += n;
+        len -= n;
     }
     osMutexRelease(cdc_mutex);
 }
 
+cdc_tx_response_t *cdc_tx_response_get()
+{
+    if (cdc_tx_response.thread_id && cdc_tx_response.thread_id == osThreadGetId()) {
+        return &cdc_tx_response;
+    }
+    return NULL;
+}
+
+void cdc_tx_drain()
+{
+    bool written = false;
+
+    while (cdc_tx_ring_pending(&cdc_tx_ring) > 0) {
+        size_t pending;
+        const uint8_t *data = cdc_tx_ring_peek(&cdc_tx_ring, &pending);
+
+        /* This only copies as much as currently fits in the USB FIFO */
+        uint32_t n = tud_cdc_write(data, pending);
+        if (n == 0) { break; }
+
+        cdc_tx_ring_consume(&cdc_tx_ring, n);
+        written = true;
+    }
+
+    if (written) {
+        tud_cdc_write_flush();
+    }
+}
+
 size_t encode_f32_array_response(char *buf, const float *array, size_t len)
 {
     size_t offset = 0;
@@ -6,6 +6,24 @@
 
 #include "sensor.h"
 
+/**
+ * Policy for handling writes that do not fit in the transmit queue.
+ */
+typedef enum {
+    CDC_TX_OVERFLOW_DROP_NEWEST = 0, /*!< Discard the new message in its entirety */
+    CDC_TX_OVERFLOW_DROP_OLDEST      /*!< Discard the oldest unsent data to make room */
+} cdc_tx_overflow_policy_t;
+
+/**
+ * Transmit queue statistics, accumulated since startup.
+ */
+typedef struct {
+    uint32_t bytes_queued;  /*!< Bytes accepted into the transmit queue */
+    uint32_t bytes_dropped; /*!< Bytes discarded due to queue overflow */
+    uint32_t bytes_pending; /*!< Bytes currently waiting in the transmit queue */
+    cdc_tx_overflow_policy_t policy; /*!< Current overflow policy */
+} cdc_tx_stats_t;
+
 void task_cdc_run(void *argument);
 
 /**
@@ -45,12 +63,31 @@ void cdc_send_raw_sensor_reading(const sensor_reading_t *reading);
  */
 void cdc_send_remote_state(bool enabled);
 
+/**
+ * Set the policy for handling writes that do not fit in the transmit queue.
+ *
+ * The policy is reset to 'CDC_TX_OVERFLOW_DROP_NEWEST' whenever the
+ * host disconnects.
+ */
+void cdc_set_tx_overflow_policy(cdc_tx_overflow_policy_t policy);
+
+/**
+ * Get the transmit queue statistics.
+ */
+void cdc_get_tx_stats(cdc_tx_stats_t *stats);
+
 /**
  * Write a message out the CDC device.
  *
- * This function will only sent data if the device is connected, and will
- * block until that data is sent. As such, only short bits of data should
- * be sent this way.
+ * This function will only send data if the device is connected. The data
+ * is appended to a transmit queue which is drained by the USB task as the
+ * host reads it, so this function does not wait for the host. If the queue
+ * is full, data is discarded according to the configured overflow policy.
+ *
+ * The exception is writes from the CDC task, which are responses to host
+ * commands. These wait for queue space, and if the host stops reading for
+ * too long partway through a response, the rest of that response is
+ * replaced with an error line.
  *
  * It is also advisable to end each sent string with a CRLF, so it will
  * appear as expected on the receiver.
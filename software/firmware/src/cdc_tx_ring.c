@@ -0,0 +1,65 @@
+#include "cdc_tx_ring.h"
+
+#include <string.h>
+
+size_t cdc_tx_ring_pending(const cdc_tx_ring_t *ring)
+{
+    return ring->head - ring->tail;
+}
+
+size_t cdc_tx_ring_available(const cdc_tx_ring_t *ring)
+{
+    return CDC_TX_RING_SIZE - (ring->head - ring->tail);
+}
+
+void cdc_tx_ring_enqueue(cdc_tx_ring_t *ring, const uint8_t *buf, size_t len, cdc_tx_overflow_policy_t policy)
+{
+    const size_t available = cdc_tx_ring_available(ring);
+
+    if (len > available) {
+        if (policy == CDC_TX_OVERFLOW_DROP_OLDEST) {
+            if (len > CDC_TX_RING_SIZE) {
+                /* Only the end of the message can fit at all */
+                ring->bytes_dropped += len - CDC_TX_RING_SIZE;
+                buf += len - CDC_TX_RING_SIZE;
+                len = CDC_TX_RING_SIZE;
+            }
+            if (len > available) {
+                /* Discard the oldest unsent data to make room */
+                ring->bytes_dropped += len - available;
+                ring->tail += len - available;
+            }
+        } else {
+            /* Discard the whole message, so the receiver never sees a partial line */
+            ring->bytes_dropped += len;
+            return;
+        }
+    }
+
+    const size_t offset = ring->head % CDC_TX_RING_SIZE;
+    const size_t first = (len < CDC_TX_RING_SIZE - offset) ? len : CDC_TX_RING_SIZE - offset;
+    memcpy(ring->data + offset, buf, first);
+    if (first < len) {
+        memcpy(ring->data, buf + first, len - first);
+    }
+    ring->head += len;
+    ring->bytes_queued += len;
+}
+
+const uint8_t *cdc_tx_ring_peek(const cdc_tx_ring_t *ring, size_t *len)
+{
+    const size_t offset = ring->tail % CDC_TX_RING_SIZE;
+    const size_t pending = cdc_tx_ring_pending(ring);
+    *len = (pending < CDC_TX_RING_SIZE - offset) ? pending : CDC_TX_RING_SIZE - offset;
+    return ring->data + offset;
+}
+
+void cdc_tx_ring_consume(cdc_tx_ring_t *ring, size_t len)
+{
+    ring->tail += len;
+}
+
+void cdc_tx_ring_clear(cdc_tx_ring_t *ring)
+{
+    ring->tail = ring->head;
+}
@@ -0,0 +1,72 @@
+/*
+ * Transmit ring buffer for the CDC interface, with free-running head and
+ * tail counters. Producers append to the head, and data is moved from the
+ * tail into the USB stack's FIFO as space becomes available.
+ *
+ * The ring does no locking of its own, so all access must be guarded
+ * by the caller.
+ */
+
+#ifndef CDC_TX_RING_H
+#define CDC_TX_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "cdc_handler.h"
+
+/*
+ * At 256 bytes, this holds one full log line or four binary frames on
+ * top of the 64 bytes already in the USB stack's FIFO. Longer command
+ * responses wait for space, so they do not need to fit.
+ */
+#define CDC_TX_RING_SIZE 256
+
+typedef struct {
+    uint8_t data[CDC_TX_RING_SIZE];
+    uint32_t head;
+    uint32_t tail;
+    uint32_t bytes_queued;  /*!< Bytes accepted into the ring */
+    uint32_t bytes_dropped; /*!< Bytes discarded due to overflow */
+} cdc_tx_ring_t;
+
+/**
+ * Get the number of bytes waiting to be sent.
+ */
+size_t cdc_tx_ring_pending(const cdc_tx_ring_t *ring);
+
+/**
+ * Get the number of bytes that can be added without overflowing.
+ */
+size_t cdc_tx_ring_available(const cdc_tx_ring_t *ring);
+
+/**
+ * Add a message to the ring, handling any overflow with the given policy.
+ *
+ * With the drop newest policy, a message that does not fit is discarded
+ * in its entirety. With the drop oldest policy, the oldest unsent data is
+ * discarded to make room, and only the end of a message longer than the
+ * ring is kept.
+ */
+void cdc_tx_ring_enqueue(cdc_tx_ring_t *ring, const uint8_t *buf, size_t len, cdc_tx_overflow_policy_t policy);
+
+/**
+ * Get the oldest unsent data that is contiguous in the ring.
+ *
+ * @param ring Transmit ring
+ * @param len Number of contiguous bytes available from the returned pointer
+ * @return Pointer to the oldest unsent data
+ */
+const uint8_t *cdc_tx_ring_peek(const cdc_tx_ring_t *ring, size_t *len);
+
+/**
+ * Remove data that has been sent from the tail of the ring.
+ */
+void cdc_tx_ring_consume(cdc_tx_ring_t *ring, size_t len);
+
+/**
+ * Discard all the data waiting to be sent, without counting it as dropped.
+ */
+void cdc_tx_ring_clear(cdc_tx_ring_t *ring);
+
+#endif /* CDC_TX_RING_H */
@@ -5,6 +5,9 @@
 #include <math.h>
 #include <elog.h>
 #include <printf.h>
+#include <cmsis_os.h>
+#include <FreeRTOS.h>
+#include <task.h>
 
 #include "settings.h"
 #include "sensor.h"
@@ -13,9 +16,15 @@
 #include "cdc_handler.h"
 #include "hid_handler.h"
 #include "util.h"
+#include "densitometer_cal.h"
 
 static densitometer_result_t reflection_measure(densitometer_t *densitometer, sensor_read_callback_t callback, void *user_data);
 static densitometer_result_t transmission_measure(densitometer_t *densitometer, sensor_read_callback_t callback, void *user_data);
+static bool densitometer_get_cal_plan(densitometer_t *densitometer, densitometer_cal_plan_t *plan);
+static densitometer_result_t continuous_start(densitometer_t *densitometer);
+static void continuous_stop();
+static void scan_add_reading(float d);
+static void scan_finish_run();
 
 struct __densitometer_t {
     float last_d;
@@ -23,6 +32,7 @@ struct __densitometer_t {
     const float max_d;
     const sensor_light_t read_light;
     const densitometer_result_t (*measure_func)(densitometer_t *densitometer, sensor_read_callback_t callback, void *user_data);
+    densitometer_cal_plan_t cal_plan;
 };
 
 static densitometer_t vis_reflection_data = {
@@ -49,7 +59,59 @@ static densitometer_t uv_transmission_data = {
     .measure_func = transmission_measure
 };
 
+/**
+ * State of the continuous measurement mode
+ */
+typedef struct {
+    densitometer_t *densitometer;
+    volatile bool running;
+    densitometer_cal_plan_t cal_plan;
+    float temp_c;
+    sensor_reading_cursor_t cursor;
+    uint32_t session;
+    uint32_t count;
+    densitometer_continuous_reading_t ring[DENSITOMETER_CONTINUOUS_RING_SIZE];
+} densitometer_continuous_state_t;
+
+/* Maximum deviation of a reading from the mean of the step it belongs to */
+#define DENSITOMETER_SCAN_STEP_TOLERANCE 0.05F
+
+/* Minimum number of consecutive readings to be considered a step */
+#define DENSITOMETER_SCAN_STEP_MIN_COUNT 3
+
+/**
+ * State of the step wedge scan segmentation
+ */
+typedef struct {
+    volatile bool active;
+    float run_sum;
+    uint16_t run_count;
+    size_t step_count;
+    densitometer_scan_step_t steps[DENSITOMETER_SCAN_MAX_STEPS];
+} densitometer_scan_state_t;
+
 static bool densitometer_allow_uncalibrated = false;
+static densitometer_continuous_state_t continuous_state = {0};
+static densitometer_scan_state_t scan_state = {0};
+
+/*
+ * Mutex guarding the continuous measurement and scan state, which are
+ * started and stopped by the CDC task but polled by the main task.
+ */
+static osMutexId_t continuous_mutex = NULL;
+static const osMutexAttr_t continuous_mutex_attrs = {
+    .name = "densitometer_mutex"
+};
+
+osStatus_t densitometer_init()
+{
+    continuous_mutex = osMutexNew(&continuous_mutex_attrs);
+    if (!continuous_mutex) {
+        log_e("densitometer_mutex create error");
+        return osErrorNoMemory;
+    }
+    return osOK;
+}
 
 void densitometer_set_allow_uncalibrated_measurements(bool allow)
 {
@@ -78,6 +140,316 @@ densitometer_result_t densitometer_measure(densitometer_t *densitometer, sensor_
     return densitometer->measure_func(densitometer, callback, user_data);
 }
 
+densitometer_result_t densitometer_continuous_start(densitometer_t *densitometer)
+{
+    densitometer_result_t result;
+
+    osMutexAcquire(continuous_mutex, portMAX_DELAY);
+    result = continuous_start(densitometer);
+    osMutexRelease(continuous_mutex);
+
+    return result;
+}
+
+densitometer_result_t continuous_start(densitometer_t *densitometer)
+{
+    osStatus_t ret = osOK;
+    bool result;
+
+    if (!densitometer) { return DENSITOMETER_CAL_ERROR; }
+    if (continuous_state.running) { return DENSITOMETER_SENSOR_ERROR; }
+
+    /* Get the current calibration plan */
+    result = densitometer_get_cal_plan(densitometer, &continuous_state.cal_plan);
+    if (!result && !densitometer_allow_uncalibrated) {
+        return DENSITOMETER_CAL_ERROR;
+    }
+
+    /*
+     * Read the current sensor head temperature, which is assumed to
+     * remain stable for the duration of the continuous measurement.
+     */
+    if (sensor_get_temperature(&continuous_state.temp_c) != osOK) {
+        log_w("Temperature sensor read error");
+        continuous_state.temp_c = NAN;
+    }
+
+    sensor_reading_cursor_init(&continuous_state.cursor);
+
+    do {
+        ret = sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
+        if (ret != osOK) { break; }
+
+        /*
+         * Let AGC follow the target, since each reading carries its own gain,
+         * and activate the light source synchronized with the sensor cycle
+         */
+        const sensor_config_t config = {
+            .mode = densitometer->read_light == SENSOR_LIGHT_UV_TRANSMISSION ? SENSOR_MODE_UV : SENSOR_MODE_VIS,
+            .trigger_mode = TSL2585_TRIGGER_OFF,
+            .gain = { TSL2585_GAIN_256X, TSL2585_GAIN_256X },
+            .sample_time = 719,
+            .sample_count = 99,
+            .agc_enabled = true,
+            .agc_sample_count = 9,
+            .light = densitometer->read_light,
+            .light_value = light_get_max_value(),
+            .light_next_cycle = true
+        };
+        ret = sensor_configure(&config);
+        if (ret != osOK) { break; }
+
+        ret = sensor_start();
+        if (ret != osOK) { break; }
+    } while (0);
+
+    if (ret != osOK) {
+        log_w("Unable to start continuous measurement: %d", ret);
+        sensor_stop();
+        densitometer_set_idle_light(densitometer, true);
+        return DENSITOMETER_SENSOR_ERROR;
+    }
+
+    taskENTER_CRITICAL();
+    continuous_state.densitometer = densitometer;
+    continuous_state.session++;
+    continuous_state.count = 0;
+    continuous_state.running = true;
+    taskEXIT_CRITICAL();
+
+    log_i("Continuous measurement started");
+
+    return DENSITOMETER_OK;
+}
+
+osStatus_t densitometer_continuous_poll(densitometer_continuous_reading_t *reading, uint32_t timeout)
+{
+    osStatus_t ret;
+    sensor_reading_t sensor_reading;
+    densitometer_continuous_reading_t result;
+    sensor_reading_cursor_t cursor;
+    uint32_t session;
+
+    osMutexAcquire(continuous_mutex, portMAX_DELAY);
+    if (!continuous_state.running) {
+        osMutexRelease(continuous_mutex);
+        return osErrorResource;
+    }
+    cursor = continuous_state.cursor;
+    session = continuous_state.session;
+    osMutexRelease(continuous_mutex);
+
+    /*
+     * Wait for the reading without holding the mutex, so stopping is not
+     * held up by the poll timeout. Continuous mode may have been stopped
+     * or restarted in the meantime, in which case the reading is dropped.
+     */
+    ret = sensor_wait_next_reading(&cursor, &sensor_reading, timeout);
+
+    osMutexAcquire(continuous_mutex, portMAX_DELAY);
+
+    do {
+        if (!continuous_state.running) {
+            ret = osErrorResource;
+            break;
+        }
+        if (continuous_state.session != session) {
+            ret = osErrorTimeout;
+            break;
+        }
+
+        continuous_state.cursor = cursor;
+
+        if (ret != osOK) {
+            if (ret == osErrorResource) {
+                ret = osErrorTimeout;
+            } else if (ret != osErrorTimeout) {
+                log_w("Continuous measurement read error: %d", ret);
+            }
+            break;
+        }
+
+        /* Saturated readings are skipped, as AGC will adjust for the next cycle */
+        if (sensor_reading.mod0.result != SENSOR_RESULT_VALID) {
+            ret = osErrorTimeout;
+            break;
+        }
+
+        densitometer_t *densitometer = continuous_state.densitometer;
+        const float als_basic = sensor_apply_light_drift_correction(densitometer->read_light, &sensor_reading,
+            (float)sensor_convert_to_basic_counts(&sensor_reading, 0));
+        result.als_basic = sensor_apply_temperature_correction(densitometer->read_light, continuous_state.temp_c, als_basic);
+        result.ticks = sensor_reading.reading_ticks;
+
+        if (!continuous_state.cal_plan.calibrated) {
+            result.d = 0.0F;
+        } else {
+            result.d = densitometer_cal_calc_d(&continuous_state.cal_plan, densitometer->max_d, result.als_basic);
+        }
+
+        taskENTER_CRITICAL();
+        result.index = continuous_state.count;
+        continuous_state.ring[continuous_state.count % DENSITOMETER_CONTINUOUS_RING_SIZE] = result;
+        continuous_state.count++;
+        densitometer->last_d = result.d;
+        taskEXIT_CRITICAL();
+
+        if (scan_state.active) {
+            scan_add_reading(result.d);
+        }
+    } while (0);
+
+    osMutexRelease(continuous_mutex);
+
+    if (ret == osOK && reading) {
+        *reading = result;
+    }
+
+    return ret;
+}
+
+bool densitometer_continuous_read(uint32_t *cursor, densitometer_continuous_reading_t *reading)
+{
+    bool result = false;
+
+    if (!cursor || !reading) { return false; }
+
+    taskENTER_CRITICAL();
+    if (*cursor < continuous_state.count) {
+        /* Skip ahead if the consumer has fallen behind */
+        if (continuous_state.count - *cursor > DENSITOMETER_CONTINUOUS_RING_SIZE) {
+            *cursor = continuous_state.count - DENSITOMETER_CONTINUOUS_RING_SIZE;
+        }
+        *reading = continuous_state.ring[*cursor % DENSITOMETER_CONTINUOUS_RING_SIZE];
+        (*cursor)++;
+        result = true;
+    }
+    taskEXIT_CRITICAL();
+
+    return result;
+}
+
+void densitometer_continuous_stop()
+{
+    osMutexAcquire(continuous_mutex, portMAX_DELAY);
+    continuous_stop();
+    osMutexRelease(continuous_mutex);
+}
+
+void continuous_stop()
+{
+    if (!continuous_state.running) { return; }
+
+    continuous_state.running = false;
+    scan_state.active = false;
+
+    sensor_stop();
+    densitometer_set_idle_light(continuous_state.densitometer, true);
+
+    log_i("Continuous measurement stopped after %lu readings, %lu overruns",
+        continuous_state.count, continuous_state.cursor.overruns);
+}
+
+bool densitometer_continuous_is_running()
+{
+    return continuous_state.running;
+}
+
+densitometer_result_t densitometer_scan_start(densitometer_t *densitometer)
+{
+    densitometer_result_t result;
+
+    osMutexAcquire(continuous_mutex, portMAX_DELAY);
+
+    if (continuous_state.running) {
+        osMutexRelease(continuous_mutex);
+        return DENSITOMETER_SENSOR_ERROR;
+    }
+
+    scan_state.active = false;
+    scan_state.run_sum = 0;
+    scan_state.run_count = 0;
+    scan_state.step_count = 0;
+
+    result = continuous_start(densitometer);
+    if (result == DENSITOMETER_OK) {
+        scan_state.active = true;
+    }
+
+    osMutexRelease(continuous_mutex);
+
+    return result;
+}
+
+size_t densitometer_scan_stop(densitometer_scan_step_t *steps, size_t len)
+{
+    size_t count = 0;
+
+    osMutexAcquire(continuous_mutex, portMAX_DELAY);
+
+    if (scan_state.active) {
+        continuous_stop();
+        scan_finish_run();
+
+        log_i("Scan found %d steps", scan_state.step_count);
+
+        count = MIN(scan_state.step_count, len);
+        if (steps) {
+            for (size_t i = 0; i < count; i++) {
+                steps[i] = scan_state.steps[i];
+            }
+        }
+    }
+
+    osMutexRelease(continuous_mutex);
+
+    return count;
+}
+
+bool densitometer_scan_is_running()
+{
+    return scan_state.active;
+}
+
+void scan_add_reading(float d)
+{
+    if (scan_state.run_count > 0) {
+        const float run_mean = scan_state.run_sum / (float)scan_state.run_count;
+        if (fabsf(d - run_mean) > DENSITOMETER_SCAN_STEP_TOLERANCE) {
+            /* The reading has left the current run, so start a new one */
+            scan_finish_run();
+        }
+    }
+
+    scan_state.run_sum += d;
+    scan_state.run_count++;
+}
+
+void scan_finish_run()
+{
+    if (scan_state.run_count >= DENSITOMETER_SCAN_STEP_MIN_COUNT) {
+        const float run_mean = scan_state.run_sum / (float)scan_state.run_count;
+        densitometer_scan_step_t *last_step = (scan_state.step_count > 0)
+            ? &scan_state.steps[scan_state.step_count - 1] : NULL;
+
+        if (last_step && fabsf(run_mean - last_step->d) <= DENSITOMETER_SCAN_STEP_TOLERANCE) {
+            /* Merge with the previous step, which was split by a noisy reading */
+            const float total = (last_step->d * (float)last_step->count) + scan_state.run_sum;
+            last_step->count += scan_state.run_count;
+            last_step->d = total / (float)last_step->count;
+        } else if (scan_state.step_count < DENSITOMETER_SCAN_MAX_STEPS) {
+            scan_state.steps[scan_state.step_count].d = run_mean;
+            scan_state.steps[scan_state.step_count].count = scan_state.run_count;
+            scan_state.step_count++;
+        } else {
+            log_w("Too many scan steps");
+        }
+    }
+
+    scan_state.run_sum = 0;
+    scan_state.run_count = 0;
+}
+
 void densitometer_set_idle_light(const densitometer_t *densitometer, bool enabled)
 {
     if (!densitometer) { return; }
@@ -106,12 +478,12 @@ void densitometer_set_idle_light(const densitometer_t *densitometer, bool enable
 
 densitometer_result_t reflection_measure(densitometer_t *densitometer, sensor_read_callback_t callback, void *user_data)
 {
-    settings_cal_reflection_t cal_reflection;
+    densitometer_cal_plan_t cal_plan;
     bool use_target_cal = true;
     float temp_c;
 
-    /* Get the current calibration values */
-    if (!settings_get_cal_vis_reflection(&cal_reflection)) {
+    /* Get the current calibration plan */
+    if (!densitometer_get_cal_plan(densitometer, &cal_plan)) {
         if (densitometer_allow_uncalibrated) {
             use_target_cal = false;
         } else {
@@ -120,7 +492,7 @@ densitometer_result_t reflection_measure(densitometer_t *densitometer, sensor_re
     }
 
     /* Read the current sensor head temperature */
-    if (sensor_read_temperature(&temp_c) != osOK) {
+    if (sensor_get_temperature(&temp_c) != osOK) {
         log_w("Temperature sensor read error");
         temp_c = NAN;
     }
@@ -137,43 +509,10 @@ densitometer_result_t reflection_measure(densitometer_t *densitometer, sensor_re
     const float als_basic_temp = sensor_apply_temperature_correction(densitometer->read_light, temp_c, als_basic_raw);
 
     if (use_target_cal) {
-        float meas_d;
-
-        if (isnan(cal_reflection.hi_d) && isnan(cal_reflection.hi_value)) {
-            /* Single point calibration */
-
-            log_i("Using single point calibration");
-
-            /* Calculate the zero equivalent reading value */
-            const float zero_value = cal_reflection.lo_value * powf(10.0F, -1.0F * cal_reflection.lo_d);
-
-            /* Calculate the measured density */
-            meas_d = -1.0F * log10f(als_basic_temp / zero_value);
-        } else {
-            /* Two point calibration */
-
-            /* Convert all values into log units */
-            const float meas_ll = log10f(als_basic_temp);
-            const float cal_hi_ll = log10f(cal_reflection.hi_value);
-            const float cal_lo_ll = log10f(cal_reflection.lo_value);
-
-            /* Calculate the slope of the line */
-            const float m = (cal_reflection.hi_d - cal_reflection.lo_d) / (cal_hi_ll - cal_lo_ll);
-
-            /* Calculate the measured density */
-            meas_d = (m * (meas_ll - cal_lo_ll)) + cal_reflection.lo_d;
-        }
+        const float meas_d = densitometer_cal_calc_d(&cal_plan, densitometer->max_d, als_basic_temp);
 
         log_i("D=%.2f, VALUE=%f,%f(%.1fC)", meas_d, als_basic_raw, als_basic_temp, temp_c);
 
-        /* Clamp the return value to be within an acceptable range */
-        if (meas_d <= 0.0F && cal_reflection.lo_d >= 0.0F) {
-            meas_d = 0.0F;
-        }
-        else if (meas_d > densitometer->max_d) {
-            meas_d = densitometer->max_d;
-        }
-
         densitometer->last_d = meas_d;
 
     } else {
@@ -197,21 +536,19 @@ densitometer_result_t reflection_measure(densitometer_t *densitometer, sensor_re
 
 densitometer_result_t transmission_measure(densitometer_t *densitometer, sensor_read_callback_t callback, void *user_data)
 {
-    settings_cal_transmission_t cal_transmission;
+    densitometer_cal_plan_t cal_plan;
     bool use_target_cal = true;
     char prefix;
     float temp_c;
 
-    /* Get the current calibration values */
-    bool result;
     if (densitometer->read_light == SENSOR_LIGHT_UV_TRANSMISSION) {
-        result = settings_get_cal_uv_transmission(&cal_transmission);
         prefix = 'U';
     } else {
-        result = settings_get_cal_vis_transmission(&cal_transmission);
         prefix = 'T';
     }
-    if (!result) {
+
+    /* Get the current calibration plan */
+    if (!densitometer_get_cal_plan(densitometer, &cal_plan)) {
         if (densitometer_allow_uncalibrated) {
             use_target_cal = false;
         } else {
@@ -220,7 +557,7 @@ densitometer_result_t transmission_measure(densitometer_t *densitometer, sensor_
     }
 
     /* Read the current sensor head temperature */
-    if (sensor_read_temperature(&temp_c) != osOK) {
+    if (sensor_get_temperature(&temp_c) != osOK) {
         log_w("Temperature sensor read error");
         temp_c = NAN;
     }
@@ -237,24 +574,10 @@ densitometer_result_t transmission_measure(densitometer_t *densitometer, sensor_
     const float als_basic_temp = sensor_apply_temperature_correction(densitometer->read_light, temp_c, als_basic_raw);
 
     if (use_target_cal) {
-        /* Calculate the measured CAL-HI density relative to the zero value */
-        float cal_hi_meas_d = -1.0F * log10f(cal_transmission.hi_value / cal_transmission.zero_value);
-
-        /* Calculate the measured target density relative to the zero value */
-        float meas_d = -1.0F * log10f(als_basic_temp / cal_transmission.zero_value);
-
-        /* Calculate the adjustment factor */
-        float adj_factor = cal_transmission.hi_d / cal_hi_meas_d;
-
-        /* Calculate the calibration corrected density */
-        float corr_d = meas_d * adj_factor;
+        const float corr_d = densitometer_cal_calc_d(&cal_plan, densitometer->max_d, als_basic_temp);
 
         log_i("D=%.2f, VALUE=%f,%f(%.1fC)", corr_d, als_basic_raw, als_basic_temp, temp_c);
 
-        /* Clamp the return value to be within an acceptable range */
-        if (corr_d <= 0.0F) { corr_d = 0.0F; }
-        else if (corr_d > densitometer->max_d) { corr_d = densitometer->max_d; }
-
         densitometer->last_d = corr_d;
 
     } else {
@@ -276,13 +599,56 @@ densitometer_result_t transmission_measure(densitometer_t *densitometer, sensor_
     return DENSITOMETER_OK;
 }
 
+bool densitometer_get_cal_plan(densitometer_t *densitometer, densitometer_cal_plan_t *plan)
+{
+    const uint32_t cal_generation = settings_get_cal_generation();
+
+    taskENTER_CRITICAL();
+    *plan = densitometer->cal_plan;
+    taskEXIT_CRITICAL();
+
+    if (plan->built && plan->cal_generation == cal_generation) {
+        return plan->calibrated;
+    }
+
+    /* Rebuild the plan, since the calibration values have changed */
+    plan->built = true;
+    plan->cal_generation = cal_generation;
+
+    if (densitometer->read_light == SENSOR_LIGHT_VIS_REFLECTION) {
+        settings_cal_reflection_t cal_reflection;
+        plan->calibrated = settings_get_cal_vis_reflection(&cal_reflection);
+        densitometer_cal_reflection_plan(&cal_reflection, plan);
+    } else {
+        settings_cal_transmission_t cal_transmission;
+        if (densitometer->read_light == SENSOR_LIGHT_UV_TRANSMISSION) {
+            plan->calibrated = settings_get_cal_uv_transmission(&cal_transmission);
+        } else {
+            plan->calibrated = settings_get_cal_vis_transmission(&cal_transmission);
+        }
+        densitometer_cal_transmission_plan(&cal_transmission, plan);
+    }
+
+    /* Refuse to mix readings and calibration values with different drift correction */
+    if (plan->calibrated && !sensor_is_light_drift_cal_current(densitometer->read_light)) {
+        log_w("Target calibration does not match the current drift correction");
+        plan->calibrated = false;
+    }
+
+    taskENTER_CRITICAL();
+    densitometer->cal_plan = *plan;
+    taskEXIT_CRITICAL();
+
+    return plan->calibrated;
+}
+
 densitometer_result_t densitometer_calibrate(densitometer_t *densitometer, float *cal_value, bool is_zero, sensor_read_callback_t callback, void *user_data)
 {
     float temp_c;
     if (!densitometer) { return DENSITOMETER_CAL_ERROR; }
 
     /* Read the current sensor head temperature */
-    if (sensor_read_temperature(&temp_c) != osOK) {
+    if (sensor_get_temperature(&temp_c) != osOK) {
         log_w("Temperature sensor read error");
         temp_c = NAN;
     }
@@ -364,7 +730,8 @@ float densitometer_get_display_f(const densitometer_t *densitometer)
     float d_value = densitometer_get_display_d(densitometer);
     if (isnan(d_value)) { return d_value; }
 
-    float f_value = log2f(powf(10.0F, d_value));
+    /* log2(10^D) reduces to D * log2(10) */
+    float f_value = d_value * LOG2_10F;
 
     return f_value;
 }
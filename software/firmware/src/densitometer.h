@@ -22,6 +22,45 @@ typedef enum {
 
 typedef struct __densitometer_t densitometer_t;
 
+/**
+ * Density reading produced by the continuous measurement mode
+ */
+typedef struct {
+    uint32_t index;  /*!< Sequence number of the reading since continuous mode was started */
+    uint32_t ticks;  /*!< Tick time when the sensor integration cycle finished */
+    float d;         /*!< Calibrated density, or 0 if target calibration is unavailable */
+    float als_basic; /*!< Temperature corrected sensor reading, in basic counts */
+} densitometer_continuous_reading_t;
+
+/*
+ * Number of readings held by the continuous measurement ring buffer.
+ * At 16 bytes each, the ring costs 128 bytes. This matches the most
+ * readings returned by one GM CONT poll, and consumers that fall further
+ * behind skip ahead to the newest readings.
+ */
+#define DENSITOMETER_CONTINUOUS_RING_SIZE 8
+
+/**
+ * Step found while scanning a step wedge
+ */
+typedef struct {
+    float d;        /*!< Mean density of all the readings in the step */
+    uint16_t count; /*!< Number of readings in the step */
+} densitometer_scan_step_t;
+
+/*
+ * Maximum number of steps that can be found in a single scan. This covers
+ * a 21 step tablet plus the film base and clear leader on either side.
+ * At 8 bytes each, the steps cost 192 bytes.
+ */
+#define DENSITOMETER_SCAN_MAX_STEPS 24
+
+/**
+ * Initialize the densitometer, creating the resources shared by the
+ * tasks that use continuous measurement mode.
+ */
+osStatus_t densitometer_init();
+
 /**
  * Set a global flag to allow uncalibrated measurements
  *
@@ -73,6 +112,92 @@ densitometer_result_t densitometer_measure(densitometer_t *densitometer, sensor_
  */
 densitometer_result_t densitometer_calibrate(densitometer_t *densitometer, float *cal_value, bool is_zero, sensor_read_callback_t callback, void *user_data);
 
+/**
+ * Start continuous measurement of a target material.
+ *
+ * This starts the sensor and turns on the measurement light, and keeps them
+ * running until 'densitometer_continuous_stop' is called. Every sensor
+ * integration cycle processed by 'densitometer_continuous_poll' produces
+ * a density reading in a ring buffer, which any number of consumers can
+ * read from with 'densitometer_continuous_read'.
+ *
+ * While continuous mode is running, it owns the sensor. Nothing else may
+ * reconfigure, start, or stop the sensor until it has been stopped.
+ *
+ * @return Result code for starting the measurement process
+ */
+densitometer_result_t densitometer_continuous_start(densitometer_t *densitometer);
+
+/**
+ * Process the next sensor reading in continuous measurement mode.
+ *
+ * This blocks until the next sensor reading is available, converts it into
+ * a density reading, and appends it to the ring buffer. It must be called
+ * periodically by the code that started the continuous mode.
+ *
+ * @param reading Optional copy of the new density reading
+ * @param timeout Amount of time to wait for a sensor reading
+ * @return osOK if a reading was added, osErrorTimeout if no valid reading was available,
+ *         or osErrorResource if continuous mode is not running
+ */
+osStatus_t densitometer_continuous_poll(densitometer_continuous_reading_t *reading, uint32_t timeout);
+
+/**
+ * Read the next density reading from the continuous measurement ring buffer.
+ *
+ * Each consumer keeps its own cursor, which should be initialized to zero
+ * when continuous mode is started. If a consumer falls behind by more than
+ * the size of the ring buffer, its cursor skips ahead to the oldest reading
+ * still available.
+ *
+ * @param cursor Consumer's read cursor, which is advanced on success
+ * @param reading Density reading
+ * @return True if a reading was returned, false if there are no new readings
+ */
+bool densitometer_continuous_read(uint32_t *cursor, densitometer_continuous_reading_t *reading);
+
+/**
+ * Stop continuous measurement, and return the light to idle.
+ *
+ * This may be called from any task. If a poll is in progress, this waits
+ * for it to finish first.
+ */
+void densitometer_continuous_stop();
+
+/**
+ * Check if continuous measurement mode is running.
+ */
+bool densitometer_continuous_is_running();
+
+/**
+ * Start scanning a step wedge.
+ *
+ * This starts continuous measurement, and segments the resulting stream
+ * of density readings into steps as the target is moved under the sensor.
+ * A step is a run of readings that stay within a tolerance of their mean.
+ * Short runs, which occur while moving between steps, are ignored.
+ *
+ * As with continuous measurement, 'densitometer_continuous_poll' must be
+ * called periodically while the scan is running.
+ *
+ * @return Result code for starting the measurement process
+ */
+densitometer_result_t densitometer_scan_start(densitometer_t *densitometer);
+
+/**
+ * Stop scanning a step wedge, and get the steps that were found.
+ *
+ * @param steps Array to hold the steps, in the order they were scanned
+ * @param len Maximum number of steps to return
+ * @return Number of steps that were found
+ */
+size_t densitometer_scan_stop(densitometer_scan_step_t *steps, size_t len);
+
+/**
+ * Check if a step wedge scan is running.
+ */
+bool densitometer_scan_is_running();
+
 /**
  * Control the idle light for the densitometer mode.
  *
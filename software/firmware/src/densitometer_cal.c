@@ -0,0 +1,87 @@
+#include "densitometer_cal.h"
+
+#include <math.h>
+#include <float.h>
+
+void densitometer_cal_reflection_plan(const settings_cal_reflection_t *cal_reflection, densitometer_cal_plan_t *plan)
+{
+    const float cal_lo_ll = log10f(cal_reflection->lo_value);
+
+    if (isnan(cal_reflection->hi_d) && isnan(cal_reflection->hi_value)) {
+        /*
+         * Single point calibration, where the zero equivalent reading value
+         * is: zero_value = lo_value * 10^(-lo_d)
+         * and the measured density is: D = -log10(basic / zero_value)
+         */
+        plan->slope = -1.0F;
+        plan->offset = cal_lo_ll - cal_reflection->lo_d;
+    } else {
+        /*
+         * Two point calibration, using the line through both calibration
+         * points in log units: D = m * (log10(basic) - cal_lo_ll) + lo_d
+         */
+        const float cal_hi_ll = log10f(cal_reflection->hi_value);
+        const float m = (cal_reflection->hi_d - cal_reflection->lo_d) / (cal_hi_ll - cal_lo_ll);
+
+        plan->slope = m;
+        plan->offset = cal_reflection->lo_d - (m * cal_lo_ll);
+    }
+
+    /* Only clamp to zero if the low calibration point is not negative */
+    plan->clamp_zero = cal_reflection->lo_d >= 0.0F;
+
+#ifdef USE_FIXED_POINT_DENSITY
+    plan->slope_q16 = q16_from_float(plan->slope);
+    plan->offset_q16 = q16_from_float(plan->offset);
+#endif
+}
+
+void densitometer_cal_transmission_plan(const settings_cal_transmission_t *cal_transmission, densitometer_cal_plan_t *plan)
+{
+    const float zero_ll = log10f(cal_transmission->zero_value);
+
+    /* Calculate the measured CAL-HI density relative to the zero value */
+    const float cal_hi_meas_d = zero_ll - log10f(cal_transmission->hi_value);
+
+    /* Calculate the adjustment factor */
+    const float adj_factor = cal_transmission->hi_d / cal_hi_meas_d;
+
+    /*
+     * The calibration corrected density is the target density relative
+     * to the zero value, scaled by the adjustment factor:
+     * D = adj_factor * (log10(zero_value) - log10(basic))
+     */
+    plan->slope = -1.0F * adj_factor;
+    plan->offset = adj_factor * zero_ll;
+    plan->clamp_zero = true;
+
+#ifdef USE_FIXED_POINT_DENSITY
+    plan->slope_q16 = q16_from_float(plan->slope);
+    plan->offset_q16 = q16_from_float(plan->offset);
+#endif
+}
+
+float densitometer_cal_calc_d(const densitometer_cal_plan_t *plan, float max_d, float als_basic)
+{
+#ifdef USE_FIXED_POINT_DENSITY
+    float meas_d;
+    if (als_basic >= FLT_MIN && als_basic <= FLT_MAX) {
+        meas_d = q16_to_float(q16_mul(plan->slope_q16, fixed_log10f(als_basic)) + plan->offset_q16);
+    } else {
+        /* Zero, negative, and non-finite readings take the reference path */
+        meas_d = (plan->slope * log10f(als_basic)) + plan->offset;
+    }
+#else
+    float meas_d = (plan->slope * log10f(als_basic)) + plan->offset;
+#endif
+
+    /* Clamp the return value to be within an acceptable range */
+    if (meas_d <= 0.0F && plan->clamp_zero) {
+        meas_d = 0.0F;
+    }
+    else if (meas_d > max_d) {
+        meas_d = max_d;
+    }
+
+    return meas_d;
+}
@@ -0,0 +1,63 @@
+/*
+ * Calibration plans for the density calculation of each measurement mode.
+ *
+ * The target calibration values of a measurement mode are reduced to a
+ * plan, which holds the constants of the form:
+ *   D = slope * log10(basic) + offset
+ * This keeps all the log and power work of the calibration math out of
+ * each individual reading, so it only has to happen again whenever the
+ * calibration values change.
+ */
+
+#ifndef DENSITOMETER_CAL_H
+#define DENSITOMETER_CAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "settings.h"
+#ifdef USE_FIXED_POINT_DENSITY
+#include "fixed_math.h"
+#endif
+
+/**
+ * Calibration plan, holding the constants derived from the target
+ * calibration values of a measurement mode.
+ */
+typedef struct {
+    bool built;              /*!< Whether the plan has been built */
+    bool calibrated;         /*!< Whether valid target calibration values were available */
+    uint32_t cal_generation; /*!< Settings calibration generation the plan was built from */
+    float slope;
+    float offset;
+#ifdef USE_FIXED_POINT_DENSITY
+    q16_t slope_q16;
+    q16_t offset_q16;
+#endif
+    bool clamp_zero;         /*!< Whether to clamp negative results to zero */
+} densitometer_cal_plan_t;
+
+/**
+ * Build the density constants of a plan from reflection calibration values.
+ *
+ * If the high calibration point is missing, the plan is built from
+ * the low calibration point alone.
+ */
+void densitometer_cal_reflection_plan(const settings_cal_reflection_t *cal_reflection, densitometer_cal_plan_t *plan);
+
+/**
+ * Build the density constants of a plan from transmission calibration values.
+ */
+void densitometer_cal_transmission_plan(const settings_cal_transmission_t *cal_transmission, densitometer_cal_plan_t *plan);
+
+/**
+ * Calculate the density of a reading using a calibration plan.
+ *
+ * @param plan Calibration plan for the measurement mode
+ * @param max_d Maximum density the measurement mode can report
+ * @param als_basic Reading in basic counts
+ * @return Density, clamped to the range of the measurement mode
+ */
+float densitometer_cal_calc_d(const densitometer_cal_plan_t *plan, float max_d, float als_basic);
+
+#endif /* DENSITOMETER_CAL_H */
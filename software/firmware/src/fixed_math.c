@@ -0,0 +1,64 @@
+#include "fixed_math.h"
+
+#include <string.h>
+
+/* log2(1 + i/64) for i = 0..64, in Q8.24 format */
+static const int32_t log2_table[65] = {
+           0,   375270,   744810,  1108793,  1467383,  1820738,  2169009,  2512340,
+     2850868,  3184728,  3514044,  3838941,  4159533,  4475935,  4788255,  5096595,
+     5401057,  5701737,  5998727,  6292118,  6581994,  6868440,  7151536,  7431359,
+     7707984,  7981483,  8251926,  8519380,  8783912,  9045584,  9304457,  9560591,
+     9814042, 10064867, 10313120, 10558852, 10802114, 11042956, 11281425, 11517568,
+    11751428, 11983051, 12212479, 12439752, 12664911, 12887994, 13109041, 13328087,
+    13545168, 13760320, 13973576, 14184969, 14394532, 14602297, 14808293, 15012551,
+    15215099, 15415967, 15615181, 15812769, 16008758, 16203172, 16396036, 16587377,
+    16777216
+};
+
+/* log10(2) in Q8.24 format */
+#define LOG10_2_Q24 5050445
+
+q16_t q16_from_float(float x)
+{
+    const float scaled = x * 65536.0F;
+    return (q16_t)(scaled >= 0.0F ? (scaled + 0.5F) : (scaled - 0.5F));
+}
+
+float q16_to_float(q16_t x)
+{
+    return (float)x * (1.0F / 65536.0F);
+}
+
+q16_t q16_mul(q16_t a, q16_t b)
+{
+    return (q16_t)((((int64_t)a * (int64_t)b) + 0x8000) >> 16);
+}
+
+q16_t fixed_log10f(float x)
+{
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+
+    /*
+     * Split the float into its exponent and mantissa, using the top
+     * 6 bits of the mantissa as the table index and the remaining
+     * 17 bits as the interpolation fraction.
+     */
+    const int32_t exponent = (int32_t)((bits >> 23) & 0xFF) - 127;
+    const uint32_t index = (bits >> 17) & 0x3F;
+    const int32_t frac = (int32_t)(bits & 0x1FFFF);
+
+    const int32_t lo = log2_table[index];
+    const int32_t hi = log2_table[index + 1];
+    const int32_t mant_log2 = lo + (int32_t)(((hi - lo) * (int64_t)frac) >> 17);
+
+    /* Combine into log2(x) in Q8.24, then scale by log10(2) down to Q16.16 */
+    const int64_t log2_q24 = ((int64_t)exponent << 24) + mant_log2;
+    return (q16_t)(((log2_q24 * LOG10_2_Q24) + (1LL << 31)) >> 32);
+}
+
+uint32_t fixed_muldiv_u32(uint32_t value, uint32_t num, uint32_t den)
+{
+    const uint64_t result = (((uint64_t)value * num) + (den / 2)) / den;
+    return (result > UINT32_MAX) ? UINT32_MAX : (uint32_t)result;
+}
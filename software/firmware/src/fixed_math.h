@@ -0,0 +1,63 @@
+/*
+ * Fixed-point math kernels for the density calculation path.
+ *
+ * The Cortex-M0+ has no FPU, so every call into the libm logarithm and
+ * power functions expands into a long soft-float routine. These kernels
+ * provide table-driven replacements that only use integer arithmetic,
+ * with results in Q16.16 format.
+ */
+
+#ifndef FIXED_MATH_H
+#define FIXED_MATH_H
+
+#include <stdint.h>
+
+/**
+ * Signed Q16.16 fixed-point value
+ */
+typedef int32_t q16_t;
+
+#define Q16_ONE ((q16_t)0x00010000)
+
+/**
+ * Convert a float to Q16.16, rounding to the nearest value.
+ *
+ * The input must be within the representable range of +/-32768.
+ */
+q16_t q16_from_float(float x);
+
+/**
+ * Convert a Q16.16 value to a float.
+ */
+float q16_to_float(q16_t x);
+
+/**
+ * Multiply two Q16.16 values, rounding to the nearest value.
+ */
+q16_t q16_mul(q16_t a, q16_t b);
+
+/**
+ * Calculate log10(x) as a Q16.16 value.
+ *
+ * The mantissa logarithm is linearly interpolated from a 65 entry
+ * table of log2 values, and the exponent is added exactly. Across the
+ * full range of normal positive floats, the absolute error against
+ * 'log10f()' is less than 2.5e-5, which is under two Q16.16 LSBs.
+ *
+ * @param x Input value, which must be a positive normal float
+ */
+q16_t fixed_log10f(float x);
+
+/**
+ * Calculate (value * num / den), rounded to the nearest integer.
+ *
+ * The intermediate product is 64-bit, so this is exact for all inputs.
+ * Results that do not fit in 32 bits are saturated to UINT32_MAX.
+ *
+ * @param value Value to scale
+ * @param num Numerator of the scale factor
+ * @param den Denominator of the scale factor, which must not be zero
+ */
+uint32_t fixed_muldiv_u32(uint32_t value, uint32_t num, uint32_t den);
+
+#endif /* FIXED_MATH_H */
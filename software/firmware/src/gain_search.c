@@ -0,0 +1,164 @@
+#include "gain_search.h"
+
+#include <math.h>
+
+static uint16_t gain_search_next_brightness(gain_search_t *search);
+
+void gain_search_init(gain_search_t *search, uint16_t predicted_brightness, float sat_counts, uint16_t max_brightness)
+{
+    search->max_brightness = max_brightness;
+    search->sat_brightness = 0;
+    search->sat_counts = sat_counts;
+    search->lo_probe.brightness = 0;
+    search->lo_probe.counts = 0.0F;
+    search->prev_probe = search->lo_probe;
+    search->probe_count = 0;
+    search->model_probe = false;
+
+    /* Begin at the predicted brightness, or the max brightness if there is none */
+    if (predicted_brightness > 0 && predicted_brightness < max_brightness) {
+        search->cur_brightness = predicted_brightness;
+    } else {
+        search->cur_brightness = max_brightness;
+    }
+}
+
+gain_search_result_t gain_search_update(gain_search_t *search, bool saturated, float counts)
+{
+    search->probe_count++;
+
+    if (saturated) {
+        if (search->cur_brightness <= 1) {
+            /* Saturated at the lowest brightness, so there is nothing left to search */
+            return GAIN_SEARCH_FAILED;
+        }
+        search->sat_brightness = search->cur_brightness;
+    } else {
+        if (search->cur_brightness == search->max_brightness) {
+            /* Does not saturate at max brightness */
+            return GAIN_SEARCH_FOUND;
+        }
+        search->prev_probe = search->lo_probe;
+        search->lo_probe.brightness = search->cur_brightness;
+        search->lo_probe.counts = counts;
+    }
+
+    /* Stop once the saturation point is bracketed closely enough */
+    if (search->lo_probe.brightness > 0 && search->sat_brightness > 0
+        && (search->sat_brightness - search->lo_probe.brightness) <= gain_search_bracket_step(search->sat_brightness)) {
+        search->cur_brightness = search->lo_probe.brightness;
+        return GAIN_SEARCH_FOUND;
+    }
+
+    if (search->probe_count >= GAIN_SEARCH_MAX_PROBES) {
+        return GAIN_SEARCH_FAILED;
+    }
+
+    search->cur_brightness = gain_search_next_brightness(search);
+    return GAIN_SEARCH_CONTINUE;
+}
+
+uint16_t gain_search_bracket_step(uint16_t brightness)
+{
+    const uint16_t step = (uint16_t)((float)brightness * GAIN_SEARCH_BRACKET_TOLERANCE);
+    return (step > 1) ? step : 1;
+}
+
+uint16_t gain_search_next_brightness(gain_search_t *search)
+{
+    const gain_search_probe_t *lo_probe = &search->lo_probe;
+    const gain_search_probe_t *prev_probe = &search->prev_probe;
+    const uint16_t upper = (search->sat_brightness > 0) ? search->sat_brightness : search->max_brightness;
+    const bool use_model = !search->model_probe;
+    float target = NAN;
+
+    search->model_probe = false;
+
+    if (lo_probe->brightness == 0) {
+        /* Only saturated so far, so halve the brightness */
+        return (search->sat_brightness > 1) ? search->sat_brightness / 2 : 1;
+    }
+
+    /*
+     * Keep the next probe at least one bracket step away from either end
+     * of the interval, so that its result can close the bracket.
+     */
+    float lower_limit = (float)(lo_probe->brightness + gain_search_bracket_step(lo_probe->brightness));
+    float upper_limit = (float)(upper - gain_search_bracket_step(upper));
+    if (upper_limit > (float)search->max_brightness) { upper_limit = (float)search->max_brightness; }
+    if (lower_limit > upper_limit) { lower_limit = upper_limit; }
+
+    /*
+     * A model prediction that did not close the bracket is followed by a
+     * bisection step, so the interval at least halves every two probes
+     * even when the model does not fit this LED response.
+     */
+    if (use_model && search->sat_counts > 0.0F && lo_probe->counts > 0.0F) {
+        /*
+         * Predict the brightness where the reading reaches the known
+         * saturation count. With two unsaturated readings, use a secant
+         * through both of them, which accounts for any offset in the
+         * LED response. Otherwise assume the response is proportional
+         * to the PWM value.
+         */
+        float slope = lo_probe->counts / (float)lo_probe->brightness;
+        if (prev_probe->brightness > 0 && prev_probe->brightness != lo_probe->brightness
+            && lo_probe->counts != prev_probe->counts) {
+            const float secant = (lo_probe->counts - prev_probe->counts)
+                / ((float)lo_probe->brightness - (float)prev_probe->brightness);
+            if (secant > 0.0F) { slope = secant; }
+        }
+        /*
+         * The known saturation count is the highest unsaturated reading
+         * from a previous search, so the real limit is slightly above it.
+         * Aim at the middle of that range, so the probe lands within one
+         * bracket step of the limit on either side.
+         */
+        const float target_counts = search->sat_counts * (1.0F + (GAIN_SEARCH_BRACKET_TOLERANCE / 2.0F));
+        target = (float)lo_probe->brightness + ((target_counts - lo_probe->counts) / slope);
+
+        /* A prediction past the known saturation point is discarded */
+        if (target > upper_limit) {
+            target = NAN;
+        } else {
+            search->model_probe = true;
+        }
+    }
+
+    if (isnan(target)) {
+        /* Without a usable model, bisect the remaining interval */
+        target = ((float)lo_probe->brightness + (float)upper) / 2.0F;
+    }
+
+    if (target > upper_limit) { target = upper_limit; }
+    if (target < lower_limit) { target = lower_limit; }
+
+    return (uint16_t)lroundf(target);
+}
+
+bool gain_search_is_settled(const float *counts, size_t count, float interval_s)
+{
+    float mean_t = 0.0F;
+    float mean_counts = 0.0F;
+    float cov = 0.0F;
+    float var = 0.0F;
+
+    if (!counts || count < 2 || interval_s <= 0.0F) { return false; }
+
+    for (size_t i = 0; i < count; i++) {
+        mean_t += (float)i * interval_s;
+        mean_counts += counts[i];
+    }
+    mean_t /= (float)count;
+    mean_counts /= (float)count;
+    if (mean_counts <= 0.0F) { return false; }
+
+    /* Least-squares slope of the readings over time */
+    for (size_t i = 0; i < count; i++) {
+        const float dt = ((float)i * interval_s) - mean_t;
+        cov += dt * (counts[i] - mean_counts);
+        var += dt * dt;
+    }
+
+    return fabsf(cov / var) <= (mean_counts * GAIN_SEARCH_SETTLE_SLOPE);
+}
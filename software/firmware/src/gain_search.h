@@ -0,0 +1,106 @@
+/*
+ * LED brightness search for sensor gain calibration.
+ *
+ * For each gain setting, the calibration process looks for the highest
+ * LED brightness that does not saturate the sensor. This module holds
+ * the search itself, separate from the sensor and LED control, so it
+ * only decides which brightness to probe next based on the results of
+ * the previous probes.
+ *
+ * It also holds the check for when the LED has cooled down enough
+ * between calibration steps, based on a short run of dim readings.
+ */
+
+#ifndef GAIN_SEARCH_H
+#define GAIN_SEARCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * The search stops once the saturation point is bracketed to within
+ * this fraction of the brightness value, since the selected brightness
+ * is backed off from it anyway.
+ */
+#define GAIN_SEARCH_BRACKET_TOLERANCE 0.01F
+#define GAIN_SEARCH_MAX_PROBES 16
+
+/*
+ * The LED output rises as it cools, so it is considered settled once the
+ * last few readings change by less than this fraction per second.
+ */
+#define GAIN_SEARCH_SETTLE_COUNT 4
+#define GAIN_SEARCH_SETTLE_SLOPE 0.002F
+
+typedef enum {
+    GAIN_SEARCH_CONTINUE = 0,
+    GAIN_SEARCH_FOUND,
+    GAIN_SEARCH_FAILED
+} gain_search_result_t;
+
+/**
+ * Unsaturated probe reading taken during the search.
+ */
+typedef struct {
+    uint16_t brightness;
+    float counts;
+} gain_search_probe_t;
+
+typedef struct {
+    uint16_t max_brightness;
+    uint16_t cur_brightness;
+    uint16_t sat_brightness;
+    float sat_counts;
+    gain_search_probe_t lo_probe;
+    gain_search_probe_t prev_probe;
+    int probe_count;
+    bool model_probe;
+} gain_search_t;
+
+/**
+ * Start a new brightness search.
+ *
+ * @param search Search state to initialize
+ * @param predicted_brightness Expected brightness, or zero if unknown
+ * @param sat_counts Highest unsaturated reading from a previous search, or zero if unknown
+ * @param max_brightness Maximum LED brightness value
+ */
+void gain_search_init(gain_search_t *search, uint16_t predicted_brightness, float sat_counts, uint16_t max_brightness);
+
+/**
+ * Update the search with the result of a probe at the current brightness.
+ *
+ * If this returns GAIN_SEARCH_CONTINUE, then the next probe should be
+ * taken at the updated 'cur_brightness' value. If this returns
+ * GAIN_SEARCH_FOUND, then 'cur_brightness' is the highest unsaturated
+ * brightness, and 'lo_probe' holds its reading unless it is the maximum.
+ *
+ * @param search Search state
+ * @param saturated True if the probe saturated the sensor
+ * @param counts Sensor reading for the probe, if not saturated
+ * @return Search result after this probe
+ */
+gain_search_result_t gain_search_update(gain_search_t *search, bool saturated, float counts);
+
+/**
+ * Get the smallest brightness difference that closes the bracket
+ * around the saturation point.
+ */
+uint16_t gain_search_bracket_step(uint16_t brightness);
+
+/**
+ * Check whether a run of LED cooldown readings has settled.
+ *
+ * Fits a line through the readings, and compares its slope relative to
+ * their mean against GAIN_SEARCH_SETTLE_SLOPE. Readings with no light
+ * cannot show the LED settling, so they never pass.
+ *
+ * @param counts Readings in the order they were taken
+ * @param count Number of readings, at least 2
+ * @param interval_s Time between readings, in seconds
+ * @return True if the readings have settled
+ */
+bool gain_search_is_settled(const float *counts, size_t count, float interval_s);
+
+#endif /* GAIN_SEARCH_H */
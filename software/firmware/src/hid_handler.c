@@ -45,7 +45,7 @@ void hid_send_density_reading(char prefix, float d_value, float d_zero)
 
     /* Convert the output if set to f-stop unit mode */
     if (display_format.unit == SETTING_DISPLAY_UNIT_FSTOP) {
-        d_display = log2f(powf(10.0F, d_display));
+        d_display = d_display * LOG2_10F;
     }
 
     /* Find the sign character */
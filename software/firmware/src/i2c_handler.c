@@ -0,0 +1,266 @@
+#include "i2c_handler.h"
+
+#include "stm32l0xx_hal.h"
+#include <cmsis_os.h>
+
+#define LOG_TAG "i2c"
+#include <elog.h>
+
+/* Default time to wait for a transfer list to complete */
+#define I2C_TRANSFER_TIMEOUT 100
+
+/*
+ * Transfers shorter than this are run in interrupt mode, since setting
+ * up the DMA channel costs more than it saves for just a few bytes.
+ */
+#define I2C_DMA_MIN_LENGTH 4
+
+typedef struct {
+    I2C_HandleTypeDef *hi2c;
+    const i2c_transfer_t *transfers;
+    size_t count;
+    size_t index;
+    HAL_StatusTypeDef result;
+} i2c_transaction_t;
+
+static volatile bool i2c_initialized = false;
+static I2C_HandleTypeDef *i2c_handle = NULL;
+static volatile i2c_transaction_t i2c_transaction = {0};
+
+static osMutexId_t i2c_mutex = NULL;
+static const osMutexAttr_t i2c_mutex_attrs = {
+    .name = "i2c_mutex",
+    .attr_bits = osMutexPrioInherit
+};
+
+static osSemaphoreId_t i2c_semaphore = NULL;
+static const osSemaphoreAttr_t i2c_semaphore_attrs = {
+    .name = "i2c_semaphore"
+};
+
+static HAL_StatusTypeDef i2c_transfer_start(I2C_HandleTypeDef *hi2c, const i2c_transfer_t *transfer);
+static HAL_StatusTypeDef i2c_transfer_blocking(I2C_HandleTypeDef *hi2c, const i2c_transfer_t *transfers, size_t count);
+static void i2c_transaction_finish(HAL_StatusTypeDef result);
+static void i2c_bus_reset(I2C_HandleTypeDef *hi2c);
+
+osStatus_t i2c_handler_init(I2C_HandleTypeDef *hi2c)
+{
+    if (!hi2c) {
+        return osErrorParameter;
+    }
+
+    /* Create the mutex used to serialize access to the bus */
+    i2c_mutex = osMutexNew(&i2c_mutex_attrs);
+    if (!i2c_mutex) {
+        log_e("i2c_mutex create error");
+        return osErrorNoMemory;
+    }
+
+    /* Create the semaphore used to signal transfer list completion */
+    i2c_semaphore = osSemaphoreNew(1, 0, &i2c_semaphore_attrs);
+    if (!i2c_semaphore) {
+        log_e("i2c_semaphore create error");
+        return osErrorNoMemory;
+    }
+
+    i2c_handle = hi2c;
+    i2c_initialized = true;
+
+    log_i("I2C handler initialized");
+
+    return osOK;
+}
+
+HAL_StatusTypeDef i2c_transfer_submit(I2C_HandleTypeDef *hi2c, const i2c_transfer_t *transfers, size_t count)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+
+    if (!hi2c || !transfers || count == 0) {
+        return HAL_ERROR;
+    }
+
+    if (!i2c_initialized || hi2c != i2c_handle) {
+        return HAL_ERROR;
+    }
+
+    if (osMutexAcquire(i2c_mutex, portMAX_DELAY) != osOK) {
+        return HAL_ERROR;
+    }
+
+    /* Clear any completion left over from a previously abandoned transaction */
+    osSemaphoreAcquire(i2c_semaphore, 0);
+
+    i2c_transaction.hi2c = hi2c;
+    i2c_transaction.transfers = transfers;
+    i2c_transaction.count = count;
+    i2c_transaction.index = 0;
+    i2c_transaction.result = HAL_OK;
+
+    ret = i2c_transfer_start(hi2c, &transfers[0]);
+    if (ret != HAL_OK) {
+        log_e("Unable to start transfer: %d", ret);
+        i2c_transaction.transfers = NULL;
+        osMutexRelease(i2c_mutex);
+    }
+
+    return ret;
+}
+
+HAL_StatusTypeDef i2c_transfer_wait(I2C_HandleTypeDef *hi2c, uint32_t timeout)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+
+    if (!i2c_initialized || hi2c != i2c_handle) {
+        return HAL_ERROR;
+    }
+
+    if (osSemaphoreAcquire(i2c_semaphore, timeout) == osOK) {
+        ret = i2c_transaction.result;
+    } else {
+        log_e("Transfer timeout: index=%d, state=0x%02X, error=0x%lX",
+            (int)i2c_transaction.index, HAL_I2C_GetState(hi2c), HAL_I2C_GetError(hi2c));
+
+        /* Abandon the transaction so late callbacks are ignored */
+        taskENTER_CRITICAL();
+        i2c_transaction.transfers = NULL;
+        taskEXIT_CRITICAL();
+
+        i2c_bus_reset(hi2c);
+        ret = HAL_TIMEOUT;
+    }
+
+    osMutexRelease(i2c_mutex);
+
+    return ret;
+}
+
+HAL_StatusTypeDef i2c_transfer(I2C_HandleTypeDef *hi2c, const i2c_transfer_t *transfers, size_t count)
+{
+    HAL_StatusTypeDef ret;
+
+    /*
+     * Fall back to polled transfers if the scheduler is not running,
+     * or has been suspended, since blocking on the completion semaphore
+     * is not possible in either case.
+     */
+    if (!i2c_initialized || osKernelGetState() != osKernelRunning) {
+        return i2c_transfer_blocking(hi2c, transfers, count);
+    }
+
+    ret = i2c_transfer_submit(hi2c, transfers, count);
+    if (ret != HAL_OK) {
+        return ret;
+    }
+
+    return i2c_transfer_wait(hi2c, I2C_TRANSFER_TIMEOUT);
+}
+
+HAL_StatusTypeDef i2c_mem_read(I2C_HandleTypeDef *hi2c, uint16_t dev_address, uint16_t mem_address, uint8_t *data, uint16_t len)
+{
+    const i2c_transfer_t transfer = {
+        .dir = I2C_TRANSFER_READ,
+        .dev_address = dev_address,
+        .mem_address = mem_address,
+        .data = data,
+        .len = len
+    };
+    return i2c_transfer(hi2c, &transfer, 1);
+}
+
+HAL_StatusTypeDef i2c_mem_write(I2C_HandleTypeDef *hi2c, uint16_t dev_address, uint16_t mem_address, uint8_t *data, uint16_t len)
+{
+    const i2c_transfer_t transfer = {
+        .dir = I2C_TRANSFER_WRITE,
+        .dev_address = dev_address,
+        .mem_address = mem_address,
+        .data = data,
+        .len = len
+    };
+    return i2c_transfer(hi2c, &transfer, 1);
+}
+
+HAL_StatusTypeDef i2c_transfer_start(I2C_HandleTypeDef *hi2c, const i2c_transfer_t *transfer)
+{
+    if (transfer->dir == I2C_TRANSFER_READ) {
+        if (transfer->len >= I2C_DMA_MIN_LENGTH && hi2c->hdmarx) {
+            return HAL_I2C_Mem_Read_DMA(hi2c, transfer->dev_address, transfer->mem_address,
+                I2C_MEMADD_SIZE_8BIT, transfer->data, transfer->len);
+        } else {
+            return HAL_I2C_Mem_Read_IT(hi2c, transfer->dev_address, transfer->mem_address,
+                I2C_MEMADD_SIZE_8BIT, transfer->data, transfer->len);
+        }
+    } else {
+        if (transfer->len >= I2C_DMA_MIN_LENGTH && hi2c->hdmatx) {
+            return HAL_I2C_Mem_Write_DMA(hi2c, transfer->dev_address, transfer->mem_address,
+                I2C_MEMADD_SIZE_8BIT, transfer->data, transfer->len);
+        } else {
+            return HAL_I2C_Mem_Write_IT(hi2c, transfer->dev_address, transfer->mem_address,
+                I2C_MEMADD_SIZE_8BIT, transfer->data, transfer->len);
+        }
+    }
+}
+
+HAL_StatusTypeDef i2c_transfer_blocking(I2C_HandleTypeDef *hi2c, const i2c_transfer_t *transfers, size_t count)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+
+    for (size_t i = 0; i < count; i++) {
+        const i2c_transfer_t *transfer = &transfers[i];
+        if (transfer->dir == I2C_TRANSFER_READ) {
+            ret = HAL_I2C_Mem_Read(hi2c, transfer->dev_address, transfer->mem_address,
+                I2C_MEMADD_SIZE_8BIT, transfer->data, transfer->len, HAL_MAX_DELAY);
+        } else {
+            ret = HAL_I2C_Mem_Write(hi2c, transfer->dev_address, transfer->mem_address,
+                I2C_MEMADD_SIZE_8BIT, transfer->data, transfer->len, HAL_MAX_DELAY);
+        }
+        if (ret != HAL_OK) { break; }
+    }
+
+    return ret;
+}
+
+void i2c_transaction_finish(HAL_StatusTypeDef result)
+{
+    i2c_transaction.result = result;
+    i2c_transaction.transfers = NULL;
+    osSemaphoreRelease(i2c_semaphore);
+}
+
+void i2c_bus_reset(I2C_HandleTypeDef *hi2c)
+{
+    HAL_I2C_DeInit(hi2c);
+    if (HAL_I2C_Init(hi2c) != HAL_OK) {
+        log_e("Unable to reinitialize I2C peripheral");
+        return;
+    }
+    HAL_I2CEx_ConfigAnalogFilter(hi2c, I2C_ANALOGFILTER_ENABLE);
+    HAL_I2CEx_ConfigDigitalFilter(hi2c, 0);
+}
+
+void i2c_completion_callback(I2C_HandleTypeDef *hi2c)
+{
+    if (hi2c != i2c_transaction.hi2c || !i2c_transaction.transfers) {
+        return;
+    }
+
+    /* Chain the next transfer in the list directly from the interrupt */
+    i2c_transaction.index++;
+    if (i2c_transaction.index < i2c_transaction.count) {
+        HAL_StatusTypeDef ret = i2c_transfer_start(hi2c, &i2c_transaction.transfers[i2c_transaction.index]);
+        if (ret != HAL_OK) {
+            i2c_transaction_finish(ret);
+        }
+        return;
+    }
+
+    i2c_transaction_finish(HAL_OK);
+}
+
+void i2c_error_callback(I2C_HandleTypeDef *hi2c)
+{
+    if (hi2c != i2c_transaction.hi2c || !i2c_transaction.transfers) {
+        return;
+    }
+
+    i2c_transaction_finish(HAL_ERROR);
+}
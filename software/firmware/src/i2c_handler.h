@@ -0,0 +1,96 @@
+/*
+ * Handles transactions on the I2C bus shared by the light sensor and
+ * the temperature sensor.
+ *
+ * Transactions are submitted as a list of register reads and writes,
+ * which are then run back-to-back from the I2C completion interrupts
+ * using interrupt or DMA driven transfers. The submitting task sleeps
+ * until the whole list has completed, so other tasks can run while
+ * the bus is busy.
+ */
+
+#ifndef I2C_HANDLER_H
+#define I2C_HANDLER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cmsis_os.h>
+#include "stm32l0xx_hal.h"
+
+typedef enum {
+    I2C_TRANSFER_WRITE = 0,
+    I2C_TRANSFER_READ
+} i2c_transfer_dir_t;
+
+/**
+ * A single register read or write on the I2C bus
+ */
+typedef struct {
+    i2c_transfer_dir_t dir; /*!< Transfer direction */
+    uint16_t dev_address;   /*!< 8-bit device address */
+    uint16_t mem_address;   /*!< 8-bit register address */
+    uint8_t *data;          /*!< Data buffer, which must remain valid until completion */
+    uint16_t len;           /*!< Number of bytes to transfer */
+} i2c_transfer_t;
+
+osStatus_t i2c_handler_init(I2C_HandleTypeDef *hi2c);
+
+/**
+ * Submit a list of transfers to run on the I2C bus.
+ *
+ * This function returns as soon as the first transfer has been started.
+ * The transfer list, and all the buffers it references, must remain valid
+ * until the list has been completed by calling 'i2c_transfer_wait()'.
+ * That call must be made from the same task that submitted the list,
+ * as the bus remains locked by that task until then.
+ *
+ * @param hi2c I2C peripheral handle
+ * @param transfers List of transfers to run
+ * @param count Number of transfers in the list
+ */
+HAL_StatusTypeDef i2c_transfer_submit(I2C_HandleTypeDef *hi2c, const i2c_transfer_t *transfers, size_t count);
+
+/**
+ * Wait for completion of the previously submitted transfer list.
+ *
+ * The calling task will sleep until all transfers have finished, or the
+ * first error has occurred. If the timeout expires, the peripheral is
+ * reset so the bus can be used again.
+ *
+ * @param hi2c I2C peripheral handle
+ * @param timeout Amount of time to wait for completion, in ticks
+ */
+HAL_StatusTypeDef i2c_transfer_wait(I2C_HandleTypeDef *hi2c, uint32_t timeout);
+
+/**
+ * Run a list of transfers on the I2C bus, and block until completion.
+ *
+ * If the scheduler is not running, or is currently suspended, the
+ * transfers are instead run using the polled HAL functions.
+ *
+ * @param hi2c I2C peripheral handle
+ * @param transfers List of transfers to run
+ * @param count Number of transfers in the list
+ */
+HAL_StatusTypeDef i2c_transfer(I2C_HandleTypeDef *hi2c, const i2c_transfer_t *transfers, size_t count);
+
+/**
+ * Read a block of registers from a device on the I2C bus.
+ *
+ * This is a convenience wrapper around 'i2c_transfer()' for a single
+ * register read, with arguments that match 'HAL_I2C_Mem_Read()'.
+ */
+HAL_StatusTypeDef i2c_mem_read(I2C_HandleTypeDef *hi2c, uint16_t dev_address, uint16_t mem_address, uint8_t *data, uint16_t len);
+
+/**
+ * Write a block of registers to a device on the I2C bus.
+ *
+ * This is a convenience wrapper around 'i2c_transfer()' for a single
+ * register write, with arguments that match 'HAL_I2C_Mem_Write()'.
+ */
+HAL_StatusTypeDef i2c_mem_write(I2C_HandleTypeDef *hi2c, uint16_t dev_address, uint16_t mem_address, uint8_t *data, uint16_t len);
+
+void i2c_completion_callback(I2C_HandleTypeDef *hi2c);
+void i2c_error_callback(I2C_HandleTypeDef *hi2c);
+
+#endif /* I2C_HANDLER_H */
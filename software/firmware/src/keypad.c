@@ -19,6 +19,7 @@
 #define KEYPAD_INDEX_MAX       5
 #define KEYPAD_REPEAT_DELAY_MS 600
 #define KEYPAD_REPEAT_RATE_S   25
+#define KEYPAD_QUEUE_SIZE      8
 
 /* Internal raw keypad event data */
 typedef struct {
@@ -67,13 +68,13 @@ void task_keypad_run(void *argument)
     log_d("keypad_task start");
 
     /* Create the queues for key events */
-    keypad_raw_event_queue = osMessageQueueNew(20, sizeof(keypad_raw_event_t), &keypad_raw_event_queue_attrs);
+    keypad_raw_event_queue = osMessageQueueNew(KEYPAD_QUEUE_SIZE, sizeof(keypad_raw_event_t), &keypad_raw_event_queue_attrs);
     if (!keypad_raw_event_queue) {
         log_e("Unable to create event queue");
         return;
     }
 
-    keypad_event_queue = osMessageQueueNew(20, sizeof(keypad_event_t), &keypad_event_queue_attrs);
+    keypad_event_queue = osMessageQueueNew(KEYPAD_QUEUE_SIZE, sizeof(keypad_event_t), &keypad_event_queue_attrs);
     if (!keypad_event_queue) {
         log_e("Unable to create event queue");
         return;
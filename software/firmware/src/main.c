@@ -18,6 +18,7 @@
 #include "display.h"
 #include "light.h"
 #include "adc_handler.h"
+#include "i2c_handler.h"
 #include "task_main.h"
 #include "task_sensor.h"
 #include "app_descriptor.h"
@@ -31,6 +32,7 @@ CRC_HandleTypeDef hcrc;
 RTC_HandleTypeDef hrtc;
 ADC_HandleTypeDef hadc;
 DMA_HandleTypeDef hdma_adc;
+DMA_HandleTypeDef hdma_i2c1_rx;
 I2C_HandleTypeDef hi2c1;
 SPI_HandleTypeDef hspi1;
 TIM_HandleTypeDef htim2;
@@ -433,6 +435,10 @@ void dma_init(void)
     /* DMA1_Channel1_IRQn interrupt configuration */
     HAL_NVIC_SetPriority(DMA1_Channel1_IRQn, 3, 0);
     HAL_NVIC_EnableIRQ(DMA1_Channel1_IRQn);
+
+    /* DMA1_Channel2_3_IRQn interrupt configuration, for I2C1 receive */
+    HAL_NVIC_SetPriority(DMA1_Channel2_3_IRQn, 3, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Channel2_3_IRQn);
 }
 
 void adc_init(void)
@@ -581,11 +587,11 @@ int main(void)
 
     /* Initialize the rest of the configured peripherals */
     gpio_init();
+    dma_init();
     i2c1_init();
     tim2_init();
     spi1_init();
     crc_init();
-    dma_init();
     adc_init();
     usb_init();
 
@@ -636,6 +642,21 @@ void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc)
     adc_completion_callback();
 }
 
+void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+    i2c_completion_callback(hi2c);
+}
+
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+    i2c_completion_callback(hi2c);
+}
+
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
+{
+    i2c_error_callback(hi2c);
+}
+
 void HAL_TIM_PWM_PulseFinishedCallback(TIM_HandleTypeDef *htim)
 {
     if (htim->Instance == TIM2) {
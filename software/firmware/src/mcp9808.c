@@ -6,6 +6,8 @@
 
 #include <elog.h>
 
+#include "i2c_handler.h"
+
 /* I2C device address */
 static const uint8_t MCP9808_ADDRESS = 0x18 << 1; // Use 8-bit address
 
@@ -27,9 +29,8 @@ HAL_StatusTypeDef mcp9808_init(I2C_HandleTypeDef *hi2c)
     log_i("Initializing MCP9808");
 
     /* Read manufacturer ID */
-    ret = HAL_I2C_Mem_Read(hi2c, MCP9808_ADDRESS,
-        MCP9808_MFG_ID, I2C_MEMADD_SIZE_8BIT,
-        data, 2, HAL_MAX_DELAY);
+    ret = i2c_mem_read(hi2c, MCP9808_ADDRESS,
+        MCP9808_MFG_ID, data, 2);
     if (ret != HAL_OK) {
         return ret;
     }
@@ -42,9 +43,8 @@ HAL_StatusTypeDef mcp9808_init(I2C_HandleTypeDef *hi2c)
     }
 
     /* Read Device ID and revision register */
-    ret = HAL_I2C_Mem_Read(hi2c, MCP9808_ADDRESS,
-        MCP9808_DEVICE_ID, I2C_MEMADD_SIZE_8BIT,
-        data, 2, HAL_MAX_DELAY);
+    ret = i2c_mem_read(hi2c, MCP9808_ADDRESS,
+        MCP9808_DEVICE_ID, data, 2);
     if (ret != HAL_OK) {
         return ret;
     }
@@ -58,9 +58,8 @@ HAL_StatusTypeDef mcp9808_init(I2C_HandleTypeDef *hi2c)
     }
 
     /* Read startup configuration */
-    ret = HAL_I2C_Mem_Read(hi2c, MCP9808_ADDRESS,
-        MCP9808_CONFIG, I2C_MEMADD_SIZE_8BIT,
-        data, 2, HAL_MAX_DELAY);
+    ret = i2c_mem_read(hi2c, MCP9808_ADDRESS,
+        MCP9808_CONFIG, data, 2);
     if (ret != HAL_OK) {
         return ret;
     }
@@ -78,9 +77,8 @@ HAL_StatusTypeDef mcp9808_set_enable(I2C_HandleTypeDef *hi2c, bool enable)
     HAL_StatusTypeDef ret;
     uint8_t data[2];
 
-    ret = HAL_I2C_Mem_Read(hi2c, MCP9808_ADDRESS,
-        MCP9808_CONFIG, I2C_MEMADD_SIZE_8BIT,
-        data, 2, HAL_MAX_DELAY);
+    ret = i2c_mem_read(hi2c, MCP9808_ADDRESS,
+        MCP9808_CONFIG, data, 2);
     if (ret != HAL_OK) {
         return ret;
     }
@@ -90,9 +88,8 @@ HAL_StatusTypeDef mcp9808_set_enable(I2C_HandleTypeDef *hi2c, bool enable)
         data[0] |= 0x01;
     }
 
-    return HAL_I2C_Mem_Write(hi2c, MCP9808_ADDRESS,
-        MCP9808_CONFIG, I2C_MEMADD_SIZE_8BIT,
-        data, 2, HAL_MAX_DELAY);
+    return i2c_mem_write(hi2c, MCP9808_ADDRESS,
+        MCP9808_CONFIG, data, 2);
 }
 
 HAL_StatusTypeDef mcp9808_set_resolution(I2C_HandleTypeDef *hi2c, mcp9808_resolution_t value)
@@ -100,9 +97,8 @@ HAL_StatusTypeDef mcp9808_set_resolution(I2C_HandleTypeDef *hi2c, mcp9808_resolu
     uint8_t data;
     data = (uint8_t)value & 0x03;
 
-    return HAL_I2C_Mem_Write(hi2c, MCP9808_ADDRESS,
-        MCP9808_RESOLUTION, I2C_MEMADD_SIZE_8BIT,
-        &data, 1, HAL_MAX_DELAY);
+    return i2c_mem_write(hi2c, MCP9808_ADDRESS,
+        MCP9808_RESOLUTION, &data, 1);
 }
 
 HAL_StatusTypeDef mcp9808_get_resolution(I2C_HandleTypeDef *hi2c, mcp9808_resolution_t *value)
@@ -112,9 +108,8 @@ HAL_StatusTypeDef mcp9808_get_resolution(I2C_HandleTypeDef *hi2c, mcp9808_resolu
 
     if (!value) { return HAL_ERROR; }
 
-    ret = HAL_I2C_Mem_Read(hi2c, MCP9808_ADDRESS,
-        MCP9808_RESOLUTION, I2C_MEMADD_SIZE_8BIT,
-        &data, 1, HAL_MAX_DELAY);
+    ret = i2c_mem_read(hi2c, MCP9808_ADDRESS,
+        MCP9808_RESOLUTION, &data, 1);
     if (ret != HAL_OK) {
         return ret;
     }
@@ -133,9 +128,8 @@ HAL_StatusTypeDef mcp9808_read_temperature(I2C_HandleTypeDef *hi2c, float *temp_
     }
 
     /* Read the ambient temperature register */
-    ret = HAL_I2C_Mem_Read(hi2c, MCP9808_ADDRESS,
-        MCP9808_TA, I2C_MEMADD_SIZE_8BIT,
-        data, 2, HAL_MAX_DELAY);
+    ret = i2c_mem_read(hi2c, MCP9808_ADDRESS,
+        MCP9808_TA, data, 2);
     if (ret != HAL_OK) {
         return ret;
     }
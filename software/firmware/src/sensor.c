@@ -6,32 +6,125 @@
 
 #include <math.h>
 #include <limits.h>
+#include <string.h>
 #include <cmsis_os.h>
 
 #include "settings.h"
 #include "task_sensor.h"
 #include "light.h"
+#include "gain_search.h"
 #include "util.h"
 
 #define SENSOR_TARGET_READ_ITERATIONS 2
+
+/*
+ * Integration cycle length for target reads, at the fixed sample time
+ * of 719: (sample_count + 1) * (719 + 1) * 1.388889us, so 200 ms.
+ * Adaptive reads use the same cycle, since the gain calibration and the
+ * target calibrations were all measured with it. They only differ in
+ * how many cycles are averaged.
+ *
+ * Target reads stay on a single modulator, since the SMUX already routes
+ * all the selected photodiodes to MOD0. Splitting them across both
+ * modulators would not add any signal per cycle, and the gain calibration
+ * only covers MOD0.
+ */
+#define SENSOR_TARGET_READ_SAMPLE_COUNT 199
+
+/*
+ * Target measurement cycles with fewer raw counts than this are considered
+ * low signal, and step the gain up if possible. Cycles that saturate step
+ * the gain down. Only the gain is ever adjusted, since every reading in a
+ * target read has to share one integration time for the basic count
+ * conversion plan. The number of in-place adjustments is bounded to prevent
+ * oscillating between the two.
+ */
+#define SENSOR_TARGET_LOW_SIGNAL_COUNTS 1000UL
+#define SENSOR_TARGET_MAX_ADJUSTMENTS 4
 #define SENSOR_GAIN_CAL_BRIGHTNESS_THRESHOLD 0.95F
 #define SENSOR_GAIN_CAL_READ_ITERATIONS 5
 #define SENSOR_GAIN_CAL_LIGHT_LEVELS 5
 #define SENSOR_GAIN_CAL_LIGHT_LEVEL_INCREMENT 0.10F
 #define SENSOR_GAIN_LED_CHECK_READ_ITERATIONS 2
+
+/*
+ * Longest time the LED is left off between gain calibration steps, so it
+ * can cool down from the previous measurement. The wait ends early once
+ * short dim probes of the LED show its output has settled, at a fraction
+ * of the measurement brightness so the probes add little heat.
+ */
 #define SENSOR_GAIN_LED_COOLDOWN_MS 5000UL
+#define SENSOR_GAIN_COOLDOWN_PROBE_INTERVAL_MS 500UL
+#define SENSOR_GAIN_COOLDOWN_PROBE_DIVISOR 8
+#define SENSOR_GAIN_COOLDOWN_PROBE_SAMPLE_COUNT 49
 
 /* Number of iterations to use for light source calibration */
 #define LIGHT_CAL_ITERATIONS 600
 
+/*
+ * Readings much darker than the one the predicted gain was learned from
+ * are considered under-range, and send the measurement back through AGC.
+ */
+#define SENSOR_PREDICT_UNDERRANGE_RATIO 4.0
+
+/**
+ * Gain prediction for target readings, learned from the last successful
+ * reading with each light source.
+ */
+typedef struct {
+    bool valid;
+    tsl2585_gain_t gain;
+    double als_basic;
+} sensor_gain_prediction_t;
+
+static sensor_gain_prediction_t gain_prediction[SENSOR_LIGHT_UV_TRANSMISSION + 1] = {0};
+
+/**
+ * Conversion plan for basic counts, holding the reciprocal of the
+ * calibrated gain and integration time product for every gain setting.
+ * It is rebuilt whenever the gain calibration or integration time changes.
+ */
+typedef struct {
+    bool built;
+    uint32_t cal_generation;
+    uint16_t sample_time;
+    uint16_t sample_count;
+    float scale[TSL2585_GAIN_256X + 1];
+} sensor_basic_plan_t;
+
+static sensor_basic_plan_t basic_plan = {0};
+
+/* Configuration used for the final readings of the last target read */
+static sensor_read_info_t last_read_info = {0};
+
+/*
+ * Convergence settings for target readings, fixed length by default.
+ * The default minimum matches the cycles of a fixed read, so a stable
+ * target finishes in the same time and only a noisy one runs longer.
+ */
+static sensor_read_convergence_t read_convergence = {
+    .tolerance_d = 0.0F,
+    .min_cycles = SENSOR_TARGET_READ_ITERATIONS,
+    .max_cycles = 8
+};
+
 static osStatus_t sensor_find_gain_brightness(uint16_t led_brightness[static 1],
-    tsl2585_gain_t gain,
+    tsl2585_gain_t gain, uint16_t predicted_brightness, float *sat_counts,
+    sensor_gain_calibration_callback_t callback, void *user_data);
+static osStatus_t sensor_gain_led_cooldown(tsl2585_gain_t gain, uint16_t led_brightness, uint32_t max_ms,
     sensor_gain_calibration_callback_t callback, void *user_data);
 static osStatus_t sensor_measure_gain_pair(
     float gain_ratio[static 1],
     tsl2585_gain_t low_gain, tsl2585_gain_t high_gain,
     uint16_t led_brightness,
     sensor_gain_calibration_callback_t callback, void *user_data);
+static void sensor_read_target_agc_config(sensor_config_t *config);
+static bool sensor_read_target_step_down(sensor_config_t *config, const sensor_reading_t *reading);
+static bool sensor_read_target_step_up(sensor_config_t *config, const sensor_reading_t *reading);
+static bool sensor_raw_step_is_valid(const sensor_raw_step_t *step);
+static void sensor_build_basic_plan(sensor_basic_plan_t *plan, uint32_t cal_generation,
+    uint16_t sample_time, uint16_t sample_count);
+static float sensor_light_drift_drop_factor(const settings_cal_light_drift_t *cal_light_drift, sensor_light_t light_source);
 static bool gain_status_callback(
     sensor_gain_calibration_callback_t callback,
     sensor_gain_calibration_status_t status, int param,
@@ -44,8 +137,12 @@ osStatus_t sensor_gain_calibration(sensor_gain_calibration_callback_t callback,
     float gain_ratios[TSL2585_GAIN_256X] = {0};
     tsl2585_gain_t base_gain = TSL2585_GAIN_0_5X;
     settings_cal_gain_t cal_gain = {0};
+    float sat_counts = 0.0F;
     size_t i;
 
+    const uint16_t max_brightness = light_get_max_value();
+    const uint32_t start_ticks = osKernelGetTickCount();
+
     log_i("Starting gain calibration");
 
     do {
@@ -58,40 +155,31 @@ osStatus_t sensor_gain_calibration(sensor_gain_calibration_callback_t callback,
         /* Change the light frequency for better calibration behavior */
         light_set_frequency(LIGHT_FREQUENCY_HIGH);
 
-        /* Put the sensor into a known initial state */
-        ret = sensor_set_mode(SENSOR_MODE_VIS);
-        if (ret != osOK) { break; }
-
-        ret = sensor_set_config(TSL2585_GAIN_256X, 719, 199);
-        if (ret != osOK) { break; }
-
-        /* Start the sensor */
-        ret = sensor_start();
-        if (ret != osOK) { break; }
-
         /* Iterate over each gain setting and find the maximum measurement brightness */
         for (i = TSL2585_GAIN_1X; i <= TSL2585_GAIN_256X; i++) {
+            /*
+             * Each gain step doubles the sensor response, so the LED
+             * brightness for the previous gain predicts half of that
+             * for this one. If the previous gain never saturated, there
+             * is nothing to predict from.
+             */
+            uint16_t predicted_brightness = 0;
+            if (i > TSL2585_GAIN_1X && led_brightness[i - 1] < max_brightness) {
+                predicted_brightness = led_brightness[i - 1] / 2;
+            }
+
             uint16_t measure_brightness;
-            ret = sensor_find_gain_brightness(&measure_brightness, i, callback, user_data);
+            ret = sensor_find_gain_brightness(&measure_brightness, i, predicted_brightness, &sat_counts, callback, user_data);
             if (ret != osOK) { break; }
             led_brightness[i] = measure_brightness;
 
             /* Wait for cooldown before next step */
-            if (!gain_status_callback(callback, SENSOR_GAIN_CALIBRATION_STATUS_WAITING, 0, user_data)) { return osError; }
-            osDelay(SENSOR_GAIN_LED_COOLDOWN_MS);
+            ret = sensor_gain_led_cooldown(i, measure_brightness, SENSOR_GAIN_LED_COOLDOWN_MS, callback, user_data);
+            if (ret != osOK) { break; }
         }
         if (ret != osOK) { break; }
         led_brightness[TSL2585_GAIN_0_5X] = led_brightness[TSL2585_GAIN_1X];
 
-        /* Turn off the sensor */
-        sensor_stop();
-
-        /* Set lights to off state */
-        ret = sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
-        if (ret != osOK) { break; }
-
-        if (!gain_status_callback(callback, SENSOR_GAIN_CALIBRATION_STATUS_WAITING, 0, user_data)) { return osError; }
-
         /*
          * Note: It is possible this routine may fail to find an appropriate
          * measurement brightness for the highest gain settings on certain
@@ -120,7 +208,7 @@ osStatus_t sensor_gain_calibration(sensor_gain_calibration_callback_t callback,
          * selected for measuring an open sensor.
          */
         for (i = 0; i <= TSL2585_GAIN_256X; i++) {
-            if (led_brightness[i] == light_get_max_value()) {
+            if (led_brightness[i] == max_brightness) {
                 base_gain = i;
             } else {
                 break;
@@ -129,9 +217,9 @@ osStatus_t sensor_gain_calibration(sensor_gain_calibration_callback_t callback,
         log_d("Base measurement gain: %s", tsl2585_gain_str(base_gain));
 
         log_d("Waiting for cooldown before measurement");
-        osDelay(SENSOR_GAIN_LED_COOLDOWN_MS * 2);
-
-        if (!gain_status_callback(callback, SENSOR_GAIN_CALIBRATION_STATUS_WAITING, 0, user_data)) { return osError; }
+        ret = sensor_gain_led_cooldown(TSL2585_GAIN_1X, led_brightness[TSL2585_GAIN_1X],
+            SENSOR_GAIN_LED_COOLDOWN_MS * 2, callback, user_data);
+        if (ret != osOK) { break; }
 
         /* Iterate over each gain pair and measure the ratio */
         for (i = TSL2585_GAIN_1X; i <= TSL2585_GAIN_256X; i++) {
@@ -139,8 +227,8 @@ osStatus_t sensor_gain_calibration(sensor_gain_calibration_callback_t callback,
             if (ret != osOK) { break; }
 
             if (i < TSL2585_GAIN_256X) {
-                if (!gain_status_callback(callback, SENSOR_GAIN_CALIBRATION_STATUS_WAITING, 0, user_data)) { return osError; }
-                osDelay(SENSOR_GAIN_LED_COOLDOWN_MS);
+                ret = sensor_gain_led_cooldown(i + 1, led_brightness[i + 1], SENSOR_GAIN_LED_COOLDOWN_MS, callback, user_data);
+                if (ret != osOK) { break; }
             }
         }
         if (ret != osOK) { break; }
@@ -175,9 +263,13 @@ osStatus_t sensor_gain_calibration(sensor_gain_calibration_callback_t callback,
 #endif
     } while (0);
 
+    const uint32_t elapsed_s = (osKernelGetTickCount() - start_ticks) / osKernelGetTickFreq();
+
     if (ret == osOK) {
-        if (!gain_status_callback(callback, SENSOR_GAIN_CALIBRATION_STATUS_DONE, 0, user_data)) { ret = osError; }
+        log_i("Gain calibration complete in %lus", elapsed_s);
+        if (!gain_status_callback(callback, SENSOR_GAIN_CALIBRATION_STATUS_DONE, (int)elapsed_s, user_data)) { ret = osError; }
     } else {
+        log_w("Gain calibration failed after %lus", elapsed_s);
         if (!gain_status_callback(callback, SENSOR_GAIN_CALIBRATION_STATUS_FAILED, 0, user_data)) { ret = osError; }
     }
 
@@ -200,66 +292,62 @@ osStatus_t sensor_gain_calibration(sensor_gain_calibration_callback_t callback,
 }
 
 osStatus_t sensor_find_gain_brightness(uint16_t led_brightness[static 1],
-    tsl2585_gain_t gain,
+    tsl2585_gain_t gain, uint16_t predicted_brightness, float *sat_counts,
     sensor_gain_calibration_callback_t callback, void *user_data)
 {
     osStatus_t ret = osOK;
-    uint16_t cur_brightness = 0;
-    uint16_t sat_brightness = 0;
-    uint16_t min_brightness = 0;
+    gain_search_t search;
+    gain_search_result_t result = GAIN_SEARCH_CONTINUE;
     sensor_reading_t reading;
+    sensor_reading_cursor_t cursor;
 
     const uint16_t max_brightness = light_get_max_value();
 
     if (!gain_status_callback(callback, SENSOR_GAIN_CALIBRATION_STATUS_LED, gain, user_data)) { return osError; }
 
+    sensor_reading_cursor_init(&cursor);
+
     do {
-        /* Select the measurement gain */
-        ret = sensor_set_gain(gain, TSL2585_MOD0);
+        /* Configure the sensor for the measurement gain, with the LED off */
+        const sensor_config_t config = {
+            .mode = SENSOR_MODE_VIS,
+            .trigger_mode = TSL2585_TRIGGER_OFF,
+            .gain = { gain, gain },
+            .sample_time = 719,
+            .sample_count = 199,
+            .agc_enabled = false,
+            .agc_sample_count = 0,
+            .light = SENSOR_LIGHT_OFF,
+            .light_value = 0,
+            .light_next_cycle = false
+        };
+        ret = sensor_configure(&config);
+        if (ret != osOK) { break; }
+
+        ret = sensor_start();
         if (ret != osOK) { break; }
 
         /* Wait for the first reading at the new settings to come through */
-        ret = sensor_get_next_reading(&reading, 2000);
+        ret = sensor_wait_next_reading(&cursor, &reading, 2000);
         if (ret != osOK) { break; }
 
-        /* Begin at the max brightness */
-        cur_brightness = max_brightness;
+        gain_search_init(&search, predicted_brightness, *sat_counts, max_brightness);
 
-        while (1) {
+        while (result == GAIN_SEARCH_CONTINUE) {
             /* Set the LED to target brightness on the next cycle */
-            log_d("Setting brightness to %d", cur_brightness);
-            sensor_set_light_mode(SENSOR_LIGHT_VIS_TRANSMISSION, /*next_cycle*/true, cur_brightness);
+            log_d("Setting brightness to %d", search.cur_brightness);
+            sensor_set_light_mode(SENSOR_LIGHT_VIS_TRANSMISSION, /*next_cycle*/true, search.cur_brightness);
 
             /* Wait for two readings, discarding the first */
-            ret = sensor_get_next_reading(&reading, 2000);
+            ret = sensor_wait_next_reading(&cursor, &reading, 2000);
             if (ret != osOK) { break; }
-            ret = sensor_get_next_reading(&reading, 2000);
+            ret = sensor_wait_next_reading(&cursor, &reading, 2000);
             if (ret != osOK) { break; }
 
             if (reading.mod0.result == SENSOR_RESULT_VALID) {
-                /* Valid result */
-                if (cur_brightness == max_brightness) {
-                    log_d("Does not saturate at max brightness");
-                    break;
-                } else {
-                    /* Sensor not saturated, need to increase brightness */
-                    if (cur_brightness + 1 == sat_brightness) {
-                        log_d("Found target brightness");
-                        break;
-                    } else {
-                        min_brightness = cur_brightness;
-                        if (sat_brightness == 0) {
-                            cur_brightness = (cur_brightness + max_brightness) / 2;
-                        } else {
-                            cur_brightness = (cur_brightness + sat_brightness) / 2;
-                        }
-                    }
-                }
+                result = gain_search_update(&search, false, (float)reading.mod0.als_data);
             } else if (reading.mod0.result == SENSOR_RESULT_SATURATED_ANALOG || reading.mod0.result == SENSOR_RESULT_SATURATED_DIGITAL) {
-                /* Sensor saturated, need to reduce brightness by half */
-                sat_brightness = cur_brightness;
-                cur_brightness = min_brightness + ((cur_brightness - min_brightness) / 2);
-                if (cur_brightness == sat_brightness) { cur_brightness--; }
+                result = gain_search_update(&search, true, 0.0F);
             } else {
                 log_w("Sensor reading error: %d", reading.mod0.result);
                 ret = osError;
@@ -267,18 +355,31 @@ osStatus_t sensor_find_gain_brightness(uint16_t led_brightness[static 1],
             }
         }
         if (ret != osOK) { break; }
+        if (result != GAIN_SEARCH_FOUND) {
+            log_w("Brightness search did not converge");
+            ret = osError;
+            break;
+        }
     } while (0);
 
-    /* Turn off the LED */
+    /* Turn off the sensor and LED */
+    sensor_stop();
     sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
 
     if (ret == osOK) {
         uint16_t adj_brightness;
-        if (cur_brightness == max_brightness) {
-            adj_brightness = cur_brightness;
+        if (search.cur_brightness == max_brightness) {
+            log_d("Does not saturate at max brightness");
+            adj_brightness = search.cur_brightness;
         } else {
+            /*
+             * The highest unsaturated reading is within the bracket
+             * tolerance of saturation, so use it to predict the next gain.
+             */
+            *sat_counts = search.lo_probe.counts;
+
             /* Adjust to prevent saturation due to noise */
-            adj_brightness = (uint16_t)floorf((float)cur_brightness * SENSOR_GAIN_CAL_BRIGHTNESS_THRESHOLD);
+            adj_brightness = (uint16_t)floorf((float)search.cur_brightness * SENSOR_GAIN_CAL_BRIGHTNESS_THRESHOLD);
 
             /* Prevent near-zero */
             if (adj_brightness < 2) {
@@ -287,12 +388,70 @@ osStatus_t sensor_find_gain_brightness(uint16_t led_brightness[static 1],
         }
 
         *led_brightness = adj_brightness;
-        log_d("Selected brightness: %d (%d)", adj_brightness, sat_brightness);
+        log_d("Selected brightness: %d (%d), probes=%d", adj_brightness, search.sat_brightness, search.probe_count);
     }
 
     return ret;
 }
 
+osStatus_t sensor_gain_led_cooldown(tsl2585_gain_t gain, uint16_t led_brightness, uint32_t max_ms,
+    sensor_gain_calibration_callback_t callback, void *user_data)
+{
+    float counts[GAIN_SEARCH_SETTLE_COUNT];
+    size_t count = 0;
+    uint32_t als_reading;
+
+    /*
+     * Keep the LED off between the probes. Any steady light from it
+     * would keep heating it, so only short dim probes are taken to
+     * see whether its output is still changing.
+     */
+    osStatus_t ret = sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
+    if (ret != osOK) { return ret; }
+
+    if (!gain_status_callback(callback, SENSOR_GAIN_CALIBRATION_STATUS_WAITING, 0, user_data)) { return osError; }
+
+    uint16_t probe_brightness = led_brightness / SENSOR_GAIN_COOLDOWN_PROBE_DIVISOR;
+    if (probe_brightness < 1) { probe_brightness = 1; }
+
+    /* The kernel tick is 1ms, so tick counts are used as milliseconds */
+    const uint32_t start_ticks = osKernelGetTickCount();
+    uint32_t probe_ticks = start_ticks;
+
+    while ((probe_ticks += SENSOR_GAIN_COOLDOWN_PROBE_INTERVAL_MS) - start_ticks < max_ms) {
+        osDelayUntil(probe_ticks);
+
+        ret = sensor_read_target_raw(
+            SENSOR_LIGHT_VIS_TRANSMISSION, probe_brightness, SENSOR_MODE_VIS,
+            gain, 719, SENSOR_GAIN_COOLDOWN_PROBE_SAMPLE_COUNT,
+            &als_reading);
+        if (ret != osOK) { return ret; }
+        if (als_reading == UINT32_MAX) {
+            /* Nothing to learn from a saturated probe, so wait out the limit */
+            break;
+        }
+
+        if (count == GAIN_SEARCH_SETTLE_COUNT) {
+            memmove(counts, counts + 1, sizeof(float) * (GAIN_SEARCH_SETTLE_COUNT - 1));
+            count--;
+        }
+        counts[count++] = (float)als_reading;
+
+        if (count == GAIN_SEARCH_SETTLE_COUNT
+            && gain_search_is_settled(counts, count, SENSOR_GAIN_COOLDOWN_PROBE_INTERVAL_MS / 1000.0F)) {
+            log_d("LED settled after %lums", osKernelGetTickCount() - start_ticks);
+            return osOK;
+        }
+    }
+
+    const uint32_t elapsed_ms = osKernelGetTickCount() - start_ticks;
+    if (elapsed_ms < max_ms) {
+        osDelay(max_ms - elapsed_ms);
+    }
+
+    return osOK;
+}
+
 osStatus_t sensor_measure_gain_pair(float gain_ratio[static 1],
     tsl2585_gain_t low_gain, tsl2585_gain_t high_gain,
     uint16_t led_brightness,
@@ -318,8 +477,8 @@ osStatus_t sensor_measure_gain_pair(float gain_ratio[static 1],
             break;
         }
 
-        if (!gain_status_callback(callback, SENSOR_GAIN_CALIBRATION_STATUS_WAITING, 0, user_data)) { return osError; }
-        osDelay(SENSOR_GAIN_LED_COOLDOWN_MS);
+        ret = sensor_gain_led_cooldown(high_gain, led_brightness, SENSOR_GAIN_LED_COOLDOWN_MS, callback, user_data);
+        if (ret != osOK) { break; }
 
         if (!gain_status_callback(callback, SENSOR_GAIN_CALIBRATION_STATUS_GAIN, high_gain, user_data)) { return osError; }
         ret = sensor_read_target_raw(
@@ -348,7 +507,7 @@ osStatus_t sensor_light_calibration(sensor_light_t light_source)
     sensor_mode_t mode = SENSOR_MODE_DEFAULT;
     tsl2585_gain_t gain = TSL2585_GAIN_128X;
     sensor_reading_t reading;
-    uint32_t ticks_start;
+    sensor_reading_cursor_t cursor;
     uint16_t light_max = light_get_max_value();
 
     /*
@@ -377,6 +536,8 @@ osStatus_t sensor_light_calibration(sensor_light_t light_source)
 
     log_i("Starting LED brightness calibration");
 
+    sensor_reading_cursor_init(&cursor);
+
     do {
         /* Set lights to initial off state */
         ret = sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
@@ -414,7 +575,7 @@ osStatus_t sensor_light_calibration(sensor_light_t light_source)
         if (ret != osOK) { break; }
 
         /* Swallow the first reading */
-        ret = sensor_get_next_reading(&reading, 2000);
+        ret = sensor_wait_next_reading(&cursor, &reading, 2000);
         if (ret != osOK) { break; }
 
         /* Set LED to full brightness at the next cycle */
@@ -422,19 +583,18 @@ osStatus_t sensor_light_calibration(sensor_light_t light_source)
         if (ret != osOK) { break; }
 
         /* Wait for another cycle which will trigger the LED on */
-        ret = sensor_get_next_reading(&reading, 2000);
+        ret = sensor_wait_next_reading(&cursor, &reading, 2000);
         if (ret != osOK) { break; }
         log_d("TSL2585[%d]: %ld", reading.reading_count, reading.mod0.als_data);
 
-        ticks_start = reading.reading_ticks;
-
         /* Iterate over 2 minutes of readings and accumulate regression data */
         log_d("Starting read loop");
         for (int i = 0; i < LIGHT_CAL_ITERATIONS; i++) {
-            ret = sensor_get_next_reading(&reading, 1000);
+            ret = sensor_wait_next_reading(&cursor, &reading, 1000);
             if (ret != osOK) { break; }
 
-            double x = log((double)(reading.reading_ticks - ticks_start));
+            /* Use the same time base as 'sensor_apply_light_drift_correction()' */
+            double x = log((double)(reading.reading_ticks - reading.light_ticks));
 
             log_d("TSL2585[%d]: %ld", reading.reading_count, reading.mod0.als_data);
 
@@ -483,34 +643,94 @@ osStatus_t sensor_light_calibration(sensor_light_t light_source)
     log_d("Drop factor = %f", drop_factor);
 
     /*
-     * Correction formula is:
-     * ch_val - (ch_val * (drop_factor * log(elapsed_ticks)))
+     * Save the drop factor as the coefficient for this light, which
+     * 'sensor_apply_light_drift_correction()' uses to divide each
+     * reading by (1 + (drop_factor * log(elapsed_ticks))).
      */
+    settings_cal_light_drift_t cal_light_drift;
+    if (!settings_get_cal_light_drift(&cal_light_drift)) {
+        memset(&cal_light_drift, 0, sizeof(settings_cal_light_drift_t));
+    }
+    switch (light_source) {
+    case SENSOR_LIGHT_VIS_REFLECTION:
+        cal_light_drift.vis_reflection = (float)drop_factor;
+        break;
+    case SENSOR_LIGHT_VIS_TRANSMISSION:
+        cal_light_drift.vis_transmission = (float)drop_factor;
+        break;
+    case SENSOR_LIGHT_UV_TRANSMISSION:
+        cal_light_drift.uv_transmission = (float)drop_factor;
+        break;
+    default:
+        break;
+    }
+    if (!settings_set_cal_light_drift(&cal_light_drift)) {
+        log_e("Unable to save drop factor");
+        return osError;
+    }
+
+    if (!sensor_is_light_drift_cal_current(light_source)) {
+        log_w("Target calibration must be measured again");
+    }
 
     return os_to_hal_status(ret);
 }
 #endif
 
+osStatus_t sensor_set_read_convergence(const sensor_read_convergence_t *convergence)
+{
+    if (!convergence) { return osErrorParameter; }
+
+    if (!is_valid_number(convergence->tolerance_d) || convergence->tolerance_d < 0.0F
+        || convergence->min_cycles < 2 || convergence->max_cycles < convergence->min_cycles) {
+        return osErrorParameter;
+    }
+
+    read_convergence = *convergence;
+    return osOK;
+}
+
+void sensor_get_read_convergence(sensor_read_convergence_t *convergence)
+{
+    if (!convergence) { return; }
+    *convergence = read_convergence;
+}
+
 osStatus_t sensor_read_target(sensor_light_t light_source, uint16_t light_value,
     float *als_result,
     sensor_read_callback_t callback, void *user_data)
 {
     osStatus_t ret = osOK;
     sensor_reading_t reading;
+    sensor_reading_cursor_t cursor;
+    sensor_config_t config;
     sensor_mode_t sensor_mode;
-    int agc_step;
+    bool agc_active;
+    bool cycle_pending;
+    int cycle_count = 0;
     int invalid_count;
     int reading_count;
+    uint8_t adjustments = 0;
+    bool saturation_seen = false;
     double als_basic = 0;
-    double als_sum = 0;
+    double als_mean = 0;
+    double als_m2 = 0;
     double als_avg = NAN;
 
+    /* Capture the convergence settings, so they cannot change mid-read */
+    const sensor_read_convergence_t convergence = read_convergence;
+    const bool adaptive = convergence.tolerance_d > 0.0F;
+
     if (light_source != SENSOR_LIGHT_VIS_REFLECTION
         && light_source != SENSOR_LIGHT_VIS_TRANSMISSION
         && light_source != SENSOR_LIGHT_UV_TRANSMISSION) {
         return osErrorParameter;
     }
 
+    /* Use the gain from the last reading with this light source, if there was one */
+    const sensor_gain_prediction_t prediction = gain_prediction[light_source];
+    bool predicted = prediction.valid;
+
     if (light_source == SENSOR_LIGHT_UV_TRANSMISSION) {
         sensor_mode = SENSOR_MODE_UV;
     } else {
@@ -519,6 +739,8 @@ osStatus_t sensor_read_target(sensor_light_t light_source, uint16_t light_value,
 
     log_i("Starting sensor target read");
 
+    sensor_reading_cursor_init(&cursor);
+
     do {
         /* Make sure the light is disabled */
         ret = sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
@@ -526,36 +748,103 @@ osStatus_t sensor_read_target(sensor_light_t light_source, uint16_t light_value,
 
         osDelay(10);
 
-        /* Configure initial sensor settings */
-        ret = sensor_set_mode(sensor_mode);
-        if (ret != osOK) { break; }
-
-        ret = sensor_set_config(TSL2585_GAIN_256X, 719, 0);
-        if (ret != osOK) { break; }
-
-        ret = sensor_set_agc_enabled(9);
-        if (ret != osOK) { break; }
+        /*
+         * Configure initial sensor settings, using VSYNC triggering so
+         * that each integration cycle only starts once the configuration
+         * and light state for it have been settled. This avoids the need
+         * to discard readings after every configuration change.
+         * The light source is activated ahead of the first triggered cycle.
+         */
+        config.mode = sensor_mode;
+        config.trigger_mode = TSL2585_TRIGGER_VSYNC;
+        config.light = light_source;
+        config.light_value = light_value;
+        config.light_next_cycle = false;
+
+        if (predicted) {
+            /* Start directly in fixed gain measurement */
+            log_d("Using predicted gain: %s", tsl2585_gain_str(prediction.gain));
+            config.gain[0] = prediction.gain;
+            config.gain[1] = prediction.gain;
+            config.sample_time = 719;
+            config.sample_count = SENSOR_TARGET_READ_SAMPLE_COUNT;
+            config.agc_enabled = false;
+            config.agc_sample_count = 0;
+        } else {
+            sensor_read_target_agc_config(&config);
+        }
 
-        /* Activate light source synchronized with sensor cycle */
-        ret = sensor_set_light_mode(light_source, /*next_cycle*/true, light_value);
+        ret = sensor_configure(&config);
         if (ret != osOK) { break; }
 
-        /* Start the sensor */
+        /* Start the sensor, which also triggers the first cycle */
         ret = sensor_start();
         if (ret != osOK) { break; }
 
-        agc_step = 1;
+        agc_active = !predicted;
+        cycle_pending = true;
         invalid_count = 0;
         reading_count = 0;
         do {
+            /* Trigger the next cycle, now that its settings are in place */
+            if (!cycle_pending) {
+                ret = sensor_trigger_next_reading();
+                if (ret != osOK) { break; }
+            }
+            cycle_pending = false;
+
             /* Invoke the progress callback */
             if (callback) { callback(user_data); }
 
-            ret = sensor_get_next_reading(&reading, 500);
+            ret = sensor_wait_next_reading(&cursor, &reading, 500);
             if (ret != osOK) { break; }
+            cycle_count++;
+
+            if (predicted) {
+                /*
+                 * Fall back to the AGC sequence if the predicted gain turns
+                 * out to be too high or too low for the current target.
+                 */
+                bool fallback = false;
+                if (reading.mod0.result != SENSOR_RESULT_VALID) {
+                    log_d("Predicted gain saturated");
+                    fallback = true;
+                } else if (reading_count == 0 && reading.mod0.gain < TSL2585_GAIN_256X
+                    && sensor_convert_to_basic_counts(&reading, 0) < prediction.als_basic / SENSOR_PREDICT_UNDERRANGE_RATIO) {
+                    log_d("Predicted gain under-range");
+                    fallback = true;
+                }
+
+                if (fallback) {
+                    sensor_read_target_agc_config(&config);
+                    ret = sensor_configure(&config);
+                    if (ret != osOK) { break; }
+                    predicted = false;
+                    agc_active = true;
+                    reading_count = 0;
+                    als_mean = 0;
+                    als_m2 = 0;
+                    continue;
+                }
+            }
 
             /* Make sure the reading is valid */
             if (reading.mod0.result != SENSOR_RESULT_VALID) {
+                /*
+                 * A saturated measurement cycle steps the configuration
+                 * down for the next cycle, which is applied in place since
+                 * the sensor is idle until triggered.
+                 */
+                if (!agc_active && adjustments < SENSOR_TARGET_MAX_ADJUSTMENTS
+                    && sensor_read_target_step_down(&config, &reading)) {
+                    log_d("Saturated, stepping down to %s", tsl2585_gain_str(config.gain[0]));
+                    ret = sensor_configure(&config);
+                    if (ret != osOK) { break; }
+                    adjustments++;
+                    saturation_seen = true;
+                    continue;
+                }
+
                 invalid_count++;
                 if (invalid_count > 5) {
                     ret = osErrorTimeout;
@@ -565,43 +854,85 @@ osStatus_t sensor_read_target(sensor_light_t light_source, uint16_t light_value,
                 }
             }
 
-            /* Handle the process of moving from AGC to measurement */
-            if (agc_step == 1) {
-                /* Disable AGC */
-                ret = sensor_set_agc_disabled();
-                if (ret != osOK) { break; }
-                /* Increase integration time to prevent FIFO overflow while AGC disable takes effect */
-                ret = sensor_set_integration(719, 9);
+            /*
+             * Move from AGC to measurement, which takes effect from the
+             * next triggered cycle since the sensor is idle in between.
+             */
+            if (agc_active) {
+                config.gain[0] = reading.mod0.gain;
+                config.sample_count = SENSOR_TARGET_READ_SAMPLE_COUNT;
+                config.agc_enabled = false;
+                config.agc_sample_count = 0;
+                ret = sensor_configure(&config);
                 if (ret != osOK) { break; }
-                agc_step++;
+                agc_active = false;
                 continue;
-            } else if (agc_step == 2) {
-                /* Set measurement sample time */
-                ret = sensor_set_integration(719, 199);
+            }
+
+            /*
+             * Step up the gain on a low signal measurement cycle, unless
+             * a previous step down shows that it would saturate.
+             */
+            if (!saturation_seen && adjustments < SENSOR_TARGET_MAX_ADJUSTMENTS
+                && sensor_read_target_step_up(&config, &reading)) {
+                log_d("Low signal, stepping up to %s", tsl2585_gain_str(config.gain[0]));
+                ret = sensor_configure(&config);
                 if (ret != osOK) { break; }
-                agc_step = 0;
+                adjustments++;
                 continue;
             }
 
-            /* Collect the measurement */
-            als_basic = sensor_convert_to_basic_counts(&reading, 0);
-            als_sum += als_basic;
+            /* Collect the measurement, tracking the running mean and variance */
+            als_basic = sensor_apply_light_drift_correction(light_source, &reading,
+                (float)sensor_convert_to_basic_counts(&reading, 0));
             reading_count++;
-        } while (reading_count < SENSOR_TARGET_READ_ITERATIONS);
+            const double delta = als_basic - als_mean;
+            als_mean += delta / (double)reading_count;
+            als_m2 += delta * (als_basic - als_mean);
+
+            if (!adaptive) {
+                if (reading_count >= SENSOR_TARGET_READ_ITERATIONS) { break; }
+                continue;
+            }
+            if (reading_count >= convergence.max_cycles) { break; }
+            if (reading_count < convergence.min_cycles || als_mean <= 0) { continue; }
+
+            /*
+             * Convert the standard error of the mean into density units,
+             * using the derivative of D = -log10(x), and stop once it
+             * falls within the tolerance. The spread is measured across
+             * the actual cycles, so it already reflects their length.
+             */
+            const double als_stderr = sqrt(als_m2 / (double)(reading_count - 1) / (double)reading_count);
+            const double stderr_d = als_stderr / (als_mean * M_LN10);
+            if (stderr_d <= convergence.tolerance_d) {
+                log_d("Converged after %d cycles, stderr=%.4fD", reading_count, stderr_d);
+                break;
+            }
+        } while (1);
         if (ret != osOK) { break; }
 
-        als_avg = (als_sum / (double)SENSOR_TARGET_READ_ITERATIONS);
+        als_avg = als_mean;
 
-        //TODO Detect errors or saturation here
+        /* Remember the settled gain for the next reading with this light source */
+        gain_prediction[light_source].valid = true;
+        gain_prediction[light_source].gain = reading.mod0.gain;
+        gain_prediction[light_source].als_basic = als_mean;
 
+        /* Record the configuration used for the final readings */
+        last_read_info.gain = reading.mod0.gain;
+        last_read_info.sample_time = reading.sample_time;
+        last_read_info.sample_count = reading.sample_count;
+        last_read_info.adjustments = adjustments;
     } while (0);
 
     /* Turn off the sensor */
     sensor_stop();
     sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
+    sensor_set_trigger_mode(TSL2585_TRIGGER_OFF);
 
     if (ret == osOK) {
-        log_i("Sensor read complete");
+        log_i("Sensor read complete, cycles=%d, adjustments=%d", cycle_count, adjustments);
         if (als_result) { *als_result = (float)als_avg; }
     } else {
         log_e("Sensor read failed: ret=%d", ret);
@@ -610,6 +941,47 @@ osStatus_t sensor_read_target(sensor_light_t light_source, uint16_t light_value,
     return ret;
 }
 
+void sensor_read_target_agc_config(sensor_config_t *config)
+{
+    config->gain[0] = TSL2585_GAIN_256X;
+    config->gain[1] = TSL2585_GAIN_256X;
+    config->sample_time = 719;
+    config->sample_count = 0;
+    config->agc_enabled = true;
+    config->agc_sample_count = 9;
+}
+
+bool sensor_read_target_step_down(sensor_config_t *config, const sensor_reading_t *reading)
+{
+    if (reading->mod0.result == SENSOR_RESULT_VALID) {
+        return false;
+    }
+
+    /* Saturation at the minimum gain is left to the invalid reading limit */
+    if (config->gain[0] > TSL2585_GAIN_0_5X) {
+        config->gain[0]--;
+        return true;
+    }
+
+    return false;
+}
+
+bool sensor_read_target_step_up(sensor_config_t *config, const sensor_reading_t *reading)
+{
+    if (reading->mod0.als_data < SENSOR_TARGET_LOW_SIGNAL_COUNTS && config->gain[0] < TSL2585_GAIN_256X) {
+        config->gain[0]++;
+        return true;
+    }
+
+    return false;
+}
+
+void sensor_get_last_read_info(sensor_read_info_t *info)
+{
+    if (!info) { return; }
+    *info = last_read_info;
+}
+
 osStatus_t sensor_read_target_raw(sensor_light_t light_source, uint16_t light_value,
     sensor_mode_t mode, tsl2585_gain_t gain,
     uint16_t sample_time, uint16_t sample_count,
@@ -617,41 +989,45 @@ osStatus_t sensor_read_target_raw(sensor_light_t light_source, uint16_t light_va
 {
     osStatus_t ret = osOK;
     sensor_reading_t reading;
+    sensor_reading_cursor_t cursor;
     double als_sum = 0;
     double als_avg = NAN;
     bool saturated = false;
 
-    if (light_source != SENSOR_LIGHT_OFF
-        && light_source != SENSOR_LIGHT_VIS_REFLECTION
-        && light_source != SENSOR_LIGHT_VIS_TRANSMISSION
-        && light_source != SENSOR_LIGHT_UV_TRANSMISSION) {
-        return osErrorParameter;
-    }
-    if (mode < 0 || mode > SENSOR_MODE_UV) {
-        return osErrorParameter;
-    }
-    if (gain < 0 || gain > TSL2585_GAIN_MAX) {
-        return osErrorParameter;
-    }
-    if (sample_time > 2047 || sample_count > 2047) {
+    const sensor_raw_step_t step = {
+        .light = light_source,
+        .mode = mode,
+        .gain = gain,
+        .light_value = light_value,
+        .sample_time = sample_time,
+        .sample_count = sample_count
+    };
+    if (!sensor_raw_step_is_valid(&step)) {
         return osErrorParameter;
     }
 
     log_i("Starting sensor raw target read");
 
-    do {
-        /* Put the sensor into the configured state */
-        ret = sensor_set_mode(mode);
-        if (ret != osOK) { break; }
+    sensor_reading_cursor_init(&cursor);
 
-        ret = sensor_set_config(gain, sample_time, sample_count);
-        if (ret != osOK) { break; }
-
-        ret = sensor_set_agc_disabled();
-        if (ret != osOK) { break; }
-
-        /* Activate light source synchronized with sensor cycle */
-        ret = sensor_set_light_mode(light_source, /*next_cycle*/true, light_value);
+    do {
+        /*
+         * Put the sensor into the configured state, and activate the
+         * light source synchronized with the sensor cycle
+         */
+        const sensor_config_t config = {
+            .mode = mode,
+            .trigger_mode = TSL2585_TRIGGER_OFF,
+            .gain = { gain, gain },
+            .sample_time = sample_time,
+            .sample_count = sample_count,
+            .agc_enabled = false,
+            .agc_sample_count = 0,
+            .light = light_source,
+            .light_value = light_value,
+            .light_next_cycle = true
+        };
+        ret = sensor_configure(&config);
         if (ret != osOK) { break; }
 
         /* Start the sensor */
@@ -660,7 +1036,7 @@ osStatus_t sensor_read_target_raw(sensor_light_t light_source, uint16_t light_va
 
         /* Take the target measurement readings */
         for (int i = 0; i < SENSOR_TARGET_READ_ITERATIONS; i++) {
-            ret = sensor_get_next_reading(&reading, 2000);
+            ret = sensor_wait_next_reading(&cursor, &reading, 2000);
             if (ret != osOK) { break; }
 
             /* Make sure we're consistent with our read cycles */
@@ -703,6 +1079,146 @@ osStatus_t sensor_read_target_raw(sensor_light_t light_source, uint16_t light_va
     return ret;
 }
 
+osStatus_t sensor_read_target_raw_sequence(const sensor_raw_step_t *steps, size_t count,
+    sensor_raw_sequence_callback_t callback, void *user_data)
+{
+    osStatus_t ret = osOK;
+    sensor_reading_t reading;
+    sensor_reading_cursor_t cursor;
+    sensor_config_t config = {0};
+    bool running = false;
+    bool cycle_pending = false;
+    size_t completed = 0;
+
+    if (!steps || count == 0) {
+        return osErrorParameter;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (!sensor_raw_step_is_valid(&steps[i])) {
+            return osErrorParameter;
+        }
+    }
+
+    log_i("Starting sensor raw target sequence, steps=%d", (int)count);
+
+    sensor_reading_cursor_init(&cursor);
+
+    for (size_t i = 0; i < count; i++) {
+        const sensor_raw_step_t *step = &steps[i];
+        double als_sum = 0;
+        bool saturated = false;
+
+        /* Changing the sensor mode requires a restart */
+        if (running && step->mode != config.mode) {
+            ret = sensor_stop();
+            if (ret != osOK) { break; }
+            running = false;
+        }
+
+        /*
+         * Use VSYNC triggering, so the sensor sits idle between cycles
+         * and the settings for this step can be applied in place.
+         * The light source is activated ahead of the next triggered cycle.
+         */
+        config.mode = step->mode;
+        config.trigger_mode = TSL2585_TRIGGER_VSYNC;
+        config.gain[0] = step->gain;
+        config.gain[1] = step->gain;
+        config.sample_time = step->sample_time;
+        config.sample_count = step->sample_count;
+        config.agc_enabled = false;
+        config.agc_sample_count = 0;
+        config.light = step->light;
+        config.light_value = step->light_value;
+        config.light_next_cycle = false;
+
+        ret = sensor_configure(&config);
+        if (ret != osOK) { break; }
+
+        /* Start the sensor, which also triggers the first cycle */
+        if (!running) {
+            ret = sensor_start();
+            if (ret != osOK) { break; }
+            running = true;
+            cycle_pending = true;
+        }
+
+        /* Take the target measurement readings */
+        for (int j = 0; j < SENSOR_TARGET_READ_ITERATIONS; j++) {
+            if (!cycle_pending) {
+                ret = sensor_trigger_next_reading();
+                if (ret != osOK) { break; }
+            }
+            cycle_pending = false;
+
+            ret = sensor_wait_next_reading(&cursor, &reading, 2000);
+            if (ret != osOK) { break; }
+
+            /* Make sure the reading was taken with the settings for this step */
+            if (reading.mod0.gain != step->gain
+                || reading.sample_time != step->sample_time
+                || reading.sample_count != step->sample_count) {
+                log_e("Unexpected reading settings: step=%d", (int)i);
+                ret = osError;
+                break;
+            }
+
+            /* Move on to the next step if the sensor is saturated */
+            if (reading.mod0.result != SENSOR_RESULT_VALID) {
+                log_w("Sensor saturated: step=%d", (int)i);
+                saturated = true;
+                break;
+            }
+
+            /* Accumulate the results */
+            als_sum += (double)reading.mod0.als_data;
+        }
+        if (ret != osOK) { break; }
+
+        completed++;
+
+        const uint32_t als_reading = saturated
+            ? UINT32_MAX
+            : (uint32_t)lround(als_sum / (double)SENSOR_TARGET_READ_ITERATIONS);
+        if (callback && !callback(i, als_reading, user_data)) {
+            break;
+        }
+    }
+
+    /* Turn off the sensor */
+    sensor_stop();
+    sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
+    sensor_set_trigger_mode(TSL2585_TRIGGER_OFF);
+
+    if (ret == osOK) {
+        log_i("Sensor sequence complete, steps=%d/%d", (int)completed, (int)count);
+    } else {
+        log_e("Sensor sequence failed: ret=%d, step=%d", ret, (int)completed);
+        ret = osError;
+    }
+    return ret;
+}
+
+bool sensor_raw_step_is_valid(const sensor_raw_step_t *step)
+{
+    if (step->light != SENSOR_LIGHT_OFF
+        && step->light != SENSOR_LIGHT_VIS_REFLECTION
+        && step->light != SENSOR_LIGHT_VIS_TRANSMISSION
+        && step->light != SENSOR_LIGHT_UV_TRANSMISSION) {
+        return false;
+    }
+    if (step->mode < 0 || step->mode > SENSOR_MODE_UV) {
+        return false;
+    }
+    if (step->gain < 0 || step->gain >= TSL2585_GAIN_MAX) {
+        return false;
+    }
+    if (step->sample_time > 2047 || step->sample_count > 2047) {
+        return false;
+    }
+    return true;
+}
+
 bool gain_status_callback(
     sensor_gain_calibration_callback_t callback,
     sensor_gain_calibration_status_t status, int param,
@@ -718,10 +1234,8 @@ bool gain_status_callback(
 double sensor_convert_to_basic_counts(const sensor_reading_t *reading, uint8_t mod)
 {
     const sensor_mod_reading_t *mod_reading;
-    settings_cal_gain_t cal_gain;
-    double als_gain;
-    double atime_ms;
-    double als_reading;
+    float scale = NAN;
+    bool plan_valid;
 
     if (!reading) {
         return NAN;
@@ -735,20 +1249,64 @@ double sensor_convert_to_basic_counts(const sensor_reading_t *reading, uint8_t m
         return NAN;
     }
 
-    /* Get the gain value from sensor calibration */
+    /* Gain settings outside the calibrated range only have nominal values */
+    if (mod_reading->gain > TSL2585_GAIN_256X) {
+        const float atime_ms = tsl2585_integration_time_ms(reading->sample_time, reading->sample_count);
+        return ((double)mod_reading->als_data / 16.0) / (atime_ms * tsl2585_gain_value(mod_reading->gain));
+    }
+
+    const uint32_t cal_generation = settings_get_cal_generation();
+
+    taskENTER_CRITICAL();
+    plan_valid = basic_plan.built
+        && basic_plan.cal_generation == cal_generation
+        && basic_plan.sample_time == reading->sample_time
+        && basic_plan.sample_count == reading->sample_count;
+    if (plan_valid) {
+        scale = basic_plan.scale[mod_reading->gain];
+    }
+    taskEXIT_CRITICAL();
+
+    if (!plan_valid) {
+        sensor_basic_plan_t plan;
+        sensor_build_basic_plan(&plan, cal_generation, reading->sample_time, reading->sample_count);
+        scale = plan.scale[mod_reading->gain];
+
+        taskENTER_CRITICAL();
+        basic_plan = plan;
+        taskEXIT_CRITICAL();
+    }
+
+    return (double)((float)mod_reading->als_data * scale);
+}
+
+void sensor_build_basic_plan(sensor_basic_plan_t *plan, uint32_t cal_generation,
+    uint16_t sample_time, uint16_t sample_count)
+{
+    settings_cal_gain_t cal_gain;
+
+    /* Get the gain values from sensor calibration */
     settings_get_cal_gain(&cal_gain);
-    als_gain = settings_get_cal_gain_value(&cal_gain, mod_reading->gain);
 
     /*
      * Integration time is uncalibrated, due to the assumption that all
      * target measurements will be done at the same setting.
      */
-    atime_ms = tsl2585_integration_time_ms(reading->sample_time, reading->sample_count);
+    const float atime_ms = tsl2585_integration_time_ms(sample_time, sample_count);
 
-    /* Divide to get numbers in a similar range as previous sensors */
-    als_reading = (double)mod_reading->als_data / 16.0F;
+    /*
+     * Raw readings are also divided by 16, to get numbers in a similar
+     * range as previous sensors.
+     */
+    for (size_t i = 0; i <= TSL2585_GAIN_256X; i++) {
+        const float als_gain = settings_get_cal_gain_value(&cal_gain, (tsl2585_gain_t)i);
+        plan->scale[i] = 1.0F / (16.0F * atime_ms * als_gain);
+    }
 
-    return als_reading / (atime_ms * als_gain);
+    plan->built = true;
+    plan->cal_generation = cal_generation;
+    plan->sample_time = sample_time;
+    plan->sample_count = sample_count;
 }
 
 float sensor_apply_temperature_correction(sensor_light_t light_source, float temp_c, float basic_reading)
@@ -782,12 +1340,70 @@ float sensor_apply_temperature_correction(sensor_light_t light_source, float tem
 
     /*
      * Calculate the temperature correction multiplier from the correction
-     * coefficients and the temperature reading.
+     * coefficients and the temperature reading, with the polynomial
+     * evaluated in Horner form to avoid a call to powf().
      */
-    temp_corr = cal_temperature.b0 + (cal_temperature.b1 * temp_c) + (cal_temperature.b2 * powf(temp_c, 2.0F));
+    temp_corr = cal_temperature.b0 + (temp_c * (cal_temperature.b1 + (temp_c * cal_temperature.b2)));
 
     /* Calculate the final temperature-corrected reading */
     float corr_reading = basic_reading * temp_corr;
 
     return corr_reading;
 }
+
+float sensor_light_drift_drop_factor(const settings_cal_light_drift_t *cal_light_drift, sensor_light_t light_source)
+{
+    switch (light_source) {
+    case SENSOR_LIGHT_VIS_REFLECTION:
+        return cal_light_drift->vis_reflection;
+    case SENSOR_LIGHT_VIS_TRANSMISSION:
+        return cal_light_drift->vis_transmission;
+    case SENSOR_LIGHT_UV_TRANSMISSION:
+        return cal_light_drift->uv_transmission;
+    default:
+        return 0.0F;
+    }
+}
+
+float sensor_apply_light_drift_correction(sensor_light_t light_source, const sensor_reading_t *reading, float basic_reading)
+{
+    settings_cal_light_drift_t cal_light_drift;
+
+    if (!reading || !settings_get_cal_light_drift(&cal_light_drift)) {
+        return basic_reading;
+    }
+
+    const float drop_factor = sensor_light_drift_drop_factor(&cal_light_drift, light_source);
+
+    /* Readings that finished within a tick of the light change have no correction */
+    const uint32_t elapsed_ticks = reading->reading_ticks - reading->light_ticks;
+    if (drop_factor == 0.0F || elapsed_ticks <= 1) {
+        return basic_reading;
+    }
+
+    /*
+     * Invert the fitted output model, which is:
+     * output(t) = output(1) * (1 + drop_factor * ln(t))
+     */
+    const float drift = 1.0F + (drop_factor * logf((float)elapsed_ticks));
+    if (drift <= 0.0F) {
+        return basic_reading;
+    }
+
+    return basic_reading / drift;
+}
+
+bool sensor_is_light_drift_cal_current(sensor_light_t light_source)
+{
+    settings_cal_light_drift_t cal_light_drift;
+    settings_cal_light_drift_t cal_target_drift;
+    float drop_factor = 0.0F;
+
+    if (settings_get_cal_light_drift(&cal_light_drift)) {
+        drop_factor = sensor_light_drift_drop_factor(&cal_light_drift, light_source);
+    }
+
+    settings_get_cal_target_drift(&cal_target_drift);
+
+    return sensor_light_drift_drop_factor(&cal_target_drift, light_source) == drop_factor;
+}
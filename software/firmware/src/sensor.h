@@ -65,8 +65,45 @@ typedef struct {
     uint32_t reading_count; /*!< Number of integration cycles since the sensor was enabled */
 } sensor_reading_t;
 
+/**
+ * Convergence settings for target readings.
+ *
+ * When the tolerance is nonzero, target readings keep taking integration
+ * cycles until the standard error of the mean, expressed in density units,
+ * falls within the tolerance. The cycles themselves are the same as for
+ * fixed length readings.
+ */
+typedef struct {
+    float tolerance_d;  /*!< Target standard error in density units, or 0 for fixed length readings */
+    uint8_t min_cycles; /*!< Minimum number of integration cycles to average */
+    uint8_t max_cycles; /*!< Maximum number of integration cycles to average */
+} sensor_read_convergence_t;
+
+/**
+ * Sensor configuration used for the final readings of a target read
+ */
+typedef struct {
+    tsl2585_gain_t gain;    /*!< Sensor ADC gain */
+    uint16_t sample_time;   /*!< Duration of each sample in an integration cycle */
+    uint16_t sample_count;  /*!< Number of samples in an integration cycle */
+    uint8_t adjustments;    /*!< Number of in-place adjustments made for saturation or low signal */
+} sensor_read_info_t;
+
+/**
+ * Sensor settings for one step of a raw target read sequence
+ */
+typedef struct {
+    sensor_light_t light;  /*!< Light source to use for target measurement */
+    sensor_mode_t mode;    /*!< Sensor mode */
+    tsl2585_gain_t gain;   /*!< Sensor gain */
+    uint16_t light_value;  /*!< Light brightness value */
+    uint16_t sample_time;  /*!< Sensor integration sample time */
+    uint16_t sample_count; /*!< Sensor integration sample count */
+} sensor_raw_step_t;
+
 typedef bool (*sensor_gain_calibration_callback_t)(sensor_gain_calibration_status_t status, int param, void *user_data);
 typedef void (*sensor_read_callback_t)(void *user_data);
+typedef bool (*sensor_raw_sequence_callback_t)(size_t index, uint32_t als_reading, void *user_data);
 
 /**
  * Run the sensor gain calibration process.
@@ -102,6 +139,19 @@ osStatus_t sensor_light_calibration(sensor_light_t light_source);
  * using automatic gain adjustment to arrive at a result in basic counts
  * from which target density can be calculated.
  *
+ * If a previous reading was taken with the same light source, its settled
+ * gain is used directly and the automatic gain adjustment is only run if
+ * that gain turns out to be saturated or under-range.
+ *
+ * The number of readings is either fixed, or determined by the convergence
+ * settings configured with 'sensor_set_read_convergence()'.
+ *
+ * If a measurement cycle saturates or has too little signal, then the gain
+ * is stepped for the next cycle without restarting the sensor. The
+ * integration time is never changed, so all the readings share it.
+ * The configuration used for the final readings can be retrieved
+ * with 'sensor_get_last_read_info()'.
+ *
  * @param light_source Light source to use for target measurement
  * @param light_value Light brightness value (Always use `light_get_max_value()` for normal measurements)
  * @param als_result Sensor result
@@ -111,6 +161,25 @@ osStatus_t sensor_read_target(sensor_light_t light_source, uint16_t light_value,
     float *als_result,
     sensor_read_callback_t callback, void *user_data);
 
+/**
+ * Set the convergence settings used by 'sensor_read_target()'.
+ *
+ * @param convergence Convergence settings
+ * @return osOK on success, osErrorParameter if the settings are invalid
+ */
+osStatus_t sensor_set_read_convergence(const sensor_read_convergence_t *convergence);
+
+/**
+ * Get the convergence settings used by 'sensor_read_target()'.
+ */
+void sensor_get_read_convergence(sensor_read_convergence_t *convergence);
+
+/**
+ * Get the sensor configuration used by the last successful call to
+ * 'sensor_read_target()'.
+ */
+void sensor_get_last_read_info(sensor_read_info_t *info);
+
 /**
  * Perform a repeatable raw target reading with the sensor.
  *
@@ -137,6 +206,28 @@ osStatus_t sensor_read_target_raw(sensor_light_t light_source, uint16_t light_va
     uint16_t sample_time, uint16_t sample_count,
     uint32_t *als_reading);
 
+/**
+ * Perform a sequence of raw target readings with the sensor.
+ *
+ * Each step is measured the same way as 'sensor_read_target_raw()',
+ * but the sensor is kept running between steps that share the same
+ * sensor mode. It is triggered one integration cycle at a time, so the
+ * light source, gain, and integration settings for each step can be
+ * applied while the sensor is idle, without stopping it or discarding
+ * any readings. A change of sensor mode still requires a restart.
+ *
+ * The callback is invoked with the result of each step as soon as it
+ * completes, and may return false to stop the sequence early.
+ *
+ * @param steps Sensor settings for each step
+ * @param count Number of steps
+ * @param callback Callback to receive the result of each step
+ * @param user_data Data to pass to the callback
+ * @return osOK on success, osErrorParameter if any step is invalid
+ */
+osStatus_t sensor_read_target_raw_sequence(const sensor_raw_step_t *steps, size_t count,
+    sensor_raw_sequence_callback_t callback, void *user_data);
+
 /**
  * Convert sensor readings from raw counts to basic counts.
  *
@@ -175,4 +266,35 @@ double sensor_convert_to_basic_counts(const sensor_reading_t *reading, uint8_t m
  */
 float sensor_apply_temperature_correction(sensor_light_t light_source, float temp_c, float basic_reading);
 
+/**
+ * Apply the LED warm-up drift correction to a sensor reading.
+ *
+ * This normalizes the reading to the LED output at the moment it was
+ * turned on, based on the time elapsed between the last light change
+ * and the end of the integration cycle. This allows readings taken
+ * before the LED has stabilized to be used directly.
+ *
+ * If the drift calibration values are not configured, then the input
+ * value will be returned unmodified.
+ *
+ * @param light_source The light source used for the reading
+ * @param reading Sensor reading, used for its timing information
+ * @param basic_reading Sensor reading in combined basic counts
+ * @return Drift corrected sensor reading
+ */
+float sensor_apply_light_drift_correction(sensor_light_t light_source, const sensor_reading_t *reading, float basic_reading);
+
+/**
+ * Check if the target calibration for a light source was measured with
+ * the LED warm-up drift correction that is currently configured.
+ *
+ * Target calibration values are stored as corrected basic counts, so they
+ * cannot be combined with readings taken under a different drop factor.
+ * When this returns false, the target calibration must be measured again.
+ *
+ * @param light_source The light source to check
+ * @return True if the current drift correction matches the calibration
+ */
+bool sensor_is_light_drift_cal_current(sensor_light_t light_source);
+
 #endif /* SENSOR_H */
@@ -28,11 +28,16 @@ static bool settings_load_cal_gain();
 static void settings_set_cal_temperature_defaults(settings_cal_temperature_t *cal_temperature);
 static bool settings_load_cal_vis_temperature();
 static bool settings_load_cal_uv_temperature();
+static void settings_set_cal_light_drift_defaults(settings_cal_light_drift_t *cal_light_drift);
+static bool settings_load_cal_light_drift();
 static void settings_set_cal_reflection_defaults(settings_cal_reflection_t *cal_reflection);
 static bool settings_load_cal_vis_reflection();
 static void settings_set_cal_transmission_defaults(settings_cal_transmission_t *cal_transmission);
 static bool settings_load_cal_vis_transmission();
 static bool settings_load_cal_uv_transmission();
+static void settings_get_cal_light_drift_active(settings_cal_light_drift_t *cal_light_drift);
+static bool settings_set_cal_target_drift(const settings_cal_light_drift_t *cal_target_drift);
+static bool settings_load_cal_target_drift();
 static void settings_set_user_usb_key_defaults(settings_user_usb_key_t *usb_key);
 static bool settings_load_user_usb_key();
 static void settings_set_user_idle_light_defaults(settings_user_idle_light_t *idle_light);
@@ -99,6 +104,9 @@ static HAL_StatusTypeDef settings_write_uint32(uint32_t address, uint32_t val);
 #define CONFIG_CAL_UV_TRANSMISSION         (PAGE_CAL_TARGET + 40U)
 #define CONFIG_CAL_UV_TRANSMISSION_SIZE    (16U)
 
+#define CONFIG_CAL_TARGET_DRIFT            (PAGE_CAL_TARGET + 56U)
+#define CONFIG_CAL_TARGET_DRIFT_SIZE       (16U)
+
 /*
  * User Settings (128b)
  * This page contains any user settings that the device may need to store.
@@ -119,8 +127,8 @@ static HAL_StatusTypeDef settings_write_uint32(uint32_t address, uint32_t val);
 /*
  * Temperature Calibration Data (128b)
 *  This page contains data specific to calibration of the sensor's response
-*  to temperature, and can be considered a continuation of the sensor
-*  calibration data section.
+*  to temperature and of the LED output during warm-up, and can be
+*  considered a continuation of the sensor calibration data section.
 *  The data stored here will be considered part of factory calibration,
  * as it is the result of a process which requires specialized equipment
  * to perform.
@@ -132,17 +140,24 @@ static HAL_StatusTypeDef settings_write_uint32(uint32_t address, uint32_t val);
 #define CONFIG_CAL_VIS_TEMP_SIZE     (16U)
 #define CONFIG_CAL_UV_TEMP           (PAGE_CAL_TEMPERATURE + 20U)
 #define CONFIG_CAL_UV_TEMP_SIZE      (16U)
+#define CONFIG_CAL_LIGHT_DRIFT       (PAGE_CAL_TEMPERATURE + 36U)
+#define CONFIG_CAL_LIGHT_DRIFT_SIZE  (16U)
 
 static settings_cal_gain_t setting_cal_gain = {0};
 static settings_cal_temperature_t setting_cal_vis_temperature = {0};
 static settings_cal_temperature_t setting_cal_uv_temperature = {0};
+static settings_cal_light_drift_t setting_cal_light_drift = {0};
 static settings_cal_reflection_t setting_cal_vis_reflection = {0};
 static settings_cal_transmission_t setting_cal_vis_transmission = {0};
 static settings_cal_transmission_t setting_cal_uv_transmission = {0};
+static settings_cal_light_drift_t setting_cal_target_drift = {0};
 static settings_user_usb_key_t setting_user_usb_key = {0};
 static settings_user_idle_light_t setting_user_idle_light = {0};
 static settings_user_display_format_t setting_user_display_format = {0};
 
+/* Incremented whenever any of the calibration values above change */
+static volatile uint32_t setting_cal_generation = 0;
+
 HAL_StatusTypeDef settings_init()
 {
     HAL_StatusTypeDef ret = HAL_OK;
@@ -180,6 +195,8 @@ HAL_StatusTypeDef settings_init()
             watchdog_refresh();
         }
 
+        setting_cal_generation++;
+
         log_i("Settings loaded");
 
     } while (0);
@@ -348,6 +365,7 @@ bool settings_init_cal_target(bool force_clear)
     settings_set_cal_reflection_defaults(&setting_cal_vis_reflection);
     settings_set_cal_transmission_defaults(&setting_cal_vis_transmission);
     settings_set_cal_transmission_defaults(&setting_cal_uv_transmission);
+    memset(&setting_cal_target_drift, 0, sizeof(settings_cal_light_drift_t));
 
     /* Load settings if the version matches */
     uint32_t version = force_clear ? 0 : settings_read_uint32(PAGE_CAL_TARGET);
@@ -356,6 +374,7 @@ bool settings_init_cal_target(bool force_clear)
         settings_load_cal_vis_reflection();
         settings_load_cal_vis_transmission();
         settings_load_cal_uv_transmission();
+        settings_load_cal_target_drift();
         result = true;
     } else {
         /* Version is bad, initialize a blank page */
@@ -509,6 +528,7 @@ bool settings_init_cal_temp_settings(bool force_clear)
     /* Initialize all fields to their default values */
     settings_set_cal_temperature_defaults(&setting_cal_vis_temperature);
     settings_set_cal_temperature_defaults(&setting_cal_uv_temperature);
+    settings_set_cal_light_drift_defaults(&setting_cal_light_drift);
 
     /* Load settings if the version matches */
     uint32_t version = force_clear ? 0 : settings_read_uint32(PAGE_CAL_TEMPERATURE);
@@ -516,6 +536,7 @@ bool settings_init_cal_temp_settings(bool force_clear)
         /* Version is good, load data with per-field validation */
         settings_load_cal_vis_temperature();
         settings_load_cal_uv_temperature();
+        settings_load_cal_light_drift();
         result = true;
     } else {
         /* Version is bad, initialize a blank page */
@@ -546,6 +567,13 @@ bool settings_clear_cal_temp_settings()
         return false;
     }
 
+    /* Write empty light drift cal struct */
+    settings_cal_light_drift_t cal_light_drift;
+    settings_set_cal_light_drift_defaults(&cal_light_drift);
+    if (!settings_set_cal_light_drift(&cal_light_drift)) {
+        return false;
+    }
+
     /* Write the page version */
     if (settings_write_uint32(PAGE_CAL_TEMPERATURE, PAGE_CAL_TEMPERATURE_VERSION) != HAL_OK) {
         return false;
@@ -582,6 +610,7 @@ bool settings_set_cal_gain(const settings_cal_gain_t *cal_gain)
 
     if (ret == HAL_OK) {
         memcpy(&setting_cal_gain, cal_gain, sizeof(settings_cal_gain_t));
+        setting_cal_generation++;
         return true;
     } else {
         return false;
@@ -629,6 +658,11 @@ bool settings_get_cal_gain(settings_cal_gain_t *cal_gain)
     }
 }
 
+uint32_t settings_get_cal_generation()
+{
+    return setting_cal_generation;
+}
+
 float settings_get_cal_gain_value(const settings_cal_gain_t *cal_gain, tsl2585_gain_t gain)
 {
     float result = NAN;
@@ -694,6 +728,7 @@ bool settings_set_cal_vis_temperature(const settings_cal_temperature_t *cal_temp
 
     if (ret == HAL_OK) {
         memcpy(&setting_cal_vis_temperature, cal_temperature, sizeof(settings_cal_temperature_t));
+        setting_cal_generation++;
         return true;
     } else {
         return false;
@@ -773,6 +808,7 @@ bool settings_set_cal_uv_temperature(const settings_cal_temperature_t *cal_tempe
 
     if (ret == HAL_OK) {
         memcpy(&setting_cal_uv_temperature, cal_temperature, sizeof(settings_cal_temperature_t));
+        setting_cal_generation++;
         return true;
     } else {
         return false;
@@ -817,6 +853,95 @@ bool settings_get_cal_uv_temperature(settings_cal_temperature_t *cal_temperature
     }
 }
 
+void settings_set_cal_light_drift_defaults(settings_cal_light_drift_t *cal_light_drift)
+{
+    if (!cal_light_drift) { return; }
+    memset(cal_light_drift, 0, sizeof(settings_cal_light_drift_t));
+    cal_light_drift->vis_reflection = NAN;
+    cal_light_drift->vis_transmission = NAN;
+    cal_light_drift->uv_transmission = NAN;
+}
+
+bool settings_set_cal_light_drift(const settings_cal_light_drift_t *cal_light_drift)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+    if (!cal_light_drift) { return false; }
+
+    uint8_t buf[CONFIG_CAL_LIGHT_DRIFT_SIZE];
+    copy_from_f32(&buf[0], cal_light_drift->vis_reflection);
+    copy_from_f32(&buf[4], cal_light_drift->vis_transmission);
+    copy_from_f32(&buf[8], cal_light_drift->uv_transmission);
+
+    const uint32_t crc = HAL_CRC_Calculate(&hcrc, (uint32_t *)buf, (CONFIG_CAL_LIGHT_DRIFT_SIZE - 4) / 4);
+    copy_from_u32(&buf[CONFIG_CAL_LIGHT_DRIFT_SIZE - 4], crc);
+
+    ret = settings_write_buffer(CONFIG_CAL_LIGHT_DRIFT, buf, sizeof(buf));
+
+    if (ret == HAL_OK) {
+        memcpy(&setting_cal_light_drift, cal_light_drift, sizeof(settings_cal_light_drift_t));
+        setting_cal_generation++;
+        return true;
+    } else {
+        return false;
+    }
+}
+
+bool settings_load_cal_light_drift()
+{
+    uint8_t buf[CONFIG_CAL_LIGHT_DRIFT_SIZE];
+
+    if (settings_read_buffer(CONFIG_CAL_LIGHT_DRIFT, buf, sizeof(buf)) != HAL_OK) {
+        return false;
+    }
+
+    const uint32_t crc = copy_to_u32(&buf[CONFIG_CAL_LIGHT_DRIFT_SIZE - 4]);
+    const uint32_t calculated_crc = HAL_CRC_Calculate(&hcrc, (uint32_t *)buf, (CONFIG_CAL_LIGHT_DRIFT_SIZE - 4) / 4);
+
+    if (crc != calculated_crc) {
+        log_w("Invalid cal light drift CRC: %08X != %08X", crc, calculated_crc);
+        return false;
+    } else {
+        setting_cal_light_drift.vis_reflection = copy_to_f32(&buf[0]);
+        setting_cal_light_drift.vis_transmission = copy_to_f32(&buf[4]);
+        setting_cal_light_drift.uv_transmission = copy_to_f32(&buf[8]);
+        return true;
+    }
+}
+
+bool settings_get_cal_light_drift(settings_cal_light_drift_t *cal_light_drift)
+{
+    if (!cal_light_drift) { return false; }
+
+    /* Copy over the settings values */
+    memcpy(cal_light_drift, &setting_cal_light_drift, sizeof(settings_cal_light_drift_t));
+
+    /* Set default values if validation fails */
+    if (!settings_validate_cal_light_drift(cal_light_drift)) {
+        settings_set_cal_light_drift_defaults(cal_light_drift);
+        return false;
+    } else {
+        return true;
+    }
+}
+
+bool settings_validate_cal_light_drift(const settings_cal_light_drift_t *cal_light_drift)
+{
+    if (!cal_light_drift) { return false; }
+
+    /* Validate field numeric properties */
+    if (isnan(cal_light_drift->vis_reflection) || isinf(cal_light_drift->vis_reflection)) {
+        return false;
+    }
+    if (isnan(cal_light_drift->vis_transmission) || isinf(cal_light_drift->vis_transmission)) {
+        return false;
+    }
+    if (isnan(cal_light_drift->uv_transmission) || isinf(cal_light_drift->uv_transmission)) {
+        return false;
+    }
+
+    return true;
+}
+
 void settings_set_cal_reflection_defaults(settings_cal_reflection_t *cal_reflection)
 {
     if (!cal_reflection) { return; }
@@ -843,8 +968,20 @@ bool settings_set_cal_vis_reflection(const settings_cal_reflection_t *cal_reflec
 
     ret = settings_write_buffer(CONFIG_CAL_VIS_REFLECTION, buf, sizeof(buf));
 
+    if (ret == HAL_OK) {
+        /* Record the drift correction that was applied to these readings */
+        settings_cal_light_drift_t cal_light_drift;
+        settings_cal_light_drift_t cal_target_drift = setting_cal_target_drift;
+        settings_get_cal_light_drift_active(&cal_light_drift);
+        cal_target_drift.vis_reflection = cal_light_drift.vis_reflection;
+        if (!settings_set_cal_target_drift(&cal_target_drift)) {
+            ret = HAL_ERROR;
+        }
+    }
+
     if (ret == HAL_OK) {
         memcpy(&setting_cal_vis_reflection, cal_reflection, sizeof(settings_cal_reflection_t));
+        setting_cal_generation++;
         return true;
     } else {
         return false;
@@ -954,8 +1091,20 @@ bool settings_set_cal_vis_transmission(const settings_cal_transmission_t *cal_tr
 
     ret = settings_write_buffer(CONFIG_CAL_VIS_TRANSMISSION, buf, sizeof(buf));
 
+    if (ret == HAL_OK) {
+        /* Record the drift correction that was applied to these readings */
+        settings_cal_light_drift_t cal_light_drift;
+        settings_cal_light_drift_t cal_target_drift = setting_cal_target_drift;
+        settings_get_cal_light_drift_active(&cal_light_drift);
+        cal_target_drift.vis_transmission = cal_light_drift.vis_transmission;
+        if (!settings_set_cal_target_drift(&cal_target_drift)) {
+            ret = HAL_ERROR;
+        }
+    }
+
     if (ret == HAL_OK) {
         memcpy(&setting_cal_vis_transmission, cal_transmission, sizeof(settings_cal_transmission_t));
+        setting_cal_generation++;
         return true;
     } else {
         return false;
@@ -1018,8 +1167,20 @@ bool settings_set_cal_uv_transmission(const settings_cal_transmission_t *cal_tra
 
     ret = settings_write_buffer(CONFIG_CAL_UV_TRANSMISSION, buf, sizeof(buf));
 
+    if (ret == HAL_OK) {
+        /* Record the drift correction that was applied to these readings */
+        settings_cal_light_drift_t cal_light_drift;
+        settings_cal_light_drift_t cal_target_drift = setting_cal_target_drift;
+        settings_get_cal_light_drift_active(&cal_light_drift);
+        cal_target_drift.uv_transmission = cal_light_drift.uv_transmission;
+        if (!settings_set_cal_target_drift(&cal_target_drift)) {
+            ret = HAL_ERROR;
+        }
+    }
+
     if (ret == HAL_OK) {
         memcpy(&setting_cal_uv_transmission, cal_transmission, sizeof(settings_cal_transmission_t));
+        setting_cal_generation++;
         return true;
     } else {
         return false;
@@ -1067,6 +1228,69 @@ bool settings_get_cal_uv_transmission(settings_cal_transmission_t *cal_transmiss
     }
 }
 
+void settings_get_cal_light_drift_active(settings_cal_light_drift_t *cal_light_drift)
+{
+    /* Without valid drift values, readings are not corrected at all */
+    if (!settings_get_cal_light_drift(cal_light_drift)) {
+        memset(cal_light_drift, 0, sizeof(settings_cal_light_drift_t));
+    }
+}
+
+bool settings_set_cal_target_drift(const settings_cal_light_drift_t *cal_target_drift)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+    if (!cal_target_drift) { return false; }
+
+    uint8_t buf[CONFIG_CAL_TARGET_DRIFT_SIZE];
+    copy_from_f32(&buf[0], cal_target_drift->vis_reflection);
+    copy_from_f32(&buf[4], cal_target_drift->vis_transmission);
+    copy_from_f32(&buf[8], cal_target_drift->uv_transmission);
+
+    const uint32_t crc = HAL_CRC_Calculate(&hcrc, (uint32_t *)buf, (CONFIG_CAL_TARGET_DRIFT_SIZE - 4) / 4);
+    copy_from_u32(&buf[CONFIG_CAL_TARGET_DRIFT_SIZE - 4], crc);
+
+    ret = settings_write_buffer(CONFIG_CAL_TARGET_DRIFT, buf, sizeof(buf));
+
+    if (ret == HAL_OK) {
+        memcpy(&setting_cal_target_drift, cal_target_drift, sizeof(settings_cal_light_drift_t));
+        return true;
+    } else {
+        return false;
+    }
+}
+
+bool settings_load_cal_target_drift()
+{
+    uint8_t buf[CONFIG_CAL_TARGET_DRIFT_SIZE];
+
+    if (settings_read_buffer(CONFIG_CAL_TARGET_DRIFT, buf, sizeof(buf)) != HAL_OK) {
+        return false;
+    }
+
+    const uint32_t crc = copy_to_u32(&buf[CONFIG_CAL_TARGET_DRIFT_SIZE - 4]);
+    const uint32_t calculated_crc = HAL_CRC_Calculate(&hcrc, (uint32_t *)buf, (CONFIG_CAL_TARGET_DRIFT_SIZE - 4) / 4);
+
+    if (crc != calculated_crc) {
+        /*
+         * Target calibrations saved before this block existed were measured
+         * without any drift correction, which the zeroed defaults describe.
+         */
+        log_w("Invalid cal target drift CRC: %08X != %08X", crc, calculated_crc);
+        return false;
+    } else {
+        setting_cal_target_drift.vis_reflection = copy_to_f32(&buf[0]);
+        setting_cal_target_drift.vis_transmission = copy_to_f32(&buf[4]);
+        setting_cal_target_drift.uv_transmission = copy_to_f32(&buf[8]);
+        return true;
+    }
+}
+
+void settings_get_cal_target_drift(settings_cal_light_drift_t *cal_target_drift)
+{
+    if (!cal_target_drift) { return; }
+    memcpy(cal_target_drift, &setting_cal_target_drift, sizeof(settings_cal_light_drift_t));
+}
+
 bool settings_validate_cal_transmission(const settings_cal_transmission_t *cal_transmission)
 {
     if (!cal_transmission) { return false; }
@@ -32,6 +32,19 @@ typedef struct {
     float b2;
 } settings_cal_temperature_t;
 
+/**
+ * LED warm-up drift coefficients for each light source.
+ *
+ * Each coefficient is the drop factor of a logarithmic fit of LED output
+ * against the time since the LED was turned on, such that:
+ * output(t) = output(1) * (1 + drop_factor * ln(t_ticks))
+ */
+typedef struct {
+    float vis_reflection;
+    float vis_transmission;
+    float uv_transmission;
+} settings_cal_light_drift_t;
+
 typedef struct {
     float lo_d;
     float lo_value;
@@ -93,6 +106,14 @@ HAL_StatusTypeDef settings_init();
 
 HAL_StatusTypeDef settings_wipe();
 
+/**
+ * Get the calibration generation counter.
+ *
+ * This counter changes every time any calibration values are loaded
+ * or saved, so values derived from them can be cached until it changes.
+ */
+uint32_t settings_get_cal_generation();
+
 /**
  * Set the gain calibration values.
  *
@@ -169,6 +190,45 @@ bool settings_set_cal_uv_temperature(const settings_cal_temperature_t *cal_tempe
  */
 bool settings_get_cal_uv_temperature(settings_cal_temperature_t *cal_temperature);
 
+/**
+ * Set the LED warm-up drift calibration values.
+ *
+ * @param cal_light_drift Struct populated with values to save
+ * @return True if saved, false on error
+ */
+bool settings_set_cal_light_drift(const settings_cal_light_drift_t *cal_light_drift);
+
+/**
+ * Get the LED warm-up drift calibration values.
+ * If a valid set of values are not available, but the provided struct is
+ * usable, it will be initialized to NaN.
+ *
+ * @param cal_light_drift Struct to be populated with saved values
+ * @return True if valid values are returned, false otherwise.
+ */
+bool settings_get_cal_light_drift(settings_cal_light_drift_t *cal_light_drift);
+
+/**
+ * Check if the LED warm-up drift calibration values are valid
+ *
+ * @param cal_light_drift Struct to validate
+ * @return True if valid, false if invalid
+ */
+bool settings_validate_cal_light_drift(const settings_cal_light_drift_t *cal_light_drift);
+
+/**
+ * Get the LED warm-up drift values that were in effect when each target
+ * calibration was last saved.
+ *
+ * These are recorded automatically whenever the target calibration values
+ * for a light source are set, with zero representing readings that were not
+ * drift corrected. Target calibrations saved before these were recorded are
+ * reported as zero.
+ *
+ * @param cal_target_drift Struct to be populated with recorded values
+ */
+void settings_get_cal_target_drift(settings_cal_light_drift_t *cal_target_drift);
+
 /**
  * Set the VIS reflection density calibration values.
  *
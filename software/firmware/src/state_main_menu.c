@@ -834,6 +834,7 @@ void main_menu_settings_diagnostics(state_main_menu_t *state, state_controller_t
     const tsl2585_gain_t max_gain = TSL2585_GAIN_256X;
     uint8_t time_index = 1;
     sensor_reading_t reading;
+    sensor_reading_cursor_t cursor;
     uint8_t light_mode = 0;
     char light_ch = ' ';
     bool display_mode = false;
@@ -845,6 +846,8 @@ void main_menu_settings_diagnostics(state_main_menu_t *state, state_controller_t
     char buf[128];
     const uint16_t light_max = light_get_max_value();
 
+    sensor_reading_cursor_init(&cursor);
+
     do {
         ret = sensor_set_mode(sensor_mode);
         if (ret != osOK) { break; }
@@ -855,7 +858,7 @@ void main_menu_settings_diagnostics(state_main_menu_t *state, state_controller_t
         ret = sensor_start();
         if (ret != osOK) { break; }
 
-        ret = sensor_get_next_reading(&reading, 2000);
+        ret = sensor_wait_next_reading(&cursor, &reading, 2000);
         if (ret != osOK) { break; }
     } while (0);
 
@@ -973,7 +976,7 @@ void main_menu_settings_diagnostics(state_main_menu_t *state, state_controller_t
             settings_changed = false;
         }
 
-        if (sensor_get_next_reading(&reading, 1000) == osOK) {
+        if (sensor_wait_next_reading(&cursor, &reading, 1000) == osOK) {
             bool is_detect = keypad_is_detect();
 
             if (reading.mod0.result == SENSOR_RESULT_SATURATED_ANALOG) {
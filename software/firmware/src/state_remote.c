@@ -4,14 +4,17 @@
 #include <elog.h>
 
 #include <cmsis_os.h>
+#include <printf.h>
 
 #include "display.h"
 #include "keypad.h"
 #include "task_sensor.h"
+#include "densitometer.h"
 #include "cdc_handler.h"
 
 typedef struct {
     state_t base;
+    bool continuous_shown;
 } state_remote_t;
 
 static void state_remote_entry(state_t *state_base, state_controller_t *controller, state_identifier_t prev_state);
@@ -35,20 +38,42 @@ void state_remote_entry(state_t *state_base, state_controller_t *controller, sta
     log_i("Entering remote control state");
     sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
     display_static_message("Remote\nControl");
+    state_remote_data.continuous_shown = false;
     cdc_send_remote_state(true);
 }
 
 void state_remote_process(state_t *state_base, state_controller_t *controller)
 {
+    state_remote_t *state = (state_remote_t *)state_base;
+
     /* Wait on the keypad queue to avoid letting irrelevant events pile up */
     keypad_event_t keypad_event;
     keypad_wait_for_event(&keypad_event, 50);
     UNUSED(keypad_event);
+
+    /* Feed any remotely started continuous measurement, and show its latest reading */
+    if (densitometer_continuous_is_running()) {
+        densitometer_continuous_reading_t reading;
+        bool updated = false;
+        while (densitometer_continuous_poll(&reading, 0) == osOK) {
+            updated = true;
+        }
+        if (updated) {
+            char buf[32];
+            sprintf_(buf, "Remote\n%.2fD", reading.d);
+            display_static_message(buf);
+            state->continuous_shown = true;
+        }
+    } else if (state->continuous_shown) {
+        display_static_message("Remote\nControl");
+        state->continuous_shown = false;
+    }
 }
 
 void state_remote_exit(state_t *state, state_controller_t *controller, state_identifier_t next_state)
 {
     log_i("Leaving remote control state");
+    densitometer_continuous_stop();
     sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
     sensor_stop();
     display_enable(true);
@@ -20,6 +20,7 @@
 #include "board_config.h"
 
 extern DMA_HandleTypeDef hdma_adc;
+extern DMA_HandleTypeDef hdma_i2c1_rx;
 
 extern void error_handler(void);
 void HAL_TIM_MspPostInit(TIM_HandleTypeDef *htim);
@@ -134,6 +135,32 @@ void HAL_I2C_MspInit(I2C_HandleTypeDef* hi2c)
 
         /* Peripheral clock enable */
         __HAL_RCC_I2C1_CLK_ENABLE();
+
+        /* I2C1 DMA Init */
+        /* I2C1_RX Init */
+        hdma_i2c1_rx.Instance = DMA1_Channel3;
+        hdma_i2c1_rx.Init.Request = DMA_REQUEST_6;
+        hdma_i2c1_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+        hdma_i2c1_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+        hdma_i2c1_rx.Init.MemInc = DMA_MINC_ENABLE;
+        hdma_i2c1_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+        hdma_i2c1_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+        hdma_i2c1_rx.Init.Mode = DMA_NORMAL;
+        hdma_i2c1_rx.Init.Priority = DMA_PRIORITY_MEDIUM;
+        if (HAL_DMA_Init(&hdma_i2c1_rx) != HAL_OK) {
+            error_handler();
+        }
+
+        __HAL_LINKDMA(hi2c, hdmarx, hdma_i2c1_rx);
+
+        /*
+         * I2C1_TX has no DMA channel, since register writes are short enough
+         * for interrupt mode and its handle would cost another 76 bytes of RAM
+         */
+
+        /* I2C1 interrupt Init */
+        HAL_NVIC_SetPriority(I2C1_IRQn, 3, 0);
+        HAL_NVIC_EnableIRQ(I2C1_IRQn);
     }
 }
 
@@ -156,6 +183,12 @@ void HAL_I2C_MspDeInit(I2C_HandleTypeDef* hi2c)
         HAL_GPIO_DeInit(GPIOB, GPIO_PIN_6);
 
         HAL_GPIO_DeInit(GPIOB, GPIO_PIN_7);
+
+        /* I2C1 DMA DeInit */
+        HAL_DMA_DeInit(hi2c->hdmarx);
+
+        /* I2C1 interrupt DeInit */
+        HAL_NVIC_DisableIRQ(I2C1_IRQn);
     }
 }
 
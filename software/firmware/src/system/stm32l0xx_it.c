@@ -23,6 +23,8 @@
 #include "state_suspend.h"
 
 extern DMA_HandleTypeDef hdma_adc;
+extern DMA_HandleTypeDef hdma_i2c1_rx;
+extern I2C_HandleTypeDef hi2c1;
 extern RTC_HandleTypeDef hrtc;
 extern TIM_HandleTypeDef htim2;
 extern TIM_HandleTypeDef htim6;
@@ -171,6 +173,27 @@ void DMA1_Channel1_IRQHandler(void)
     HAL_DMA_IRQHandler(&hdma_adc);
 }
 
+/**
+ * Handles the DMA1 channel 2 and channel 3 interrupts, where only
+ * channel 3 is in use for I2C1 receive.
+ */
+void DMA1_Channel2_3_IRQHandler(void)
+{
+    HAL_DMA_IRQHandler(&hdma_i2c1_rx);
+}
+
+/**
+ * Handles the I2C1 event and error interrupts.
+ */
+void I2C1_IRQHandler(void)
+{
+    if (hi2c1.Instance->ISR & (I2C_FLAG_BERR | I2C_FLAG_ARLO | I2C_FLAG_OVR)) {
+        HAL_I2C_ER_IRQHandler(&hi2c1);
+    } else {
+        HAL_I2C_EV_IRQHandler(&hi2c1);
+    }
+}
+
 /**
  * Handles the TIM2 global interrupt.
  */
@@ -15,8 +15,11 @@
 #include "task_usbd.h"
 #include "task_sensor.h"
 #include "adc_handler.h"
+#include "i2c_handler.h"
 #include "state_controller.h"
+#include "densitometer.h"
 
+extern I2C_HandleTypeDef hi2c1;
 extern SPI_HandleTypeDef hspi1;
 extern TIM_HandleTypeDef htim2;
 
@@ -132,9 +135,15 @@ void task_main_run(void *argument)
     /* Load system settings */
     settings_init();
 
+    /* Initialize the densitometer */
+    densitometer_init();
+
     /* Initialize the ADC handler */
     adc_handler_init();
 
+    /* Initialize the I2C handler */
+    i2c_handler_init(&hi2c1);
+
     /* Initialize the state controller */
     state_controller_init();
 
@@ -192,3 +201,23 @@ osStatus_t task_main_force_state(state_identifier_t next_state)
 
     return result;
 }
+
+bool task_main_get_stack_info(size_t index, const char **name, uint32_t *stack_size, uint32_t *stack_free)
+{
+    const size_t task_count = sizeof(task_list) / sizeof(task_params_t);
+
+    if (index >= task_count) {
+        return false;
+    }
+
+    *name = task_list[index].task_attrs.name;
+    *stack_size = task_list[index].task_attrs.stack_size;
+
+    /* The high water mark is reported in stack words, not bytes */
+    if (task_list[index].task_handle) {
+        *stack_free = osThreadGetStackSpace(task_list[index].task_handle) * sizeof(StackType_t);
+    } else {
+        *stack_free = 0;
+    }
+    return true;
+}
@@ -7,6 +7,7 @@
 #define TASK_MAIN_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <cmsis_os.h>
 #include "state_controller.h"
 
@@ -28,4 +29,16 @@ bool task_main_is_running();
  */
 osStatus_t task_main_force_state(state_identifier_t next_state);
 
+/**
+ * Get the stack usage of a task created by the main task.
+ *
+ * @param index Task index, starting from zero
+ * @param name Set to the task name
+ * @param stack_size Set to the stack size, in bytes
+ * @param stack_free Set to the smallest amount of free stack seen so far, in bytes,
+ *                   or zero if the task could not be created
+ * @return True if the index refers to a task
+ */
+bool task_main_get_stack_info(size_t index, const char **name, uint32_t *stack_size, uint32_t *stack_free);
+
 #endif /* TASK_MAIN_H */
@@ -4,9 +4,11 @@
 #include <elog.h>
 
 #include <math.h>
+#include <string.h>
 #include <cmsis_os.h>
 #include <FreeRTOS.h>
 #include <queue.h>
+#include <semphr.h>
 
 #include "stm32l0xx_hal.h"
 #include "board_config.h"
@@ -16,6 +18,9 @@
 #include "light.h"
 #include "util.h"
 #include "cdc_handler.h"
+#ifdef USE_FIXED_POINT_DENSITY
+#include "fixed_math.h"
+#endif
 
 /**
  * Sensor control event types.
@@ -25,13 +30,16 @@ typedef enum {
     SENSOR_CONTROL_START,
     SENSOR_CONTROL_SET_MODE,
     SENSOR_CONTROL_SET_TRIGGER_MODE,
+    SENSOR_CONTROL_SET_FIFO_BATCH,
     SENSOR_CONTROL_SET_GAIN,
     SENSOR_CONTROL_SET_INTEGRATION,
     SENSOR_CONTROL_SET_AGC_ENABLED,
     SENSOR_CONTROL_SET_AGC_DISABLED,
     SENSOR_CONTROL_SET_LIGHT_MODE,
+    SENSOR_CONTROL_CONFIGURE,
     SENSOR_CONTROL_TRIGGER_NEXT_READING,
     SENSOR_CONTROL_READ_TEMPERATURE,
+    SENSOR_CONTROL_SET_TEMPERATURE_SAMPLING,
     SENSOR_CONTROL_INTERRUPT
 } sensor_control_event_type_t;
 
@@ -59,6 +67,11 @@ typedef struct {
     float *temp_c;
 } sensor_control_read_temperature_params_t;
 
+typedef struct {
+    uint32_t interval_ms;
+    mcp9808_resolution_t resolution;
+} sensor_control_temperature_sampling_params_t;
+
 typedef struct {
     uint32_t sensor_ticks;
     uint32_t light_ticks;
@@ -70,15 +83,19 @@ typedef struct {
  */
 typedef struct {
     sensor_control_event_type_t event_type;
+    osSemaphoreId_t done;
     osStatus_t *result;
     union {
         sensor_mode_t sensor_mode;
         tsl2585_trigger_mode_t trigger_mode;
+        uint8_t fifo_batch;
         sensor_control_gain_params_t gain;
         sensor_control_integration_params_t integration;
         sensor_control_agc_params_t agc;
         sensor_control_light_mode_params_t light_mode;
+        const sensor_config_t *config;
         sensor_control_read_temperature_params_t read_temperature;
+        sensor_control_temperature_sampling_params_t temperature_sampling;
         sensor_control_interrupt_params_t interrupt;
     };
 } sensor_control_event_t;
@@ -104,6 +121,9 @@ typedef struct {
     bool sai_active;
     bool agc_disabled_reset_gain;
     bool discard_next_reading;
+    uint8_t fifo_batch;
+    bool fifo_batch_active;
+    uint32_t fifo_reading_count;
 } tsl2585_state_t;
 
 /**
@@ -117,6 +137,34 @@ typedef struct {
     uint32_t als_data1;
 } tsl2585_fifo_data_t;
 
+/* Size of a single integration cycle record in the FIFO */
+#define SENSOR_FIFO_RECORD_SIZE 7
+#define SENSOR_FIFO_RECORD_SIZE_DUAL 11
+
+/*
+ * Maximum number of integration cycles read out of the FIFO at once,
+ * which must leave room in the reading ring for consumers to keep up
+ */
+#define SENSOR_FIFO_BATCH_MAX 4
+
+/*
+ * Number of readings held for consumers in the reading ring buffer,
+ * which is a full FIFO batch plus the slot a consumer may still be
+ * copying (5 x 44 = 220 bytes)
+ */
+#define SENSOR_READING_RING_SIZE 5
+_Static_assert(SENSOR_READING_RING_SIZE > SENSOR_FIFO_BATCH_MAX, "Reading ring must hold a full FIFO batch");
+
+/*
+ * Event flags used to wake up consumers waiting for a new reading.
+ * Exactly one flag is set at a time, selected by the ring head position,
+ * so a consumer can wait for the head to move away from the position it
+ * last saw without missing a reading published in the meantime.
+ */
+#define SENSOR_READING_FLAG_COUNT 24
+#define SENSOR_READING_FLAGS_ALL 0x00FFFFFFU
+#define SENSOR_READING_FLAG(head) (1UL << ((head) % SENSOR_READING_FLAG_COUNT))
+
 /* Global I2C handle for the sensor */
 extern I2C_HandleTypeDef hi2c1;
 
@@ -130,65 +178,172 @@ static volatile uint32_t reading_count = 0;
 static tsl2585_state_t sensor_state = {0};
 static uint32_t last_aint_ticks = 0;
 
-/* Queue for low level sensor control events */
+/*
+ * Raw FIFO records captured by the last sensor interrupt, which are
+ * decoded and published one at a time (44 bytes)
+ */
+static uint8_t sensor_fifo_buf[SENSOR_FIFO_BATCH_MAX * SENSOR_FIFO_RECORD_SIZE_DUAL];
+
+/* Timing statistics for the sensor interrupt path */
+static volatile sensor_interrupt_stats_t sensor_interrupt_stats = {0};
+
+/*
+ * Queue for low level sensor control events. Each task waits for its own
+ * call to finish before making another, so the queue only has to hold one
+ * call each from the main and CDC tasks plus the pending sensor interrupt.
+ * At 24 bytes per event, 4 entries take 176 bytes of heap.
+ */
+#define SENSOR_CONTROL_QUEUE_SIZE 4
 static osMessageQueueId_t sensor_control_queue = NULL;
 static const osMessageQueueAttr_t sensor_control_queue_attrs = {
     .name = "sensor_control_queue"
 };
 
-/* Queue to hold the latest sensor reading */
-static osMessageQueueId_t sensor_reading_queue = NULL;
-static const osMessageQueueAttr_t sensor_reading_queue_attrs = {
-    .name = "sensor_reading_queue"
-};
-
-/* Semaphore to synchronize sensor control calls */
-static osSemaphoreId_t sensor_control_semaphore = NULL;
-static const osSemaphoreAttr_t sensor_control_semaphore_attrs = {
-    .name = "sensor_control_semaphore"
-};
-
-/* Default photodiodes configuration */
-static const tsl2585_modulator_t sensor_phd_mod_default[] = {
-    TSL2585_MOD1, TSL2585_MOD0, TSL2585_MOD1, TSL2585_MOD0, TSL2585_MOD1, TSL2585_MOD0
+/*
+ * Ring buffer of recent sensor readings, which is only written by this
+ * task. Consumers each track their own position with a cursor, and
+ * detect readings overwritten before they could be read by comparing
+ * that position against the total number of published readings.
+ */
+static sensor_reading_t sensor_reading_ring[SENSOR_READING_RING_SIZE];
+static volatile uint32_t sensor_reading_head = 0;
+static volatile uint32_t sensor_reading_floor = 0;
+static volatile uint32_t sensor_reading_overruns = 0;
+
+/* Event flags to signal consumers of the reading ring buffer */
+static osEventFlagsId_t sensor_reading_flags = NULL;
+static const osEventFlagsAttr_t sensor_reading_flags_attrs = {
+    .name = "sensor_reading_flags"
 };
 
-/* Only enable Photopic photodiodes */
-static const tsl2585_modulator_t sensor_phd_mod_vis[] = {
-    0, TSL2585_MOD0, 0, 0, 0, TSL2585_MOD0
-};
+/* Round trip timing statistics for sensor control calls */
+static sensor_control_stats_t sensor_control_stats = {0};
+static uint64_t sensor_control_total_us = 0;
 
-/* Only enable UV-A photodiodes */
-static const tsl2585_modulator_t sensor_phd_mod_uv[] = {
-    0, 0, 0, TSL2585_MOD0, TSL2585_MOD0, 0
-};
+/* Default interval between background temperature samples */
+#define SENSOR_TEMP_SAMPLE_INTERVAL_MS 1000
 
-/* Only enable Photopic photodiodes (dual modulators) */
-static const tsl2585_modulator_t sensor_phd_mod_vis_dual[] = {
-    0, TSL2585_MOD0, 0, 0, 0, TSL2585_MOD1
-};
+/*
+ * Weight given to each new background temperature sample, as the
+ * coefficient of a simple exponential moving average filter.
+ */
+#define SENSOR_TEMP_FILTER_ALPHA 0.25F
 
-/* Only enable UV-A photodiodes (dual modulators) */
-static const tsl2585_modulator_t sensor_phd_mod_uv_dual[] = {
-    0, 0, 0, TSL2585_MOD0, TSL2585_MOD1, 0
+/*
+ * Background temperature sampling state. The sample settings are only
+ * accessed from the sensor task, while the cached value is also read
+ * by other tasks from within a critical section.
+ */
+static uint32_t sensor_temp_interval_ms = SENSOR_TEMP_SAMPLE_INTERVAL_MS;
+static mcp9808_resolution_t sensor_temp_resolution = MCP9808_RESOLUTION_00625C;
+static uint32_t sensor_temp_next_ticks = 0;
+static float sensor_temp_filtered_c = NAN;
+static uint32_t sensor_temp_sample_ticks = 0;
+static bool sensor_temp_valid = false;
+
+/*
+ * Readout configuration shared by all sensor modes:
+ * - Residuals enabled on all sequencer steps
+ * - 32-bit FIFO data with the MSB position set for a full 26-bit result
+ * - Alternate gain table, which caps gain at 256x but gives us more residual bits
+ * - Maximum gain of 256x per app note on residual measurement
+ * - Internal calibration on every sequencer round
+ * - VSYNC pin configured as an inverted input
+ * - ALS interrupt and FIFO status on every ALS cycle
+ */
+#define SENSOR_PRESET_COMMON \
+    .residual_steps = TSL2585_STEPS_ALL, \
+    .fifo_data_format = TSL2585_ALS_FIFO_32BIT, \
+    .als_msb_position = 6, \
+    .alternate_gain_table = true, \
+    .max_mod_gain = TSL2585_GAIN_256X, \
+    .calibration_nth_iteration = 1, \
+    .vsync_config = TSL2585_VSYNC_CFG_VSYNC_INVERT, \
+    .vsync_gpio_int = TSL2585_GPIO_INT_VSYNC_GPIO_IN_EN | TSL2585_GPIO_INT_VSYNC_GPIO_INVERT, \
+    .als_interrupt_persistence = 0, \
+    .interrupt_enable = TSL2585_INTENAB_AIEN
+
+/* Sensor register presets for each sensor mode */
+static const tsl2585_preset_t sensor_presets[] = {
+    [SENSOR_MODE_DEFAULT] = {
+        /* Default photodiodes configuration */
+        .mods = TSL2585_MOD0,
+        .smux = {
+            TSL2585_SMUX_L(TSL2585_MOD1, TSL2585_MOD0, TSL2585_MOD1, TSL2585_MOD0),
+            TSL2585_SMUX_H(TSL2585_MOD1, TSL2585_MOD0)
+        },
+        SENSOR_PRESET_COMMON
+    },
+    [SENSOR_MODE_VIS] = {
+        /* Only enable Photopic photodiodes */
+        .mods = TSL2585_MOD0,
+        .smux = {
+            TSL2585_SMUX_L(0, TSL2585_MOD0, 0, 0),
+            TSL2585_SMUX_H(0, TSL2585_MOD0)
+        },
+        SENSOR_PRESET_COMMON
+    },
+    [SENSOR_MODE_UV] = {
+        /* Only enable UV-A photodiodes */
+        .mods = TSL2585_MOD0,
+        .smux = {
+            TSL2585_SMUX_L(0, 0, 0, TSL2585_MOD0),
+            TSL2585_SMUX_H(TSL2585_MOD0, 0)
+        },
+        SENSOR_PRESET_COMMON
+    },
+    [SENSOR_MODE_VIS_DUAL] = {
+        /* Only enable Photopic photodiodes (dual modulators) */
+        .mods = TSL2585_MOD0 | TSL2585_MOD1,
+        .smux = {
+            TSL2585_SMUX_L(0, TSL2585_MOD0, 0, 0),
+            TSL2585_SMUX_H(0, TSL2585_MOD1)
+        },
+        SENSOR_PRESET_COMMON
+    },
+    [SENSOR_MODE_UV_DUAL] = {
+        /* Only enable UV-A photodiodes (dual modulators) */
+        .mods = TSL2585_MOD0 | TSL2585_MOD1,
+        .smux = {
+            TSL2585_SMUX_L(0, 0, 0, TSL2585_MOD0),
+            TSL2585_SMUX_H(TSL2585_MOD1, 0)
+        },
+        SENSOR_PRESET_COMMON
+    }
 };
 
 /* Sensor control implementation functions */
+static osStatus_t sensor_control_call(sensor_control_event_t *control_event);
 static osStatus_t sensor_control_start();
 static osStatus_t sensor_control_stop();
 static osStatus_t sensor_control_set_mode(sensor_mode_t sensor_mode);
 static osStatus_t sensor_control_set_trigger_mode(tsl2585_trigger_mode_t trigger_mode);
+static osStatus_t sensor_control_set_fifo_batch(uint8_t count);
 static osStatus_t sensor_control_set_gain(const sensor_control_gain_params_t *params);
 static osStatus_t sensor_control_set_integration(const sensor_control_integration_params_t *params);
 static osStatus_t sensor_control_set_agc_enabled(const sensor_control_agc_params_t *params);
 static osStatus_t sensor_control_set_agc_disabled();
 static osStatus_t sensor_control_set_light_mode(const sensor_control_light_mode_params_t *params);
+static osStatus_t sensor_control_configure(const sensor_config_t *config);
 static void sensor_light_change_impl(sensor_light_t light, uint16_t value);
 static osStatus_t sensor_control_trigger_next_reading();
 static osStatus_t sensor_control_read_temperature(sensor_control_read_temperature_params_t *params);
+static osStatus_t sensor_control_set_temperature_sampling(const sensor_control_temperature_sampling_params_t *params);
+static uint32_t sensor_temp_sample_timeout();
+static void sensor_temp_sample_poll();
+static void sensor_temp_update(float temp_c, bool reset);
 static osStatus_t sensor_control_interrupt(const sensor_control_interrupt_params_t *params);
-static HAL_StatusTypeDef sensor_control_read_fifo(tsl2585_fifo_data_t *fifo_data);
-static HAL_StatusTypeDef sensor_control_set_mod_photodiode_smux(sensor_mode_t mode);
+static HAL_StatusTypeDef sensor_control_restore_gain();
+static void sensor_control_flush_readings();
+static bool sensor_reading_take(sensor_reading_cursor_t *cursor, sensor_reading_t *reading);
+static HAL_StatusTypeDef sensor_control_capture(uint8_t *status, size_t *fifo_count);
+static HAL_StatusTypeDef sensor_control_read_fifo(uint8_t *data);
+static HAL_StatusTypeDef sensor_control_read_fifo_batch(size_t *count);
+static void sensor_control_parse_fifo_record(const uint8_t *data, tsl2585_fifo_data_t *fifo_data);
+static void sensor_control_fill_reading(const tsl2585_fifo_data_t *fifo_data, sensor_reading_t *reading);
+static uint32_t sensor_apply_uv_calibration(uint32_t als_data);
+static void sensor_control_publish_reading(const sensor_reading_t *reading);
+static HAL_StatusTypeDef sensor_control_apply_preset(sensor_mode_t mode, bool running);
 
 static void sensor_set_vsync_state(bool state);
 
@@ -201,23 +356,16 @@ void task_sensor_run(void *argument)
     log_d("sensor_task start");
 
     /* Create the queue for sensor control events */
-    sensor_control_queue = osMessageQueueNew(20, sizeof(sensor_control_event_t), &sensor_control_queue_attrs);
+    sensor_control_queue = osMessageQueueNew(SENSOR_CONTROL_QUEUE_SIZE, sizeof(sensor_control_event_t), &sensor_control_queue_attrs);
     if (!sensor_control_queue) {
         log_e("Unable to create control queue");
         return;
     }
 
-    /* Create the one-element queue to hold the latest sensor reading */
-    sensor_reading_queue = osMessageQueueNew(1, sizeof(sensor_reading_t), &sensor_reading_queue_attrs);
-    if (!sensor_reading_queue) {
-        log_e("Unable to create reading queue");
-        return;
-    }
-
-    /* Create the semaphore used to synchronize sensor control */
-    sensor_control_semaphore = osSemaphoreNew(1, 0, &sensor_control_semaphore_attrs);
-    if (!sensor_control_semaphore) {
-        log_e("sensor_control_semaphore create error");
+    /* Create the event flags used to signal new sensor readings */
+    sensor_reading_flags = osEventFlagsNew(&sensor_reading_flags_attrs);
+    if (!sensor_reading_flags) {
+        log_e("Unable to create reading flags");
         return;
     }
 
@@ -268,6 +416,7 @@ void task_sensor_run(void *argument)
     sensor_state.sample_time = 719;
     sensor_state.sample_count = 99;
     sensor_state.integration_pending = true;
+    sensor_state.fifo_batch = 1;
 
     /* Release the startup semaphore */
     if (osSemaphoreRelease(task_start_semaphore) != osOK) {
@@ -275,9 +424,12 @@ void task_sensor_run(void *argument)
         return;
     }
 
+    /* Take the first background temperature sample right away */
+    sensor_temp_next_ticks = osKernelGetTickCount();
+
     /* Start the main control event loop */
     for (;;) {
-        if(osMessageQueueGet(sensor_control_queue, &control_event, NULL, portMAX_DELAY) == osOK) {
+        if(osMessageQueueGet(sensor_control_queue, &control_event, NULL, sensor_temp_sample_timeout()) == osOK) {
             switch (control_event.event_type) {
             case SENSOR_CONTROL_STOP:
                 ret = sensor_control_stop();
@@ -291,6 +443,9 @@ void task_sensor_run(void *argument)
             case SENSOR_CONTROL_SET_TRIGGER_MODE:
                 ret = sensor_control_set_trigger_mode(control_event.trigger_mode);
                 break;
+            case SENSOR_CONTROL_SET_FIFO_BATCH:
+                ret = sensor_control_set_fifo_batch(control_event.fifo_batch);
+                break;
             case SENSOR_CONTROL_SET_GAIN:
                 ret = sensor_control_set_gain(&control_event.gain);
                 break;
@@ -306,12 +461,18 @@ void task_sensor_run(void *argument)
             case SENSOR_CONTROL_SET_LIGHT_MODE:
                 ret = sensor_control_set_light_mode(&control_event.light_mode);
                 break;
+            case SENSOR_CONTROL_CONFIGURE:
+                ret = sensor_control_configure(control_event.config);
+                break;
             case SENSOR_CONTROL_TRIGGER_NEXT_READING:
                 ret = sensor_control_trigger_next_reading();
                 break;
             case SENSOR_CONTROL_READ_TEMPERATURE:
                 ret = sensor_control_read_temperature(&control_event.read_temperature);
                 break;
+            case SENSOR_CONTROL_SET_TEMPERATURE_SAMPLING:
+                ret = sensor_control_set_temperature_sampling(&control_event.temperature_sampling);
+                break;
             case SENSOR_CONTROL_INTERRUPT:
                 ret = sensor_control_interrupt(&control_event.interrupt);
                 break;
@@ -324,11 +485,18 @@ void task_sensor_run(void *argument)
                 if (control_event.result) {
                     *(control_event.result) = ret;
                 }
-                if (osSemaphoreRelease(sensor_control_semaphore) != osOK) {
-                    log_e("Unable to release sensor_control_semaphore");
+                if (osSemaphoreRelease(control_event.done) != osOK) {
+                    log_e("Unable to notify sensor control caller");
                 }
             }
         }
+
+        /*
+         * Check for a due temperature sample after every event, since
+         * a steady stream of sensor interrupts would otherwise keep the
+         * queue wait from ever timing out.
+         */
+        sensor_temp_sample_poll();
     }
 }
 
@@ -337,18 +505,76 @@ bool sensor_is_initialized()
     return sensor_initialized;
 }
 
+osStatus_t sensor_control_call(sensor_control_event_t *control_event)
+{
+    osStatus_t result = osOK;
+    osStatus_t ret;
+    StaticSemaphore_t done_cb;
+
+    /* Calls must come from a task, since they block until completion */
+    if (__get_IPSR() != 0U) {
+        return osErrorISR;
+    }
+
+    /*
+     * Each call waits on its own binary semaphore, kept on the caller's
+     * stack so no heap allocation is needed. Since nothing else can
+     * release it, the call cannot complete early from a stale signal,
+     * and any number of callers can have requests in flight at once.
+     *
+     * The event carries pointers into this stack frame, so once the
+     * event has been queued, this function must not return until the
+     * sensor task has signaled that it is finished with them.
+     */
+    const osSemaphoreAttr_t done_attrs = {
+        .cb_mem = &done_cb,
+        .cb_size = sizeof(done_cb)
+    };
+    control_event->done = osSemaphoreNew(1, 0, &done_attrs);
+    if (!control_event->done) {
+        return osErrorResource;
+    }
+    control_event->result = &result;
+
+    const uint32_t call_start = timestamp_us();
+
+    ret = osMessageQueuePut(sensor_control_queue, control_event, 0, portMAX_DELAY);
+    if (ret == osOK) {
+        /* This cannot time out, so it only fails on invalid use */
+        while (osSemaphoreAcquire(control_event->done, osWaitForever) != osOK) {
+            log_e("Sensor control wait error");
+        }
+    } else {
+        log_e("Unable to queue sensor control event: %d", ret);
+    }
+
+    osSemaphoreDelete(control_event->done);
+
+    if (ret != osOK) {
+        return ret;
+    }
+
+    const uint32_t call_elapsed = timestamp_us() - call_start;
+
+    taskENTER_CRITICAL();
+    sensor_control_stats.call_count++;
+    sensor_control_total_us += call_elapsed;
+    if (call_elapsed > sensor_control_stats.latency_max_us) {
+        sensor_control_stats.latency_max_us = call_elapsed;
+    }
+    taskEXIT_CRITICAL();
+
+    return result;
+}
+
 osStatus_t sensor_start()
 {
     if (!sensor_initialized) { return osErrorResource; }
 
-    osStatus_t result = osOK;
     sensor_control_event_t control_event = {
-        .event_type = SENSOR_CONTROL_START,
-        .result = &result
+        .event_type = SENSOR_CONTROL_START
     };
-    osMessageQueuePut(sensor_control_queue, &control_event, 0, portMAX_DELAY);
-    osSemaphoreAcquire(sensor_control_semaphore, portMAX_DELAY);
-    return result;
+    return sensor_control_call(&control_event);
 }
 
 osStatus_t sensor_control_start()
@@ -366,6 +592,13 @@ osStatus_t sensor_control_start()
             sensor_state.dual_mod = false;
         }
 
+        /*
+         * Check whether to batch multiple integration cycles in the FIFO,
+         * which only makes sense when the sensor is running continuously
+         */
+        sensor_state.fifo_batch_active = sensor_state.fifo_batch > 1
+            && sensor_state.trigger_mode != TSL2585_TRIGGER_VSYNC;
+
         /* Clear the FIFO */
         ret = tsl2585_clear_fifo(&hi2c1);
         if (ret != HAL_OK) { break; }
@@ -394,69 +627,22 @@ osStatus_t sensor_control_start()
             if (ret != HAL_OK) { break; }
         }
 
-        /* Put the sensor into a known initial state */
-
-        /* Enable writing of ALS status to the FIFO */
-        ret = tsl2585_set_fifo_als_status_write_enable(&hi2c1, true);
-        if (ret != HAL_OK) { break; }
-
-        /* Enable writing of results to the FIFO */
-        ret = tsl2585_set_fifo_data_write_enable(&hi2c1, TSL2585_MOD0, true);
-        if (ret != HAL_OK) { break; }
-        ret = tsl2585_set_fifo_data_write_enable(&hi2c1, TSL2585_MOD1, sensor_state.dual_mod);
-        if (ret != HAL_OK) { break; }
-        ret = tsl2585_set_fifo_data_write_enable(&hi2c1, TSL2585_MOD2, false);
-        if (ret != HAL_OK) { break; }
-
-        /* Set FIFO data format to 32-bits */
-        ret = tsl2585_set_fifo_als_data_format(&hi2c1, TSL2585_ALS_FIFO_32BIT);
-        if (ret != HAL_OK) { break; }
-
-        /* Set MSB position for full 26-bit result */
-        ret = tsl2585_set_als_msb_position(&hi2c1, 6);
-        if (ret != HAL_OK) { break; }
-
-        /* Make sure residuals are enabled */
-        ret = tsl2585_set_mod_residual_enable(&hi2c1, TSL2585_MOD0, TSL2585_STEPS_ALL);
-        if (ret != HAL_OK) { break; }
-        ret = tsl2585_set_mod_residual_enable(&hi2c1, TSL2585_MOD1, TSL2585_STEPS_ALL);
-        if (ret != HAL_OK) { break; }
-
-        /* Select alternate gain table, which caps gain at 256x but gives us more residual bits */
-        ret = tsl2585_set_mod_gain_table_select(&hi2c1, true);
-        if (ret != HAL_OK) { break; }
-
-        /* Set maximum gain to 256x per app note on residual measurement */
-        ret = tsl2585_set_max_mod_gain(&hi2c1, TSL2585_GAIN_256X);
-        if (ret != HAL_OK) { break; }
-
-        /* Enable modulator(s) */
-        ret = tsl2585_enable_modulators(&hi2c1, TSL2585_MOD0 | (sensor_state.dual_mod ? TSL2585_MOD1 : 0));
-        if (ret != HAL_OK) { break; }
-
-        /* Enable internal calibration on every sequencer round */
-        ret = tsl2585_set_calibration_nth_iteration(&hi2c1, 1);
-        if (ret != HAL_OK) { break; }
-
         /* Set initial state of the VSYNC pin to high */
         sensor_set_vsync_state(true);
 
-        /* Set VSYNC pin configuration */
-        ret = tsl2585_set_vsync_config(&hi2c1, TSL2585_VSYNC_CFG_VSYNC_INVERT);
+        /* Put the sensor into a known initial state for the current mode */
+        ret = sensor_control_apply_preset(sensor_state.sensor_mode, false);
         if (ret != HAL_OK) { break; }
+        sensor_state.mode_pending = false;
 
-        /* Set VSYNC pin as input */
-        ret = tsl2585_set_vsync_gpio_int(&hi2c1, TSL2585_GPIO_INT_VSYNC_GPIO_IN_EN | TSL2585_GPIO_INT_VSYNC_GPIO_INVERT);
-        if (ret != HAL_OK) { break; }
-
-        /* Apply any startup settings */
-        if (sensor_state.mode_pending) {
-            ret = sensor_control_set_mod_photodiode_smux(sensor_state.sensor_mode);
+        if (sensor_state.fifo_batch_active) {
+            /* Interrupt once the FIFO contains a full batch of records */
+            const uint16_t record_size = sensor_state.dual_mod ? SENSOR_FIFO_RECORD_SIZE_DUAL : SENSOR_FIFO_RECORD_SIZE;
+            ret = tsl2585_set_fifo_threshold(&hi2c1, (sensor_state.fifo_batch * record_size) - 1);
             if (ret != HAL_OK) { break; }
-
-            sensor_state.mode_pending = false;
         }
 
+        /* Apply any startup settings */
         if (sensor_state.gain_pending) {
             ret = tsl2585_set_mod_gain(&hi2c1, TSL2585_MOD0, TSL2585_STEP0, sensor_state.gain[0]);
             if (ret != HAL_OK) { break; }
@@ -496,26 +682,9 @@ osStatus_t sensor_control_start()
             als_atime, agc_atime);
 
         /* Clear out any old sensor readings */
-        osMessageQueueReset(sensor_reading_queue);
+        sensor_control_flush_readings();
         reading_count = 0;
-
-        /* Configure to interrupt on every ALS cycle */
-        ret = tsl2585_set_als_interrupt_persistence(&hi2c1, 0);
-        if (ret != HAL_OK) {
-            break;
-        }
-
-        /* Enable sensor ALS interrupts */
-        ret = tsl2585_set_interrupt_enable(&hi2c1, TSL2585_INTENAB_AIEN);
-        if (ret != HAL_OK) {
-            break;
-        }
-
-        /* Set the trigger mode */
-        ret = tsl2585_set_trigger_mode(&hi2c1, sensor_state.trigger_mode);
-        if (ret != HAL_OK) {
-            break;
-        }
+        sensor_state.fifo_reading_count = 0;
 
         /* Enable the sensor (ALS Enable and Power ON) */
         ret = tsl2585_enable(&hi2c1);
@@ -545,14 +714,10 @@ osStatus_t sensor_stop()
 {
     if (!sensor_initialized) { return osErrorResource; }
 
-    osStatus_t result = osOK;
     sensor_control_event_t control_event = {
-        .event_type = SENSOR_CONTROL_STOP,
-        .result = &result
+        .event_type = SENSOR_CONTROL_STOP
     };
-    osMessageQueuePut(sensor_control_queue, &control_event, 0, portMAX_DELAY);
-    osSemaphoreAcquire(sensor_control_semaphore, portMAX_DELAY);
-    return result;
+    return sensor_control_call(&control_event);
 }
 
 osStatus_t sensor_control_stop()
@@ -573,15 +738,11 @@ osStatus_t sensor_set_mode(sensor_mode_t mode)
 {
     if (!sensor_initialized) { return osErrorResource; }
 
-    osStatus_t result = osOK;
     sensor_control_event_t control_event = {
         .event_type = SENSOR_CONTROL_SET_MODE,
-        .result = &result,
         .sensor_mode = mode
     };
-    osMessageQueuePut(sensor_control_queue, &control_event, 0, portMAX_DELAY);
-    osSemaphoreAcquire(sensor_control_semaphore, portMAX_DELAY);
-    return result;
+    return sensor_control_call(&control_event);
 }
 
 osStatus_t sensor_control_set_mode(sensor_mode_t sensor_mode)
@@ -590,7 +751,7 @@ osStatus_t sensor_control_set_mode(sensor_mode_t sensor_mode)
     log_d("sensor_control_set_mode: %d", sensor_mode);
 
     if (sensor_state.running) {
-        ret = sensor_control_set_mod_photodiode_smux(sensor_mode);
+        ret = sensor_control_apply_preset(sensor_mode, true);
         if (ret == HAL_OK) {
             sensor_state.sensor_mode = sensor_mode;
         }
@@ -598,7 +759,7 @@ osStatus_t sensor_control_set_mode(sensor_mode_t sensor_mode)
         if (sensor_state.trigger_mode != TSL2585_TRIGGER_VSYNC) {
             sensor_state.discard_next_reading = true;
         }
-        osMessageQueueReset(sensor_reading_queue);
+        sensor_control_flush_readings();
     } else {
         sensor_state.sensor_mode = sensor_mode;
         sensor_state.mode_pending = true;
@@ -611,15 +772,11 @@ osStatus_t sensor_set_trigger_mode(tsl2585_trigger_mode_t trigger_mode)
 {
     if (!sensor_initialized) { return osErrorResource; }
 
-    osStatus_t result = osOK;
     sensor_control_event_t control_event = {
         .event_type = SENSOR_CONTROL_SET_TRIGGER_MODE,
-        .result = &result,
         .trigger_mode = trigger_mode
     };
-    osMessageQueuePut(sensor_control_queue, &control_event, 0, portMAX_DELAY);
-    osSemaphoreAcquire(sensor_control_semaphore, portMAX_DELAY);
-    return result;
+    return sensor_control_call(&control_event);
 }
 
 osStatus_t sensor_control_set_trigger_mode(tsl2585_trigger_mode_t trigger_mode)
@@ -634,7 +791,7 @@ osStatus_t sensor_control_set_trigger_mode(tsl2585_trigger_mode_t trigger_mode)
             sensor_state.trigger_mode = trigger_mode;
         }
 
-        osMessageQueueReset(sensor_reading_queue);
+        sensor_control_flush_readings();
     } else {
         sensor_state.trigger_mode = trigger_mode;
     }
@@ -642,6 +799,28 @@ osStatus_t sensor_control_set_trigger_mode(tsl2585_trigger_mode_t trigger_mode)
     return hal_to_os_status(ret);
 }
 
+osStatus_t sensor_set_fifo_batch(uint8_t count)
+{
+    if (!sensor_initialized) { return osErrorResource; }
+    if (count < 1 || count > SENSOR_FIFO_BATCH_MAX) { return osErrorParameter; }
+
+    sensor_control_event_t control_event = {
+        .event_type = SENSOR_CONTROL_SET_FIFO_BATCH,
+        .fifo_batch = count
+    };
+    return sensor_control_call(&control_event);
+}
+
+osStatus_t sensor_control_set_fifo_batch(uint8_t count)
+{
+    log_d("sensor_control_set_fifo_batch: %d", count);
+
+    /* Takes effect the next time the sensor is started */
+    sensor_state.fifo_batch = count;
+
+    return osOK;
+}
+
 osStatus_t sensor_set_config(tsl2585_gain_t gain, uint16_t sample_time, uint16_t sample_count)
 {
     osStatus_t result;
@@ -659,18 +838,14 @@ osStatus_t sensor_set_gain(tsl2585_gain_t gain, tsl2585_modulator_t mod)
 {
     if (!sensor_initialized) { return osErrorResource; }
 
-    osStatus_t result = osOK;
     sensor_control_event_t control_event = {
         .event_type = SENSOR_CONTROL_SET_GAIN,
-        .result = &result,
         .gain = {
             .gain = gain,
             .mod = mod
         }
     };
-    osMessageQueuePut(sensor_control_queue, &control_event, 0, portMAX_DELAY);
-    osSemaphoreAcquire(sensor_control_semaphore, portMAX_DELAY);
-    return result;
+    return sensor_control_call(&control_event);
 }
 
 osStatus_t sensor_control_set_gain(const sensor_control_gain_params_t *params)
@@ -702,7 +877,7 @@ osStatus_t sensor_control_set_gain(const sensor_control_gain_params_t *params)
         if (sensor_state.trigger_mode != TSL2585_TRIGGER_VSYNC) {
             sensor_state.discard_next_reading = true;
         }
-        osMessageQueueReset(sensor_reading_queue);
+        sensor_control_flush_readings();
     } else {
         sensor_state.gain[mod_index] = params->gain;
         sensor_state.gain_pending = true;
@@ -715,18 +890,14 @@ osStatus_t sensor_set_integration(uint16_t sample_time, uint16_t sample_count)
 {
     if (!sensor_initialized) { return osErrorResource; }
 
-    osStatus_t result = osOK;
     sensor_control_event_t control_event = {
         .event_type = SENSOR_CONTROL_SET_INTEGRATION,
-        .result = &result,
         .integration = {
             .sample_time = sample_time,
             .sample_count = sample_count
         }
     };
-    osMessageQueuePut(sensor_control_queue, &control_event, 0, portMAX_DELAY);
-    osSemaphoreAcquire(sensor_control_semaphore, portMAX_DELAY);
-    return result;
+    return sensor_control_call(&control_event);
 }
 
 osStatus_t sensor_control_set_integration(const sensor_control_integration_params_t *params)
@@ -748,7 +919,7 @@ osStatus_t sensor_control_set_integration(const sensor_control_integration_param
         if (sensor_state.trigger_mode != TSL2585_TRIGGER_VSYNC) {
             sensor_state.discard_next_reading = true;
         }
-        osMessageQueueReset(sensor_reading_queue);
+        sensor_control_flush_readings();
     } else {
         sensor_state.sample_time = params->sample_time;
         sensor_state.sample_count = params->sample_count;
@@ -762,17 +933,13 @@ osStatus_t sensor_set_agc_enabled(uint16_t sample_count)
 {
     if (!sensor_initialized) { return osErrorResource; }
 
-    osStatus_t result = osOK;
     sensor_control_event_t control_event = {
         .event_type = SENSOR_CONTROL_SET_AGC_ENABLED,
-        .result = &result,
         .agc = {
             .sample_count = sample_count
         }
     };
-    osMessageQueuePut(sensor_control_queue, &control_event, 0, portMAX_DELAY);
-    osSemaphoreAcquire(sensor_control_semaphore, portMAX_DELAY);
-    return result;
+    return sensor_control_call(&control_event);
 }
 
 osStatus_t sensor_control_set_agc_enabled(const sensor_control_agc_params_t *params)
@@ -783,7 +950,7 @@ osStatus_t sensor_control_set_agc_enabled(const sensor_control_agc_params_t *par
     if (sensor_state.running) {
         ret = tsl2585_set_agc_num_samples(&hi2c1, params->sample_count);
         if (ret == HAL_OK) {
-            sensor_state.agc_sample_count = sensor_state.sample_count;
+            sensor_state.agc_sample_count = params->sample_count;
         }
 
         ret = tsl2585_set_agc_calibration(&hi2c1, true);
@@ -803,14 +970,10 @@ osStatus_t sensor_set_agc_disabled()
 {
     if (!sensor_initialized) { return osErrorResource; }
 
-    osStatus_t result = osOK;
     sensor_control_event_t control_event = {
-        .event_type = SENSOR_CONTROL_SET_AGC_DISABLED,
-        .result = &result
+        .event_type = SENSOR_CONTROL_SET_AGC_DISABLED
     };
-    osMessageQueuePut(sensor_control_queue, &control_event, 0, portMAX_DELAY);
-    osSemaphoreAcquire(sensor_control_semaphore, portMAX_DELAY);
-    return result;
+    return sensor_control_call(&control_event);
 }
 
 osStatus_t sensor_control_set_agc_disabled()
@@ -829,13 +992,21 @@ osStatus_t sensor_control_set_agc_disabled()
         } while (0);
         if (ret == HAL_OK) {
             sensor_state.agc_enabled = false;
-            sensor_state.agc_disabled_reset_gain = true;
-            if (sensor_state.trigger_mode != TSL2585_TRIGGER_VSYNC) {
+            if (sensor_state.trigger_mode == TSL2585_TRIGGER_VSYNC) {
+                /*
+                 * In VSYNC trigger mode, the sensor sits idle between
+                 * cycles, so the gain can be restored right away and
+                 * is in effect for the next triggered cycle.
+                 */
+                ret = sensor_control_restore_gain();
+            } else {
+                sensor_state.agc_disabled_reset_gain = true;
                 sensor_state.discard_next_reading = true;
             }
         }
     } else {
         sensor_state.agc_enabled = false;
+        sensor_state.agc_sample_count = 0;
         sensor_state.agc_pending = true;
     }
 
@@ -846,19 +1017,15 @@ osStatus_t sensor_set_light_mode(sensor_light_t light, bool next_cycle, uint16_t
 {
     if (!sensor_initialized) { return osErrorResource; }
 
-    osStatus_t result = osOK;
     sensor_control_event_t control_event = {
         .event_type = SENSOR_CONTROL_SET_LIGHT_MODE,
-        .result = &result,
         .light_mode = {
             .light = light,
             .next_cycle = next_cycle,
             .value = value
         }
     };
-    osMessageQueuePut(sensor_control_queue, &control_event, 0, portMAX_DELAY);
-    osSemaphoreAcquire(sensor_control_semaphore, portMAX_DELAY);
-    return result;
+    return sensor_control_call(&control_event);
 }
 
 osStatus_t sensor_control_set_light_mode(const sensor_control_light_mode_params_t *params)
@@ -903,18 +1070,98 @@ void sensor_light_change_impl(sensor_light_t light, uint16_t value)
     }
 }
 
+osStatus_t sensor_configure(const sensor_config_t *config)
+{
+    if (!sensor_initialized) { return osErrorResource; }
+    if (!config) { return osErrorParameter; }
+
+    sensor_control_event_t control_event = {
+        .event_type = SENSOR_CONTROL_CONFIGURE,
+        .config = config
+    };
+    return sensor_control_call(&control_event);
+}
+
+osStatus_t sensor_control_configure(const sensor_config_t *config)
+{
+    osStatus_t ret = osOK;
+
+    log_d("sensor_control_configure");
+
+    /*
+     * While stopped, settings are only recorded for the next start,
+     * so there is nothing to save by comparing against the current
+     * state. Doing so could even skip settings that were never
+     * actually sent to the sensor.
+     */
+    const bool running = sensor_state.running;
+
+    do {
+        if (!running || config->trigger_mode != sensor_state.trigger_mode) {
+            ret = sensor_control_set_trigger_mode(config->trigger_mode);
+            if (ret != osOK) { break; }
+        }
+
+        if (!running || config->mode != sensor_state.sensor_mode) {
+            ret = sensor_control_set_mode(config->mode);
+            if (ret != osOK) { break; }
+        }
+
+        for (uint8_t i = 0; i < 2; i++) {
+            if (!running || config->gain[i] != sensor_state.gain[i]) {
+                const sensor_control_gain_params_t gain_params = {
+                    .gain = config->gain[i],
+                    .mod = (i == 0) ? TSL2585_MOD0 : TSL2585_MOD1
+                };
+                ret = sensor_control_set_gain(&gain_params);
+                if (ret != osOK) { break; }
+            }
+        }
+        if (ret != osOK) { break; }
+
+        if (!running || config->sample_time != sensor_state.sample_time
+            || config->sample_count != sensor_state.sample_count) {
+            const sensor_control_integration_params_t integration_params = {
+                .sample_time = config->sample_time,
+                .sample_count = config->sample_count
+            };
+            ret = sensor_control_set_integration(&integration_params);
+            if (ret != osOK) { break; }
+        }
+
+        if (config->agc_enabled) {
+            if (!running || !sensor_state.agc_enabled
+                || config->agc_sample_count != sensor_state.agc_sample_count) {
+                const sensor_control_agc_params_t agc_params = {
+                    .sample_count = config->agc_sample_count
+                };
+                ret = sensor_control_set_agc_enabled(&agc_params);
+                if (ret != osOK) { break; }
+            }
+        } else if (!running || sensor_state.agc_enabled) {
+            ret = sensor_control_set_agc_disabled();
+            if (ret != osOK) { break; }
+        }
+
+        const sensor_control_light_mode_params_t light_params = {
+            .light = config->light,
+            .next_cycle = config->light_next_cycle,
+            .value = config->light_value
+        };
+        ret = sensor_control_set_light_mode(&light_params);
+    } while (0);
+
+    return ret;
+}
+
 osStatus_t sensor_trigger_next_reading()
 {
     if (!sensor_initialized) { return osErrorResource; }
 
-    osStatus_t result = osOK;
     sensor_control_event_t control_event = {
-        .event_type = SENSOR_CONTROL_TRIGGER_NEXT_READING,
-        .result = &result
+        .event_type = SENSOR_CONTROL_TRIGGER_NEXT_READING
     };
-    osMessageQueuePut(sensor_control_queue, &control_event, 0, portMAX_DELAY);
-    osSemaphoreAcquire(sensor_control_semaphore, portMAX_DELAY);
-    return result;
+    return sensor_control_call(&control_event);
 }
 
 osStatus_t sensor_control_trigger_next_reading()
@@ -937,15 +1184,95 @@ osStatus_t sensor_control_trigger_next_reading()
     return ret;
 }
 
-osStatus_t sensor_get_next_reading(sensor_reading_t *reading, uint32_t timeout)
+void sensor_reading_cursor_init(sensor_reading_cursor_t *cursor)
+{
+    if (!cursor) { return; }
+    cursor->next = sensor_reading_head;
+    cursor->overruns = 0;
+}
+
+osStatus_t sensor_wait_next_reading(sensor_reading_cursor_t *cursor, sensor_reading_t *reading, uint32_t timeout)
 {
     if (!sensor_initialized) { return osErrorResource; }
 
-    if (!reading) {
+    if (!cursor || !reading) {
         return osErrorParameter;
     }
 
-    return osMessageQueueGet(sensor_reading_queue, reading, NULL, timeout);
+    const uint32_t start_ticks = osKernelGetTickCount();
+    do {
+        const uint32_t head = sensor_reading_head;
+        if (sensor_reading_take(cursor, reading)) {
+            return osOK;
+        }
+
+        uint32_t wait_ticks;
+        if (timeout == osWaitForever) {
+            wait_ticks = osWaitForever;
+        } else {
+            const uint32_t elapsed_ticks = osKernelGetTickCount() - start_ticks;
+            if (elapsed_ticks >= timeout) { break; }
+            wait_ticks = timeout - elapsed_ticks;
+        }
+
+        /*
+         * Wait for the head to move on from where it was before the check
+         * above, which returns right away if a reading was published since.
+         */
+        osEventFlagsWait(sensor_reading_flags, SENSOR_READING_FLAGS_ALL & ~SENSOR_READING_FLAG(head),
+            osFlagsWaitAny | osFlagsNoClear, wait_ticks);
+    } while (1);
+
+    return (timeout == 0) ? osErrorResource : osErrorTimeout;
+}
+
+bool sensor_reading_take(sensor_reading_cursor_t *cursor, sensor_reading_t *reading)
+{
+    do {
+        const uint32_t head = sensor_reading_head;
+        const uint32_t floor = sensor_reading_floor;
+
+        /* Skip anything published before the last flush */
+        if ((int32_t)(cursor->next - floor) < 0) {
+            cursor->next = floor;
+        }
+
+        if (cursor->next == head) {
+            return false;
+        }
+
+        /*
+         * The slot after the head may be in the middle of being written,
+         * so only the remaining slots hold readings that are safe to copy.
+         */
+        if (head - cursor->next >= SENSOR_READING_RING_SIZE) {
+            const uint32_t lost = head - cursor->next - (SENSOR_READING_RING_SIZE - 1);
+            cursor->overruns += lost;
+            taskENTER_CRITICAL();
+            sensor_reading_overruns += lost;
+            taskEXIT_CRITICAL();
+            cursor->next = head - (SENSOR_READING_RING_SIZE - 1);
+        }
+
+        *reading = sensor_reading_ring[cursor->next % SENSOR_READING_RING_SIZE];
+        __DMB();
+
+        /* Make sure the slot was not overwritten while it was being copied */
+        if (sensor_reading_head - cursor->next < SENSOR_READING_RING_SIZE) {
+            cursor->next++;
+            return true;
+        }
+    } while (1);
+}
+
+void sensor_get_reading_stats(sensor_reading_stats_t *stats)
+{
+    if (!stats) { return; }
+
+    taskENTER_CRITICAL();
+    stats->published = sensor_reading_head;
+    stats->overruns = sensor_reading_overruns;
+    taskEXIT_CRITICAL();
 }
 
 osStatus_t sensor_read_temperature(float *temp_c)
@@ -953,18 +1280,13 @@ osStatus_t sensor_read_temperature(float *temp_c)
     if (!temp_sensor_initialized) { return osErrorResource; }
     if (!temp_c) { return osErrorParameter; }
 
-    osStatus_t result = osOK;
     sensor_control_event_t control_event = {
         .event_type = SENSOR_CONTROL_READ_TEMPERATURE,
-        .result = &result,
         .read_temperature = {
             .temp_c = temp_c
         }
     };
-
-    osMessageQueuePut(sensor_control_queue, &control_event, 0, portMAX_DELAY);
-    osSemaphoreAcquire(sensor_control_semaphore, portMAX_DELAY);
-    return result;
+    return sensor_control_call(&control_event);
 }
 
 osStatus_t sensor_control_read_temperature(sensor_control_read_temperature_params_t *params)
@@ -974,9 +1296,172 @@ osStatus_t sensor_control_read_temperature(sensor_control_read_temperature_param
 
     ret = mcp9808_read_temperature(&hi2c1, params->temp_c);
 
+    if (ret == HAL_OK) {
+        /* A direct read is the most current value, so restart the filter from it */
+        sensor_temp_update(*(params->temp_c), true);
+    }
+
     return hal_to_os_status(ret);
 }
 
+osStatus_t sensor_set_temperature_sampling(uint32_t interval_ms, mcp9808_resolution_t resolution)
+{
+    if (!temp_sensor_initialized) { return osErrorResource; }
+    if (resolution > MCP9808_RESOLUTION_00625C) { return osErrorParameter; }
+
+    sensor_control_event_t control_event = {
+        .event_type = SENSOR_CONTROL_SET_TEMPERATURE_SAMPLING,
+        .temperature_sampling = {
+            .interval_ms = interval_ms,
+            .resolution = resolution
+        }
+    };
+    return sensor_control_call(&control_event);
+}
+
+osStatus_t sensor_control_set_temperature_sampling(const sensor_control_temperature_sampling_params_t *params)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+    log_d("sensor_control_set_temperature_sampling: %ldms, res=%d", params->interval_ms, params->resolution);
+
+    if (params->resolution != sensor_temp_resolution) {
+        ret = mcp9808_set_resolution(&hi2c1, params->resolution);
+        if (ret != HAL_OK) {
+            return hal_to_os_status(ret);
+        }
+        sensor_temp_resolution = params->resolution;
+
+        /* Samples taken at the old resolution should not be mixed with new ones */
+        taskENTER_CRITICAL();
+        sensor_temp_valid = false;
+        taskEXIT_CRITICAL();
+    }
+
+    sensor_temp_interval_ms = params->interval_ms;
+    sensor_temp_next_ticks = osKernelGetTickCount() + pdMS_TO_TICKS(sensor_temp_interval_ms);
+
+    return osOK;
+}
+
+uint32_t sensor_temp_sample_timeout()
+{
+    if (!temp_sensor_initialized || sensor_temp_interval_ms == 0) {
+        return osWaitForever;
+    }
+
+    const uint32_t ticks = osKernelGetTickCount();
+    if (!TIME_AFTER(sensor_temp_next_ticks, ticks)) {
+        return 0;
+    }
+    return sensor_temp_next_ticks - ticks;
+}
+
+void sensor_temp_sample_poll()
+{
+    float temp_c;
+
+    if (!temp_sensor_initialized || sensor_temp_interval_ms == 0) {
+        return;
+    }
+
+    const uint32_t ticks = osKernelGetTickCount();
+    if (TIME_AFTER(sensor_temp_next_ticks, ticks)) {
+        return;
+    }
+    sensor_temp_next_ticks = ticks + pdMS_TO_TICKS(sensor_temp_interval_ms);
+
+    if (mcp9808_read_temperature(&hi2c1, &temp_c) != HAL_OK) {
+        log_w("Background temperature read error");
+        return;
+    }
+
+    sensor_temp_update(temp_c, false);
+}
+
+void sensor_temp_update(float temp_c, bool reset)
+{
+    const uint32_t ticks = osKernelGetTickCount();
+
+    taskENTER_CRITICAL();
+    if (reset || !sensor_temp_valid) {
+        sensor_temp_filtered_c = temp_c;
+    } else {
+        sensor_temp_filtered_c += (temp_c - sensor_temp_filtered_c) * SENSOR_TEMP_FILTER_ALPHA;
+    }
+    sensor_temp_sample_ticks = ticks;
+    sensor_temp_valid = true;
+    taskEXIT_CRITICAL();
+}
+
+osStatus_t sensor_get_cached_temperature(float *temp_c, uint32_t *age_ms)
+{
+    if (!temp_c) { return osErrorParameter; }
+
+    const uint32_t ticks = osKernelGetTickCount();
+    bool valid;
+    float value;
+    uint32_t sample_ticks;
+
+    taskENTER_CRITICAL();
+    valid = sensor_temp_valid;
+    value = sensor_temp_filtered_c;
+    sample_ticks = sensor_temp_sample_ticks;
+    taskEXIT_CRITICAL();
+
+    if (!valid) { return osErrorResource; }
+
+    *temp_c = value;
+    if (age_ms) {
+        *age_ms = (uint32_t)(((uint64_t)(ticks - sample_ticks) * 1000ULL) / osKernelGetTickFreq());
+    }
+    return osOK;
+}
+
+osStatus_t sensor_get_temperature(float *temp_c)
+{
+    uint32_t age_ms;
+    float value;
+
+    if (!temp_c) { return osErrorParameter; }
+
+    /*
+     * Use the background sample if it was taken within two sampling
+     * intervals, which allows for one missed sample before falling
+     * back to a direct read.
+     */
+    if (sensor_temp_interval_ms > 0
+        && sensor_get_cached_temperature(&value, &age_ms) == osOK
+        && age_ms <= sensor_temp_interval_ms * 2) {
+        *temp_c = value;
+        return osOK;
+    }
+
+    return sensor_read_temperature(temp_c);
+}
+
+void sensor_get_control_stats(sensor_control_stats_t *stats)
+{
+    if (!stats) { return; }
+
+    taskENTER_CRITICAL();
+    stats->call_count = sensor_control_stats.call_count;
+    stats->latency_max_us = sensor_control_stats.latency_max_us;
+    stats->latency_avg_us = (sensor_control_stats.call_count > 0)
+        ? (uint32_t)(sensor_control_total_us / sensor_control_stats.call_count) : 0;
+    taskEXIT_CRITICAL();
+}
+
+void sensor_get_interrupt_stats(sensor_interrupt_stats_t *stats)
+{
+    if (!stats) { return; }
+
+    taskENTER_CRITICAL();
+    stats->blackout_max_us = sensor_interrupt_stats.blackout_max_us;
+    stats->capture_max_us = sensor_interrupt_stats.capture_max_us;
+    stats->latency_max_ticks = sensor_interrupt_stats.latency_max_ticks;
+    taskEXIT_CRITICAL();
+}
+
 void sensor_int_handler()
 {
     if (!sensor_initialized) { return; }
@@ -989,6 +1474,7 @@ void sensor_int_handler()
     };
 
     /* Apply any pending light change values */
+    const uint32_t blackout_start = timestamp_us();
     UBaseType_t interrupt_status = taskENTER_CRITICAL_FROM_ISR();
     if ((pending_int_light_change & 0x80000000) == 0x80000000) {
         const sensor_light_t light = (pending_int_light_change & 0x00FF0000) >> 16;
@@ -1001,18 +1487,25 @@ void sensor_int_handler()
     control_event.interrupt.reading_count = ++reading_count;
     taskEXIT_CRITICAL_FROM_ISR(interrupt_status);
 
-    osMessageQueuePut(sensor_control_queue, &control_event, 0, 0);
+    const uint32_t blackout_elapsed = timestamp_us() - blackout_start;
+    if (blackout_elapsed > sensor_interrupt_stats.blackout_max_us) {
+        sensor_interrupt_stats.blackout_max_us = blackout_elapsed;
+    }
+
+    /*
+     * Put interrupt events at the front of the queue, so they are handled
+     * ahead of any control calls that are still waiting to be processed.
+     */
+    BaseType_t task_woken = pdFALSE;
+    xQueueSendToFrontFromISR((QueueHandle_t)sensor_control_queue, &control_event, &task_woken);
+    portYIELD_FROM_ISR(task_woken);
 }
 
 osStatus_t sensor_control_interrupt(const sensor_control_interrupt_params_t *params)
 {
     HAL_StatusTypeDef ret = HAL_OK;
     uint8_t status = 0;
-    sensor_reading_t reading = {0};
-    bool has_reading = false;
-
-    /* Prevent task switching to ensure fast processing of incoming sensor data */
-    vTaskSuspendAll();
+    size_t fifo_count = 0;
 
 #if 0
     log_d("sensor_control_interrupt");
@@ -1022,149 +1515,253 @@ osStatus_t sensor_control_interrupt(const sensor_control_interrupt_params_t *par
         log_w("Unexpected sensor interrupt!");
     }
 
+    /*
+     * Capture the interrupt status and FIFO contents as quickly as possible.
+     * Other tasks are free to run while the I2C transfers are in progress,
+     * since nothing else can touch the sensor until this task is done.
+     */
+    const uint32_t capture_start = timestamp_us();
+    ret = sensor_control_capture(&status, &fifo_count);
+    const uint32_t capture_end = timestamp_us();
+
+    sensor_interrupt_stats.capture_max_us = MAX(sensor_interrupt_stats.capture_max_us, capture_end - capture_start);
+    sensor_interrupt_stats.latency_max_ticks = MAX(sensor_interrupt_stats.latency_max_ticks, osKernelGetTickCount() - params->sensor_ticks);
+
+    if (ret != HAL_OK || fifo_count == 0) {
+        return hal_to_os_status(ret);
+    }
+
+    /* Process the captured data */
+    uint32_t elapsed_ticks = params->sensor_ticks - last_aint_ticks;
+    last_aint_ticks = params->sensor_ticks;
+
+    /*
+     * The individual cycle completion times of a batch are not known,
+     * so spread them evenly across the time since the last interrupt,
+     * ending with the most recent one.
+     */
+    elapsed_ticks /= fifo_count;
+
+    /*
+     * If AGC was just disabled, then reset the gain to its last
+     * known value and ignore the reading. This is necessary because
+     * disabling AGC on its own seems to reset the gain to a low
+     * default, and attempting to set it immediately after setting
+     * the registers to disable AGC does not seem to take.
+     * The gain is restored before publishing the captured readings,
+     * so it is in place before a consumer can trigger the next cycle.
+     */
+    bool gain_restored = false;
+    if (sensor_state.agc_disabled_reset_gain) {
+        ret = sensor_control_restore_gain();
+        gain_restored = (ret == HAL_OK);
+    }
+
+    const uint8_t data_size = sensor_state.dual_mod ? SENSOR_FIFO_RECORD_SIZE_DUAL : SENSOR_FIFO_RECORD_SIZE;
+    for (size_t i = 0; i < fifo_count; i++) {
+        tsl2585_fifo_data_t fifo_data;
+        sensor_reading_t reading = {0};
+
+        sensor_control_parse_fifo_record(sensor_fifo_buf + (i * data_size), &fifo_data);
+        sensor_control_fill_reading(&fifo_data, &reading);
+
+        /* Every cycle counts towards the reading count, even if discarded */
+        const uint32_t cycle_count = sensor_state.fifo_batch_active
+            ? ++sensor_state.fifo_reading_count : params->reading_count;
+
+        if (!sensor_state.discard_next_reading) {
+            /* Fill out other reading fields */
+            reading.sample_time = sensor_state.sample_time;
+            reading.sample_count = sensor_state.sample_count;
+            reading.reading_ticks = params->sensor_ticks - ((fifo_count - 1 - i) * elapsed_ticks);
+            reading.elapsed_ticks = elapsed_ticks;
+            reading.light_ticks = params->light_ticks;
+            reading.reading_count = cycle_count;
+
+            sensor_control_publish_reading(&reading);
+        } else {
+            sensor_state.discard_next_reading = false;
+        }
+    }
+
+    if (gain_restored) {
+        sensor_state.agc_disabled_reset_gain = false;
+        if (sensor_state.trigger_mode != TSL2585_TRIGGER_VSYNC) {
+            sensor_state.discard_next_reading = true;
+        }
+    }
+
+    return hal_to_os_status(ret);
+}
+
+HAL_StatusTypeDef sensor_control_restore_gain()
+{
+    HAL_StatusTypeDef ret;
+
+    ret = tsl2585_set_mod_gain(&hi2c1, TSL2585_MOD0, TSL2585_STEP0, sensor_state.gain[0]);
+    if (ret == HAL_OK && sensor_state.dual_mod) {
+        ret = tsl2585_set_mod_gain(&hi2c1, TSL2585_MOD1, TSL2585_STEP0, sensor_state.gain[1]);
+    }
+
+    return ret;
+}
+
+HAL_StatusTypeDef sensor_control_capture(uint8_t *status, size_t *fifo_count)
+{
+    HAL_StatusTypeDef ret = HAL_OK;
+
+    *status = 0;
+    *fifo_count = 0;
+
     do {
         /* Get the interrupt status */
-        ret = tsl2585_get_status(&hi2c1, &status);
+        ret = tsl2585_get_status(&hi2c1, status);
         if (ret != HAL_OK) { break; }
 
 #if 0
         /* Log interrupt flags */
         log_d("MINT=%d, AINT=%d, FINT=%d, SINT=%d",
-            (status & TSL2585_STATUS_MINT) != 0,
-            (status & TSL2585_STATUS_AINT) != 0,
-            (status & TSL2585_STATUS_FINT) != 0,
-            (status & TSL2585_STATUS_SINT) != 0);
+            (*status & TSL2585_STATUS_MINT) != 0,
+            (*status & TSL2585_STATUS_AINT) != 0,
+            (*status & TSL2585_STATUS_FINT) != 0,
+            (*status & TSL2585_STATUS_SINT) != 0);
 #endif
 
-        if ((status & TSL2585_STATUS_AINT) != 0) {
-            uint32_t elapsed_ticks = params->sensor_ticks - last_aint_ticks;
-            last_aint_ticks = params->sensor_ticks;
+        if (sensor_state.fifo_batch_active && (*status & TSL2585_STATUS_FINT) != 0) {
+            ret = sensor_control_read_fifo_batch(fifo_count);
+            if (ret != HAL_OK) { break; }
+        } else if (!sensor_state.fifo_batch_active && (*status & TSL2585_STATUS_AINT) != 0) {
+            ret = sensor_control_read_fifo(sensor_fifo_buf);
+            if (ret != HAL_OK) { break; }
+            *fifo_count = 1;
+        }
+    } while (0);
 
-            tsl2585_fifo_data_t fifo_data;
+    /* Clear the interrupt status */
+    if (*status != 0) {
+        HAL_StatusTypeDef clear_ret = tsl2585_set_status(&hi2c1, *status);
+        if (ret == HAL_OK) { ret = clear_ret; }
+    }
 
-            ret = sensor_control_read_fifo(&fifo_data);
-            if (ret != HAL_OK) { break; }
+    if (ret != HAL_OK) {
+        *fifo_count = 0;
+    }
+
+    return ret;
+}
 
-            if ((fifo_data.als_status & TSL2585_ALS_DATA0_ANALOG_SATURATION_STATUS) != 0) {
+void sensor_control_fill_reading(const tsl2585_fifo_data_t *fifo_data, sensor_reading_t *reading)
+{
+    if ((fifo_data->als_status & TSL2585_ALS_DATA0_ANALOG_SATURATION_STATUS) != 0) {
 #if 0
-                log_d("TSL2585: [0:analog saturation]");
+        log_d("TSL2585: [0:analog saturation]");
 #endif
-                reading.mod0.als_data = UINT32_MAX;
-                reading.mod0.gain = sensor_state.gain[0];
-                reading.mod0.result = SENSOR_RESULT_SATURATED_ANALOG;
-            } else {
-                tsl2585_gain_t als_gain = (fifo_data.als_status2 & 0x0F);
+        reading->mod0.als_data = UINT32_MAX;
+        reading->mod0.gain = sensor_state.gain[0];
+        reading->mod0.result = SENSOR_RESULT_SATURATED_ANALOG;
+    } else {
+        tsl2585_gain_t als_gain = (fifo_data->als_status2 & 0x0F);
 
-                /* If AGC is enabled, then update the configured gain value */
-                if (sensor_state.agc_enabled) {
-                    sensor_state.gain[0] = als_gain;
-                }
+        /* If AGC is enabled, then update the configured gain value */
+        if (sensor_state.agc_enabled) {
+            sensor_state.gain[0] = als_gain;
+        }
 
-                reading.mod0.als_data = fifo_data.als_data0;
-                reading.mod0.gain = als_gain;
-                reading.mod0.result = SENSOR_RESULT_VALID;
+        reading->mod0.als_data = fifo_data->als_data0;
+        reading->mod0.gain = als_gain;
+        reading->mod0.result = SENSOR_RESULT_VALID;
 
-                /* If in UV mode, apply the UV calibration value */
-                if (sensor_state.sensor_mode == SENSOR_MODE_UV) {
-                    reading.mod0.als_data= lroundf(
-                        (float)reading.mod0.als_data
-                        / (1.0F - (((float)sensor_state.uv_calibration - 127.0F) / 100.0F)));
-                }
-            }
+        /* If in UV mode, apply the UV calibration value */
+        if (sensor_state.sensor_mode == SENSOR_MODE_UV || sensor_state.sensor_mode == SENSOR_MODE_UV_DUAL) {
+            reading->mod0.als_data = sensor_apply_uv_calibration(reading->mod0.als_data);
+        }
+    }
 
-            if (sensor_state.dual_mod) {
-                if ((fifo_data.als_status & TSL2585_ALS_DATA1_ANALOG_SATURATION_STATUS) != 0) {
+    if (sensor_state.dual_mod) {
+        if ((fifo_data->als_status & TSL2585_ALS_DATA1_ANALOG_SATURATION_STATUS) != 0) {
 #if 0
-                    log_d("TSL2585: [1:analog saturation]");
+            log_d("TSL2585: [1:analog saturation]");
 #endif
-                    reading.mod1.als_data = UINT32_MAX;
-                    reading.mod1.gain = sensor_state.gain[1];
-                    reading.mod1.result = SENSOR_RESULT_SATURATED_ANALOG;
-                } else {
-                    tsl2585_gain_t als_gain = (fifo_data.als_status2 & 0xF0) >> 4;
-
-                    reading.mod1.als_data = fifo_data.als_data1;
-                    reading.mod1.gain = als_gain;
-                    reading.mod1.result = SENSOR_RESULT_VALID;
-
-                    /* If in UV mode, apply the UV calibration value */
-                    if (sensor_state.sensor_mode == SENSOR_MODE_UV) {
-                        reading.mod1.als_data = lroundf(
-                            (float)reading.mod1.als_data
-                            / (1.0F - (((float)sensor_state.uv_calibration - 127.0F) / 100.0F)));
-                    }
-                }
-            }
-
-            if (!sensor_state.discard_next_reading) {
-                /* Fill out other reading fields */
-                reading.sample_time = sensor_state.sample_time;
-                reading.sample_count = sensor_state.sample_count;
-                reading.reading_ticks = params->sensor_ticks;
-                reading.elapsed_ticks = elapsed_ticks;
-                reading.light_ticks = params->light_ticks;
-                reading.reading_count = params->reading_count;
+            reading->mod1.als_data = UINT32_MAX;
+            reading->mod1.gain = sensor_state.gain[1];
+            reading->mod1.result = SENSOR_RESULT_SATURATED_ANALOG;
+        } else {
+            tsl2585_gain_t als_gain = (fifo_data->als_status2 & 0xF0) >> 4;
 
-                has_reading = true;
-            } else {
-                sensor_state.discard_next_reading = false;
+            /* If AGC is enabled, then update the configured gain value */
+            if (sensor_state.agc_enabled) {
+                sensor_state.gain[1] = als_gain;
             }
 
-            /*
-             * If AGC was just disabled, then reset the gain to its last
-             * known value and ignore the reading. This is necessary because
-             * disabling AGC on its own seems to reset the gain to a low
-             * default, and attempting to set it immediately after setting
-             * the registers to disable AGC does not seem to take.
-             */
-            if (sensor_state.agc_disabled_reset_gain) {
-                ret = tsl2585_set_mod_gain(&hi2c1, TSL2585_MOD0, TSL2585_STEP0, sensor_state.gain[0]);
-                if (ret != HAL_OK) { break; }
-                sensor_state.agc_disabled_reset_gain = false;
-                if (sensor_state.trigger_mode != TSL2585_TRIGGER_VSYNC) {
-                    sensor_state.discard_next_reading = true;
-                }
+            reading->mod1.als_data = fifo_data->als_data1;
+            reading->mod1.gain = als_gain;
+            reading->mod1.result = SENSOR_RESULT_VALID;
+
+            /* If in UV mode, apply the UV calibration value */
+            if (sensor_state.sensor_mode == SENSOR_MODE_UV || sensor_state.sensor_mode == SENSOR_MODE_UV_DUAL) {
+                reading->mod1.als_data = sensor_apply_uv_calibration(reading->mod1.als_data);
             }
         }
+    }
+}
 
-        /* Clear the interrupt status */
-        ret = tsl2585_set_status(&hi2c1, status);
-        if (ret != HAL_OK) { break; }
-    } while (0);
-
-    /* Resume normal task switching */
-    xTaskResumeAll();
+uint32_t sensor_apply_uv_calibration(uint32_t als_data)
+{
+#ifdef USE_FIXED_POINT_DENSITY
+    /*
+     * The calibration divisor of (1 - ((uv_calibration - 127) / 100))
+     * reduces to the integer ratio of 100 / (227 - uv_calibration).
+     */
+    const int32_t den = 227 - (int32_t)sensor_state.uv_calibration;
+    if (den <= 0) { return als_data; }
+    return fixed_muldiv_u32(als_data, 100, (uint32_t)den);
+#else
+    return lroundf(
+        (float)als_data
+        / (1.0F - (((float)sensor_state.uv_calibration - 127.0F) / 100.0F)));
+#endif
+}
 
-    if (has_reading) {
+void sensor_control_publish_reading(const sensor_reading_t *reading)
+{
 #if 1
-        if (sensor_state.dual_mod) {
-            log_d("TSL2585[%d]: MOD=[%lu,%lu], Gain=[%s,%s], Time=%.2fms",
-                reading.reading_count,
-                reading.mod0.als_data, reading.mod1.als_data,
-                tsl2585_gain_str(reading.mod0.gain), tsl2585_gain_str(reading.mod1.gain),
-                tsl2585_integration_time_ms(sensor_state.sample_time, sensor_state.sample_count));
-        } else {
-            log_d("TSL2585[%d]: MOD0=%lu, Gain=[%s], Time=%.2fms",
-                reading.reading_count,
-                reading.mod0.als_data, tsl2585_gain_str(reading.mod0.gain),
-                tsl2585_integration_time_ms(sensor_state.sample_time, sensor_state.sample_count));
-        }
+    if (sensor_state.dual_mod) {
+        log_d("TSL2585[%d]: MOD=[%lu,%lu], Gain=[%s,%s], Time=%.2fms",
+            reading->reading_count,
+            reading->mod0.als_data, reading->mod1.als_data,
+            tsl2585_gain_str(reading->mod0.gain), tsl2585_gain_str(reading->mod1.gain),
+            tsl2585_integration_time_ms(sensor_state.sample_time, sensor_state.sample_count));
+    } else {
+        log_d("TSL2585[%d]: MOD0=%lu, Gain=[%s], Time=%.2fms",
+            reading->reading_count,
+            reading->mod0.als_data, tsl2585_gain_str(reading->mod0.gain),
+            tsl2585_integration_time_ms(sensor_state.sample_time, sensor_state.sample_count));
+    }
 #endif
-        cdc_send_raw_sensor_reading(&reading);
+    cdc_send_raw_sensor_reading(reading);
 
-        QueueHandle_t queue = (QueueHandle_t)sensor_reading_queue;
-        xQueueOverwrite(queue, &reading);
-    }
+    /* Fill the slot before making it visible to consumers */
+    const uint32_t head = sensor_reading_head;
+    sensor_reading_ring[head % SENSOR_READING_RING_SIZE] = *reading;
+    __DMB();
+    sensor_reading_head = head + 1;
 
-    return hal_to_os_status(ret);
+    /* Move the flag to the new head position, waking up every waiting consumer */
+    osEventFlagsSet(sensor_reading_flags, SENSOR_READING_FLAG(head + 1));
+    osEventFlagsClear(sensor_reading_flags, SENSOR_READING_FLAGS_ALL & ~SENSOR_READING_FLAG(head + 1));
 }
 
-HAL_StatusTypeDef sensor_control_read_fifo(tsl2585_fifo_data_t *fifo_data)
+void sensor_control_flush_readings()
+{
+    /* Readings published before this point are skipped by consumers */
+    sensor_reading_floor = sensor_reading_head;
+}
+
+HAL_StatusTypeDef sensor_control_read_fifo(uint8_t *data)
 {
     HAL_StatusTypeDef ret;
     tsl2585_fifo_status_t fifo_status;
-    uint8_t data[11];
-    const uint8_t data_size = sensor_state.dual_mod ? 11 : 7;
+    const uint8_t data_size = sensor_state.dual_mod ? SENSOR_FIFO_RECORD_SIZE_DUAL : SENSOR_FIFO_RECORD_SIZE;
 
     do {
         ret = tsl2585_get_fifo_status(&hi2c1, &fifo_status);
@@ -1181,61 +1778,103 @@ HAL_StatusTypeDef sensor_control_read_fifo(tsl2585_fifo_data_t *fifo_data)
         }
 
         ret = tsl2585_read_fifo(&hi2c1, data, data_size);
+    } while (0);
+
+    return ret;
+}
+
+HAL_StatusTypeDef sensor_control_read_fifo_batch(size_t *count)
+{
+    HAL_StatusTypeDef ret;
+    tsl2585_fifo_status_t fifo_status;
+    const uint8_t data_size = sensor_state.dual_mod ? SENSOR_FIFO_RECORD_SIZE_DUAL : SENSOR_FIFO_RECORD_SIZE;
+    size_t record_count = 0;
+
+    do {
+        ret = tsl2585_get_fifo_status(&hi2c1, &fifo_status);
         if (ret != HAL_OK) { break; }
 
-        if (fifo_data) {
-            fifo_data->als_data0 =
-                (uint32_t)data[3] << 24
-                | (uint32_t)data[2] << 16
-                | (uint32_t)data[1] << 8
-                | (uint32_t)data[0];
-
-            if (sensor_state.dual_mod) {
-                fifo_data->als_data1 =
-                    (uint32_t)data[7] << 24
-                    | (uint32_t)data[6] << 16
-                    | (uint32_t)data[5] << 8
-                    | (uint32_t)data[4];
-                fifo_data->als_status = data[8];
-                fifo_data->als_status2 = data[9];
-                fifo_data->als_status3 = data[10];
-            } else {
-                fifo_data->als_data1 = 0;
-                fifo_data->als_status = data[4];
-                fifo_data->als_status2 = data[5];
-                fifo_data->als_status3 = data[6];
-            }
+#if 0
+        log_d("FIFO_STATUS: OVERFLOW=%d, UNDERFLOW=%d, LEVEL=%d", fifo_status.overflow, fifo_status.underflow, fifo_status.level);
+#endif
+
+        if (fifo_status.overflow) {
+            /* Record boundaries are lost on overflow, so start over */
+            log_w("FIFO overflow, level=%d", fifo_status.level);
+            ret = tsl2585_clear_fifo(&hi2c1);
+            break;
+        }
+
+        /*
+         * Read out all the complete records in a single burst,
+         * leaving any incomplete record for the next interrupt.
+         */
+        record_count = fifo_status.level / data_size;
+        if (record_count > SENSOR_FIFO_BATCH_MAX) {
+            record_count = SENSOR_FIFO_BATCH_MAX;
+        }
+        if (record_count == 0) { break; }
+
+        ret = tsl2585_read_fifo(&hi2c1, sensor_fifo_buf, record_count * data_size);
+        if (ret != HAL_OK) {
+            record_count = 0;
+            break;
         }
     } while (0);
 
+    *count = record_count;
     return ret;
 }
 
-HAL_StatusTypeDef sensor_control_set_mod_photodiode_smux(sensor_mode_t mode)
+void sensor_control_parse_fifo_record(const uint8_t *data, tsl2585_fifo_data_t *fifo_data)
 {
-    const tsl2585_modulator_t *sensor_phd_mod;
-    switch (mode) {
-    case SENSOR_MODE_DEFAULT:
-        sensor_phd_mod = sensor_phd_mod_default;
-        break;
-    case SENSOR_MODE_VIS:
-        sensor_phd_mod = sensor_phd_mod_vis;
-        break;
-    case SENSOR_MODE_UV:
-        sensor_phd_mod = sensor_phd_mod_uv;
-        break;
-    case SENSOR_MODE_VIS_DUAL:
-        sensor_phd_mod = sensor_phd_mod_vis_dual;
-        break;
-    case SENSOR_MODE_UV_DUAL:
-        sensor_phd_mod = sensor_phd_mod_uv_dual;
-        break;
-    default:
-        log_w("Invalid smux setting: %d", mode);
+    fifo_data->als_data0 =
+        (uint32_t)data[3] << 24
+        | (uint32_t)data[2] << 16
+        | (uint32_t)data[1] << 8
+        | (uint32_t)data[0];
+
+    if (sensor_state.dual_mod) {
+        fifo_data->als_data1 =
+            (uint32_t)data[7] << 24
+            | (uint32_t)data[6] << 16
+            | (uint32_t)data[5] << 8
+            | (uint32_t)data[4];
+        fifo_data->als_status = data[8];
+        fifo_data->als_status2 = data[9];
+        fifo_data->als_status3 = data[10];
+    } else {
+        fifo_data->als_data1 = 0;
+        fifo_data->als_status = data[4];
+        fifo_data->als_status2 = data[5];
+        fifo_data->als_status3 = data[6];
+    }
+}
+
+HAL_StatusTypeDef sensor_control_apply_preset(sensor_mode_t mode, bool running)
+{
+    if (mode >= sizeof(sensor_presets) / sizeof(tsl2585_preset_t)) {
+        log_w("Invalid sensor mode: %d", mode);
         return HAL_ERROR;
     }
 
-    return tsl2585_set_mod_photodiode_smux(&hi2c1, TSL2585_STEP0, sensor_phd_mod);
+    tsl2585_preset_t preset = sensor_presets[mode];
+
+    /*
+     * Switching between single and dual modulator modes only takes effect
+     * on the next start, so keep the current modulator and FIFO setup
+     * if the sensor is already running.
+     */
+    if (running) {
+        preset.mods = TSL2585_MOD0 | (sensor_state.dual_mod ? TSL2585_MOD1 : 0);
+    }
+
+    /* In batched readout, only interrupt once the FIFO threshold is reached */
+    if (sensor_state.fifo_batch_active) {
+        preset.interrupt_enable = TSL2585_INTENAB_FIEN;
+    }
+
+    return tsl2585_apply_preset(&hi2c1, &preset, sensor_state.trigger_mode);
 }
 
 void sensor_set_vsync_state(bool state)
@@ -10,8 +10,59 @@
 
 #include "stm32l0xx_hal.h"
 #include "tsl2585.h"
+#include "mcp9808.h"
 #include "sensor.h"
 
+/**
+ * Timing statistics for the sensor interrupt path
+ */
+typedef struct {
+    uint32_t blackout_max_us;   /*!< Longest time task switching was blocked by the sensor interrupt */
+    uint32_t capture_max_us;    /*!< Longest time spent capturing the sensor status and FIFO data */
+    uint32_t latency_max_ticks; /*!< Longest delay from the sensor interrupt to the end of capture */
+} sensor_interrupt_stats_t;
+
+/**
+ * Round trip timing statistics for sensor control calls
+ */
+typedef struct {
+    uint32_t call_count;     /*!< Number of control calls made since startup */
+    uint32_t latency_avg_us; /*!< Average time from posting a call to its completion */
+    uint32_t latency_max_us; /*!< Longest time from posting a call to its completion */
+} sensor_control_stats_t;
+
+/**
+ * Read position of a consumer of sensor readings
+ */
+typedef struct {
+    uint32_t next;     /*!< Index of the next reading to be read */
+    uint32_t overruns; /*!< Number of readings overwritten before this consumer could read them */
+} sensor_reading_cursor_t;
+
+/**
+ * Delivery statistics for sensor readings
+ */
+typedef struct {
+    uint32_t published; /*!< Total number of readings published since startup */
+    uint32_t overruns;  /*!< Total number of readings lost by all consumers */
+} sensor_reading_stats_t;
+
+/**
+ * Complete sensor configuration, for use with 'sensor_configure()'
+ */
+typedef struct {
+    sensor_mode_t mode;                  /*!< Sensor spectrum selection */
+    tsl2585_trigger_mode_t trigger_mode; /*!< Sensor trigger mode */
+    tsl2585_gain_t gain[2];              /*!< ADC gain of the MOD0 and MOD1 modulators */
+    uint16_t sample_time;                /*!< Duration of each sample in an integration cycle */
+    uint16_t sample_count;               /*!< Number of samples in an integration cycle */
+    bool agc_enabled;                    /*!< Whether automatic gain control is enabled */
+    uint16_t agc_sample_count;           /*!< Number of samples in an AGC integration cycle */
+    sensor_light_t light;                /*!< Light source to turn on */
+    uint16_t light_value;                /*!< Value to set on the light source */
+    bool light_next_cycle;               /*!< Whether to delay the light change until the next cycle */
+} sensor_config_t;
+
 /**
  * Start the sensor task.
  *
@@ -58,6 +109,22 @@ osStatus_t sensor_set_mode(sensor_mode_t mode);
  */
 osStatus_t sensor_set_trigger_mode(tsl2585_trigger_mode_t trigger_mode);
 
+/**
+ * Set the number of integration cycles to batch in the sensor's FIFO
+ *
+ * With a batch size greater than 1, the sensor only interrupts once
+ * the FIFO contains that many integration cycles, which are then read
+ * out together and delivered as individual readings. This makes it
+ * possible to run with short integration times without overflowing
+ * the FIFO.
+ *
+ * Batching only applies to continuous trigger modes, and takes effect
+ * the next time the sensor is started.
+ *
+ * @param count Number of integration cycles per FIFO readout (1-16)
+ */
+osStatus_t sensor_set_fifo_batch(uint8_t count);
+
 /**
  * Set the sensor's gain and integration time
  *
@@ -70,6 +137,18 @@ osStatus_t sensor_set_trigger_mode(tsl2585_trigger_mode_t trigger_mode);
  */
 osStatus_t sensor_set_config(tsl2585_gain_t gain, uint16_t sample_time, uint16_t sample_count);
 
+/**
+ * Apply a complete sensor configuration in a single transaction
+ *
+ * This is equivalent to calling the individual setter functions for
+ * each part of the configuration, but only involves a single round trip
+ * to the sensor task. If the sensor is running, only the parts of the
+ * configuration that differ from the current state are written to it.
+ *
+ * @param config Sensor configuration to apply
+ */
+osStatus_t sensor_configure(const sensor_config_t *config);
+
 /**
  * Set the sensor's gain
  *
@@ -124,15 +203,37 @@ osStatus_t sensor_set_light_mode(sensor_light_t light, bool next_cycle, uint16_t
 osStatus_t sensor_trigger_next_reading();
 
 /**
- * Get the next reading from the sensor.
+ * Initialize a cursor for reading sensor readings.
+ *
+ * The cursor starts out positioned after the most recent reading,
+ * so only readings published after this call will be returned.
+ * Readings published before the sensor is started or reconfigured
+ * are always skipped.
+ *
+ * @param cursor Cursor to initialize
+ */
+void sensor_reading_cursor_init(sensor_reading_cursor_t *cursor);
+
+/**
+ * Get the next reading from the sensor, in the order they were published.
  * If no reading is currently available, then this function will block
  * until the completion of the next sensor integration cycle.
  *
+ * Each consumer must use its own cursor. If a consumer falls too far
+ * behind, the oldest readings are lost and counted as overruns on the
+ * cursor.
+ *
+ * @param cursor Read position of the consumer
  * @param reading Sensor reading data
  * @param timeout Amount of time to wait for a reading to become available
  * @return osOK on success, osErrorTimeout on timeout
  */
-osStatus_t sensor_get_next_reading(sensor_reading_t *reading, uint32_t timeout);
+osStatus_t sensor_wait_next_reading(sensor_reading_cursor_t *cursor, sensor_reading_t *reading, uint32_t timeout);
+
+/**
+ * Get the delivery statistics for sensor readings, collected since startup.
+ */
+void sensor_get_reading_stats(sensor_reading_stats_t *stats);
 
 /**
 * Get the current sensor head temperature reading.
@@ -144,6 +245,54 @@ osStatus_t sensor_get_next_reading(sensor_reading_t *reading, uint32_t timeout);
 */
 osStatus_t sensor_read_temperature(float *temp_c);
 
+/**
+ * Configure background sampling of the sensor head temperature.
+ *
+ * The sensor task periodically reads the temperature sensor whenever
+ * it is otherwise idle, and keeps a filtered copy of the result that
+ * can be read without a round trip to the sensor task. Changing the
+ * resolution discards the previously filtered value.
+ *
+ * @param interval_ms Time between samples, or 0 to disable sampling
+ * @param resolution Temperature sensor resolution
+ */
+osStatus_t sensor_set_temperature_sampling(uint32_t interval_ms, mcp9808_resolution_t resolution);
+
+/**
+ * Get the most recent filtered sensor head temperature.
+ *
+ * This function does not block, and only returns the value cached from
+ * background sampling and direct reads.
+ *
+ * @param temp_c Filtered sensor head temperature in Celsius
+ * @param age_ms Time since the most recent sample, may be NULL
+ * @return osOK on success, osErrorResource if no sample is available
+ */
+osStatus_t sensor_get_cached_temperature(float *temp_c, uint32_t *age_ms);
+
+/**
+ * Get the sensor head temperature for use in a measurement.
+ *
+ * If background sampling is enabled and its cached value is fresh,
+ * then that value is returned immediately. Otherwise, this falls back
+ * to 'sensor_read_temperature()'.
+ *
+ * @param temp_c Sensor head temperature in Celsius
+ */
+osStatus_t sensor_get_temperature(float *temp_c);
+
+/**
+ * Get the round trip timing statistics for sensor control calls,
+ * collected since startup.
+ */
+void sensor_get_control_stats(sensor_control_stats_t *stats);
+
+/**
+ * Get the worst-case timing statistics for the sensor interrupt path,
+ * collected since startup.
+ */
+void sensor_get_interrupt_stats(sensor_interrupt_stats_t *stats);
+
 /**
  * Sensor interrupt handler.
  */
@@ -6,6 +6,9 @@
 #include <elog.h>
 
 #include <math.h>
+#include <string.h>
+
+#include "i2c_handler.h"
 
 /* I2C device address */
 static const uint8_t TSL2585_ADDRESS = 0x39 << 1; // Use 8-bit address
@@ -153,6 +156,9 @@ static const uint8_t TSL2585_ADDRESS = 0x39 << 1; // Use 8-bit address
 #define TSL2585_CFG0_SAI                 0x40
 #define TSL2585_CFG0_LOWPOWER_IDLE       0x20
 
+/* CFG4 register values */
+#define TSL2585_CFG4_ALS_FIFO_DATA_FORMAT 0x03
+
 /* CONTROL register values */
 #define TSL2585_CONTROL_SOFT_RESET       0x08
 #define TSL2585_CONTROL_FIFO_CLR         0x02
@@ -170,6 +176,64 @@ static const uint8_t TSL2585_ADDRESS = 0x39 << 1; // Use 8-bit address
 #define TSL2585_MEAS_MODE0_MEASUREMENT_SEQUENCER_SINGLE_SHOT_MODE 0x20
 #define TSL2585_MEAS_MODE0_MOD_FIFO_ALS_STATUS_WRITE_ENABLE 0x10
 
+/*
+ * Write-through shadow copy of the configuration registers, used to avoid
+ * reading registers back over the bus for read-modify-write operations,
+ * and to skip writes that would not change the current register value.
+ * Only registers that are never modified by the sensor itself are covered.
+ */
+#define TSL2585_SHADOW_BASE 0x80
+#define TSL2585_SHADOW_SIZE 0x7C
+
+typedef struct {
+    uint8_t reg;
+    uint8_t len;
+} tsl2585_reg_range_t;
+
+static const tsl2585_reg_range_t TSL2585_SHADOW_RANGES[] = {
+    { TSL2585_MEAS_MODE0, 15 },           /* MEAS_MODE0 - AIHT2 */
+    { TSL2585_CFG0, 14 },                 /* CFG0 - TRIGGER_MODE */
+    { TSL2585_INTENAB, 2 },               /* INTENAB - SIEN */
+    { TSL2585_MOD_COMP_CFG1, 25 },        /* MOD_COMP_CFG1 - MOD_CALIB_CFG2 */
+    { TSL2585_MOD_GAIN_H, 1 },            /* MOD_GAIN_H */
+    { TSL2585_VSYNC_PERIOD_TARGET_L, 2 }, /* VSYNC_PERIOD_TARGET_L - VSYNC_PERIOD_TARGET_H */
+    { TSL2585_VSYNC_CFG, 1 },             /* VSYNC_CFG */
+    { TSL2585_MOD_FIFO_DATA_CFG0, 3 }     /* MOD_FIFO_DATA_CFG0 - MOD_FIFO_DATA_CFG2 */
+};
+
+#define TSL2585_SHADOW_RANGE_COUNT (sizeof(TSL2585_SHADOW_RANGES) / sizeof(tsl2585_reg_range_t))
+
+/* Block of consecutive registers written with a single burst write */
+#define TSL2585_REG_BLOCK_MAX 5
+#define TSL2585_REG_BLOCK_COUNT_MAX 12
+
+typedef struct {
+    uint8_t reg;
+    uint8_t len;
+    uint8_t value[TSL2585_REG_BLOCK_MAX];
+    uint8_t mask[TSL2585_REG_BLOCK_MAX];
+} tsl2585_reg_block_t;
+
+static uint8_t tsl2585_shadow[TSL2585_SHADOW_SIZE] = {0};
+static uint8_t tsl2585_shadow_valid[(TSL2585_SHADOW_SIZE + 7) / 8] = {0};
+static uint32_t tsl2585_saved_transactions = 0;
+
+static bool tsl2585_shadow_cacheable(uint8_t reg);
+static bool tsl2585_shadow_is_valid(uint8_t reg, uint8_t len);
+static bool tsl2585_shadow_matches(uint8_t reg, uint8_t value);
+static bool tsl2585_shadow_matches(uint8_t reg, uint8_t value)
+{
+    return tsl2585_shadow_is_valid(reg, 1) && tsl2585_shadow[reg - TSL2585_SHADOW_BASE] == value;
+}
+
+void tsl2585_shadow_store(uint8_t reg, const uint8_t *data, uint8_t len);
+static void tsl2585_shadow_invalidate(uint8_t reg, uint8_t len);
+static HAL_StatusTypeDef tsl2585_shadow_refresh(I2C_HandleTypeDef *hi2c);
+static HAL_StatusTypeDef tsl2585_read_cached(I2C_HandleTypeDef *hi2c, uint8_t reg, uint8_t *data, uint8_t len);
+static HAL_StatusTypeDef tsl2585_write_cached(I2C_HandleTypeDef *hi2c, uint8_t reg, uint8_t *data, uint8_t len);
+static HAL_StatusTypeDef tsl2585_update_bits(I2C_HandleTypeDef *hi2c, uint8_t reg, uint8_t mask, uint8_t value);
+static HAL_StatusTypeDef tsl2585_write_blocks(I2C_HandleTypeDef *hi2c, tsl2585_reg_block_t *blocks, size_t count);
+
 HAL_StatusTypeDef tsl2585_init(I2C_HandleTypeDef *hi2c)
 {
     HAL_StatusTypeDef ret;
@@ -177,7 +241,7 @@ HAL_StatusTypeDef tsl2585_init(I2C_HandleTypeDef *hi2c)
 
     log_i("Initializing TSL2585");
 
-    ret = HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_ID, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
+    ret = i2c_mem_read(hi2c, TSL2585_ADDRESS, TSL2585_ID, &data, 1);
     if (ret != HAL_OK) {
         return ret;
     }
@@ -189,21 +253,21 @@ HAL_StatusTypeDef tsl2585_init(I2C_HandleTypeDef *hi2c)
         return HAL_ERROR;
     }
 
-    ret = HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_REV_ID, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
+    ret = i2c_mem_read(hi2c, TSL2585_ADDRESS, TSL2585_REV_ID, &data, 1);
     if (ret != HAL_OK) {
         return ret;
     }
 
     log_i("Revision ID: %02X", data);
 
-    ret = HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_AUX_ID, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
+    ret = i2c_mem_read(hi2c, TSL2585_ADDRESS, TSL2585_AUX_ID, &data, 1);
     if (ret != HAL_OK) {
         return ret;
     }
 
     log_i("Aux ID: %02X", data & 0x0F);
 
-    ret = HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_STATUS, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
+    ret = i2c_mem_read(hi2c, TSL2585_ADDRESS, TSL2585_STATUS, &data, 1);
     if (ret != HAL_OK) {
         return ret;
     }
@@ -225,6 +289,12 @@ HAL_StatusTypeDef tsl2585_init(I2C_HandleTypeDef *hi2c)
     /* Short delay to allow the soft reset to complete */
     HAL_Delay(1);
 
+    /* Load the post-reset configuration into the register shadow */
+    ret = tsl2585_shadow_refresh(hi2c);
+    if (ret != HAL_OK) {
+        return ret;
+    }
+
     /* Power off the sensor */
     ret = tsl2585_disable(hi2c);
     if (ret != HAL_OK) {
@@ -241,7 +311,7 @@ HAL_StatusTypeDef tsl2585_get_enable(I2C_HandleTypeDef *hi2c, uint8_t *value)
     HAL_StatusTypeDef ret;
     uint8_t data;
 
-    ret =  HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_ENABLE, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
+    ret = i2c_mem_read(hi2c, TSL2585_ADDRESS, TSL2585_ENABLE, &data, 1);
     if (ret != HAL_OK) {
         return ret;
     }
@@ -256,9 +326,8 @@ HAL_StatusTypeDef tsl2585_get_enable(I2C_HandleTypeDef *hi2c, uint8_t *value)
 HAL_StatusTypeDef tsl2585_set_enable(I2C_HandleTypeDef *hi2c, uint8_t value)
 {
     uint8_t data = value & 0x43; /* Mask bits 6,1:0 */
-    HAL_StatusTypeDef ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS,
-        TSL2585_ENABLE, I2C_MEMADD_SIZE_8BIT,
-        &data, 1, HAL_MAX_DELAY);
+    HAL_StatusTypeDef ret = i2c_mem_write(hi2c, TSL2585_ADDRESS,
+        TSL2585_ENABLE, &data, 1);
     return ret;
 }
 
@@ -275,27 +344,12 @@ HAL_StatusTypeDef tsl2585_disable(I2C_HandleTypeDef *hi2c)
 HAL_StatusTypeDef tsl2585_set_interrupt_enable(I2C_HandleTypeDef *hi2c, uint8_t value)
 {
     uint8_t data = value & 0x8D; /* Mask bits 7,3,2,0 */
-    HAL_StatusTypeDef ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS,
-        TSL2585_INTENAB, I2C_MEMADD_SIZE_8BIT,
-        &data, 1, HAL_MAX_DELAY);
-    return ret;
+    return tsl2585_write_cached(hi2c, TSL2585_INTENAB, &data, 1);
 }
 
 HAL_StatusTypeDef tsl2585_set_sleep_after_interrupt(I2C_HandleTypeDef *hi2c, bool enabled)
 {
-    HAL_StatusTypeDef ret;
-    uint8_t data;
-
-    ret =  HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_CFG0, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-    if (ret != HAL_OK) {
-        return ret;
-    }
-
-    data = (data & ~TSL2585_CFG0_SAI) | (enabled ? TSL2585_CFG0_SAI : 0);
-
-    ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, TSL2585_CFG0, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-
-    return ret;
+    return tsl2585_update_bits(hi2c, TSL2585_CFG0, TSL2585_CFG0_SAI, enabled ? TSL2585_CFG0_SAI : 0);
 }
 
 HAL_StatusTypeDef tsl2585_soft_reset(I2C_HandleTypeDef *hi2c)
@@ -304,7 +358,10 @@ HAL_StatusTypeDef tsl2585_soft_reset(I2C_HandleTypeDef *hi2c)
 
     data = TSL2585_CONTROL_SOFT_RESET;
 
-    return HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, TSL2585_CONTROL, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
+    /* All configuration registers return to their defaults */
+    tsl2585_shadow_invalidate(TSL2585_SHADOW_BASE, TSL2585_SHADOW_SIZE);
+
+    return i2c_mem_write(hi2c, TSL2585_ADDRESS, TSL2585_CONTROL, &data, 1);
 }
 
 HAL_StatusTypeDef tsl2585_clear_fifo(I2C_HandleTypeDef *hi2c)
@@ -313,7 +370,7 @@ HAL_StatusTypeDef tsl2585_clear_fifo(I2C_HandleTypeDef *hi2c)
 
     data = TSL2585_CONTROL_FIFO_CLR;
 
-    return HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, TSL2585_CONTROL, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
+    return i2c_mem_write(hi2c, TSL2585_ADDRESS, TSL2585_CONTROL, &data, 1);
 }
 
 HAL_StatusTypeDef tsl2585_clear_sleep_after_interrupt(I2C_HandleTypeDef *hi2c)
@@ -322,7 +379,7 @@ HAL_StatusTypeDef tsl2585_clear_sleep_after_interrupt(I2C_HandleTypeDef *hi2c)
 
     data = TSL2585_CONTROL_CLEAR_SAI_ACTIVE;
 
-    return HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, TSL2585_CONTROL, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
+    return i2c_mem_write(hi2c, TSL2585_ADDRESS, TSL2585_CONTROL, &data, 1);
 }
 
 HAL_StatusTypeDef tsl2585_enable_modulators(I2C_HandleTypeDef *hi2c, tsl2585_modulator_t mods)
@@ -330,40 +387,39 @@ HAL_StatusTypeDef tsl2585_enable_modulators(I2C_HandleTypeDef *hi2c, tsl2585_mod
     /* Mask bits [2:0] and invert since asserting disables the modulators */
     uint8_t data = ~((uint8_t)mods) & 0x07;
 
-    HAL_StatusTypeDef ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS,
-        TSL2585_MOD_CHANNEL_CTRL, I2C_MEMADD_SIZE_8BIT,
-        &data, 1, HAL_MAX_DELAY);
+    HAL_StatusTypeDef ret = i2c_mem_write(hi2c, TSL2585_ADDRESS,
+        TSL2585_MOD_CHANNEL_CTRL, &data, 1);
     return ret;
 }
 
 HAL_StatusTypeDef tsl2585_get_status(I2C_HandleTypeDef *hi2c, uint8_t *status)
 {
-    return HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_STATUS, I2C_MEMADD_SIZE_8BIT, status, 1, HAL_MAX_DELAY);
+    return i2c_mem_read(hi2c, TSL2585_ADDRESS, TSL2585_STATUS, status, 1);
 }
 
 HAL_StatusTypeDef tsl2585_set_status(I2C_HandleTypeDef *hi2c, uint8_t status)
 {
-    return HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, TSL2585_STATUS, I2C_MEMADD_SIZE_8BIT, &status, 1, HAL_MAX_DELAY);
+    return i2c_mem_write(hi2c, TSL2585_ADDRESS, TSL2585_STATUS, &status, 1);
 }
 
 HAL_StatusTypeDef tsl2585_get_status2(I2C_HandleTypeDef *hi2c, uint8_t *status)
 {
-    return HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_STATUS2, I2C_MEMADD_SIZE_8BIT, status, 1, HAL_MAX_DELAY);
+    return i2c_mem_read(hi2c, TSL2585_ADDRESS, TSL2585_STATUS2, status, 1);
 }
 
 HAL_StatusTypeDef tsl2585_get_status3(I2C_HandleTypeDef *hi2c, uint8_t *status)
 {
-    return HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_STATUS3, I2C_MEMADD_SIZE_8BIT, status, 1, HAL_MAX_DELAY);
+    return i2c_mem_read(hi2c, TSL2585_ADDRESS, TSL2585_STATUS3, status, 1);
 }
 
 HAL_StatusTypeDef tsl2585_get_status4(I2C_HandleTypeDef *hi2c, uint8_t *status)
 {
-    return HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_STATUS4, I2C_MEMADD_SIZE_8BIT, status, 1, HAL_MAX_DELAY);
+    return i2c_mem_read(hi2c, TSL2585_ADDRESS, TSL2585_STATUS4, status, 1);
 }
 
 HAL_StatusTypeDef tsl2585_get_status5(I2C_HandleTypeDef *hi2c, uint8_t *status)
 {
-    return HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_STATUS5, I2C_MEMADD_SIZE_8BIT, status, 1, HAL_MAX_DELAY);
+    return i2c_mem_read(hi2c, TSL2585_ADDRESS, TSL2585_STATUS5, status, 1);
 }
 
 HAL_StatusTypeDef tsl2585_set_mod_gain_table_select(I2C_HandleTypeDef *hi2c, bool alternate)
@@ -373,19 +429,7 @@ HAL_StatusTypeDef tsl2585_set_mod_gain_table_select(I2C_HandleTypeDef *hi2c, boo
      * residual bits, as documented in AN001059.
      * This register is completely undocumented in the actual datasheet.
      */
-    HAL_StatusTypeDef ret;
-    uint8_t data;
-
-    ret =  HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_MOD_GAIN_H, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-    if (ret != HAL_OK) {
-        return ret;
-    }
-
-    data = (data & 0xCF) | (alternate ? 0x30 : 0x00);
-
-    ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, TSL2585_MOD_GAIN_H, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-
-    return ret;
+    return tsl2585_update_bits(hi2c, TSL2585_MOD_GAIN_H, 0x30, alternate ? 0x30 : 0x00);
 }
 
 HAL_StatusTypeDef tsl2585_get_max_mod_gain(I2C_HandleTypeDef *hi2c, tsl2585_gain_t *gain)
@@ -393,7 +437,7 @@ HAL_StatusTypeDef tsl2585_get_max_mod_gain(I2C_HandleTypeDef *hi2c, tsl2585_gain
     HAL_StatusTypeDef ret;
     uint8_t data;
 
-    ret =  HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_CFG8, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
+    ret = tsl2585_read_cached(hi2c, TSL2585_CFG8, &data, 1);
     if (ret != HAL_OK) {
         return ret;
     }
@@ -407,19 +451,7 @@ HAL_StatusTypeDef tsl2585_get_max_mod_gain(I2C_HandleTypeDef *hi2c, tsl2585_gain
 
 HAL_StatusTypeDef tsl2585_set_max_mod_gain(I2C_HandleTypeDef *hi2c, tsl2585_gain_t gain)
 {
-    HAL_StatusTypeDef ret;
-    uint8_t data;
-
-    ret =  HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_CFG8, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-    if (ret != HAL_OK) {
-        return ret;
-    }
-
-    data = (data & 0x0F) | (((uint8_t)gain & 0x0F) << 4);
-
-    ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, TSL2585_CFG8, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-
-    return ret;
+    return tsl2585_update_bits(hi2c, TSL2585_CFG8, 0xF0, ((uint8_t)gain & 0x0F) << 4);
 }
 
 bool tsl2686_get_gain_register(tsl2585_modulator_t mod, tsl2585_step_t step, uint8_t *reg, bool *upper)
@@ -482,7 +514,7 @@ HAL_StatusTypeDef tsl2585_get_mod_gain(I2C_HandleTypeDef *hi2c, tsl2585_modulato
         return HAL_ERROR;
     }
 
-    ret =  HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, reg, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
+    ret = tsl2585_read_cached(hi2c, reg, &data, 1);
     if (ret != HAL_OK) {
         return ret;
     }
@@ -500,8 +532,6 @@ HAL_StatusTypeDef tsl2585_get_mod_gain(I2C_HandleTypeDef *hi2c, tsl2585_modulato
 
 HAL_StatusTypeDef tsl2585_set_mod_gain(I2C_HandleTypeDef *hi2c, tsl2585_modulator_t mod, tsl2585_step_t step, tsl2585_gain_t gain)
 {
-    HAL_StatusTypeDef ret;
-    uint8_t data;
     uint8_t reg;
     bool upper;
 
@@ -509,20 +539,11 @@ HAL_StatusTypeDef tsl2585_set_mod_gain(I2C_HandleTypeDef *hi2c, tsl2585_modulato
         return HAL_ERROR;
     }
 
-    ret = HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, reg, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-    if (ret != HAL_OK) {
-        return ret;
-    }
-
     if (upper) {
-        data = (data & 0x0F) | ((uint8_t)gain << 4);
+        return tsl2585_update_bits(hi2c, reg, 0xF0, (uint8_t)gain << 4);
     } else {
-        data = (data & 0xF0) | (uint8_t)gain;
+        return tsl2585_update_bits(hi2c, reg, 0x0F, (uint8_t)gain);
     }
-
-    ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, reg, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-
-    return ret;
 }
 
 HAL_StatusTypeDef tsl2585_get_mod_residual_enable(I2C_HandleTypeDef *hi2c, tsl2585_modulator_t mod, tsl2585_step_t *steps)
@@ -549,7 +570,7 @@ HAL_StatusTypeDef tsl2585_get_mod_residual_enable(I2C_HandleTypeDef *hi2c, tsl25
         return HAL_ERROR;
     }
 
-    ret = HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, reg, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
+    ret = tsl2585_read_cached(hi2c, reg, &data, 1);
     if (ret != HAL_OK) {
         return ret;
     }
@@ -567,10 +588,8 @@ HAL_StatusTypeDef tsl2585_get_mod_residual_enable(I2C_HandleTypeDef *hi2c, tsl25
 
 HAL_StatusTypeDef tsl2585_set_mod_residual_enable(I2C_HandleTypeDef *hi2c, tsl2585_modulator_t mod, tsl2585_step_t steps)
 {
-    HAL_StatusTypeDef ret;
     uint8_t reg;
     bool upper;
-    uint8_t data;
 
     switch (mod) {
     case TSL2585_MOD0:
@@ -589,20 +608,11 @@ HAL_StatusTypeDef tsl2585_set_mod_residual_enable(I2C_HandleTypeDef *hi2c, tsl25
         return HAL_ERROR;
     }
 
-    ret = HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, reg, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-    if (ret != HAL_OK) {
-        return ret;
-    }
-
     if (upper) {
-        data = (data & 0x0F) | (((uint8_t)steps) & 0x0F) << 4;
+        return tsl2585_update_bits(hi2c, reg, 0xF0, (((uint8_t)steps) & 0x0F) << 4);
     } else {
-        data = (data & 0xF0) | (((uint8_t)steps) & 0x0F);
+        return tsl2585_update_bits(hi2c, reg, 0x0F, ((uint8_t)steps) & 0x0F);
     }
-
-    ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, reg, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-
-    return ret;
 }
 
 HAL_StatusTypeDef tsl2585_set_mod_photodiode_smux(I2C_HandleTypeDef *hi2c,
@@ -650,7 +660,7 @@ HAL_StatusTypeDef tsl2585_set_mod_photodiode_smux(I2C_HandleTypeDef *hi2c,
     }
 
     /* Read the current value */
-    ret = HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, reg, I2C_MEMADD_SIZE_8BIT, data, 2, HAL_MAX_DELAY);
+    ret = tsl2585_read_cached(hi2c, reg, data, 2);
     if (ret != HAL_OK) {
         return ret;
     }
@@ -669,42 +679,32 @@ HAL_StatusTypeDef tsl2585_set_mod_photodiode_smux(I2C_HandleTypeDef *hi2c,
     data[1] |= phd_mod_vals[TSL2585_PHD_4];
 
     /* Write the updated value */
-    ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, reg, I2C_MEMADD_SIZE_8BIT, data, 2, HAL_MAX_DELAY);
+    ret = tsl2585_write_cached(hi2c, reg, data, 2);
 
     return ret;
 }
 
 HAL_StatusTypeDef tsl2585_get_uv_calibration(I2C_HandleTypeDef *hi2c, uint8_t *value)
 {
-    HAL_StatusTypeDef ret = HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS,
-        TSL2585_UV_CALIB, I2C_MEMADD_SIZE_8BIT,
-        value, 1, HAL_MAX_DELAY);
+    HAL_StatusTypeDef ret = i2c_mem_read(hi2c, TSL2585_ADDRESS,
+        TSL2585_UV_CALIB, value, 1);
     return ret;
 }
 
 HAL_StatusTypeDef tsl2585_set_mod_idac_range(I2C_HandleTypeDef *hi2c, uint8_t value)
 {
     uint8_t data = (value & 0x03) << 6;
-    HAL_StatusTypeDef ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS,
-        TSL2585_MOD_COMP_CFG1, I2C_MEMADD_SIZE_8BIT,
-        &data, 1, HAL_MAX_DELAY);
-    return ret;
+    return tsl2585_write_cached(hi2c, TSL2585_MOD_COMP_CFG1, &data, 1);
 }
 
 HAL_StatusTypeDef tsl2585_get_calibration_nth_iteration(I2C_HandleTypeDef *hi2c, uint8_t *iteration)
 {
-    HAL_StatusTypeDef ret = HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS,
-        TSL2585_MOD_CALIB_CFG0, I2C_MEMADD_SIZE_8BIT,
-        iteration, 1, HAL_MAX_DELAY);
-    return ret;
+    return tsl2585_read_cached(hi2c, TSL2585_MOD_CALIB_CFG0, iteration, 1);
 }
 
 HAL_StatusTypeDef tsl2585_set_calibration_nth_iteration(I2C_HandleTypeDef *hi2c, uint8_t iteration)
 {
-    HAL_StatusTypeDef ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS,
-        TSL2585_MOD_CALIB_CFG0, I2C_MEMADD_SIZE_8BIT,
-        &iteration, 1, HAL_MAX_DELAY);
-    return ret;
+    return tsl2585_write_cached(hi2c, TSL2585_MOD_CALIB_CFG0, &iteration, 1);
 }
 
 HAL_StatusTypeDef tsl2585_get_agc_calibration(I2C_HandleTypeDef *hi2c, bool *enabled)
@@ -712,7 +712,7 @@ HAL_StatusTypeDef tsl2585_get_agc_calibration(I2C_HandleTypeDef *hi2c, bool *ena
     HAL_StatusTypeDef ret;
     uint8_t data;
 
-    ret =  HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_MOD_CALIB_CFG2, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
+    ret = tsl2585_read_cached(hi2c, TSL2585_MOD_CALIB_CFG2, &data, 1);
     if (ret != HAL_OK) {
         return ret;
     }
@@ -727,16 +727,13 @@ HAL_StatusTypeDef tsl2585_get_agc_calibration(I2C_HandleTypeDef *hi2c, bool *ena
 HAL_StatusTypeDef tsl2585_set_agc_calibration(I2C_HandleTypeDef *hi2c, bool enabled)
 {
     HAL_StatusTypeDef ret;
-    uint8_t data;
 
-    ret =  HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_MOD_CALIB_CFG2, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-    if (ret != HAL_OK) {
-        return ret;
-    }
-
-    data = (data & ~TSL2585_MOD_CALIB_NTH_ITERATION_AGC_ENABLE) | (enabled ? TSL2585_MOD_CALIB_NTH_ITERATION_AGC_ENABLE : 0);
+    ret = tsl2585_update_bits(hi2c, TSL2585_MOD_CALIB_CFG2,
+        TSL2585_MOD_CALIB_NTH_ITERATION_AGC_ENABLE,
+        enabled ? TSL2585_MOD_CALIB_NTH_ITERATION_AGC_ENABLE : 0);
 
-    ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, TSL2585_MOD_CALIB_CFG2, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
+    /* The gain registers may have been changed by AGC while it was enabled */
+    tsl2585_shadow_invalidate(TSL2585_MEAS_SEQR_STEP0_MOD_GAINX_L, 8);
 
     return ret;
 }
@@ -746,7 +743,7 @@ HAL_StatusTypeDef tsl2585_get_single_shot_mode(I2C_HandleTypeDef *hi2c, bool *en
     HAL_StatusTypeDef ret;
     uint8_t data;
 
-    ret =  HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_MEAS_MODE0, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
+    ret = tsl2585_read_cached(hi2c, TSL2585_MEAS_MODE0, &data, 1);
     if (ret != HAL_OK) {
         return ret;
     }
@@ -760,20 +757,9 @@ HAL_StatusTypeDef tsl2585_get_single_shot_mode(I2C_HandleTypeDef *hi2c, bool *en
 
 HAL_StatusTypeDef tsl2585_set_single_shot_mode(I2C_HandleTypeDef *hi2c, bool enabled)
 {
-    HAL_StatusTypeDef ret;
-    uint8_t data;
-
-    ret =  HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_MEAS_MODE0, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-    if (ret != HAL_OK) {
-        return ret;
-    }
-
-    data = (data & ~TSL2585_MEAS_MODE0_MEASUREMENT_SEQUENCER_SINGLE_SHOT_MODE)
-        | (enabled ? TSL2585_MEAS_MODE0_MEASUREMENT_SEQUENCER_SINGLE_SHOT_MODE : 0);
-
-    ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, TSL2585_MEAS_MODE0, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-
-    return ret;
+    return tsl2585_update_bits(hi2c, TSL2585_MEAS_MODE0,
+        TSL2585_MEAS_MODE0_MEASUREMENT_SEQUENCER_SINGLE_SHOT_MODE,
+        enabled ? TSL2585_MEAS_MODE0_MEASUREMENT_SEQUENCER_SINGLE_SHOT_MODE : 0);
 }
 
 HAL_StatusTypeDef tsl2585_get_vsync_period(I2C_HandleTypeDef *hi2c, uint16_t *period)
@@ -781,9 +767,8 @@ HAL_StatusTypeDef tsl2585_get_vsync_period(I2C_HandleTypeDef *hi2c, uint16_t *pe
     HAL_StatusTypeDef ret;
     uint8_t buf[2];
 
-    ret = HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS,
-        TSL2585_VSYNC_PERIOD_L, I2C_MEMADD_SIZE_8BIT,
-        buf, sizeof(buf), HAL_MAX_DELAY);
+    ret = i2c_mem_read(hi2c, TSL2585_ADDRESS,
+        TSL2585_VSYNC_PERIOD_L, buf, sizeof(buf));
     if (ret != HAL_OK) {
         return ret;
     }
@@ -803,8 +788,7 @@ HAL_StatusTypeDef tsl2585_set_vsync_period(I2C_HandleTypeDef *hi2c, uint16_t per
     buf[0] = (uint8_t)(period & 0x00FF);
     buf[1] = (uint8_t)((period & 0xFF00) >> 8);
 
-    ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, TSL2585_VSYNC_PERIOD_L,
-        I2C_MEMADD_SIZE_8BIT, buf, sizeof(buf), HAL_MAX_DELAY);
+    ret = i2c_mem_write(hi2c, TSL2585_ADDRESS, TSL2585_VSYNC_PERIOD_L, buf, sizeof(buf));
 
     return ret;
 }
@@ -821,8 +805,7 @@ HAL_StatusTypeDef tsl2585_set_vsync_period_target(I2C_HandleTypeDef *hi2c, uint1
     buf[0] = (uint8_t)(period_target & 0x00FF);
     buf[1] = (uint8_t)((period_target & 0x7F00) >> 8) | (use_fast_timing ? 0x80 : 0x00);
 
-    ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, TSL2585_VSYNC_PERIOD_TARGET_L,
-        I2C_MEMADD_SIZE_8BIT, buf, sizeof(buf), HAL_MAX_DELAY);
+    ret = tsl2585_write_cached(hi2c, TSL2585_VSYNC_PERIOD_TARGET_L, buf, sizeof(buf));
 
     return ret;
 
@@ -832,9 +815,8 @@ HAL_StatusTypeDef tsl2585_set_vsync_control(I2C_HandleTypeDef *hi2c, uint8_t val
 {
     uint8_t data = value & 0x03;
 
-    HAL_StatusTypeDef ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS,
-        TSL2585_VSYNC_CONTROL, I2C_MEMADD_SIZE_8BIT,
-        &data, 1, HAL_MAX_DELAY);
+    HAL_StatusTypeDef ret = i2c_mem_write(hi2c, TSL2585_ADDRESS,
+        TSL2585_VSYNC_CONTROL, &data, 1);
     return ret;
 }
 
@@ -842,19 +824,15 @@ HAL_StatusTypeDef tsl2585_set_vsync_config(I2C_HandleTypeDef *hi2c, uint8_t valu
 {
     uint8_t data = value & 0xC7;
 
-    HAL_StatusTypeDef ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS,
-        TSL2585_VSYNC_CFG, I2C_MEMADD_SIZE_8BIT,
-        &data, 1, HAL_MAX_DELAY);
-    return ret;
+    return tsl2585_write_cached(hi2c, TSL2585_VSYNC_CFG, &data, 1);
 }
 
 HAL_StatusTypeDef tsl2585_set_vsync_gpio_int(I2C_HandleTypeDef *hi2c, uint8_t value)
 {
     uint8_t data = value & 0x7F;
 
-    HAL_StatusTypeDef ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS,
-        TSL2585_VSYNC_GPIO_INT, I2C_MEMADD_SIZE_8BIT,
-        &data, 1, HAL_MAX_DELAY);
+    HAL_StatusTypeDef ret = i2c_mem_write(hi2c, TSL2585_ADDRESS,
+        TSL2585_VSYNC_GPIO_INT, &data, 1);
     return ret;
 }
 
@@ -863,9 +841,7 @@ HAL_StatusTypeDef tsl2585_get_agc_num_samples(I2C_HandleTypeDef *hi2c, uint16_t
     HAL_StatusTypeDef ret;
     uint8_t buf[2];
 
-    ret = HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS,
-        TSL2585_AGC_NR_SAMPLES_L, I2C_MEMADD_SIZE_8BIT,
-        buf, sizeof(buf), HAL_MAX_DELAY);
+    ret = tsl2585_read_cached(hi2c, TSL2585_AGC_NR_SAMPLES_L, buf, sizeof(buf));
     if (ret != HAL_OK) {
         return ret;
     }
@@ -889,7 +865,7 @@ HAL_StatusTypeDef tsl2585_set_agc_num_samples(I2C_HandleTypeDef *hi2c, uint16_t
     buf[0] = (uint8_t)(value & 0x0FF);
     buf[1] = (uint8_t)((value & 0x700) >> 8);
 
-    ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, TSL2585_AGC_NR_SAMPLES_L, I2C_MEMADD_SIZE_8BIT, buf, sizeof(buf), HAL_MAX_DELAY);
+    ret = tsl2585_write_cached(hi2c, TSL2585_AGC_NR_SAMPLES_L, buf, sizeof(buf));
 
     return ret;
 }
@@ -899,9 +875,7 @@ HAL_StatusTypeDef tsl2585_get_sample_time(I2C_HandleTypeDef *hi2c, uint16_t *val
     HAL_StatusTypeDef ret;
     uint8_t buf[2];
 
-    ret = HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS,
-        TSL2585_SAMPLE_TIME0, I2C_MEMADD_SIZE_8BIT,
-        buf, sizeof(buf), HAL_MAX_DELAY);
+    ret = tsl2585_read_cached(hi2c, TSL2585_SAMPLE_TIME0, buf, sizeof(buf));
     if (ret != HAL_OK) {
         return ret;
     }
@@ -925,7 +899,7 @@ HAL_StatusTypeDef tsl2585_set_sample_time(I2C_HandleTypeDef *hi2c, uint16_t valu
     buf[0] = (uint8_t)(value & 0x0FF);
     buf[1] = (uint8_t)((value & 0x700) >> 8);
 
-    ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, TSL2585_SAMPLE_TIME0, I2C_MEMADD_SIZE_8BIT, buf, sizeof(buf), HAL_MAX_DELAY);
+    ret = tsl2585_write_cached(hi2c, TSL2585_SAMPLE_TIME0, buf, sizeof(buf));
 
     return ret;
 }
@@ -935,9 +909,7 @@ HAL_StatusTypeDef tsl2585_get_als_num_samples(I2C_HandleTypeDef *hi2c, uint16_t
     HAL_StatusTypeDef ret;
     uint8_t buf[2];
 
-    ret = HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS,
-        TSL2585_ALS_NR_SAMPLES0, I2C_MEMADD_SIZE_8BIT,
-        buf, sizeof(buf), HAL_MAX_DELAY);
+    ret = tsl2585_read_cached(hi2c, TSL2585_ALS_NR_SAMPLES0, buf, sizeof(buf));
     if (ret != HAL_OK) {
         return ret;
     }
@@ -961,7 +933,7 @@ HAL_StatusTypeDef tsl2585_set_als_num_samples(I2C_HandleTypeDef *hi2c, uint16_t
     buf[0] = (uint8_t)(value & 0x0FF);
     buf[1] = (uint8_t)((value & 0x700) >> 8);
 
-    ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, TSL2585_ALS_NR_SAMPLES0, I2C_MEMADD_SIZE_8BIT, buf, sizeof(buf), HAL_MAX_DELAY);
+    ret = tsl2585_write_cached(hi2c, TSL2585_ALS_NR_SAMPLES0, buf, sizeof(buf));
 
     return ret;
 }
@@ -971,7 +943,7 @@ HAL_StatusTypeDef tsl2585_get_als_interrupt_persistence(I2C_HandleTypeDef *hi2c,
     HAL_StatusTypeDef ret;
     uint8_t data;
 
-    ret =  HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_CFG5, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
+    ret = tsl2585_read_cached(hi2c, TSL2585_CFG5, &data, 1);
     if (ret != HAL_OK) {
         return ret;
     }
@@ -985,34 +957,22 @@ HAL_StatusTypeDef tsl2585_get_als_interrupt_persistence(I2C_HandleTypeDef *hi2c,
 
 HAL_StatusTypeDef tsl2585_set_als_interrupt_persistence(I2C_HandleTypeDef *hi2c, uint8_t value)
 {
-    HAL_StatusTypeDef ret;
-    uint8_t data;
-
-    ret =  HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_CFG5, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-    if (ret != HAL_OK) {
-        return ret;
-    }
-
-    data = (data & 0xF0) | (value & 0x0F);
-
-    ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, TSL2585_CFG5, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-
-    return ret;
+    return tsl2585_update_bits(hi2c, TSL2585_CFG5, 0x0F, value);
 }
 
 HAL_StatusTypeDef tsl2585_get_als_status(I2C_HandleTypeDef *hi2c, uint8_t *status)
 {
-    return HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_ALS_STATUS, I2C_MEMADD_SIZE_8BIT, status, 1, HAL_MAX_DELAY);
+    return i2c_mem_read(hi2c, TSL2585_ADDRESS, TSL2585_ALS_STATUS, status, 1);
 }
 
 HAL_StatusTypeDef tsl2585_get_als_status2(I2C_HandleTypeDef *hi2c, uint8_t *status)
 {
-    return HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_ALS_STATUS2, I2C_MEMADD_SIZE_8BIT, status, 1, HAL_MAX_DELAY);
+    return i2c_mem_read(hi2c, TSL2585_ADDRESS, TSL2585_ALS_STATUS2, status, 1);
 }
 
 HAL_StatusTypeDef tsl2585_get_als_status3(I2C_HandleTypeDef *hi2c, uint8_t *status)
 {
-    return HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_ALS_STATUS3, I2C_MEMADD_SIZE_8BIT, status, 1, HAL_MAX_DELAY);
+    return i2c_mem_read(hi2c, TSL2585_ADDRESS, TSL2585_ALS_STATUS3, status, 1);
 }
 
 HAL_StatusTypeDef tsl2585_get_als_scale(I2C_HandleTypeDef *hi2c, uint8_t *scale)
@@ -1020,7 +980,7 @@ HAL_StatusTypeDef tsl2585_get_als_scale(I2C_HandleTypeDef *hi2c, uint8_t *scale)
     HAL_StatusTypeDef ret;
     uint8_t data;
 
-    ret =  HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_MEAS_MODE0, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
+    ret = tsl2585_read_cached(hi2c, TSL2585_MEAS_MODE0, &data, 1);
     if (ret != HAL_OK) {
         return ret;
     }
@@ -1034,20 +994,7 @@ HAL_StatusTypeDef tsl2585_get_als_scale(I2C_HandleTypeDef *hi2c, uint8_t *scale)
 
 HAL_StatusTypeDef tsl2585_set_als_scale(I2C_HandleTypeDef *hi2c, uint8_t scale)
 {
-    HAL_StatusTypeDef ret;
-    uint8_t data;
-
-    ret =  HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_MEAS_MODE0, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-    if (ret != HAL_OK) {
-        return ret;
-    }
-
-    data = (data & 0xF0) | (scale & 0x0F);
-
-    ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, TSL2585_MEAS_MODE0, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-
-    return ret;
-
+    return tsl2585_update_bits(hi2c, TSL2585_MEAS_MODE0, 0x0F, scale);
 }
 
 HAL_StatusTypeDef tsl2585_get_fifo_als_status_write_enable(I2C_HandleTypeDef *hi2c, bool *enable)
@@ -1055,7 +1002,7 @@ HAL_StatusTypeDef tsl2585_get_fifo_als_status_write_enable(I2C_HandleTypeDef *hi
     HAL_StatusTypeDef ret;
     uint8_t data;
 
-    ret =  HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_MEAS_MODE0, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
+    ret = tsl2585_read_cached(hi2c, TSL2585_MEAS_MODE0, &data, 1);
     if (ret != HAL_OK) {
         return ret;
     }
@@ -1069,19 +1016,9 @@ HAL_StatusTypeDef tsl2585_get_fifo_als_status_write_enable(I2C_HandleTypeDef *hi
 
 HAL_StatusTypeDef tsl2585_set_fifo_als_status_write_enable(I2C_HandleTypeDef *hi2c, bool enable)
 {
-    HAL_StatusTypeDef ret;
-    uint8_t data;
-
-    ret =  HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_MEAS_MODE0, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-    if (ret != HAL_OK) {
-        return ret;
-    }
-
-    data = (data & 0xEF) | (enable ? 0x10 : 0x00);
-
-    ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, TSL2585_MEAS_MODE0, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-
-    return ret;
+    return tsl2585_update_bits(hi2c, TSL2585_MEAS_MODE0,
+        TSL2585_MEAS_MODE0_MOD_FIFO_ALS_STATUS_WRITE_ENABLE,
+        enable ? TSL2585_MEAS_MODE0_MOD_FIFO_ALS_STATUS_WRITE_ENABLE : 0);
 }
 
 HAL_StatusTypeDef tsl2585_get_fifo_als_data_format(I2C_HandleTypeDef *hi2c, tsl2585_als_fifo_data_format_t *format)
@@ -1089,13 +1026,13 @@ HAL_StatusTypeDef tsl2585_get_fifo_als_data_format(I2C_HandleTypeDef *hi2c, tsl2
     HAL_StatusTypeDef ret;
     uint8_t data;
 
-    ret =  HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_CFG4, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
+    ret = tsl2585_read_cached(hi2c, TSL2585_CFG4, &data, 1);
     if (ret != HAL_OK) {
         return ret;
     }
 
     if (format) {
-        *format = data & 0x03;
+        *format = data & TSL2585_CFG4_ALS_FIFO_DATA_FORMAT;
     }
 
     return HAL_OK;
@@ -1103,19 +1040,7 @@ HAL_StatusTypeDef tsl2585_get_fifo_als_data_format(I2C_HandleTypeDef *hi2c, tsl2
 
 HAL_StatusTypeDef tsl2585_set_fifo_als_data_format(I2C_HandleTypeDef *hi2c, tsl2585_als_fifo_data_format_t format)
 {
-    HAL_StatusTypeDef ret;
-    uint8_t data;
-
-    ret =  HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_CFG4, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-    if (ret != HAL_OK) {
-        return ret;
-    }
-
-    data = (data & 0x03) | format;
-
-    ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, TSL2585_CFG4, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-
-    return ret;
+    return tsl2585_update_bits(hi2c, TSL2585_CFG4, TSL2585_CFG4_ALS_FIFO_DATA_FORMAT, format);
 }
 
 HAL_StatusTypeDef tsl2585_get_als_msb_position(I2C_HandleTypeDef *hi2c, uint8_t *position)
@@ -1123,7 +1048,7 @@ HAL_StatusTypeDef tsl2585_get_als_msb_position(I2C_HandleTypeDef *hi2c, uint8_t
     HAL_StatusTypeDef ret;
     uint8_t data;
 
-    ret =  HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_MEAS_MODE1, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
+    ret = tsl2585_read_cached(hi2c, TSL2585_MEAS_MODE1, &data, 1);
     if (ret != HAL_OK) {
         return ret;
     }
@@ -1137,19 +1062,7 @@ HAL_StatusTypeDef tsl2585_get_als_msb_position(I2C_HandleTypeDef *hi2c, uint8_t
 
 HAL_StatusTypeDef tsl2585_set_als_msb_position(I2C_HandleTypeDef *hi2c, uint8_t position)
 {
-    HAL_StatusTypeDef ret;
-    uint8_t data;
-
-    ret =  HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_MEAS_MODE1, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-    if (ret != HAL_OK) {
-        return ret;
-    }
-
-    data = (data & 0xE0) | (position & 0x1F);
-
-    ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, TSL2585_MEAS_MODE1, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-
-    return ret;
+    return tsl2585_update_bits(hi2c, TSL2585_MEAS_MODE1, 0x1F, position);
 }
 
 HAL_StatusTypeDef tsl2585_get_trigger_mode(I2C_HandleTypeDef *hi2c, tsl2585_trigger_mode_t *trigger_mode)
@@ -1157,7 +1070,7 @@ HAL_StatusTypeDef tsl2585_get_trigger_mode(I2C_HandleTypeDef *hi2c, tsl2585_trig
     HAL_StatusTypeDef ret;
     uint8_t data;
 
-    ret =  HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS, TSL2585_TRIGGER_MODE, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
+    ret = tsl2585_read_cached(hi2c, TSL2585_TRIGGER_MODE, &data, 1);
     if (ret != HAL_OK) {
         return ret;
     }
@@ -1176,7 +1089,7 @@ HAL_StatusTypeDef tsl2585_set_trigger_mode(I2C_HandleTypeDef *hi2c, tsl2585_trig
 
     data = trigger_mode & 0x07;
 
-    ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, TSL2585_TRIGGER_MODE, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
+    ret = tsl2585_write_cached(hi2c, TSL2585_TRIGGER_MODE, &data, 1);
 
     return ret;
 }
@@ -1186,9 +1099,8 @@ HAL_StatusTypeDef tsl2585_get_als_data0(I2C_HandleTypeDef *hi2c, uint16_t *data)
     HAL_StatusTypeDef ret;
     uint8_t buf[2];
 
-    ret = HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS,
-        TSL2585_ALS_DATA0_L, I2C_MEMADD_SIZE_8BIT,
-        buf, sizeof(buf), HAL_MAX_DELAY);
+    ret = i2c_mem_read(hi2c, TSL2585_ADDRESS,
+        TSL2585_ALS_DATA0_L, buf, sizeof(buf));
     if (ret != HAL_OK) {
         return ret;
     }
@@ -1205,9 +1117,8 @@ HAL_StatusTypeDef tsl2585_get_als_data1(I2C_HandleTypeDef *hi2c, uint16_t *data)
     HAL_StatusTypeDef ret;
     uint8_t buf[2];
 
-    ret = HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS,
-        TSL2585_ALS_DATA1_L, I2C_MEMADD_SIZE_8BIT,
-        buf, sizeof(buf), HAL_MAX_DELAY);
+    ret = i2c_mem_read(hi2c, TSL2585_ADDRESS,
+        TSL2585_ALS_DATA1_L, buf, sizeof(buf));
     if (ret != HAL_OK) {
         return ret;
     }
@@ -1224,9 +1135,8 @@ HAL_StatusTypeDef tsl2585_get_als_data2(I2C_HandleTypeDef *hi2c, uint16_t *data)
     HAL_StatusTypeDef ret;
     uint8_t buf[2];
 
-    ret = HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS,
-        TSL2585_ALS_DATA2_L, I2C_MEMADD_SIZE_8BIT,
-        buf, sizeof(buf), HAL_MAX_DELAY);
+    ret = i2c_mem_read(hi2c, TSL2585_ADDRESS,
+        TSL2585_ALS_DATA2_L, buf, sizeof(buf));
     if (ret != HAL_OK) {
         return ret;
     }
@@ -1240,8 +1150,6 @@ HAL_StatusTypeDef tsl2585_get_als_data2(I2C_HandleTypeDef *hi2c, uint16_t *data)
 
 HAL_StatusTypeDef tsl2585_set_fifo_data_write_enable(I2C_HandleTypeDef *hi2c, tsl2585_modulator_t mod, bool enable)
 {
-    HAL_StatusTypeDef ret;
-    uint8_t data;
     uint8_t reg;
 
     switch (mod) {
@@ -1258,17 +1166,7 @@ HAL_StatusTypeDef tsl2585_set_fifo_data_write_enable(I2C_HandleTypeDef *hi2c, ts
         return HAL_ERROR;
     }
 
-    ret = HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS,
-        reg, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-    if (ret != HAL_OK) {
-        return ret;
-    }
-
-    data = (data & 0x7F) | (enable ? 0x80 : 0x00);
-
-    ret = HAL_I2C_Mem_Write(hi2c, TSL2585_ADDRESS, reg, I2C_MEMADD_SIZE_8BIT, &data, 1, HAL_MAX_DELAY);
-
-    return ret;
+    return tsl2585_update_bits(hi2c, reg, 0x80, enable ? 0x80 : 0x00);
 }
 
 HAL_StatusTypeDef tsl2585_get_fifo_status(I2C_HandleTypeDef *hi2c, tsl2585_fifo_status_t *status)
@@ -1276,9 +1174,8 @@ HAL_StatusTypeDef tsl2585_get_fifo_status(I2C_HandleTypeDef *hi2c, tsl2585_fifo_
     HAL_StatusTypeDef ret;
     uint8_t buf[2];
 
-    ret = HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS,
-        TSL2585_FIFO_STATUS0, I2C_MEMADD_SIZE_8BIT,
-        buf, sizeof(buf), HAL_MAX_DELAY);
+    ret = i2c_mem_read(hi2c, TSL2585_ADDRESS,
+        TSL2585_FIFO_STATUS0, buf, sizeof(buf));
     if (ret != HAL_OK) {
         return ret;
     }
@@ -1292,6 +1189,36 @@ HAL_StatusTypeDef tsl2585_get_fifo_status(I2C_HandleTypeDef *hi2c, tsl2585_fifo_
     return ret;
 }
 
+HAL_StatusTypeDef tsl2585_get_fifo_threshold(I2C_HandleTypeDef *hi2c, uint16_t *threshold)
+{
+    HAL_StatusTypeDef ret;
+    uint8_t data;
+
+    ret = i2c_mem_read(hi2c, TSL2585_ADDRESS, TSL2585_FIFO_THR, &data, 1);
+    if (ret != HAL_OK) {
+        return ret;
+    }
+
+    if (threshold) {
+        *threshold = (uint16_t)data << 2;
+    }
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef tsl2585_set_fifo_threshold(I2C_HandleTypeDef *hi2c, uint16_t threshold)
+{
+    uint8_t data;
+
+    if (threshold > 0x3FF) {
+        return HAL_ERROR;
+    }
+
+    data = (uint8_t)(threshold >> 2);
+
+    return i2c_mem_write(hi2c, TSL2585_ADDRESS, TSL2585_FIFO_THR, &data, 1);
+}
+
 HAL_StatusTypeDef tsl2585_read_fifo(I2C_HandleTypeDef *hi2c, uint8_t *data, uint16_t len)
 {
     HAL_StatusTypeDef ret;
@@ -1300,9 +1227,323 @@ HAL_StatusTypeDef tsl2585_read_fifo(I2C_HandleTypeDef *hi2c, uint8_t *data, uint
         return HAL_ERROR;
     }
 
-    ret = HAL_I2C_Mem_Read(hi2c, TSL2585_ADDRESS,
-        TSL2585_FIFO_DATA, I2C_MEMADD_SIZE_8BIT,
-        data, len, HAL_MAX_DELAY);
+    ret = i2c_mem_read(hi2c, TSL2585_ADDRESS,
+        TSL2585_FIFO_DATA, data, len);
+
+    return ret;
+}
+
+HAL_StatusTypeDef tsl2585_apply_preset(I2C_HandleTypeDef *hi2c, const tsl2585_preset_t *preset, tsl2585_trigger_mode_t trigger_mode)
+{
+    if (!preset) {
+        return HAL_ERROR;
+    }
+
+    const uint8_t residual = preset->residual_steps & 0x0F;
+    tsl2585_reg_block_t blocks[] = {
+        {
+            .reg = TSL2585_MEAS_MODE0, .len = 2,
+            .value = {
+                TSL2585_MEAS_MODE0_MOD_FIFO_ALS_STATUS_WRITE_ENABLE,
+                preset->als_msb_position & 0x1F
+            },
+            .mask = { TSL2585_MEAS_MODE0_MOD_FIFO_ALS_STATUS_WRITE_ENABLE, 0x1F }
+        },
+        {
+            .reg = TSL2585_CFG4, .len = 5, /* CFG4 - CFG8 */
+            .value = {
+                (uint8_t)preset->fifo_data_format & TSL2585_CFG4_ALS_FIFO_DATA_FORMAT,
+                preset->als_interrupt_persistence & 0x0F,
+                0, 0,
+                ((uint8_t)preset->max_mod_gain & 0x0F) << 4
+            },
+            .mask = { TSL2585_CFG4_ALS_FIFO_DATA_FORMAT, 0x0F, 0x00, 0x00, 0xF0 }
+        },
+        {
+            .reg = TSL2585_TRIGGER_MODE, .len = 1,
+            .value = { trigger_mode & 0x07 },
+            .mask = { 0xFF }
+        },
+        {
+            .reg = TSL2585_INTENAB, .len = 1,
+            .value = { preset->interrupt_enable & 0x8D },
+            .mask = { 0xFF }
+        },
+        {
+            .reg = TSL2585_MEAS_SEQR_RESIDUAL_0, .len = 1,
+            .value = {
+                ((preset->mods & TSL2585_MOD1) ? (residual << 4) : 0)
+                | ((preset->mods & TSL2585_MOD0) ? residual : 0)
+            },
+            .mask = {
+                ((preset->mods & TSL2585_MOD1) ? 0xF0 : 0)
+                | ((preset->mods & TSL2585_MOD0) ? 0x0F : 0)
+            }
+        },
+        {
+            .reg = TSL2585_MEAS_SEQR_STEP0_MOD_PHDX_SMUX_L, .len = 2,
+            .value = { preset->smux[0], preset->smux[1] & 0x0F },
+            .mask = { 0xFF, 0x0F }
+        },
+        {
+            .reg = TSL2585_MOD_CALIB_CFG0, .len = 1,
+            .value = { preset->calibration_nth_iteration },
+            .mask = { 0xFF }
+        },
+        {
+            .reg = TSL2585_MOD_GAIN_H, .len = 1,
+            .value = { preset->alternate_gain_table ? 0x30 : 0x00 },
+            .mask = { 0x30 }
+        },
+        {
+            .reg = TSL2585_VSYNC_CFG, .len = 5, /* VSYNC_CFG - MOD_FIFO_DATA_CFG2 */
+            .value = {
+                preset->vsync_config & 0xC7,
+                preset->vsync_gpio_int & 0x7F,
+                (preset->mods & TSL2585_MOD0) ? 0x80 : 0x00,
+                (preset->mods & TSL2585_MOD1) ? 0x80 : 0x00,
+                (preset->mods & TSL2585_MOD2) ? 0x80 : 0x00
+            },
+            .mask = { 0xFF, 0xFF, 0x80, 0x80, 0x80 }
+        },
+        {
+            /* Asserting these bits disables the modulators */
+            .reg = TSL2585_MOD_CHANNEL_CTRL, .len = 1,
+            .value = { ~((uint8_t)preset->mods) & 0x07 },
+            .mask = { 0xFF }
+        }
+    };
+
+    return tsl2585_write_blocks(hi2c, blocks, sizeof(blocks) / sizeof(tsl2585_reg_block_t));
+}
+
+uint32_t tsl2585_get_saved_transactions()
+{
+    return tsl2585_saved_transactions;
+}
+
+bool tsl2585_shadow_cacheable(uint8_t reg)
+{
+    /*
+     * The gain registers are updated by the sensor while AGC is enabled,
+     * so they can only be cached when AGC is known to be disabled.
+     */
+    if (reg >= TSL2585_MEAS_SEQR_STEP0_MOD_GAINX_L && reg <= TSL2585_MEAS_SEQR_STEP3_MOD_GAINX_H) {
+        if (!tsl2585_shadow_is_valid(TSL2585_MOD_CALIB_CFG2, 1)
+            || (tsl2585_shadow[TSL2585_MOD_CALIB_CFG2 - TSL2585_SHADOW_BASE] & TSL2585_MOD_CALIB_NTH_ITERATION_AGC_ENABLE) != 0) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < TSL2585_SHADOW_RANGE_COUNT; i++) {
+        if (reg >= TSL2585_SHADOW_RANGES[i].reg && reg < TSL2585_SHADOW_RANGES[i].reg + TSL2585_SHADOW_RANGES[i].len) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool tsl2585_shadow_is_valid(uint8_t reg, uint8_t len)
+{
+    if (reg < TSL2585_SHADOW_BASE || reg + len > TSL2585_SHADOW_BASE + TSL2585_SHADOW_SIZE) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < len; i++) {
+        const uint8_t offset = reg + i - TSL2585_SHADOW_BASE;
+        if ((tsl2585_shadow_valid[offset / 8] & (1 << (offset % 8))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void tsl2585_shadow_store(uint8_t reg, const uint8_t *data, uint8_t len)
+{
+    for (uint8_t i = 0; i < len; i++) {
+        if (reg + i < TSL2585_SHADOW_BASE || reg + i >= TSL2585_SHADOW_BASE + TSL2585_SHADOW_SIZE) {
+            continue;
+        }
+        const uint8_t offset = reg + i - TSL2585_SHADOW_BASE;
+        if (tsl2585_shadow_cacheable(reg + i)) {
+            tsl2585_shadow[offset] = data[i];
+            tsl2585_shadow_valid[offset / 8] |= (1 << (offset % 8));
+        } else {
+            tsl2585_shadow_valid[offset / 8] &= ~(1 << (offset % 8));
+        }
+    }
+}
+
+void tsl2585_shadow_invalidate(uint8_t reg, uint8_t len)
+{
+    for (uint8_t i = 0; i < len; i++) {
+        if (reg + i < TSL2585_SHADOW_BASE || reg + i >= TSL2585_SHADOW_BASE + TSL2585_SHADOW_SIZE) {
+            continue;
+        }
+        const uint8_t offset = reg + i - TSL2585_SHADOW_BASE;
+        tsl2585_shadow_valid[offset / 8] &= ~(1 << (offset % 8));
+    }
+}
+
+HAL_StatusTypeDef tsl2585_shadow_refresh(I2C_HandleTypeDef *hi2c)
+{
+    HAL_StatusTypeDef ret;
+    i2c_transfer_t transfers[TSL2585_SHADOW_RANGE_COUNT];
+
+    tsl2585_shadow_invalidate(TSL2585_SHADOW_BASE, TSL2585_SHADOW_SIZE);
+
+    /* Read all the cached register ranges as a single transaction */
+    for (size_t i = 0; i < TSL2585_SHADOW_RANGE_COUNT; i++) {
+        transfers[i].dir = I2C_TRANSFER_READ;
+        transfers[i].dev_address = TSL2585_ADDRESS;
+        transfers[i].mem_address = TSL2585_SHADOW_RANGES[i].reg;
+        transfers[i].data = tsl2585_shadow + (TSL2585_SHADOW_RANGES[i].reg - TSL2585_SHADOW_BASE);
+        transfers[i].len = TSL2585_SHADOW_RANGES[i].len;
+    }
+
+    ret = i2c_transfer(hi2c, transfers, TSL2585_SHADOW_RANGE_COUNT);
+    if (ret != HAL_OK) {
+        return ret;
+    }
+
+    /* Mark configuration registers valid first, since it determines gain register validity */
+    tsl2585_shadow_store(TSL2585_MOD_CALIB_CFG2, tsl2585_shadow + (TSL2585_MOD_CALIB_CFG2 - TSL2585_SHADOW_BASE), 1);
+    for (size_t i = 0; i < TSL2585_SHADOW_RANGE_COUNT; i++) {
+        const uint8_t reg = TSL2585_SHADOW_RANGES[i].reg;
+        tsl2585_shadow_store(reg, tsl2585_shadow + (reg - TSL2585_SHADOW_BASE), TSL2585_SHADOW_RANGES[i].len);
+    }
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef tsl2585_read_cached(I2C_HandleTypeDef *hi2c, uint8_t reg, uint8_t *data, uint8_t len)
+{
+    HAL_StatusTypeDef ret;
+
+    if (tsl2585_shadow_is_valid(reg, len)) {
+        memcpy(data, tsl2585_shadow + (reg - TSL2585_SHADOW_BASE), len);
+        tsl2585_saved_transactions++;
+        return HAL_OK;
+    }
+
+    ret = i2c_mem_read(hi2c, TSL2585_ADDRESS, reg, data, len);
+    if (ret == HAL_OK) {
+        tsl2585_shadow_store(reg, data, len);
+    }
+
+    return ret;
+}
+
+HAL_StatusTypeDef tsl2585_write_cached(I2C_HandleTypeDef *hi2c, uint8_t reg, uint8_t *data, uint8_t len)
+{
+    HAL_StatusTypeDef ret;
+
+    if (tsl2585_shadow_is_valid(reg, len)
+        && memcmp(data, tsl2585_shadow + (reg - TSL2585_SHADOW_BASE), len) == 0) {
+        tsl2585_saved_transactions++;
+        return HAL_OK;
+    }
+
+    ret = i2c_mem_write(hi2c, TSL2585_ADDRESS, reg, data, len);
+    if (ret == HAL_OK) {
+        tsl2585_shadow_store(reg, data, len);
+    } else {
+        tsl2585_shadow_invalidate(reg, len);
+    }
+
+    return ret;
+}
+
+HAL_StatusTypeDef tsl2585_update_bits(I2C_HandleTypeDef *hi2c, uint8_t reg, uint8_t mask, uint8_t value)
+{
+    HAL_StatusTypeDef ret;
+    uint8_t data;
+
+    ret = tsl2585_read_cached(hi2c, reg, &data, 1);
+    if (ret != HAL_OK) {
+        return ret;
+    }
+
+    data = (data & ~mask) | (value & mask);
+
+    return tsl2585_write_cached(hi2c, reg, &data, 1);
+}
+
+HAL_StatusTypeDef tsl2585_write_blocks(I2C_HandleTypeDef *hi2c, tsl2585_reg_block_t *blocks, size_t count)
+{
+    HAL_StatusTypeDef ret;
+    i2c_transfer_t transfers[TSL2585_REG_BLOCK_COUNT_MAX];
+    size_t transfer_count = 0;
+
+    if (count > TSL2585_REG_BLOCK_COUNT_MAX) {
+        return HAL_ERROR;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        tsl2585_reg_block_t *block = &blocks[i];
+
+        /*
+         * Merge in the bits of the current value that are not being changed,
+         * only reading back the span of registers that are partially written.
+         */
+        uint8_t merge_first = block->len;
+        uint8_t merge_last = 0;
+        for (uint8_t j = 0; j < block->len; j++) {
+            if (block->mask[j] != 0xFF) {
+                if (merge_first > j) { merge_first = j; }
+                merge_last = j + 1;
+            }
+        }
+
+        if (merge_first < merge_last) {
+            uint8_t current[TSL2585_REG_BLOCK_MAX];
+            ret = tsl2585_read_cached(hi2c, block->reg + merge_first, current, merge_last - merge_first);
+            if (ret != HAL_OK) {
+                return ret;
+            }
+            for (uint8_t j = merge_first; j < merge_last; j++) {
+                block->value[j] = (current[j - merge_first] & ~block->mask[j]) | (block->value[j] & block->mask[j]);
+            }
+        }
+
+        /*
+         * Trim registers that would not change from both ends of the block,
+         * and skip the whole block if none of them would change.
+         */
+        uint8_t first = 0;
+        uint8_t last = block->len;
+        while (first < last && tsl2585_shadow_matches(block->reg + first, block->value[first])) {
+            first++;
+        }
+        while (last > first && tsl2585_shadow_matches(block->reg + last - 1, block->value[last - 1])) {
+            last--;
+        }
+        if (first == last) {
+            tsl2585_saved_transactions++;
+            continue;
+        }
+
+        transfers[transfer_count].dir = I2C_TRANSFER_WRITE;
+        transfers[transfer_count].dev_address = TSL2585_ADDRESS;
+        transfers[transfer_count].mem_address = block->reg + first;
+        transfers[transfer_count].data = block->value + first;
+        transfers[transfer_count].len = last - first;
+        transfer_count++;
+    }
+
+    if (transfer_count == 0) {
+        return HAL_OK;
+    }
+
+    ret = i2c_transfer(hi2c, transfers, transfer_count);
+
+    for (size_t i = 0; i < transfer_count; i++) {
+        if (ret == HAL_OK) {
+            tsl2585_shadow_store(transfers[i].mem_address, transfers[i].data, transfers[i].len);
+        } else {
+            tsl2585_shadow_invalidate(transfers[i].mem_address, transfers[i].len);
+        }
+    }
 
     return ret;
 }
@@ -76,6 +76,34 @@ typedef enum {
     TSL2585_TRIGGER_VSYNC    = 0x05  /*!< One VSYNC per WTIME step */
 } tsl2585_trigger_mode_t;
 
+/**
+ * Register preset for the readout configuration of the sensor.
+ *
+ * Presets are intended to be declared as constants, and are applied
+ * to the sensor using a minimal number of burst writes.
+ */
+typedef struct {
+    tsl2585_modulator_t mods;                       /*!< Enabled modulators, which also write to the FIFO */
+    uint8_t smux[2];                                /*!< Sequencer step 0 photodiode assignment, using TSL2585_SMUX_L/H */
+    tsl2585_step_t residual_steps;                  /*!< Sequencer steps with residual measurement, for all enabled modulators */
+    tsl2585_als_fifo_data_format_t fifo_data_format;
+    uint8_t als_msb_position;
+    bool alternate_gain_table;
+    tsl2585_gain_t max_mod_gain;
+    uint8_t calibration_nth_iteration;
+    uint8_t vsync_config;
+    uint8_t vsync_gpio_int;
+    uint8_t als_interrupt_persistence;
+    uint8_t interrupt_enable;
+} tsl2585_preset_t;
+
+/* Photodiode SMUX register encoding, for use in constant initializers */
+#define TSL2585_SMUX_MOD(m) ((m) == TSL2585_MOD0 ? 0x01 : (m) == TSL2585_MOD1 ? 0x02 : (m) == TSL2585_MOD2 ? 0x03 : 0x00)
+#define TSL2585_SMUX_L(phd0, phd1, phd2, phd3) \
+    (TSL2585_SMUX_MOD(phd3) << 6 | TSL2585_SMUX_MOD(phd2) << 4 | TSL2585_SMUX_MOD(phd1) << 2 | TSL2585_SMUX_MOD(phd0))
+#define TSL2585_SMUX_H(phd4, phd5) \
+    (TSL2585_SMUX_MOD(phd5) << 2 | TSL2585_SMUX_MOD(phd4))
+
 /* ENABLE register values */
 #define TSL2585_ENABLE_FDEN 0x40 /*!< Flicker detection enable */
 #define TSL2585_ENABLE_AEN  0x02 /*!< ALS Enable */
@@ -315,8 +343,47 @@ HAL_StatusTypeDef tsl2585_set_fifo_data_write_enable(I2C_HandleTypeDef *hi2c, ts
 
 HAL_StatusTypeDef tsl2585_get_fifo_status(I2C_HandleTypeDef *hi2c, tsl2585_fifo_status_t *status);
 
+/**
+ * Get the FIFO threshold level.
+ *
+ * @param threshold FIFO level threshold, in bytes
+ */
+HAL_StatusTypeDef tsl2585_get_fifo_threshold(I2C_HandleTypeDef *hi2c, uint16_t *threshold);
+
+/**
+ * Set the FIFO threshold level.
+ *
+ * The FIFO interrupt is asserted when the FIFO level exceeds this
+ * threshold. Only the upper 8 bits of the 10-bit threshold are
+ * configurable, so the value is rounded down to a multiple of 4 bytes.
+ *
+ * @param threshold FIFO level threshold, in bytes (0-1023)
+ */
+HAL_StatusTypeDef tsl2585_set_fifo_threshold(I2C_HandleTypeDef *hi2c, uint16_t threshold);
+
 HAL_StatusTypeDef tsl2585_read_fifo(I2C_HandleTypeDef *hi2c, uint8_t *data, uint16_t len);
 
+/**
+ * Apply a readout configuration preset to the sensor.
+ *
+ * The preset is written as a single transaction of burst writes across
+ * contiguous register blocks, skipping any blocks that already contain
+ * the preset values.
+ *
+ * @param preset Readout configuration preset
+ * @param trigger_mode Sensor trigger mode
+ */
+HAL_StatusTypeDef tsl2585_apply_preset(I2C_HandleTypeDef *hi2c, const tsl2585_preset_t *preset, tsl2585_trigger_mode_t trigger_mode);
+
+/**
+ * Get the number of bus transactions avoided by the register shadow.
+ *
+ * This counts reads served from the shadow copy of the configuration
+ * registers, and writes skipped because the register already contained
+ * the requested value.
+ */
+uint32_t tsl2585_get_saved_transactions();
+
 const char* tsl2585_gain_str(tsl2585_gain_t gain);
 float tsl2585_gain_value(tsl2585_gain_t gain);
 float tsl2585_integration_time_ms(uint16_t sample_time, uint16_t num_samples);
@@ -31,6 +31,32 @@ void watchdog_normal()
 #endif
 }
 
+uint32_t timestamp_us()
+{
+    uint32_t ticks;
+    uint32_t count;
+    uint32_t primask;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+
+    ticks = osKernelGetTickCount();
+    count = SysTick->VAL;
+
+    /* Account for a counter reload that has not been serviced yet */
+    if ((SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) != 0) {
+        ticks++;
+        count = SysTick->VAL;
+    }
+
+    __set_PRIMASK(primask);
+
+    const uint32_t reload = SysTick->LOAD + 1;
+    const uint32_t tick_us = 1000000UL / osKernelGetTickFreq();
+
+    return (ticks * tick_us) + (((reload - 1 - count) * tick_us) / reload);
+}
+
 osStatus_t hal_to_os_status(HAL_StatusTypeDef hal_status)
 {
     switch (hal_status) {
@@ -14,6 +14,9 @@
 #define MAX(a, b)  (((a) > (b)) ? (a) : (b))
 #endif
 
+/* log2(10), for converting density values into f-stops */
+#define LOG2_10F  3.32192809F
+
 #define TIME_AFTER(a, b)  (((int32_t)(a) - (int32_t)(b)) > 0)
 
 /**
@@ -33,6 +36,15 @@ void watchdog_slow();
  */
 void watchdog_normal();
 
+/**
+ * Get a timestamp with microsecond resolution.
+ *
+ * This combines the kernel tick count with the current SysTick counter
+ * value, and is intended for measuring short durations. It can be called
+ * from interrupt handlers, and wraps around roughly every 71 minutes.
+ */
+uint32_t timestamp_us();
+
 osStatus_t hal_to_os_status(HAL_StatusTypeDef hal_status);
 HAL_StatusTypeDef os_to_hal_status(osStatus_t os_status);
 
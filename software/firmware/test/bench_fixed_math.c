@@ -0,0 +1,184 @@
+/*
+ * Benchmark for the fixed-point density kernels.
+ *
+ * Counts retired instructions and CPU cycles per call for the fixed-point
+ * and libm versions of the density expression, using the Linux perf
+ * counters when they are available and falling back to wall clock time
+ * otherwise.
+ *
+ * These are host numbers, so they show the relative cost of the two
+ * paths but not the absolute cost on the Cortex-M0+, where the libm
+ * path also pays for soft-float emulation of every operation.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "fixed_math.h"
+
+#define INPUT_COUNT 1024
+#define ITERATIONS 1000
+
+typedef struct {
+    int instructions_fd;
+    int cycles_fd;
+    struct timespec start;
+    uint64_t instructions;
+    uint64_t cycles;
+    uint64_t nanoseconds;
+} bench_counter_t;
+
+static float inputs[INPUT_COUNT];
+static volatile float sink_float;
+static volatile q16_t sink_q16;
+
+static int perf_counter_open(uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void bench_counter_start(bench_counter_t *counter)
+{
+    if (counter->instructions_fd >= 0) {
+        ioctl(counter->instructions_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter->instructions_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    if (counter->cycles_fd >= 0) {
+        ioctl(counter->cycles_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter->cycles_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &counter->start);
+}
+
+static void bench_counter_stop(bench_counter_t *counter)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    counter->instructions = 0;
+    counter->cycles = 0;
+    if (counter->instructions_fd >= 0) {
+        ioctl(counter->instructions_fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter->instructions_fd, &counter->instructions, sizeof(uint64_t)) != sizeof(uint64_t)) {
+            counter->instructions = 0;
+        }
+    }
+    if (counter->cycles_fd >= 0) {
+        ioctl(counter->cycles_fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter->cycles_fd, &counter->cycles, sizeof(uint64_t)) != sizeof(uint64_t)) {
+            counter->cycles = 0;
+        }
+    }
+
+    counter->nanoseconds = ((uint64_t)(end.tv_sec - counter->start.tv_sec) * 1000000000ULL)
+        + (uint64_t)end.tv_nsec - (uint64_t)counter->start.tv_nsec;
+}
+
+static void bench_counter_print(const char *name, const bench_counter_t *counter)
+{
+    const double calls = (double)INPUT_COUNT * ITERATIONS;
+
+    printf("%-18s", name);
+    if (counter->instructions_fd >= 0) {
+        printf(" %8.1f instructions/call", (double)counter->instructions / calls);
+    }
+    if (counter->cycles_fd >= 0) {
+        printf(" %8.1f cycles/call", (double)counter->cycles / calls);
+    }
+    printf(" %8.2f ns/call\n", (double)counter->nanoseconds / calls);
+}
+
+static void bench_log10f(bench_counter_t *counter)
+{
+    bench_counter_start(counter);
+    for (int i = 0; i < ITERATIONS; i++) {
+        for (int j = 0; j < INPUT_COUNT; j++) {
+            sink_float = log10f(inputs[j]);
+        }
+    }
+    bench_counter_stop(counter);
+    bench_counter_print("log10f", counter);
+}
+
+static void bench_fixed_log10f(bench_counter_t *counter)
+{
+    bench_counter_start(counter);
+    for (int i = 0; i < ITERATIONS; i++) {
+        for (int j = 0; j < INPUT_COUNT; j++) {
+            sink_q16 = fixed_log10f(inputs[j]);
+        }
+    }
+    bench_counter_stop(counter);
+    bench_counter_print("fixed_log10f", counter);
+}
+
+static void bench_calc_d_float(bench_counter_t *counter)
+{
+    const float slope = -0.97F;
+    const float offset = 4.558F;
+
+    bench_counter_start(counter);
+    for (int i = 0; i < ITERATIONS; i++) {
+        for (int j = 0; j < INPUT_COUNT; j++) {
+            sink_float = (slope * log10f(inputs[j])) + offset;
+        }
+    }
+    bench_counter_stop(counter);
+    bench_counter_print("calc_d (float)", counter);
+}
+
+static void bench_calc_d_fixed(bench_counter_t *counter)
+{
+    const q16_t slope_q16 = q16_from_float(-0.97F);
+    const q16_t offset_q16 = q16_from_float(4.558F);
+
+    bench_counter_start(counter);
+    for (int i = 0; i < ITERATIONS; i++) {
+        for (int j = 0; j < INPUT_COUNT; j++) {
+            sink_float = q16_to_float(q16_mul(slope_q16, fixed_log10f(inputs[j])) + offset_q16);
+        }
+    }
+    bench_counter_stop(counter);
+    bench_counter_print("calc_d (fixed)", counter);
+}
+
+int main(void)
+{
+    bench_counter_t counter;
+
+    /* Readings spread evenly across 0 to 5 D from a 50000 count zero value */
+    for (int i = 0; i < INPUT_COUNT; i++) {
+        inputs[i] = 50000.0F * powf(10.0F, -5.0F * (float)i / (float)(INPUT_COUNT - 1));
+    }
+
+    counter.instructions_fd = perf_counter_open(PERF_COUNT_HW_INSTRUCTIONS);
+    counter.cycles_fd = perf_counter_open(PERF_COUNT_HW_CPU_CYCLES);
+    if (counter.instructions_fd < 0 || counter.cycles_fd < 0) {
+        printf("Hardware counters unavailable, reporting wall clock time only\n");
+    }
+
+    bench_log10f(&counter);
+    bench_fixed_log10f(&counter);
+    bench_calc_d_float(&counter);
+    bench_calc_d_fixed(&counter);
+
+    if (counter.instructions_fd >= 0) { close(counter.instructions_fd); }
+    if (counter.cycles_fd >= 0) { close(counter.cycles_fd); }
+    return 0;
+}
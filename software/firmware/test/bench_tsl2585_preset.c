@@ -0,0 +1,203 @@
+/*
+ * Bus traffic of the TSL2585 register presets against a fake I2C bus.
+ *
+ * Configures the sensor the way the sensor task does when it starts,
+ * once with the individual register setters and once with a single
+ * preset, and counts the bus transactions and bytes of each. The byte
+ * count includes the device and register addressing of each transaction.
+ * This is repeated for a cold start right after initialization, for
+ * a restart with the same mode, and for a switch between modes.
+ * Both methods must leave the sensor with the same register contents.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "tsl2585.h"
+#include "i2c_handler.h"
+#include "fake_i2c_bus.h"
+
+#define TSL2585_ID_REG    0x92
+#define TSL2585_ID_VALUE  0x5C
+#define CONFIG_REG_FIRST  0x80
+
+typedef enum {
+    MODE_VIS = 0,
+    MODE_UV
+} bench_mode_t;
+
+typedef struct {
+    uint32_t waits;
+    uint32_t transactions;
+    uint32_t bytes;
+} bench_result_t;
+
+static I2C_HandleTypeDef hi2c;
+static DMA_HandleTypeDef hdma_rx;
+static DMA_HandleTypeDef hdma_tx;
+
+/* Same content as the presets in task_sensor.c */
+#define BENCH_PRESET_COMMON \
+    .mods = TSL2585_MOD0, \
+    .residual_steps = TSL2585_STEPS_ALL, \
+    .fifo_data_format = TSL2585_ALS_FIFO_32BIT, \
+    .als_msb_position = 6, \
+    .alternate_gain_table = true, \
+    .max_mod_gain = TSL2585_GAIN_256X, \
+    .calibration_nth_iteration = 1, \
+    .vsync_config = TSL2585_VSYNC_CFG_VSYNC_INVERT, \
+    .vsync_gpio_int = TSL2585_GPIO_INT_VSYNC_GPIO_IN_EN | TSL2585_GPIO_INT_VSYNC_GPIO_INVERT, \
+    .als_interrupt_persistence = 0, \
+    .interrupt_enable = TSL2585_INTENAB_AIEN
+
+static const tsl2585_preset_t bench_presets[] = {
+    [MODE_VIS] = {
+        .smux = {
+            TSL2585_SMUX_L(0, TSL2585_MOD0, 0, 0),
+            TSL2585_SMUX_H(0, TSL2585_MOD0)
+        },
+        BENCH_PRESET_COMMON
+    },
+    [MODE_UV] = {
+        .smux = {
+            TSL2585_SMUX_L(0, 0, 0, TSL2585_MOD0),
+            TSL2585_SMUX_H(TSL2585_MOD0, 0)
+        },
+        BENCH_PRESET_COMMON
+    }
+};
+
+static const tsl2585_modulator_t bench_smux[][TSL2585_PHD_MAX] = {
+    [MODE_VIS] = { 0, TSL2585_MOD0, 0, 0, 0, TSL2585_MOD0 },
+    [MODE_UV] = { 0, 0, 0, TSL2585_MOD0, TSL2585_MOD0, 0 }
+};
+
+/* Register at a time, in the order the sensor task used before presets */
+static HAL_StatusTypeDef apply_setters(bench_mode_t mode)
+{
+    HAL_StatusTypeDef ret;
+
+    do {
+        ret = tsl2585_set_fifo_als_status_write_enable(&hi2c, true);
+        if (ret != HAL_OK) { break; }
+        ret = tsl2585_set_fifo_data_write_enable(&hi2c, TSL2585_MOD0, true);
+        if (ret != HAL_OK) { break; }
+        ret = tsl2585_set_fifo_data_write_enable(&hi2c, TSL2585_MOD1, false);
+        if (ret != HAL_OK) { break; }
+        ret = tsl2585_set_fifo_data_write_enable(&hi2c, TSL2585_MOD2, false);
+        if (ret != HAL_OK) { break; }
+        ret = tsl2585_set_fifo_als_data_format(&hi2c, TSL2585_ALS_FIFO_32BIT);
+        if (ret != HAL_OK) { break; }
+        ret = tsl2585_set_als_msb_position(&hi2c, 6);
+        if (ret != HAL_OK) { break; }
+        ret = tsl2585_set_mod_residual_enable(&hi2c, TSL2585_MOD0, TSL2585_STEPS_ALL);
+        if (ret != HAL_OK) { break; }
+        ret = tsl2585_set_mod_gain_table_select(&hi2c, true);
+        if (ret != HAL_OK) { break; }
+        ret = tsl2585_set_max_mod_gain(&hi2c, TSL2585_GAIN_256X);
+        if (ret != HAL_OK) { break; }
+        ret = tsl2585_enable_modulators(&hi2c, TSL2585_MOD0);
+        if (ret != HAL_OK) { break; }
+        ret = tsl2585_set_calibration_nth_iteration(&hi2c, 1);
+        if (ret != HAL_OK) { break; }
+        ret = tsl2585_set_vsync_config(&hi2c, TSL2585_VSYNC_CFG_VSYNC_INVERT);
+        if (ret != HAL_OK) { break; }
+        ret = tsl2585_set_vsync_gpio_int(&hi2c, TSL2585_GPIO_INT_VSYNC_GPIO_IN_EN | TSL2585_GPIO_INT_VSYNC_GPIO_INVERT);
+        if (ret != HAL_OK) { break; }
+        ret = tsl2585_set_mod_photodiode_smux(&hi2c, TSL2585_STEP0, bench_smux[mode]);
+        if (ret != HAL_OK) { break; }
+        ret = tsl2585_set_als_interrupt_persistence(&hi2c, 0);
+        if (ret != HAL_OK) { break; }
+        ret = tsl2585_set_interrupt_enable(&hi2c, TSL2585_INTENAB_AIEN);
+        if (ret != HAL_OK) { break; }
+        ret = tsl2585_set_trigger_mode(&hi2c, TSL2585_TRIGGER_NORMAL);
+    } while (0);
+
+    return ret;
+}
+
+static HAL_StatusTypeDef apply_preset(bench_mode_t mode)
+{
+    return tsl2585_apply_preset(&hi2c, &bench_presets[mode], TSL2585_TRIGGER_NORMAL);
+}
+
+/* Power up a freshly reset sensor, with every register preset to a pattern */
+static bool sensor_reset(void)
+{
+    fake_i2c_reset();
+    fake_i2c_set_kernel_running(true);
+    uint8_t *registers = fake_i2c_registers();
+    for (int reg = CONFIG_REG_FIRST; reg < 0x100; reg++) {
+        registers[reg] = (uint8_t)(reg * 37);
+    }
+    registers[TSL2585_ID_REG] = TSL2585_ID_VALUE;
+    return tsl2585_init(&hi2c) == HAL_OK;
+}
+
+static bool run_step(HAL_StatusTypeDef (*apply)(bench_mode_t), bench_mode_t mode, bench_result_t *result)
+{
+    fake_i2c_clear_stats();
+    if (apply(mode) != HAL_OK) { return false; }
+    const fake_i2c_stats_t *stats = fake_i2c_get_stats();
+    result->waits = stats->waits;
+    result->transactions = stats->transfers;
+    result->bytes = stats->bus_bytes;
+    return true;
+}
+
+/* Cold start in VIS mode, restart in VIS mode, then a switch to UV mode */
+static bool run_method(HAL_StatusTypeDef (*apply)(bench_mode_t), bench_result_t results[3], uint8_t registers[0x100])
+{
+    if (!sensor_reset()) { return false; }
+    if (!run_step(apply, MODE_VIS, &results[0])) { return false; }
+    if (!run_step(apply, MODE_VIS, &results[1])) { return false; }
+    if (!run_step(apply, MODE_UV, &results[2])) { return false; }
+    memcpy(registers, fake_i2c_registers(), 0x100);
+    return true;
+}
+
+int main(void)
+{
+    static const char *step_names[] = { "Cold start", "Same mode", "Mode switch" };
+    bench_result_t setters[3];
+    bench_result_t presets[3];
+    uint8_t setter_registers[0x100];
+    uint8_t preset_registers[0x100];
+    bool success = true;
+
+    hi2c.hdmarx = &hdma_rx;
+    hi2c.hdmatx = &hdma_tx;
+    hi2c.State = HAL_I2C_STATE_READY;
+    if (i2c_handler_init(&hi2c) != osOK) {
+        printf("FAIL: handler init\n");
+        return 1;
+    }
+
+    if (!run_method(apply_setters, setters, setter_registers)
+        || !run_method(apply_preset, presets, preset_registers)) {
+        printf("FAIL: bus error\n");
+        return 1;
+    }
+
+    printf("%-12s %-20s %-20s %s\n", "", "Setters", "Preset", "Saved");
+    for (int i = 0; i < 3; i++) {
+        printf("%-12s %2lu wait %2lu tx %3lu B  %2lu wait %2lu tx %3lu B  %2ld wait %2ld tx %3ld B\n", step_names[i],
+            (unsigned long)setters[i].waits, (unsigned long)setters[i].transactions, (unsigned long)setters[i].bytes,
+            (unsigned long)presets[i].waits, (unsigned long)presets[i].transactions, (unsigned long)presets[i].bytes,
+            (long)setters[i].waits - (long)presets[i].waits,
+            (long)setters[i].transactions - (long)presets[i].transactions,
+            (long)setters[i].bytes - (long)presets[i].bytes);
+    }
+
+    for (int reg = CONFIG_REG_FIRST; reg < 0x100; reg++) {
+        if (setter_registers[reg] != preset_registers[reg]) {
+            printf("Register 0x%02X: setters=0x%02X, preset=0x%02X\n",
+                reg, setter_registers[reg], preset_registers[reg]);
+            success = false;
+        }
+    }
+
+    printf("%s\n", success ? "PASS" : "FAIL");
+    return success ? 0 : 1;
+}
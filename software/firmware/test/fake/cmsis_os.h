@@ -0,0 +1,64 @@
+/*
+ * Minimal stand-in for the CMSIS-RTOS2 API, covering only what the
+ * portable firmware modules under test need. Everything runs in a
+ * single thread, with pending interrupts delivered by the fake bus
+ * whenever a semaphore is waited on.
+ */
+
+#ifndef CMSIS_OS_H
+#define CMSIS_OS_H
+
+#include <stdint.h>
+
+typedef enum {
+    osOK = 0,
+    osError = -1,
+    osErrorTimeout = -2,
+    osErrorResource = -3,
+    osErrorParameter = -4,
+    osErrorNoMemory = -5
+} osStatus_t;
+
+typedef enum {
+    osKernelInactive = 0,
+    osKernelReady = 1,
+    osKernelRunning = 2,
+    osKernelLocked = 3
+} osKernelState_t;
+
+typedef struct fake_os_object *osMutexId_t;
+typedef struct fake_os_object *osSemaphoreId_t;
+
+typedef struct {
+    const char *name;
+    uint32_t attr_bits;
+} osMutexAttr_t;
+
+typedef struct {
+    const char *name;
+    uint32_t attr_bits;
+} osSemaphoreAttr_t;
+
+#define osWaitForever 0xFFFFFFFFU
+#define osMutexPrioInherit 0x00000002U
+#define portMAX_DELAY 0xFFFFFFFFU
+
+#define taskENTER_CRITICAL()
+#define taskEXIT_CRITICAL()
+
+osKernelState_t osKernelGetState(void);
+uint32_t osKernelGetTickCount(void);
+uint32_t osKernelGetTickFreq(void);
+
+osStatus_t osDelay(uint32_t ticks);
+osStatus_t osDelayUntil(uint32_t ticks);
+
+osMutexId_t osMutexNew(const osMutexAttr_t *attr);
+osStatus_t osMutexAcquire(osMutexId_t mutex_id, uint32_t timeout);
+osStatus_t osMutexRelease(osMutexId_t mutex_id);
+
+osSemaphoreId_t osSemaphoreNew(uint32_t max_count, uint32_t initial_count, const osSemaphoreAttr_t *attr);
+osStatus_t osSemaphoreAcquire(osSemaphoreId_t semaphore_id, uint32_t timeout);
+osStatus_t osSemaphoreRelease(osSemaphoreId_t semaphore_id);
+
+#endif /* CMSIS_OS_H */
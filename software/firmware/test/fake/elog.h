@@ -0,0 +1,22 @@
+/*
+ * Stand-in for EasyLogger that discards all log output. The format
+ * strings are not checked, since they are written for the 32-bit
+ * target where uint32_t is an unsigned long.
+ */
+
+#ifndef ELOG_H
+#define ELOG_H
+
+static inline void elog_discard(const char *format, ...)
+{
+    (void)format;
+}
+
+#define log_a(...) elog_discard(__VA_ARGS__)
+#define log_e(...) elog_discard(__VA_ARGS__)
+#define log_w(...) elog_discard(__VA_ARGS__)
+#define log_i(...) elog_discard(__VA_ARGS__)
+#define log_d(...) elog_discard(__VA_ARGS__)
+#define log_v(...) elog_discard(__VA_ARGS__)
+
+#endif /* ELOG_H */
@@ -0,0 +1,76 @@
+/*
+ * Minimal stand-in for the STM32 HAL, covering only what the portable
+ * firmware modules under test need. The I2C functions are provided
+ * by the fake bus in fake_i2c_bus.c.
+ */
+
+#ifndef STM32L0XX_HAL_H
+#define STM32L0XX_HAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    HAL_OK = 0x00U,
+    HAL_ERROR = 0x01U,
+    HAL_BUSY = 0x02U,
+    HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+typedef enum {
+    HAL_I2C_STATE_RESET = 0x00U,
+    HAL_I2C_STATE_READY = 0x20U,
+    HAL_I2C_STATE_BUSY = 0x24U
+} HAL_I2C_StateTypeDef;
+
+typedef struct {
+    uint32_t Instance;
+} DMA_HandleTypeDef;
+
+typedef struct {
+    uint32_t Instance;
+} TIM_HandleTypeDef;
+
+typedef struct {
+    uint32_t Instance;
+    DMA_HandleTypeDef *hdmatx;
+    DMA_HandleTypeDef *hdmarx;
+    HAL_I2C_StateTypeDef State;
+    uint32_t ErrorCode;
+} I2C_HandleTypeDef;
+
+#define HAL_MAX_DELAY 0xFFFFFFFFU
+#define I2C_MEMADD_SIZE_8BIT 0x00000001U
+#define I2C_ANALOGFILTER_ENABLE 0x00000000U
+
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+
+void HAL_Delay(uint32_t delay);
+
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef *hi2c);
+HAL_StatusTypeDef HAL_I2C_DeInit(I2C_HandleTypeDef *hi2c);
+HAL_StatusTypeDef HAL_I2CEx_ConfigAnalogFilter(I2C_HandleTypeDef *hi2c, uint32_t filter);
+HAL_StatusTypeDef HAL_I2CEx_ConfigDigitalFilter(I2C_HandleTypeDef *hi2c, uint32_t filter);
+HAL_I2C_StateTypeDef HAL_I2C_GetState(I2C_HandleTypeDef *hi2c);
+uint32_t HAL_I2C_GetError(I2C_HandleTypeDef *hi2c);
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef *hi2c, uint16_t dev_address, uint16_t mem_address,
+    uint16_t mem_add_size, uint8_t *data, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef *hi2c, uint16_t dev_address, uint16_t mem_address,
+    uint16_t mem_add_size, uint8_t *data, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef HAL_I2C_Mem_Read_IT(I2C_HandleTypeDef *hi2c, uint16_t dev_address, uint16_t mem_address,
+    uint16_t mem_add_size, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_I2C_Mem_Write_IT(I2C_HandleTypeDef *hi2c, uint16_t dev_address, uint16_t mem_address,
+    uint16_t mem_add_size, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef *hi2c, uint16_t dev_address, uint16_t mem_address,
+    uint16_t mem_add_size, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_I2C_Mem_Write_DMA(I2C_HandleTypeDef *hi2c, uint16_t dev_address, uint16_t mem_address,
+    uint16_t mem_add_size, uint8_t *data, uint16_t size);
+
+#endif /* STM32L0XX_HAL_H */
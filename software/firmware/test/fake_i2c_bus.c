@@ -0,0 +1,316 @@
+/*
+ * Fake I2C bus and single-threaded RTOS stand-ins for host-side tests.
+ */
+
+#include "fake_i2c_bus.h"
+
+#include <string.h>
+
+#include "cmsis_os.h"
+#include "i2c_handler.h"
+
+#define FAKE_OS_OBJECT_MAX 8
+
+typedef enum {
+    FAKE_PENDING_NONE = 0,
+    FAKE_PENDING_COMPLETE,
+    FAKE_PENDING_ERROR
+} fake_pending_t;
+
+struct fake_os_object {
+    uint32_t count;
+    uint32_t max_count;
+};
+
+static uint8_t fake_registers[256];
+static fake_i2c_stats_t fake_stats;
+static bool fake_kernel_running;
+static bool fake_busy;
+static uint32_t fake_started;
+static uint32_t fake_fail_number;
+static uint32_t fake_stall_number;
+
+static I2C_HandleTypeDef *fake_pending_hi2c;
+static fake_pending_t fake_pending;
+
+static struct fake_os_object fake_objects[FAKE_OS_OBJECT_MAX];
+static size_t fake_object_count;
+static struct fake_os_object *fake_mutexes[FAKE_OS_OBJECT_MAX];
+static size_t fake_mutex_count;
+
+void fake_i2c_reset(void)
+{
+    memset(fake_registers, 0, sizeof(fake_registers));
+    memset(&fake_stats, 0, sizeof(fake_stats));
+    fake_kernel_running = false;
+    fake_busy = false;
+    fake_started = 0;
+    fake_fail_number = 0;
+    fake_stall_number = 0;
+    fake_pending_hi2c = NULL;
+    fake_pending = FAKE_PENDING_NONE;
+}
+
+void fake_i2c_set_kernel_running(bool running)
+{
+    fake_kernel_running = running;
+}
+
+uint8_t *fake_i2c_registers(void)
+{
+    return fake_registers;
+}
+
+void fake_i2c_fail_transfer(uint32_t number)
+{
+    fake_fail_number = number ? fake_started + number : 0;
+}
+
+void fake_i2c_stall_transfer(uint32_t number)
+{
+    fake_stall_number = number ? fake_started + number : 0;
+}
+
+void fake_i2c_set_busy(bool busy)
+{
+    fake_busy = busy;
+}
+
+void fake_i2c_clear_stats(void)
+{
+    memset(&fake_stats, 0, sizeof(fake_stats));
+}
+
+const fake_i2c_stats_t *fake_i2c_get_stats(void)
+{
+    return &fake_stats;
+}
+
+bool fake_i2c_mutex_held(void)
+{
+    for (size_t i = 0; i < fake_mutex_count; i++) {
+        if (fake_mutexes[i]->count == 0) { return true; }
+    }
+    return false;
+}
+
+/* Registers past the end of the map all alias the last one, like the FIFO */
+static void fake_bus_read(uint16_t mem_address, uint8_t *data, uint16_t size)
+{
+    for (uint16_t i = 0; i < size; i++) {
+        data[i] = fake_registers[MIN(mem_address + i, 0xFF)];
+    }
+    fake_stats.transfers++;
+    fake_stats.reads++;
+    fake_stats.bytes += size;
+    fake_stats.bus_bytes += size + 3;
+}
+
+static void fake_bus_write(uint16_t mem_address, const uint8_t *data, uint16_t size)
+{
+    for (uint16_t i = 0; i < size; i++) {
+        fake_registers[MIN(mem_address + i, 0xFF)] = data[i];
+    }
+    fake_stats.transfers++;
+    fake_stats.writes++;
+    fake_stats.bytes += size;
+    fake_stats.bus_bytes += size + 2;
+}
+
+static HAL_StatusTypeDef fake_bus_start(I2C_HandleTypeDef *hi2c, bool read,
+    uint16_t mem_address, uint8_t *data, uint16_t size)
+{
+    if (fake_busy) { return HAL_BUSY; }
+
+    fake_started++;
+    fake_pending_hi2c = hi2c;
+    if (fake_started == fake_stall_number) {
+        fake_pending = FAKE_PENDING_NONE;
+    } else if (fake_started == fake_fail_number) {
+        fake_pending = FAKE_PENDING_ERROR;
+    } else {
+        if (read) {
+            fake_bus_read(mem_address, data, size);
+        } else {
+            fake_bus_write(mem_address, data, size);
+        }
+        fake_pending = FAKE_PENDING_COMPLETE;
+    }
+    return HAL_OK;
+}
+
+/* Run the completion interrupts, which may chain further transfers */
+static void fake_bus_deliver_interrupts(void)
+{
+    while (fake_pending != FAKE_PENDING_NONE) {
+        const fake_pending_t pending = fake_pending;
+        fake_pending = FAKE_PENDING_NONE;
+        if (pending == FAKE_PENDING_COMPLETE) {
+            i2c_completion_callback(fake_pending_hi2c);
+        } else {
+            i2c_error_callback(fake_pending_hi2c);
+        }
+    }
+}
+
+void HAL_Delay(uint32_t delay)
+{
+    (void)delay;
+}
+
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef *hi2c)
+{
+    hi2c->State = HAL_I2C_STATE_READY;
+    fake_stats.bus_resets++;
+    fake_pending = FAKE_PENDING_NONE;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_DeInit(I2C_HandleTypeDef *hi2c)
+{
+    hi2c->State = HAL_I2C_STATE_RESET;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2CEx_ConfigAnalogFilter(I2C_HandleTypeDef *hi2c, uint32_t filter)
+{
+    (void)hi2c;
+    (void)filter;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2CEx_ConfigDigitalFilter(I2C_HandleTypeDef *hi2c, uint32_t filter)
+{
+    (void)hi2c;
+    (void)filter;
+    return HAL_OK;
+}
+
+HAL_I2C_StateTypeDef HAL_I2C_GetState(I2C_HandleTypeDef *hi2c)
+{
+    return hi2c->State;
+}
+
+uint32_t HAL_I2C_GetError(I2C_HandleTypeDef *hi2c)
+{
+    return hi2c->ErrorCode;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef *hi2c, uint16_t dev_address, uint16_t mem_address,
+    uint16_t mem_add_size, uint8_t *data, uint16_t size, uint32_t timeout)
+{
+    (void)hi2c; (void)dev_address; (void)mem_add_size; (void)timeout;
+    fake_bus_read(mem_address, data, size);
+    fake_stats.polled++;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef *hi2c, uint16_t dev_address, uint16_t mem_address,
+    uint16_t mem_add_size, uint8_t *data, uint16_t size, uint32_t timeout)
+{
+    (void)hi2c; (void)dev_address; (void)mem_add_size; (void)timeout;
+    fake_bus_write(mem_address, data, size);
+    fake_stats.polled++;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read_IT(I2C_HandleTypeDef *hi2c, uint16_t dev_address, uint16_t mem_address,
+    uint16_t mem_add_size, uint8_t *data, uint16_t size)
+{
+    (void)dev_address; (void)mem_add_size;
+    HAL_StatusTypeDef ret = fake_bus_start(hi2c, true, mem_address, data, size);
+    if (ret == HAL_OK) { fake_stats.interrupt++; }
+    return ret;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write_IT(I2C_HandleTypeDef *hi2c, uint16_t dev_address, uint16_t mem_address,
+    uint16_t mem_add_size, uint8_t *data, uint16_t size)
+{
+    (void)dev_address; (void)mem_add_size;
+    HAL_StatusTypeDef ret = fake_bus_start(hi2c, false, mem_address, data, size);
+    if (ret == HAL_OK) { fake_stats.interrupt++; }
+    return ret;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef *hi2c, uint16_t dev_address, uint16_t mem_address,
+    uint16_t mem_add_size, uint8_t *data, uint16_t size)
+{
+    (void)dev_address; (void)mem_add_size;
+    HAL_StatusTypeDef ret = fake_bus_start(hi2c, true, mem_address, data, size);
+    if (ret == HAL_OK) { fake_stats.dma++; }
+    return ret;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write_DMA(I2C_HandleTypeDef *hi2c, uint16_t dev_address, uint16_t mem_address,
+    uint16_t mem_add_size, uint8_t *data, uint16_t size)
+{
+    (void)dev_address; (void)mem_add_size;
+    HAL_StatusTypeDef ret = fake_bus_start(hi2c, false, mem_address, data, size);
+    if (ret == HAL_OK) { fake_stats.dma++; }
+    return ret;
+}
+
+osKernelState_t osKernelGetState(void)
+{
+    return fake_kernel_running ? osKernelRunning : osKernelReady;
+}
+
+osMutexId_t osMutexNew(const osMutexAttr_t *attr)
+{
+    (void)attr;
+    if (fake_object_count == FAKE_OS_OBJECT_MAX) { return NULL; }
+    struct fake_os_object *mutex = &fake_objects[fake_object_count++];
+    mutex->count = 1;
+    mutex->max_count = 1;
+    fake_mutexes[fake_mutex_count++] = mutex;
+    return mutex;
+}
+
+osStatus_t osMutexAcquire(osMutexId_t mutex_id, uint32_t timeout)
+{
+    /* With a single thread, a held mutex can never be released */
+    if (mutex_id->count == 0) {
+        return (timeout == 0) ? osErrorResource : osErrorTimeout;
+    }
+    mutex_id->count = 0;
+    return osOK;
+}
+
+osStatus_t osMutexRelease(osMutexId_t mutex_id)
+{
+    if (mutex_id->count != 0) { return osErrorResource; }
+    mutex_id->count = 1;
+    return osOK;
+}
+
+osSemaphoreId_t osSemaphoreNew(uint32_t max_count, uint32_t initial_count, const osSemaphoreAttr_t *attr)
+{
+    (void)attr;
+    if (fake_object_count == FAKE_OS_OBJECT_MAX) { return NULL; }
+    struct fake_os_object *semaphore = &fake_objects[fake_object_count++];
+    semaphore->count = initial_count;
+    semaphore->max_count = max_count;
+    return semaphore;
+}
+
+osStatus_t osSemaphoreAcquire(osSemaphoreId_t semaphore_id, uint32_t timeout)
+{
+    /* Waiting is when the interrupts of a running transfer would come in */
+    if (timeout != 0) {
+        fake_stats.waits++;
+        fake_bus_deliver_interrupts();
+    }
+
+    if (semaphore_id->count == 0) {
+        return (timeout == 0) ? osErrorResource : osErrorTimeout;
+    }
+    semaphore_id->count--;
+    return osOK;
+}
+
+osStatus_t osSemaphoreRelease(osSemaphoreId_t semaphore_id)
+{
+    if (semaphore_id->count >= semaphore_id->max_count) { return osErrorResource; }
+    semaphore_id->count++;
+    return osOK;
+}
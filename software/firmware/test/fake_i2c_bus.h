@@ -0,0 +1,75 @@
+/*
+ * Fake I2C bus for host-side tests of the I2C handler and the drivers
+ * built on top of it.
+ *
+ * The bus holds the register file of a single device, and implements the
+ * polled, interrupt and DMA variants of the HAL memory read and write
+ * functions against it. Interrupt and DMA transfers complete later, the
+ * next time a semaphore is waited on, which is when the firmware would
+ * be sleeping while the peripheral does the work.
+ */
+
+#ifndef FAKE_I2C_BUS_H
+#define FAKE_I2C_BUS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stm32l0xx_hal.h"
+
+typedef struct {
+    uint32_t transfers;    /*!< Register reads and writes on the bus */
+    uint32_t bytes;        /*!< Data bytes moved, excluding addressing */
+    uint32_t bus_bytes;    /*!< Bytes on the bus, including device and register addressing */
+    uint32_t reads;        /*!< Register reads */
+    uint32_t writes;       /*!< Register writes */
+    uint32_t polled;       /*!< Transfers run with the blocking HAL functions */
+    uint32_t interrupt;    /*!< Transfers run in interrupt mode */
+    uint32_t dma;          /*!< Transfers run in DMA mode */
+    uint32_t bus_resets;   /*!< Peripheral reinitializations */
+    uint32_t waits;        /*!< Times a task slept waiting for the bus */
+} fake_i2c_stats_t;
+
+/**
+ * Reset the register file, statistics, injected faults and RTOS state.
+ */
+void fake_i2c_reset(void);
+
+/**
+ * Set whether the fake RTOS reports the scheduler as running.
+ */
+void fake_i2c_set_kernel_running(bool running);
+
+/**
+ * Get the register file of the device on the bus.
+ */
+uint8_t *fake_i2c_registers(void);
+
+/**
+ * Make a future transfer fail, counting from 1 for the next one started.
+ */
+void fake_i2c_fail_transfer(uint32_t number);
+
+/**
+ * Make a future transfer never complete, counting from 1 for the next one started.
+ */
+void fake_i2c_stall_transfer(uint32_t number);
+
+/**
+ * Make the interrupt and DMA start functions report a busy peripheral.
+ */
+void fake_i2c_set_busy(bool busy);
+
+/**
+ * Clear the statistics, leaving the register file unchanged.
+ */
+void fake_i2c_clear_stats(void);
+
+const fake_i2c_stats_t *fake_i2c_get_stats(void);
+
+/**
+ * Check whether any mutex created through the fake RTOS is held.
+ */
+bool fake_i2c_mutex_held(void);
+
+#endif /* FAKE_I2C_BUS_H */
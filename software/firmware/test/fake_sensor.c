@@ -0,0 +1,346 @@
+/*
+ * Fake sensor task, light source, settings and RTOS time stand-ins
+ * for host-side tests of the measurement routines.
+ */
+
+#include "fake_sensor.h"
+
+#include <string.h>
+#include <math.h>
+
+#include "cmsis_os.h"
+#include "settings.h"
+#include "light.h"
+#include "util.h"
+
+/* Per-sample reading where the simulated ADC saturates */
+#define FAKE_SAMPLE_FULL_SCALE 2000.0
+
+/* Fraction of full scale the simulated AGC settles below */
+#define FAKE_AGC_TARGET 0.5
+
+static fake_sensor_stats_t fake_stats;
+static sensor_config_t fake_config;
+static double fake_target;
+static bool fake_running;
+static bool fake_triggered;
+static bool fake_discard_next;
+static bool fake_gain_restore;
+static bool fake_light_pending;
+static sensor_light_t fake_light;
+static uint16_t fake_light_value;
+static uint32_t fake_light_ticks;
+static uint32_t fake_reading_count;
+static uint32_t fake_ticks;
+
+void fake_sensor_reset(void)
+{
+    memset(&fake_stats, 0, sizeof(fake_stats));
+    memset(&fake_config, 0, sizeof(fake_config));
+    fake_target = 0.0;
+    fake_running = false;
+    fake_triggered = false;
+    fake_discard_next = false;
+    fake_gain_restore = false;
+    fake_light_pending = false;
+    fake_light = SENSOR_LIGHT_OFF;
+    fake_light_value = 0;
+    fake_light_ticks = 0;
+    fake_reading_count = 0;
+    fake_ticks = 0;
+}
+
+void fake_sensor_set_target(double counts_per_sample)
+{
+    fake_target = counts_per_sample;
+}
+
+void fake_sensor_clear_stats(void)
+{
+    memset(&fake_stats, 0, sizeof(fake_stats));
+}
+
+const fake_sensor_stats_t *fake_sensor_get_stats(void)
+{
+    return &fake_stats;
+}
+
+static bool fake_continuous(void)
+{
+    return fake_config.trigger_mode != TSL2585_TRIGGER_VSYNC;
+}
+
+static double fake_sample_counts(tsl2585_gain_t gain)
+{
+    if (fake_light == SENSOR_LIGHT_OFF || fake_light_value == 0) { return 0.0; }
+    return fake_target * (double)tsl2585_gain_value(gain);
+}
+
+/* Run one integration cycle with the current configuration */
+static void fake_run_cycle(sensor_reading_t *reading)
+{
+    tsl2585_gain_t gain = fake_config.gain[0];
+    uint16_t sample_count = fake_config.sample_count;
+
+    if (fake_config.agc_enabled) {
+        /* Step down from the configured gain until the reading is in range */
+        while (gain > TSL2585_GAIN_0_5X && fake_sample_counts(gain) > FAKE_SAMPLE_FULL_SCALE * FAKE_AGC_TARGET) {
+            gain--;
+        }
+        sample_count = fake_config.agc_sample_count;
+    }
+
+    const double sample_counts = fake_sample_counts(gain);
+    const uint32_t cycle_ms = (uint32_t)lroundf(tsl2585_integration_time_ms(fake_config.sample_time, sample_count));
+
+    fake_ticks += cycle_ms;
+    fake_stats.cycle_ms += cycle_ms;
+    fake_stats.cycles++;
+
+    memset(reading, 0, sizeof(sensor_reading_t));
+    reading->mod0.gain = gain;
+    if (sample_counts > FAKE_SAMPLE_FULL_SCALE) {
+        reading->mod0.result = SENSOR_RESULT_SATURATED_ANALOG;
+    } else {
+        reading->mod0.result = SENSOR_RESULT_VALID;
+        reading->mod0.als_data = (uint32_t)lround(sample_counts * (double)(sample_count + 1));
+    }
+    reading->mod1 = reading->mod0;
+    reading->sample_time = fake_config.sample_time;
+    reading->sample_count = sample_count;
+    reading->reading_ticks = fake_ticks;
+    reading->light_ticks = fake_light_ticks;
+    reading->reading_count = ++fake_reading_count;
+
+    /* A light change held for the end of the cycle happens now */
+    if (fake_light_pending) {
+        fake_light_pending = false;
+        fake_light = fake_config.light;
+        fake_light_value = fake_config.light_value;
+        fake_light_ticks = fake_ticks;
+    }
+}
+
+/* Record a change to a running sensor, which spoils the cycle in progress in continuous modes */
+static void fake_changed(void)
+{
+    fake_stats.configures++;
+    if (fake_running && fake_continuous()) {
+        fake_discard_next = true;
+    }
+}
+
+osStatus_t sensor_start()
+{
+    fake_running = true;
+    fake_reading_count = 0;
+    fake_stats.starts++;
+    fake_gain_restore = false;
+    if (fake_continuous()) {
+        fake_discard_next = true;
+    } else {
+        /* Priming the VSYNC trigger starts the first cycle */
+        fake_discard_next = false;
+        fake_triggered = true;
+        fake_stats.triggers++;
+    }
+    return osOK;
+}
+
+osStatus_t sensor_stop()
+{
+    fake_running = false;
+    fake_triggered = false;
+    return osOK;
+}
+
+osStatus_t sensor_set_trigger_mode(tsl2585_trigger_mode_t trigger_mode)
+{
+    if (trigger_mode != fake_config.trigger_mode) {
+        fake_config.trigger_mode = trigger_mode;
+        fake_changed();
+    }
+    return osOK;
+}
+
+osStatus_t sensor_configure(const sensor_config_t *config)
+{
+    if (!config) { return osErrorParameter; }
+
+    if (config->trigger_mode != fake_config.trigger_mode) {
+        sensor_set_trigger_mode(config->trigger_mode);
+    }
+
+    if (config->mode != fake_config.mode
+        || config->gain[0] != fake_config.gain[0] || config->gain[1] != fake_config.gain[1]
+        || config->sample_time != fake_config.sample_time || config->sample_count != fake_config.sample_count
+        || (config->agc_enabled && config->agc_sample_count != fake_config.agc_sample_count)) {
+        fake_changed();
+    }
+
+    if (config->agc_enabled != fake_config.agc_enabled) {
+        fake_changed();
+        if (!config->agc_enabled && fake_running && fake_continuous()) {
+            fake_gain_restore = true;
+        }
+    }
+
+    const sensor_light_t light = fake_config.light;
+    const uint16_t light_value = fake_config.light_value;
+    fake_config = *config;
+    fake_config.light = light;
+    fake_config.light_value = light_value;
+
+    return sensor_set_light_mode(config->light, config->light_next_cycle, config->light_value);
+}
+
+osStatus_t sensor_set_light_mode(sensor_light_t light, bool next_cycle, uint16_t value)
+{
+    fake_config.light = light;
+    fake_config.light_value = value;
+    if (next_cycle && fake_running) {
+        fake_light_pending = true;
+    } else if (light != fake_light || value != fake_light_value) {
+        fake_light_pending = false;
+        fake_light = light;
+        fake_light_value = value;
+        fake_light_ticks = fake_ticks;
+    }
+    return osOK;
+}
+
+osStatus_t sensor_trigger_next_reading()
+{
+    if (!fake_running || fake_continuous()) { return osErrorResource; }
+    fake_triggered = true;
+    fake_stats.triggers++;
+    return osOK;
+}
+
+void sensor_reading_cursor_init(sensor_reading_cursor_t *cursor)
+{
+    if (!cursor) { return; }
+    cursor->next = 0;
+    cursor->overruns = 0;
+}
+
+osStatus_t sensor_wait_next_reading(sensor_reading_cursor_t *cursor, sensor_reading_t *reading, uint32_t timeout)
+{
+    if (!cursor || !reading) { return osErrorParameter; }
+
+    if (!fake_running || (!fake_continuous() && !fake_triggered)) {
+        /* Nothing will ever come */
+        fake_ticks += timeout;
+        return osErrorTimeout;
+    }
+
+    if (!fake_continuous()) {
+        fake_triggered = false;
+        fake_run_cycle(reading);
+        cursor->next++;
+        return osOK;
+    }
+
+    /* Continuous cycles run back to back until one is not discarded */
+    for (;;) {
+        fake_run_cycle(reading);
+        if (!fake_discard_next) { break; }
+        fake_discard_next = false;
+        fake_stats.discarded++;
+
+        /* The gain is restored after the first cycle with AGC disabled */
+        if (fake_gain_restore) {
+            fake_gain_restore = false;
+            fake_discard_next = true;
+        }
+    }
+    cursor->next++;
+    return osOK;
+}
+
+void light_set_frequency(light_frequency_t frequency)
+{
+    (void)frequency;
+}
+
+uint16_t light_get_max_value()
+{
+    return 128;
+}
+
+uint32_t settings_get_cal_generation()
+{
+    return 1;
+}
+
+bool settings_set_cal_gain(const settings_cal_gain_t *cal_gain)
+{
+    (void)cal_gain;
+    return true;
+}
+
+bool settings_get_cal_gain(settings_cal_gain_t *cal_gain)
+{
+    /* Nominal gain values, as used without a gain calibration */
+    for (size_t i = 0; i <= TSL2585_GAIN_256X; i++) {
+        cal_gain->values[i] = tsl2585_gain_value((tsl2585_gain_t)i);
+    }
+    return true;
+}
+
+float settings_get_cal_gain_value(const settings_cal_gain_t *cal_gain, tsl2585_gain_t gain)
+{
+    return (gain <= TSL2585_GAIN_256X) ? cal_gain->values[gain] : tsl2585_gain_value(gain);
+}
+
+bool settings_get_cal_vis_temperature(settings_cal_temperature_t *cal_temperature)
+{
+    cal_temperature->b0 = NAN;
+    cal_temperature->b1 = NAN;
+    cal_temperature->b2 = NAN;
+    return false;
+}
+
+bool settings_get_cal_uv_temperature(settings_cal_temperature_t *cal_temperature)
+{
+    return settings_get_cal_vis_temperature(cal_temperature);
+}
+
+bool settings_get_cal_light_drift(settings_cal_light_drift_t *cal_light_drift)
+{
+    memset(cal_light_drift, 0, sizeof(settings_cal_light_drift_t));
+    return false;
+}
+
+void settings_get_cal_target_drift(settings_cal_light_drift_t *cal_target_drift)
+{
+    memset(cal_target_drift, 0, sizeof(settings_cal_light_drift_t));
+}
+
+bool is_valid_number(float num)
+{
+    return isnormal(num) || fpclassify(num) == FP_ZERO;
+}
+
+uint32_t osKernelGetTickCount(void)
+{
+    return fake_ticks;
+}
+
+uint32_t osKernelGetTickFreq(void)
+{
+    return 1000;
+}
+
+osStatus_t osDelay(uint32_t ticks)
+{
+    fake_ticks += ticks;
+    return osOK;
+}
+
+osStatus_t osDelayUntil(uint32_t ticks)
+{
+    if ((int32_t)(ticks - fake_ticks) <= 0) { return osErrorParameter; }
+    fake_ticks = ticks;
+    return osOK;
+}
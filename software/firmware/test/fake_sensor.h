@@ -0,0 +1,50 @@
+/*
+ * Fake sensor task for host-side tests of the measurement routines.
+ *
+ * Implements the sensor task API against a simulated TSL2585 and light
+ * source, with simulated time. Integration cycles run the same way the
+ * sensor task runs them. In VSYNC trigger mode, each cycle waits for an
+ * explicit trigger. In continuous mode, cycles run back to back, and a
+ * configuration change while running discards the cycle in progress.
+ * Disabling AGC discards one more cycle once the gain is restored.
+ */
+
+#ifndef FAKE_SENSOR_H
+#define FAKE_SENSOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "task_sensor.h"
+
+typedef struct {
+    uint32_t starts;       /*!< Times the sensor was started */
+    uint32_t cycles;       /*!< Integration cycles run by the sensor */
+    uint32_t discarded;    /*!< Cycles thrown away after a configuration change */
+    uint32_t triggers;     /*!< Cycles started by an explicit trigger */
+    uint32_t configures;   /*!< Configuration changes made to the sensor */
+    uint32_t cycle_ms;     /*!< Simulated time spent in integration cycles */
+} fake_sensor_stats_t;
+
+/**
+ * Reset the sensor state, statistics and simulated time.
+ */
+void fake_sensor_reset(void);
+
+/**
+ * Set the light that reaches the sensor with the light source on,
+ * in counts per sample at 1x gain.
+ */
+void fake_sensor_set_target(double counts_per_sample);
+
+/**
+ * Clear the statistics, keeping the sensor state.
+ */
+void fake_sensor_clear_stats(void);
+
+/**
+ * Get the statistics collected since the last reset or clear.
+ */
+const fake_sensor_stats_t *fake_sensor_get_stats(void);
+
+#endif /* FAKE_SENSOR_H */
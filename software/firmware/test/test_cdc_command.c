@@ -0,0 +1,332 @@
+/*
+ * Test for CDC command parsing and the sorted command table lookup.
+ *
+ * Every entry of a command table must be found from its command line,
+ * with any sub-action consumed from the arguments, and tables that are
+ * out of order or have ambiguous entries must be rejected. A request ID
+ * prefix on a command must come back on its response, and malformed
+ * prefixes must cause the command to be ignored.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "cdc_command.h"
+
+#define TEST_LINE_SIZE 64
+
+static bool test_handler(const cdc_command_t *cmd, const cdc_args_t *args)
+{
+    (void)cmd;
+    (void)args;
+    return true;
+}
+
+#define CMD(t, c, a, s) { CMD_TYPE_##t, CMD_CATEGORY_##c, a, s, 0, CDC_ARGS_STRING, 0, test_handler }
+static const cdc_command_entry_t test_table[] = {
+    CMD(SET,    SYSTEM,      "DISP",   NULL),
+    CMD(GET,    SYSTEM,      "CMDS",   NULL),
+    CMD(GET,    SYSTEM,      "V",      NULL),
+    CMD(INVOKE, SYSTEM,      "REMOTE", NULL),
+    CMD(SET,    MEASUREMENT, "FORMAT", NULL),
+    CMD(GET,    CALIBRATION, "GAIN",   NULL),
+    CMD(INVOKE, CALIBRATION, "GAIN",   NULL),
+    CMD(GET,    DIAGNOSTICS, "LIGHT",  NULL),
+    CMD(INVOKE, DIAGNOSTICS, "S",      "MODE"),
+    CMD(INVOKE, DIAGNOSTICS, "S",      "START"),
+    CMD(INVOKE, DIAGNOSTICS, "S",      "STOP"),
+    CMD(INVOKE, DIAGNOSTICS, "SEQ",    NULL)
+};
+#define TEST_COMMAND_COUNT (sizeof(test_table) / sizeof(cdc_command_entry_t))
+
+static const char type_chars[] = { 'S', 'G', 'I' };
+static const char category_chars[] = { 'S', 'M', 'C', 'D' };
+
+static const cdc_command_entry_t *lookup_line(const char *line, cdc_command_t *cmd)
+{
+    static char buf[TEST_LINE_SIZE];
+    strncpy(buf, line, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    memset(cmd, 0, sizeof(cdc_command_t));
+    if (!cdc_command_parse(cmd, buf, strlen(buf))) {
+        return NULL;
+    }
+    return cdc_command_lookup(test_table, TEST_COMMAND_COUNT, cmd);
+}
+
+static bool test_table_check(void)
+{
+    cdc_command_entry_t table[TEST_COMMAND_COUNT];
+    bool success = true;
+
+    if (!cdc_command_table_check(test_table, TEST_COMMAND_COUNT)) {
+        printf("FAIL: sorted table rejected\n");
+        success = false;
+    }
+
+    /* Swapped categories */
+    memcpy(table, test_table, sizeof(table));
+    table[3] = test_table[4];
+    table[4] = test_table[3];
+    if (cdc_command_table_check(table, TEST_COMMAND_COUNT)) {
+        printf("FAIL: unsorted categories accepted\n");
+        success = false;
+    }
+
+    /* Swapped actions */
+    memcpy(table, test_table, sizeof(table));
+    table[1] = test_table[2];
+    table[2] = test_table[1];
+    if (cdc_command_table_check(table, TEST_COMMAND_COUNT)) {
+        printf("FAIL: unsorted actions accepted\n");
+        success = false;
+    }
+
+    /* Swapped sub-actions */
+    memcpy(table, test_table, sizeof(table));
+    table[9] = test_table[10];
+    table[10] = test_table[9];
+    if (cdc_command_table_check(table, TEST_COMMAND_COUNT)) {
+        printf("FAIL: unsorted sub-actions accepted\n");
+        success = false;
+    }
+
+    /* Duplicate sub-action */
+    memcpy(table, test_table, sizeof(table));
+    table[10].sub = "START";
+    if (cdc_command_table_check(table, TEST_COMMAND_COUNT)) {
+        printf("FAIL: duplicate sub-action accepted\n");
+        success = false;
+    }
+
+    /* Duplicate action, where one entry would hide the other */
+    memcpy(table, test_table, sizeof(table));
+    table[8].sub = NULL;
+    if (cdc_command_table_check(table, TEST_COMMAND_COUNT)) {
+        printf("FAIL: action without a sub-action accepted alongside sub-actions\n");
+        success = false;
+    }
+    memcpy(table, test_table, sizeof(table));
+    table[2].action = "CMDS";
+    if (cdc_command_table_check(table, TEST_COMMAND_COUNT)) {
+        printf("FAIL: duplicate action accepted\n");
+        success = false;
+    }
+
+    /* Tables too short to be out of order */
+    if (!cdc_command_table_check(test_table, 1) || !cdc_command_table_check(test_table, 0)) {
+        printf("FAIL: short table rejected\n");
+        success = false;
+    }
+
+    return success;
+}
+
+static bool test_lookup_all(void)
+{
+    bool success = true;
+
+    for (size_t i = 0; i < TEST_COMMAND_COUNT; i++) {
+        const cdc_command_entry_t *expected = &test_table[i];
+        char line[TEST_LINE_SIZE];
+        cdc_command_t cmd;
+
+        /* Plain command, then with arguments after the action and any sub-action */
+        if (expected->sub) {
+            snprintf(line, sizeof(line), "%c%c %s,%s", type_chars[expected->type], category_chars[expected->category],
+                expected->action, expected->sub);
+        } else {
+            snprintf(line, sizeof(line), "%c%c %s", type_chars[expected->type], category_chars[expected->category],
+                expected->action);
+        }
+        if (lookup_line(line, &cmd) != expected || strcmp(cmd.args, "") != 0) {
+            printf("FAIL: lookup \"%s\"\n", line);
+            success = false;
+        }
+
+        strncat(line, ",12,AB", sizeof(line) - strlen(line) - 1);
+        if (lookup_line(line, &cmd) != expected || strcmp(cmd.args, "12,AB") != 0) {
+            printf("FAIL: lookup \"%s\", args \"%s\"\n", line, cmd.args);
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+static bool test_lookup_unknown(void)
+{
+    static const char *lines[] = {
+        "GS X",          /* Unknown action */
+        "GS VV",         /* Action with a known action as its prefix */
+        "GS",            /* No action */
+        "SS V",          /* Known action with the wrong type */
+        "GM V",          /* Known action in the wrong category */
+        "ID S",          /* Missing sub-action */
+        "ID S,",         /* Empty sub-action */
+        "ID S,RUN",      /* Unknown sub-action */
+        "ID S,STARTED",  /* Sub-action with a known sub-action as its prefix */
+        "ID S,STAR",     /* Prefix of a known sub-action */
+        "ID START",      /* Sub-action given as the action */
+        "XS V",          /* Invalid type */
+        "GX V",          /* Invalid category */
+        "GSV",           /* No space after the category */
+        "G",             /* Too short */
+        ""
+    };
+    bool success = true;
+
+    for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+        cdc_command_t cmd;
+        const cdc_command_entry_t *entry = lookup_line(lines[i], &cmd);
+        if (entry) {
+            printf("FAIL: \"%s\" found %s\n", lines[i], entry->action);
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+static bool test_parse(void)
+{
+    char buf[TEST_LINE_SIZE] = "IC GAIN,10,20";
+    cdc_command_t cmd = {0};
+    bool success = true;
+
+    if (!cdc_command_parse(&cmd, buf, strlen(buf))
+        || cmd.type != CMD_TYPE_INVOKE || cmd.category != CMD_CATEGORY_CALIBRATION
+        || strcmp(cmd.action, "GAIN") != 0 || strcmp(cmd.args, "10,20") != 0) {
+        printf("FAIL: parse arguments\n");
+        success = false;
+    }
+
+    strcpy(buf, "GS");
+    if (!cdc_command_parse(&cmd, buf, strlen(buf)) || strcmp(cmd.action, "") != 0 || strcmp(cmd.args, "") != 0) {
+        printf("FAIL: parse without an action\n");
+        success = false;
+    }
+
+    return success;
+}
+
+static bool test_format_response(void)
+{
+    char buf[TEST_LINE_SIZE] = "IC GAIN,10,20";
+    char out[TEST_LINE_SIZE];
+    cdc_command_t cmd = {0};
+    bool success = true;
+
+    if (!cdc_command_parse(&cmd, buf, strlen(buf))) {
+        printf("FAIL: parse for response\n");
+        return false;
+    }
+
+    size_t n = cdc_command_format_response(out, sizeof(out), &cmd, "OK");
+    if (n != strlen("IC GAIN,OK\r\n") || strcmp(out, "IC GAIN,OK\r\n") != 0) {
+        printf("FAIL: response \"%s\"\n", out);
+        success = false;
+    }
+
+    /* Truncated to fit, and still terminated */
+    n = cdc_command_format_response(out, 6, &cmd, "OK");
+    if (n != 5 || strcmp(out, "IC GA") != 0) {
+        printf("FAIL: truncated response \"%s\"\n", out);
+        success = false;
+    }
+
+    cmd.type = (cmd_type_t)3;
+    if (cdc_command_format_response(out, sizeof(out), &cmd, "OK") != 0) {
+        printf("FAIL: response to an invalid command\n");
+        success = false;
+    }
+
+    return success;
+}
+
+static bool test_request_id(void)
+{
+    static const struct {
+        const char *line;
+        uint16_t request_id;
+        const char *response;
+    } valid[] = {
+        { "#42 GS V",          42,    "#42 GS V,OK\r\n" },
+        { "#0 GS V",           0,     "#0 GS V,OK\r\n" },
+        { "#65535 GS V",       65535, "#65535 GS V,OK\r\n" },
+        { "#007 GS V",         7,     "#7 GS V,OK\r\n" },
+        { "#1234 ID S,START",  1234,  "#1234 ID S,OK\r\n" },
+    };
+    static const char *invalid[] = {
+        "#65536 GS V",         /* Out of range */
+        "#99999999999999999999 GS V",
+        "#x GS V",             /* Not a number */
+        "# GS V",              /* Empty */
+        "# 42 GS V",           /* Leading space */
+        "#+42 GS V",           /* Sign */
+        "#-1 GS V",
+        "#42GS V",             /* No space after the ID */
+        "#42",                 /* No command */
+        "#42 ",
+        "#"
+    };
+    bool success = true;
+
+    for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+        char out[TEST_LINE_SIZE];
+        cdc_command_t cmd;
+        const cdc_command_entry_t *entry = lookup_line(valid[i].line, &cmd);
+        if (!entry || !cmd.has_request_id || cmd.request_id != valid[i].request_id) {
+            printf("FAIL: \"%s\" request ID\n", valid[i].line);
+            success = false;
+            continue;
+        }
+        cdc_command_format_response(out, sizeof(out), &cmd, "OK");
+        if (strcmp(out, valid[i].response) != 0) {
+            printf("FAIL: \"%s\" response \"%s\"\n", valid[i].line, out);
+            success = false;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        char buf[TEST_LINE_SIZE];
+        cdc_command_t cmd = {0};
+        strcpy(buf, invalid[i]);
+        if (cdc_command_parse(&cmd, buf, strlen(buf))) {
+            printf("FAIL: \"%s\" accepted\n", invalid[i]);
+            success = false;
+        }
+    }
+
+    /* A command without an ID must not pick one up from an earlier command */
+    {
+        char buf[TEST_LINE_SIZE] = "GS V";
+        char out[TEST_LINE_SIZE];
+        cdc_command_t cmd = { .request_id = 42, .has_request_id = true };
+        if (!cdc_command_parse(&cmd, buf, strlen(buf)) || cmd.has_request_id
+            || cdc_command_format_response(out, sizeof(out), &cmd, "OK") == 0
+            || strcmp(out, "GS V,OK\r\n") != 0) {
+            printf("FAIL: request ID without a prefix\n");
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+int main(void)
+{
+    bool success = true;
+
+    success = test_table_check() && success;
+    success = test_lookup_all() && success;
+    success = test_lookup_unknown() && success;
+    success = test_parse() && success;
+    success = test_format_response() && success;
+    success = test_request_id() && success;
+
+    printf("%s\n", success ? "PASS" : "FAIL");
+    return success ? 0 : 1;
+}
@@ -0,0 +1,230 @@
+/*
+ * Test for the CDC transmit ring and its overflow policies.
+ *
+ * Random writes and partial drains are run against the ring and against
+ * a plain linear buffer that follows the same rules. The data drained
+ * from the ring must always match the model, including across the wrap
+ * of the free-running counters, and every byte offered to the ring must
+ * be accounted for as sent, pending, or dropped.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "cdc_tx_ring.h"
+
+#define SIM_ITERATIONS 200000
+
+/* Longer than the ring, to cover messages that can never fit */
+#define SIM_MAX_MESSAGE (CDC_TX_RING_SIZE + 64)
+
+typedef struct {
+    uint8_t data[CDC_TX_RING_SIZE];
+    size_t len;
+    uint64_t offered;
+    uint64_t sent;
+} sim_model_t;
+
+static uint32_t sim_seed = 12345;
+
+static uint32_t sim_random(void)
+{
+    sim_seed = (sim_seed * 1103515245U) + 12345U;
+    return sim_seed >> 8;
+}
+
+static void model_enqueue(sim_model_t *model, const uint8_t *buf, size_t len, cdc_tx_overflow_policy_t policy)
+{
+    model->offered += len;
+    if (len > CDC_TX_RING_SIZE - model->len) {
+        if (policy != CDC_TX_OVERFLOW_DROP_OLDEST) { return; }
+        if (len > CDC_TX_RING_SIZE) {
+            buf += len - CDC_TX_RING_SIZE;
+            len = CDC_TX_RING_SIZE;
+        }
+        const size_t discard = len - (CDC_TX_RING_SIZE - model->len);
+        if (discard > 0) {
+            memmove(model->data, model->data + discard, model->len - discard);
+            model->len -= discard;
+        }
+    }
+    memcpy(model->data + model->len, buf, len);
+    model->len += len;
+}
+
+/* Drain up to the given number of bytes, as a partly full USB FIFO would */
+static bool drain(cdc_tx_ring_t *ring, sim_model_t *model, size_t limit)
+{
+    while (limit > 0 && cdc_tx_ring_pending(ring) > 0) {
+        size_t len;
+        const uint8_t *data = cdc_tx_ring_peek(ring, &len);
+        if (len == 0 || data < ring->data || data + len > ring->data + CDC_TX_RING_SIZE) {
+            printf("FAIL: peek of %lu bytes outside the ring\n", (unsigned long)len);
+            return false;
+        }
+        if (len > limit) { len = limit; }
+        if (len > model->len || memcmp(data, model->data, len) != 0) {
+            printf("FAIL: drained data does not match\n");
+            return false;
+        }
+
+        cdc_tx_ring_consume(ring, len);
+        memmove(model->data, model->data + len, model->len - len);
+        model->len -= len;
+        model->sent += len;
+        limit -= len;
+    }
+    return true;
+}
+
+static bool check_state(const cdc_tx_ring_t *ring, const sim_model_t *model)
+{
+    if (cdc_tx_ring_pending(ring) != model->len
+        || cdc_tx_ring_available(ring) != CDC_TX_RING_SIZE - model->len) {
+        printf("FAIL: %lu bytes pending, expected %lu\n",
+            (unsigned long)cdc_tx_ring_pending(ring), (unsigned long)model->len);
+        return false;
+    }
+    return true;
+}
+
+static bool test_drop_newest(void)
+{
+    cdc_tx_ring_t ring = {0};
+    sim_model_t model = {0};
+    uint8_t message[100];
+    bool success = true;
+
+    memset(message, 'A', sizeof(message));
+    cdc_tx_ring_enqueue(&ring, message, 100, CDC_TX_OVERFLOW_DROP_NEWEST);
+    cdc_tx_ring_enqueue(&ring, message, 100, CDC_TX_OVERFLOW_DROP_NEWEST);
+    model_enqueue(&model, message, 100, CDC_TX_OVERFLOW_DROP_NEWEST);
+    model_enqueue(&model, message, 100, CDC_TX_OVERFLOW_DROP_NEWEST);
+
+    /* Does not fit, so none of it may be queued */
+    memset(message, 'B', sizeof(message));
+    cdc_tx_ring_enqueue(&ring, message, 100, CDC_TX_OVERFLOW_DROP_NEWEST);
+    model_enqueue(&model, message, 100, CDC_TX_OVERFLOW_DROP_NEWEST);
+    if (ring.bytes_dropped != 100 || ring.bytes_queued != 200) {
+        printf("FAIL: drop newest, %lu queued, %lu dropped\n",
+            (unsigned long)ring.bytes_queued, (unsigned long)ring.bytes_dropped);
+        success = false;
+    }
+
+    /* Exactly fills the ring */
+    cdc_tx_ring_enqueue(&ring, message, CDC_TX_RING_SIZE - 200, CDC_TX_OVERFLOW_DROP_NEWEST);
+    model_enqueue(&model, message, CDC_TX_RING_SIZE - 200, CDC_TX_OVERFLOW_DROP_NEWEST);
+    if (cdc_tx_ring_available(&ring) != 0 || ring.bytes_dropped != 100) {
+        printf("FAIL: drop newest, message that exactly fits\n");
+        success = false;
+    }
+
+    success = check_state(&ring, &model) && success;
+    success = drain(&ring, &model, CDC_TX_RING_SIZE) && success;
+    return success;
+}
+
+static bool test_drop_oldest(void)
+{
+    cdc_tx_ring_t ring = {0};
+    sim_model_t model = {0};
+    uint8_t message[CDC_TX_RING_SIZE + 10];
+    bool success = true;
+
+    for (size_t i = 0; i < sizeof(message); i++) {
+        message[i] = (uint8_t)i;
+    }
+
+    cdc_tx_ring_enqueue(&ring, message, 200, CDC_TX_OVERFLOW_DROP_OLDEST);
+    cdc_tx_ring_enqueue(&ring, message + 200, 100, CDC_TX_OVERFLOW_DROP_OLDEST);
+    model_enqueue(&model, message, 200, CDC_TX_OVERFLOW_DROP_OLDEST);
+    model_enqueue(&model, message + 200, 100, CDC_TX_OVERFLOW_DROP_OLDEST);
+    if (ring.bytes_dropped != 300 - CDC_TX_RING_SIZE || cdc_tx_ring_available(&ring) != 0) {
+        printf("FAIL: drop oldest, %lu dropped\n", (unsigned long)ring.bytes_dropped);
+        success = false;
+    }
+    success = check_state(&ring, &model) && success;
+    success = drain(&ring, &model, 50) && success;
+
+    /* Longer than the ring, so only its end is kept */
+    const uint32_t dropped = ring.bytes_dropped;
+    cdc_tx_ring_enqueue(&ring, message, sizeof(message), CDC_TX_OVERFLOW_DROP_OLDEST);
+    model_enqueue(&model, message, sizeof(message), CDC_TX_OVERFLOW_DROP_OLDEST);
+    if (ring.bytes_dropped - dropped != 10 + (CDC_TX_RING_SIZE - 50)) {
+        printf("FAIL: drop oldest, long message dropped %lu\n", (unsigned long)(ring.bytes_dropped - dropped));
+        success = false;
+    }
+    success = check_state(&ring, &model) && success;
+    success = drain(&ring, &model, CDC_TX_RING_SIZE) && success;
+
+    return success;
+}
+
+static bool test_clear(void)
+{
+    cdc_tx_ring_t ring = {0};
+    const uint8_t message[] = "GS V,1.0\r\n";
+    bool success = true;
+
+    cdc_tx_ring_enqueue(&ring, message, sizeof(message) - 1, CDC_TX_OVERFLOW_DROP_NEWEST);
+    cdc_tx_ring_clear(&ring);
+    if (cdc_tx_ring_pending(&ring) != 0 || cdc_tx_ring_available(&ring) != CDC_TX_RING_SIZE
+        || ring.bytes_dropped != 0) {
+        printf("FAIL: clear\n");
+        success = false;
+    }
+    return success;
+}
+
+static bool test_random(cdc_tx_overflow_policy_t policy, const char *name)
+{
+    cdc_tx_ring_t ring = {0};
+    sim_model_t model = {0};
+    uint8_t message[SIM_MAX_MESSAGE];
+    uint8_t next = 0;
+
+    /* Start close to the wrap of the free-running counters */
+    ring.head = UINT32_MAX - 1000;
+    ring.tail = ring.head;
+
+    for (size_t i = 0; i < SIM_ITERATIONS; i++) {
+        /* Mostly short lines, with the odd message longer than the ring */
+        const size_t len = (sim_random() % 16 == 0) ? (sim_random() % SIM_MAX_MESSAGE) + 1 : (sim_random() % 80) + 1;
+        for (size_t j = 0; j < len; j++) {
+            message[j] = next++;
+        }
+
+        cdc_tx_ring_enqueue(&ring, message, len, policy);
+        model_enqueue(&model, message, len, policy);
+        if (!check_state(&ring, &model)) { return false; }
+
+        if (!drain(&ring, &model, sim_random() % 96)) { return false; }
+    }
+    if (!drain(&ring, &model, CDC_TX_RING_SIZE)) { return false; }
+
+    /* Everything offered must have been sent or dropped */
+    if (model.sent + ring.bytes_dropped != model.offered) {
+        printf("FAIL: %s, %llu offered, %llu sent, %lu dropped\n", name,
+            (unsigned long long)model.offered, (unsigned long long)model.sent, (unsigned long)ring.bytes_dropped);
+        return false;
+    }
+
+    printf("%s: %llu bytes offered, %llu sent, %lu dropped\n", name,
+        (unsigned long long)model.offered, (unsigned long long)model.sent, (unsigned long)ring.bytes_dropped);
+    return true;
+}
+
+int main(void)
+{
+    bool success = true;
+
+    success = test_drop_newest() && success;
+    success = test_drop_oldest() && success;
+    success = test_clear() && success;
+    success = test_random(CDC_TX_OVERFLOW_DROP_NEWEST, "drop newest") && success;
+    success = test_random(CDC_TX_OVERFLOW_DROP_OLDEST, "drop oldest") && success;
+
+    printf("%s\n", success ? "PASS" : "FAIL");
+    return success ? 0 : 1;
+}
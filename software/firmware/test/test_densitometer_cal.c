@@ -0,0 +1,182 @@
+/*
+ * Accuracy of the calibration plans against the density formulas they replace.
+ *
+ * Each plan reduces the calibration math of a measurement mode to one log
+ * and one multiply-add. Its results must match the original formulas,
+ * which worked from the calibration values on every reading, across the
+ * whole range of readings including the clamped ends. This is built once
+ * with float math and once with the fixed-point density path.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "densitometer.h"
+#include "densitometer_cal.h"
+
+/* One tenth of the 0.01 D resolution of a reported reading */
+#define DENSITY_MAX_ERROR 0.001
+
+/* Readings from far below the darkest target to far above the brightest */
+#define BASIC_MIN 1.0e-4
+#define BASIC_MAX 1.0e6
+#define BASIC_STEPS 2000
+
+typedef struct {
+    const char *name;
+    settings_cal_reflection_t cal;
+} sim_reflection_t;
+
+typedef struct {
+    const char *name;
+    settings_cal_transmission_t cal;
+} sim_transmission_t;
+
+/* Reflection density as calculated before calibration plans */
+static float reference_reflection_d(const settings_cal_reflection_t *cal_reflection, float max_d, float als_basic)
+{
+    float meas_d;
+
+    if (isnan(cal_reflection->hi_d) && isnan(cal_reflection->hi_value)) {
+        const float zero_value = cal_reflection->lo_value * powf(10.0F, -1.0F * cal_reflection->lo_d);
+        meas_d = -1.0F * log10f(als_basic / zero_value);
+    } else {
+        const float meas_ll = log10f(als_basic);
+        const float cal_hi_ll = log10f(cal_reflection->hi_value);
+        const float cal_lo_ll = log10f(cal_reflection->lo_value);
+        const float m = (cal_reflection->hi_d - cal_reflection->lo_d) / (cal_hi_ll - cal_lo_ll);
+        meas_d = (m * (meas_ll - cal_lo_ll)) + cal_reflection->lo_d;
+    }
+
+    if (meas_d <= 0.0F && cal_reflection->lo_d >= 0.0F) {
+        meas_d = 0.0F;
+    } else if (meas_d > max_d) {
+        meas_d = max_d;
+    }
+
+    return meas_d;
+}
+
+/* Transmission density as calculated before calibration plans */
+static float reference_transmission_d(const settings_cal_transmission_t *cal_transmission, float max_d, float als_basic)
+{
+    const float cal_hi_meas_d = -1.0F * log10f(cal_transmission->hi_value / cal_transmission->zero_value);
+    const float meas_d = -1.0F * log10f(als_basic / cal_transmission->zero_value);
+    const float adj_factor = cal_transmission->hi_d / cal_hi_meas_d;
+    float corr_d = meas_d * adj_factor;
+
+    if (corr_d <= 0.0F) { corr_d = 0.0F; }
+    else if (corr_d > max_d) { corr_d = max_d; }
+
+    return corr_d;
+}
+
+static bool check_d(const char *name, float als_basic, float plan_d, float reference_d, double *max_error)
+{
+    if (isnan(reference_d) || isnan(plan_d)) {
+        if (isnan(reference_d) != isnan(plan_d)) {
+            printf("  %s: basic %g, D %f, expected %f\n", name, als_basic, plan_d, reference_d);
+            return false;
+        }
+        return true;
+    }
+
+    const double error = fabs((double)plan_d - (double)reference_d);
+    if (error > *max_error) {
+        *max_error = error;
+    }
+    if (error > DENSITY_MAX_ERROR) {
+        printf("  %s: basic %g, D %f, expected %f\n", name, als_basic, plan_d, reference_d);
+        return false;
+    }
+    return true;
+}
+
+static float sweep_basic(size_t i)
+{
+    return (float)(BASIC_MIN * pow(BASIC_MAX / BASIC_MIN, (double)i / (double)(BASIC_STEPS - 1)));
+}
+
+/* Readings outside the normal range, which must be handled the same way */
+static const float edge_basic[] = { 0.0F, -1.0F, INFINITY };
+
+static bool test_reflection(const sim_reflection_t *sim)
+{
+    densitometer_cal_plan_t plan = {0};
+    double max_error = 0.0;
+    bool success = true;
+
+    densitometer_cal_reflection_plan(&sim->cal, &plan);
+
+    for (size_t i = 0; i < BASIC_STEPS; i++) {
+        const float als_basic = sweep_basic(i);
+        success = check_d(sim->name, als_basic,
+            densitometer_cal_calc_d(&plan, REFLECTION_MAX_D, als_basic),
+            reference_reflection_d(&sim->cal, REFLECTION_MAX_D, als_basic), &max_error) && success;
+    }
+    for (size_t i = 0; i < sizeof(edge_basic) / sizeof(edge_basic[0]); i++) {
+        success = check_d(sim->name, edge_basic[i],
+            densitometer_cal_calc_d(&plan, REFLECTION_MAX_D, edge_basic[i]),
+            reference_reflection_d(&sim->cal, REFLECTION_MAX_D, edge_basic[i]), &max_error) && success;
+    }
+
+    printf("%s: max error %.3e D\n", sim->name, max_error);
+    return success;
+}
+
+static bool test_transmission(const sim_transmission_t *sim)
+{
+    densitometer_cal_plan_t plan = {0};
+    double max_error = 0.0;
+    bool success = true;
+
+    densitometer_cal_transmission_plan(&sim->cal, &plan);
+
+    for (size_t i = 0; i < BASIC_STEPS; i++) {
+        const float als_basic = sweep_basic(i);
+        success = check_d(sim->name, als_basic,
+            densitometer_cal_calc_d(&plan, TRANSMISSION_MAX_D, als_basic),
+            reference_transmission_d(&sim->cal, TRANSMISSION_MAX_D, als_basic), &max_error) && success;
+    }
+    for (size_t i = 0; i < sizeof(edge_basic) / sizeof(edge_basic[0]); i++) {
+        success = check_d(sim->name, edge_basic[i],
+            densitometer_cal_calc_d(&plan, TRANSMISSION_MAX_D, edge_basic[i]),
+            reference_transmission_d(&sim->cal, TRANSMISSION_MAX_D, edge_basic[i]), &max_error) && success;
+    }
+
+    printf("%s: max error %.3e D\n", sim->name, max_error);
+    return success;
+}
+
+int main(void)
+{
+    static const sim_reflection_t reflections[] = {
+        { "reflection two point",       { 0.08F, 450.0F, 1.50F, 17.5F } },
+        { "reflection single point",    { 0.08F, 450.0F, NAN, NAN } },
+        /* A negative low point is allowed, and turns off clamping to zero */
+        { "reflection negative lo",     { -0.20F, 900.0F, 1.80F, 9.0F } },
+        { "reflection single negative", { -0.20F, 900.0F, NAN, NAN } }
+    };
+    static const sim_transmission_t transmissions[] = {
+        { "transmission",               { 5200.0F, 2.95F, 6.1F } },
+        { "transmission UV",            { 180.0F, 2.10F, 1.5F } }
+    };
+    bool success = true;
+
+    for (size_t i = 0; i < sizeof(reflections) / sizeof(reflections[0]); i++) {
+        if (!test_reflection(&reflections[i])) {
+            printf("FAIL: %s\n", reflections[i].name);
+            success = false;
+        }
+    }
+    for (size_t i = 0; i < sizeof(transmissions) / sizeof(transmissions[0]); i++) {
+        if (!test_transmission(&transmissions[i])) {
+            printf("FAIL: %s\n", transmissions[i].name);
+            success = false;
+        }
+    }
+
+    printf("%s\n", success ? "PASS" : "FAIL");
+    return success ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+/*
+ * Accuracy test for the fixed-point density kernels.
+ *
+ * Compares 'fixed_log10f()' against 'log10f()' over every mantissa
+ * table segment for the span of sensor readings that can occur, then
+ * runs the complete Q16.16 density expression from 'densitometer_calc_d()'
+ * against the float version for target densities from 0 to 5 D.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "fixed_math.h"
+
+/* Documented bound for 'fixed_log10f()' in fixed_math.h */
+#define LOG10_MAX_ERROR 2.5e-5
+
+/* One tenth of the 0.01 D resolution of a reported reading */
+#define DENSITY_MAX_ERROR 0.001
+
+/* Density range covered by the device */
+#define DENSITY_MIN 0.0
+#define DENSITY_MAX 5.0
+#define DENSITY_STEP 0.0005
+
+typedef struct {
+    const char *name;
+    float slope;
+    float offset;
+} test_plan_t;
+
+static bool test_log10_sweep(void)
+{
+    double max_error = 0.0;
+    float max_error_x = 0.0F;
+    unsigned long count = 0;
+
+    /*
+     * Basic counts range from well under 1e-3 for the darkest targets
+     * at low gain, up to 1e5 for an unobstructed reading at high gain.
+     * Walk the mantissa in 2^-12 steps to hit every table segment at
+     * several interpolation points within each power of two.
+     */
+    for (int exponent = -20; exponent <= 20; exponent++) {
+        for (int step = 0; step < 4096; step++) {
+            const float x = ldexpf(1.0F + ((float)step / 4096.0F), exponent);
+            const double expected = log10f(x);
+            const double actual = q16_to_float(fixed_log10f(x));
+            const double error = fabs(actual - expected);
+            if (error > max_error) {
+                max_error = error;
+                max_error_x = x;
+            }
+            count++;
+        }
+    }
+
+    printf("log10: %lu points, max error %.3e at x=%g\n", count, max_error, max_error_x);
+    return max_error < LOG10_MAX_ERROR;
+}
+
+static double plan_calc_d_float(const test_plan_t *plan, float als_basic)
+{
+    return (plan->slope * log10f(als_basic)) + plan->offset;
+}
+
+static double plan_calc_d_fixed(const test_plan_t *plan, float als_basic)
+{
+    const q16_t slope_q16 = q16_from_float(plan->slope);
+    const q16_t offset_q16 = q16_from_float(plan->offset);
+    return q16_to_float(q16_mul(slope_q16, fixed_log10f(als_basic)) + offset_q16);
+}
+
+static bool test_density_sweep(const test_plan_t *plan)
+{
+    double max_error = 0.0;
+    double max_error_d = 0.0;
+    unsigned long count = 0;
+
+    for (double d = DENSITY_MIN; d <= DENSITY_MAX + (DENSITY_STEP / 2.0); d += DENSITY_STEP) {
+        /* Invert the plan to find the reading that produces this density */
+        const float als_basic = (float)pow(10.0, (d - plan->offset) / plan->slope);
+
+        const double expected = plan_calc_d_float(plan, als_basic);
+        const double actual = plan_calc_d_fixed(plan, als_basic);
+        const double error = fabs(actual - expected);
+        if (error > max_error) {
+            max_error = error;
+            max_error_d = d;
+        }
+        count++;
+    }
+
+    printf("%s: %lu points, max error %.3e D at %.4f D\n", plan->name, count, max_error, max_error_d);
+    return max_error < DENSITY_MAX_ERROR;
+}
+
+int main(void)
+{
+    /*
+     * Plans equivalent to what the build_plan functions produce for
+     * calibrations at the low and high ends of the usable gain range.
+     * Transmission: slope = -adj_factor, offset = adj_factor * log10(zero_value)
+     * Reflection: slope = -1 or the two point line, offset from CAL-LO
+     */
+    static const test_plan_t plans[] = {
+        { "transmission, zero=25, adj=1.00",    -1.00F,  1.00F * 1.3979F },
+        { "transmission, zero=50000, adj=0.97", -0.97F,  0.97F * 4.6990F },
+        { "transmission, zero=2.5, adj=1.04",   -1.04F,  1.04F * 0.3979F },
+        { "reflection, single point",           -1.00F,  3.2000F },
+        { "reflection, two point",              -1.06F,  0.8800F },
+    };
+    bool success = true;
+
+    if (!test_log10_sweep()) {
+        printf("FAIL: log10 error exceeds %.1e\n", LOG10_MAX_ERROR);
+        success = false;
+    }
+
+    for (size_t i = 0; i < sizeof(plans) / sizeof(plans[0]); i++) {
+        if (!test_density_sweep(&plans[i])) {
+            printf("FAIL: density error exceeds %.3f D\n", DENSITY_MAX_ERROR);
+            success = false;
+        }
+    }
+
+    printf("%s\n", success ? "PASS" : "FAIL");
+    return success ? 0 : 1;
+}
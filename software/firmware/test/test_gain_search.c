@@ -0,0 +1,288 @@
+/*
+ * Simulated sensor test for the gain calibration brightness search.
+ *
+ * Runs the search for every gain setting, the same way the calibration
+ * process chains them, against simulated LED and sensor responses. Each
+ * search must find a brightness within one bracket step of the true
+ * saturation point, without ever selecting a saturated brightness.
+ * The total number of probes is compared against the plain bisection
+ * search that was used before the modelled search.
+ *
+ * The LED cooldown settle check is run against simulated LED output
+ * curves, probed the same way the calibration process does between steps.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "gain_search.h"
+
+/* Gain settings searched by the calibration process, from 1x to 256x */
+#define GAIN_COUNT 9
+
+/* Sensor reading that counts as saturated in the simulation */
+#define SIM_SATURATION_COUNTS 60000.0
+
+typedef struct {
+    const char *name;
+    uint16_t max_brightness;  /*!< LED PWM period for the light frequency */
+    double counts_1x;         /*!< Reading at full brightness and 1x gain */
+    uint16_t offset;          /*!< PWM value where the LED starts to emit */
+    double exponent;          /*!< Shape of the brightness response */
+    double gain_error;        /*!< Alternating error on each doubling of gain */
+} sim_model_t;
+
+static double sim_gain_value(const sim_model_t *model, int gain_index)
+{
+    double value = 1.0;
+    for (int i = 1; i <= gain_index; i++) {
+        value *= 2.0 * ((i % 2) ? (1.0 + model->gain_error) : (1.0 - model->gain_error));
+    }
+    return value;
+}
+
+static double sim_counts(const sim_model_t *model, int gain_index, uint16_t brightness)
+{
+    if (brightness <= model->offset) { return 0.0; }
+    const double level = (double)(brightness - model->offset) / (double)(model->max_brightness - model->offset);
+    return model->counts_1x * sim_gain_value(model, gain_index) * pow(level, model->exponent);
+}
+
+static bool sim_saturated(const sim_model_t *model, int gain_index, uint16_t brightness)
+{
+    return sim_counts(model, gain_index, brightness) >= SIM_SATURATION_COUNTS;
+}
+
+/* Lowest brightness that saturates, or zero if the maximum does not */
+static uint16_t sim_saturation_brightness(const sim_model_t *model, int gain_index)
+{
+    for (uint32_t b = 1; b <= model->max_brightness; b++) {
+        if (sim_saturated(model, gain_index, (uint16_t)b)) { return (uint16_t)b; }
+    }
+    return 0;
+}
+
+/* The bisection search used before the modelled search, for comparison */
+static int bisection_probe_count(const sim_model_t *model, int gain_index)
+{
+    uint16_t cur_brightness = model->max_brightness;
+    uint16_t min_brightness = 0;
+    uint16_t sat_brightness = 0;
+    int probe_count = 0;
+
+    while (1) {
+        probe_count++;
+        if (!sim_saturated(model, gain_index, cur_brightness)) {
+            if (cur_brightness == model->max_brightness || cur_brightness + 1 == sat_brightness) {
+                break;
+            }
+            min_brightness = cur_brightness;
+            cur_brightness = (cur_brightness + ((sat_brightness == 0) ? model->max_brightness : sat_brightness)) / 2;
+        } else {
+            sat_brightness = cur_brightness;
+            cur_brightness = min_brightness + ((cur_brightness - min_brightness) / 2);
+            if (cur_brightness == sat_brightness) { cur_brightness--; }
+        }
+    }
+    return probe_count;
+}
+
+static bool test_model(const sim_model_t *model)
+{
+    uint16_t found_brightness[GAIN_COUNT] = {0};
+    float sat_counts = 0.0F;
+    int total_probes = 0;
+    int baseline_probes = 0;
+    bool success = true;
+
+    for (int i = 0; i < GAIN_COUNT; i++) {
+        /* Predict from the previous gain, as 'sensor_gain_calibration()' does */
+        uint16_t predicted_brightness = 0;
+        if (i > 0 && found_brightness[i - 1] < model->max_brightness) {
+            predicted_brightness = found_brightness[i - 1] / 2;
+        }
+
+        gain_search_t search;
+        gain_search_result_t result = GAIN_SEARCH_CONTINUE;
+        gain_search_init(&search, predicted_brightness, sat_counts, model->max_brightness);
+
+        while (result == GAIN_SEARCH_CONTINUE) {
+            const bool saturated = sim_saturated(model, i, search.cur_brightness);
+            result = gain_search_update(&search, saturated,
+                saturated ? 0.0F : (float)sim_counts(model, i, search.cur_brightness));
+        }
+
+        total_probes += search.probe_count;
+        baseline_probes += bisection_probe_count(model, i);
+
+        if (result != GAIN_SEARCH_FOUND) {
+            printf("  gain %d: search failed after %d probes\n", i, search.probe_count);
+            success = false;
+            continue;
+        }
+
+        const uint16_t found = search.cur_brightness;
+        const uint16_t true_sat = sim_saturation_brightness(model, i);
+        found_brightness[i] = found;
+
+        if (sim_saturated(model, i, found)) {
+            printf("  gain %d: selected brightness %d is saturated\n", i, found);
+            success = false;
+        } else if (true_sat == 0) {
+            if (found != model->max_brightness) {
+                printf("  gain %d: selected %d, but maximum %d does not saturate\n", i, found, model->max_brightness);
+                success = false;
+            }
+        } else {
+            if ((uint16_t)(true_sat - found) > gain_search_bracket_step(true_sat)) {
+                printf("  gain %d: selected %d, too far below saturation at %d\n", i, found, true_sat);
+                success = false;
+            }
+            sat_counts = search.lo_probe.counts;
+        }
+    }
+
+    printf("%s: %d probes, %d with bisection\n", model->name, total_probes, baseline_probes);
+
+    if (total_probes > baseline_probes) {
+        printf("  more probes than bisection\n");
+        success = false;
+    }
+    return success;
+}
+
+static bool test_saturated_at_min(void)
+{
+    gain_search_t search;
+    gain_search_result_t result = GAIN_SEARCH_CONTINUE;
+
+    /* A sensor that saturates at any brightness must fail, not select the LED being off */
+    gain_search_init(&search, 0, 0.0F, 128);
+    while (result == GAIN_SEARCH_CONTINUE) {
+        result = gain_search_update(&search, true, 0.0F);
+    }
+
+    printf("always saturated: %d probes\n", search.probe_count);
+    return result == GAIN_SEARCH_FAILED && search.cur_brightness == 1;
+}
+
+/* LED cooldown probe interval and time limit used by the calibration process */
+#define SIM_COOLDOWN_INTERVAL_S 0.5F
+#define SIM_COOLDOWN_MAX_S 5.0F
+
+typedef struct {
+    const char *name;
+    double drift;             /*!< Output change still to come, as a fraction */
+    double time_constant;     /*!< Time constant of the output change, or 0 for linear */
+    double noise;             /*!< Alternating reading noise, as a fraction */
+    bool settles;             /*!< Whether the check should end the wait early */
+} sim_cooldown_t;
+
+static double sim_cooldown_counts(const sim_cooldown_t *model, double t)
+{
+    double level;
+    if (model->time_constant > 0.0) {
+        /* The LED gets brighter as it cools towards ambient */
+        level = 1.0 - (model->drift * exp(-t / model->time_constant));
+    } else {
+        level = 1.0 + (model->drift * t);
+    }
+    const int step = (int)lround(t / SIM_COOLDOWN_INTERVAL_S);
+    return 10000.0 * level * ((step % 2) ? (1.0 + model->noise) : (1.0 - model->noise));
+}
+
+/* Time the cooldown loop waits, or the limit if the readings never settle */
+static float sim_cooldown_time(const sim_cooldown_t *model)
+{
+    float counts[GAIN_SEARCH_SETTLE_COUNT];
+    size_t count = 0;
+
+    for (float t = SIM_COOLDOWN_INTERVAL_S; t < SIM_COOLDOWN_MAX_S; t += SIM_COOLDOWN_INTERVAL_S) {
+        if (count == GAIN_SEARCH_SETTLE_COUNT) {
+            for (size_t i = 1; i < count; i++) { counts[i - 1] = counts[i]; }
+            count--;
+        }
+        counts[count++] = (float)sim_cooldown_counts(model, t);
+        if (count == GAIN_SEARCH_SETTLE_COUNT && gain_search_is_settled(counts, count, SIM_COOLDOWN_INTERVAL_S)) {
+            return t;
+        }
+    }
+    return SIM_COOLDOWN_MAX_S;
+}
+
+static bool test_cooldown(const sim_cooldown_t *model)
+{
+    const float t = sim_cooldown_time(model);
+    const bool settled = t < SIM_COOLDOWN_MAX_S;
+
+    printf("cooldown %s: %.1fs\n", model->name, t);
+    if (settled != model->settles) { return false; }
+
+    /* A settled wait must not end while the output is still moving */
+    if (settled && model->time_constant > 0.0) {
+        const double remaining = model->drift * exp(-t / model->time_constant);
+        if (remaining > 0.01) {
+            printf("  ended with %.2f%% drift left\n", remaining * 100.0);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool test_cooldown_dark(void)
+{
+    static const float counts[GAIN_SEARCH_SETTLE_COUNT] = { 0.0F };
+    return !gain_search_is_settled(counts, GAIN_SEARCH_SETTLE_COUNT, SIM_COOLDOWN_INTERVAL_S);
+}
+
+int main(void)
+{
+    static const sim_model_t models[] = {
+        /* Gain calibration light frequency, saturating from the 4x gain */
+        { "high frequency, linear",           128,  20000.0,  0, 1.00,  0.00 },
+        { "high frequency, offset",           128,  20000.0,  4, 1.00,  0.03 },
+        { "high frequency, nonlinear",        128,  20000.0,  2, 0.80,  0.05 },
+        /* Dimmer LED, which does not saturate until the middle gains */
+        { "high frequency, dim",              128,   2000.0,  0, 1.00,  0.02 },
+        /* Default light frequency, with a much finer brightness range */
+        { "default frequency, linear",      16384, 400000.0,  0, 1.00,  0.00 },
+        { "default frequency, nonlinear",   16384, 400000.0, 40, 1.15, -0.04 },
+    };
+    bool success = true;
+
+    for (size_t i = 0; i < sizeof(models) / sizeof(models[0]); i++) {
+        if (!test_model(&models[i])) {
+            printf("FAIL: %s\n", models[i].name);
+            success = false;
+        }
+    }
+
+    if (!test_saturated_at_min()) {
+        printf("FAIL: always saturated\n");
+        success = false;
+    }
+
+    static const sim_cooldown_t cooldowns[] = {
+        { "already cool",     0.00, 0.0, 0.0005, true  },
+        { "fast recovery",    0.05, 0.8, 0.0005, true  },
+        { "slow recovery",    0.05, 4.0, 0.0005, false },
+        { "steady drift",     0.01, 0.0, 0.0,    false },
+        { "steady dimming",  -0.01, 0.0, 0.0,    false },
+    };
+
+    for (size_t i = 0; i < sizeof(cooldowns) / sizeof(cooldowns[0]); i++) {
+        if (!test_cooldown(&cooldowns[i])) {
+            printf("FAIL: cooldown %s\n", cooldowns[i].name);
+            success = false;
+        }
+    }
+
+    if (!test_cooldown_dark()) {
+        printf("FAIL: cooldown dark\n");
+        success = false;
+    }
+
+    printf("%s\n", success ? "PASS" : "FAIL");
+    return success ? 0 : 1;
+}
@@ -0,0 +1,184 @@
+/*
+ * Fake bus test for the I2C transaction handler.
+ *
+ * Covers the polled fallback used before the scheduler is running,
+ * the choice between interrupt and DMA transfers by length, chaining
+ * of transfer lists from the completion interrupt, and recovery from
+ * failed, refused and stalled transfers. After every transaction the
+ * bus mutex must have been released again.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "i2c_handler.h"
+#include "fake_i2c_bus.h"
+
+#define DEV_ADDRESS (0x39 << 1)
+
+static I2C_HandleTypeDef hi2c;
+static DMA_HandleTypeDef hdma_rx;
+static DMA_HandleTypeDef hdma_tx;
+
+static bool check(bool condition, const char *name)
+{
+    if (!condition) {
+        printf("FAIL: %s\n", name);
+    }
+    return condition;
+}
+
+static bool test_polled_fallback(void)
+{
+    bool success = true;
+    uint8_t data[6] = { 1, 2, 3, 4, 5, 6 };
+    uint8_t readback[6] = {0};
+
+    /* Used before the handler is initialized */
+    fake_i2c_reset();
+    fake_i2c_set_kernel_running(true);
+    success &= check(i2c_mem_write(&hi2c, DEV_ADDRESS, 0x10, data, sizeof(data)) == HAL_OK, "write before init");
+
+    if (i2c_handler_init(&hi2c) != osOK) {
+        printf("FAIL: handler init\n");
+        return false;
+    }
+
+    /* Used once initialized, but before the scheduler is started */
+    fake_i2c_set_kernel_running(false);
+    success &= check(i2c_mem_read(&hi2c, DEV_ADDRESS, 0x10, readback, sizeof(readback)) == HAL_OK, "read before start");
+    success &= check(memcmp(data, readback, sizeof(data)) == 0, "polled data");
+
+    const fake_i2c_stats_t *stats = fake_i2c_get_stats();
+    success &= check(stats->polled == 2 && stats->interrupt == 0 && stats->dma == 0, "polled transfer modes");
+    success &= check(!fake_i2c_mutex_held(), "polled mutex");
+
+    printf("Polled fallback: %lu polled transfers\n", (unsigned long)stats->polled);
+    return success;
+}
+
+static bool test_transfer_modes(void)
+{
+    bool success = true;
+    uint8_t data[8] = {0};
+
+    fake_i2c_reset();
+    fake_i2c_set_kernel_running(true);
+
+    /* Transfers below the DMA threshold run in interrupt mode */
+    for (uint16_t len = 1; len <= sizeof(data); len++) {
+        success &= check(i2c_mem_read(&hi2c, DEV_ADDRESS, 0x20, data, len) == HAL_OK, "read length");
+        success &= check(i2c_mem_write(&hi2c, DEV_ADDRESS, 0x20, data, len) == HAL_OK, "write length");
+    }
+
+    const fake_i2c_stats_t *stats = fake_i2c_get_stats();
+    success &= check(stats->interrupt == 6 && stats->dma == 10 && stats->polled == 0, "threshold modes");
+
+    /* Without a DMA channel, everything runs in interrupt mode */
+    fake_i2c_clear_stats();
+    hi2c.hdmarx = NULL;
+    hi2c.hdmatx = NULL;
+    success &= check(i2c_mem_read(&hi2c, DEV_ADDRESS, 0x20, data, sizeof(data)) == HAL_OK, "read without DMA");
+    success &= check(i2c_mem_write(&hi2c, DEV_ADDRESS, 0x20, data, sizeof(data)) == HAL_OK, "write without DMA");
+    success &= check(stats->interrupt == 2 && stats->dma == 0, "modes without DMA");
+    hi2c.hdmarx = &hdma_rx;
+    hi2c.hdmatx = &hdma_tx;
+
+    success &= check(!fake_i2c_mutex_held(), "modes mutex");
+    return success;
+}
+
+static bool test_submit_wait(void)
+{
+    bool success = true;
+    uint8_t config[5] = { 0xA1, 0xA2, 0xA3, 0xA4, 0xA5 };
+    uint8_t enable = 0x03;
+    uint8_t readback[5] = {0};
+    const i2c_transfer_t transfers[] = {
+        { .dir = I2C_TRANSFER_WRITE, .dev_address = DEV_ADDRESS, .mem_address = 0xA5, .data = config, .len = sizeof(config) },
+        { .dir = I2C_TRANSFER_WRITE, .dev_address = DEV_ADDRESS, .mem_address = 0x80, .data = &enable, .len = 1 },
+        { .dir = I2C_TRANSFER_READ, .dev_address = DEV_ADDRESS, .mem_address = 0xA5, .data = readback, .len = sizeof(readback) }
+    };
+
+    fake_i2c_reset();
+    fake_i2c_set_kernel_running(true);
+
+    /* Nothing beyond the first transfer happens until the task waits */
+    success &= check(i2c_transfer_submit(&hi2c, transfers, 3) == HAL_OK, "submit");
+    const fake_i2c_stats_t *stats = fake_i2c_get_stats();
+    success &= check(stats->transfers == 1, "first transfer started");
+    success &= check(fake_i2c_mutex_held(), "bus locked until wait");
+
+    success &= check(i2c_transfer_wait(&hi2c, 100) == HAL_OK, "wait");
+    success &= check(stats->transfers == 3 && stats->bytes == 11, "whole list transferred");
+    success &= check(fake_i2c_registers()[0x80] == enable, "chained write");
+    success &= check(memcmp(config, readback, sizeof(config)) == 0, "chained read");
+    success &= check(!fake_i2c_mutex_held(), "wait mutex");
+
+    printf("Transfer list: %lu transfers, %lu bytes, %lu DMA, %lu interrupt\n",
+        (unsigned long)stats->transfers, (unsigned long)stats->bytes,
+        (unsigned long)stats->dma, (unsigned long)stats->interrupt);
+    return success;
+}
+
+static bool test_failures(void)
+{
+    bool success = true;
+    uint8_t data[4] = {0};
+    const i2c_transfer_t transfers[] = {
+        { .dir = I2C_TRANSFER_READ, .dev_address = DEV_ADDRESS, .mem_address = 0x00, .data = data, .len = 1 },
+        { .dir = I2C_TRANSFER_READ, .dev_address = DEV_ADDRESS, .mem_address = 0x01, .data = data, .len = 1 },
+        { .dir = I2C_TRANSFER_READ, .dev_address = DEV_ADDRESS, .mem_address = 0x02, .data = data, .len = 1 }
+    };
+
+    fake_i2c_reset();
+    fake_i2c_set_kernel_running(true);
+    const fake_i2c_stats_t *stats = fake_i2c_get_stats();
+
+    /* An error stops the rest of the list from running */
+    fake_i2c_fail_transfer(2);
+    success &= check(i2c_transfer(&hi2c, transfers, 3) == HAL_ERROR, "error result");
+    success &= check(stats->transfers == 1, "list stopped at error");
+    success &= check(!fake_i2c_mutex_held(), "error mutex");
+
+    /* A transfer the peripheral refuses to start fails the submit */
+    fake_i2c_set_busy(true);
+    success &= check(i2c_transfer_submit(&hi2c, transfers, 3) == HAL_BUSY, "busy result");
+    success &= check(!fake_i2c_mutex_held(), "busy mutex");
+    fake_i2c_set_busy(false);
+
+    /* A stalled transfer times out, and the peripheral is reset */
+    fake_i2c_clear_stats();
+    fake_i2c_stall_transfer(1);
+    success &= check(i2c_transfer(&hi2c, transfers, 3) == HAL_TIMEOUT, "stall result");
+    success &= check(stats->bus_resets == 1, "stall bus reset");
+    success &= check(!fake_i2c_mutex_held(), "stall mutex");
+
+    /* A late completion of the abandoned list must not satisfy the next one */
+    i2c_completion_callback(&hi2c);
+    fake_i2c_fail_transfer(1);
+    success &= check(i2c_transfer(&hi2c, transfers, 1) == HAL_ERROR, "late completion ignored");
+
+    /* The bus works normally afterwards */
+    success &= check(i2c_transfer(&hi2c, transfers, 3) == HAL_OK, "recovered");
+    success &= check(!fake_i2c_mutex_held(), "recovered mutex");
+    return success;
+}
+
+int main(void)
+{
+    bool success = true;
+
+    hi2c.hdmarx = &hdma_rx;
+    hi2c.hdmatx = &hdma_tx;
+    hi2c.State = HAL_I2C_STATE_READY;
+
+    success &= test_polled_fallback();
+    success &= test_transfer_modes();
+    success &= test_submit_wait();
+    success &= test_failures();
+
+    printf("%s\n", success ? "PASS" : "FAIL");
+    return success ? 0 : 1;
+}
@@ -0,0 +1,154 @@
+/*
+ * Fake sensor test for raw target read sequences.
+ *
+ * Every step of a sequence is validated before the sensor is touched,
+ * so a sequence with any step out of range must be rejected as a whole
+ * without configuring or starting the sensor. Valid sequences must
+ * return the simulated reading for each step, keeping the sensor
+ * running between steps that share a sensor mode.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "sensor.h"
+#include "task_sensor.h"
+#include "fake_sensor.h"
+
+/* Light at the sensor with the light source on, in counts per sample at 1x gain */
+#define SIM_TARGET_COUNTS 10.0
+
+#define SIM_MAX_STEPS 8
+
+typedef struct {
+    size_t count;
+    uint32_t readings[SIM_MAX_STEPS];
+} sim_results_t;
+
+typedef struct {
+    const char *name;
+    sensor_raw_step_t step;
+} sim_invalid_step_t;
+
+static bool sim_sequence_callback(size_t index, uint32_t als_reading, void *user_data)
+{
+    sim_results_t *results = user_data;
+    if (index != results->count || index >= SIM_MAX_STEPS) { return false; }
+    results->readings[results->count++] = als_reading;
+    return true;
+}
+
+static uint32_t sim_expected_reading(const sensor_raw_step_t *step)
+{
+    if (step->light == SENSOR_LIGHT_OFF || step->light_value == 0) { return 0; }
+    return (uint32_t)lround(SIM_TARGET_COUNTS * tsl2585_gain_value(step->gain) * (double)(step->sample_count + 1));
+}
+
+static bool test_invalid_steps(void)
+{
+    static const sim_invalid_step_t invalid_steps[] = {
+        { "light",        { SENSOR_LIGHT_UV_TRANSMISSION + 1, SENSOR_MODE_VIS, TSL2585_GAIN_1X, 100, 719, 99 } },
+        { "dual mode",    { SENSOR_LIGHT_VIS_TRANSMISSION, SENSOR_MODE_VIS_DUAL, TSL2585_GAIN_1X, 100, 719, 99 } },
+        { "mode",         { SENSOR_LIGHT_VIS_TRANSMISSION, (sensor_mode_t)-1, TSL2585_GAIN_1X, 100, 719, 99 } },
+        { "gain limit",   { SENSOR_LIGHT_VIS_TRANSMISSION, SENSOR_MODE_VIS, TSL2585_GAIN_MAX, 100, 719, 99 } },
+        { "gain",         { SENSOR_LIGHT_VIS_TRANSMISSION, SENSOR_MODE_VIS, (tsl2585_gain_t)-1, 100, 719, 99 } },
+        { "sample time",  { SENSOR_LIGHT_VIS_TRANSMISSION, SENSOR_MODE_VIS, TSL2585_GAIN_1X, 100, 2048, 99 } },
+        { "sample count", { SENSOR_LIGHT_VIS_TRANSMISSION, SENSOR_MODE_VIS, TSL2585_GAIN_1X, 100, 719, 2048 } },
+    };
+    const sensor_raw_step_t valid_step = { SENSOR_LIGHT_VIS_TRANSMISSION, SENSOR_MODE_VIS, TSL2585_GAIN_1X, 100, 719, 99 };
+    bool success = true;
+
+    for (size_t i = 0; i < sizeof(invalid_steps) / sizeof(invalid_steps[0]); i++) {
+        /* The invalid step comes last, so nothing may run before it is checked */
+        const sensor_raw_step_t steps[] = { valid_step, valid_step, invalid_steps[i].step };
+        sim_results_t results = {0};
+
+        fake_sensor_clear_stats();
+        const osStatus_t ret = sensor_read_target_raw_sequence(steps, 3, sim_sequence_callback, &results);
+        const fake_sensor_stats_t *stats = fake_sensor_get_stats();
+
+        if (ret != osErrorParameter || results.count != 0 || stats->starts != 0 || stats->configures != 0) {
+            printf("FAIL: invalid %s, ret=%d, steps=%lu, starts=%lu\n", invalid_steps[i].name, ret,
+                (unsigned long)results.count, (unsigned long)stats->starts);
+            success = false;
+        }
+    }
+
+    if (sensor_read_target_raw_sequence(&valid_step, 0, sim_sequence_callback, NULL) != osErrorParameter
+        || sensor_read_target_raw_sequence(NULL, 1, sim_sequence_callback, NULL) != osErrorParameter) {
+        printf("FAIL: empty sequence\n");
+        success = false;
+    }
+
+    return success;
+}
+
+static bool test_sequence(const char *name, const sensor_raw_step_t *steps, size_t count, uint32_t expected_starts)
+{
+    sim_results_t results = {0};
+    bool success = true;
+
+    fake_sensor_clear_stats();
+    const osStatus_t ret = sensor_read_target_raw_sequence(steps, count, sim_sequence_callback, &results);
+    const fake_sensor_stats_t *stats = fake_sensor_get_stats();
+
+    printf("%s: %lu steps, %lu starts, %lu cycles\n", name,
+        (unsigned long)results.count, (unsigned long)stats->starts, (unsigned long)stats->cycles);
+
+    if (ret != osOK || results.count != count) {
+        printf("  ret=%d\n", ret);
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        const uint32_t expected = sim_expected_reading(&steps[i]);
+        if (results.readings[i] != expected) {
+            printf("  step %lu: %lu, expected %lu\n", (unsigned long)i,
+                (unsigned long)results.readings[i], (unsigned long)expected);
+            success = false;
+        }
+    }
+    if (stats->starts != expected_starts || stats->discarded != 0) {
+        printf("  expected %lu starts without discarded cycles\n", (unsigned long)expected_starts);
+        success = false;
+    }
+
+    return success;
+}
+
+int main(void)
+{
+    /* Limits of each range, which must all be accepted */
+    static const sensor_raw_step_t limit_steps[] = {
+        { SENSOR_LIGHT_OFF,              SENSOR_MODE_DEFAULT, TSL2585_GAIN_0_5X,  0,   0,    0    },
+        { SENSOR_LIGHT_OFF,              SENSOR_MODE_UV,      TSL2585_GAIN_4096X, 0,   2047, 0    },
+        { SENSOR_LIGHT_VIS_REFLECTION,   SENSOR_MODE_UV,      TSL2585_GAIN_0_5X,  128, 0,    2047 },
+    };
+    /* Gain and integration sweep in one mode, then a change of mode */
+    static const sensor_raw_step_t sweep_steps[] = {
+        { SENSOR_LIGHT_VIS_TRANSMISSION, SENSOR_MODE_VIS, TSL2585_GAIN_1X,   100, 719, 99  },
+        { SENSOR_LIGHT_VIS_TRANSMISSION, SENSOR_MODE_VIS, TSL2585_GAIN_16X,  100, 719, 99  },
+        { SENSOR_LIGHT_VIS_TRANSMISSION, SENSOR_MODE_VIS, TSL2585_GAIN_16X,  100, 719, 199 },
+        { SENSOR_LIGHT_VIS_REFLECTION,   SENSOR_MODE_VIS, TSL2585_GAIN_4X,   50,  359, 49  },
+        { SENSOR_LIGHT_UV_TRANSMISSION,  SENSOR_MODE_UV,  TSL2585_GAIN_128X, 100, 719, 99  },
+    };
+    bool success = true;
+
+    fake_sensor_reset();
+    fake_sensor_set_target(SIM_TARGET_COUNTS);
+
+    if (!test_invalid_steps()) {
+        success = false;
+    }
+    if (!test_sequence("range limits", limit_steps, sizeof(limit_steps) / sizeof(limit_steps[0]), 2)) {
+        printf("FAIL: range limits\n");
+        success = false;
+    }
+    if (!test_sequence("sweep", sweep_steps, sizeof(sweep_steps) / sizeof(sweep_steps[0]), 2)) {
+        printf("FAIL: sweep\n");
+        success = false;
+    }
+
+    printf("%s\n", success ? "PASS" : "FAIL");
+    return success ? 0 : 1;
+}
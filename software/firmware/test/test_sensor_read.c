@@ -0,0 +1,213 @@
+/*
+ * Simulated sensor test for VSYNC triggered target reads.
+ *
+ * Runs 'sensor_read_target()' against a fake sensor task through a
+ * sequence of targets that covers each path: AGC on the first read,
+ * the predicted gain on a repeat read, and the fallback to AGC when the
+ * predicted gain saturates or is under-range. Each read must return the
+ * simulated target value without discarding any integration cycles.
+ *
+ * The cycles and integration time of each read are compared against the
+ * continuous pipeline that was used before triggered reads, which runs
+ * the same steps with the sensor running freely and has to throw away
+ * the cycle in progress after every configuration change.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "sensor.h"
+#include "task_sensor.h"
+#include "fake_sensor.h"
+
+/* Light at the sensor for an open target, in counts per sample at 1x gain */
+#define SIM_OPEN_COUNTS 1500.0
+
+/* LED brightness used for the reads, which only has to be nonzero here */
+#define SIM_LIGHT_VALUE 100
+
+typedef struct {
+    const char *name;
+    double density;
+    uint32_t cycles;          /*!< Integration cycles the triggered read should take */
+} sim_read_t;
+
+/* Basic counts the simulation should produce for a target */
+static double sim_expected_basic(double density, uint16_t sample_count)
+{
+    const double counts = SIM_OPEN_COUNTS * pow(10.0, -density);
+    return (counts * (double)(sample_count + 1)) / (16.0 * tsl2585_integration_time_ms(719, sample_count));
+}
+
+/*
+ * Target read with the sensor running continuously, following the
+ * steps of the pipeline used before VSYNC triggering. It starts in AGC,
+ * then disables AGC with a short guard cycle to keep the FIFO from
+ * overflowing, and only then sets the measurement integration time.
+ */
+static osStatus_t continuous_read(sensor_light_t light_source, uint16_t light_value, float *als_result)
+{
+    osStatus_t ret = osOK;
+    sensor_reading_t reading;
+    sensor_reading_cursor_t cursor;
+    int agc_step = 1;
+    int invalid_count = 0;
+    int reading_count = 0;
+    double als_sum = 0;
+
+    sensor_config_t config = {
+        .mode = SENSOR_MODE_VIS,
+        .trigger_mode = TSL2585_TRIGGER_OFF,
+        .gain = { TSL2585_GAIN_256X, TSL2585_GAIN_256X },
+        .sample_time = 719,
+        .sample_count = 0,
+        .agc_enabled = true,
+        .agc_sample_count = 9,
+        .light = light_source,
+        .light_value = light_value,
+        .light_next_cycle = true
+    };
+
+    sensor_reading_cursor_init(&cursor);
+    sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
+    osDelay(10);
+
+    do {
+        ret = sensor_configure(&config);
+        if (ret != osOK) { break; }
+        ret = sensor_start();
+        if (ret != osOK) { break; }
+
+        while (reading_count < 2) {
+            ret = sensor_wait_next_reading(&cursor, &reading, 500);
+            if (ret != osOK) { break; }
+
+            if (reading.mod0.result != SENSOR_RESULT_VALID) {
+                if (++invalid_count > 5) { ret = osErrorTimeout; break; }
+                continue;
+            }
+
+            if (agc_step == 1) {
+                config.gain[0] = reading.mod0.gain;
+                config.gain[1] = reading.mod0.gain;
+                config.agc_enabled = false;
+                config.agc_sample_count = 0;
+                config.sample_count = 9;
+                ret = sensor_configure(&config);
+                if (ret != osOK) { break; }
+                agc_step++;
+                continue;
+            } else if (agc_step == 2) {
+                config.sample_count = 199;
+                ret = sensor_configure(&config);
+                if (ret != osOK) { break; }
+                agc_step = 0;
+                continue;
+            }
+
+            als_sum += sensor_convert_to_basic_counts(&reading, 0);
+            reading_count++;
+        }
+    } while (0);
+
+    sensor_stop();
+    sensor_set_light_mode(SENSOR_LIGHT_OFF, false, 0);
+
+    if (ret == osOK && als_result) {
+        *als_result = (float)(als_sum / 2.0);
+    }
+    return ret;
+}
+
+static bool check_result(const char *label, float als_result, double expected)
+{
+    if (fabs((double)als_result - expected) > expected * 0.001) {
+        printf("  %s result %f, expected %f\n", label, als_result, expected);
+        return false;
+    }
+    return true;
+}
+
+static bool test_read(const sim_read_t *read)
+{
+    bool success = true;
+    float als_result = NAN;
+    sensor_read_info_t info;
+    const double expected = sim_expected_basic(read->density, 199);
+
+    fake_sensor_set_target(SIM_OPEN_COUNTS * pow(10.0, -read->density));
+
+    /* Reference read, with the sensor running continuously */
+    fake_sensor_clear_stats();
+    if (continuous_read(SENSOR_LIGHT_VIS_TRANSMISSION, SIM_LIGHT_VALUE, &als_result) != osOK) {
+        printf("  continuous read failed\n");
+        return false;
+    }
+    const fake_sensor_stats_t continuous = *fake_sensor_get_stats();
+    success = check_result("continuous", als_result, expected) && success;
+
+    /* Triggered read */
+    fake_sensor_clear_stats();
+    if (sensor_read_target(SENSOR_LIGHT_VIS_TRANSMISSION, SIM_LIGHT_VALUE, &als_result, NULL, NULL) != osOK) {
+        printf("  triggered read failed\n");
+        return false;
+    }
+    const fake_sensor_stats_t triggered = *fake_sensor_get_stats();
+    success = check_result("triggered", als_result, expected) && success;
+    sensor_get_last_read_info(&info);
+
+    printf("%s: %lu cycles in %lums (%lu discarded), %lu in %lums with VSYNC, gain %s\n",
+        read->name,
+        (unsigned long)continuous.cycles, (unsigned long)continuous.cycle_ms, (unsigned long)continuous.discarded,
+        (unsigned long)triggered.cycles, (unsigned long)triggered.cycle_ms,
+        tsl2585_gain_str(info.gain));
+
+    if (triggered.discarded != 0) {
+        printf("  discarded %lu cycles\n", (unsigned long)triggered.discarded);
+        success = false;
+    }
+    if (triggered.triggers != triggered.cycles) {
+        printf("  %lu cycles for %lu triggers\n", (unsigned long)triggered.cycles, (unsigned long)triggered.triggers);
+        success = false;
+    }
+    if (triggered.cycles >= continuous.cycles || triggered.cycle_ms > continuous.cycle_ms) {
+        printf("  no savings over the continuous read\n");
+        success = false;
+    }
+
+    if (triggered.cycles != read->cycles) {
+        printf("  expected %lu cycles\n", (unsigned long)read->cycles);
+        success = false;
+    }
+
+    return success;
+}
+
+int main(void)
+{
+    static const sim_read_t reads[] = {
+        /* First read of a light source, with one AGC cycle before the measurement */
+        { "first read",      1.00, 3 },
+        /* Same target again, measured directly at the predicted gain */
+        { "repeat read",     1.00, 2 },
+        { "similar target",  1.20, 2 },
+        /* Much lighter target, which saturates at the predicted gain */
+        { "lighter target",  0.00, 4 },
+        /* Much darker target, which is under-range at the predicted gain */
+        { "darker target",   2.50, 4 },
+    };
+    bool success = true;
+
+    fake_sensor_reset();
+
+    for (size_t i = 0; i < sizeof(reads) / sizeof(reads[0]); i++) {
+        if (!test_read(&reads[i])) {
+            printf("FAIL: %s\n", reads[i].name);
+            success = false;
+        }
+    }
+
+    printf("%s\n", success ? "PASS" : "FAIL");
+    return success ? 0 : 1;
+}
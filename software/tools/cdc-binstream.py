@@ -0,0 +1,332 @@
+#!/usr/bin/env python3
+
+# Host-side decoder for the binary streaming mode of the CDC interface.
+#
+# Binary mode is enabled with "SM FORMAT,BIN". After that, density readings,
+# raw diagnostic sensor readings, and status updates are sent as COBS encoded
+# packets delimited by zero bytes, while command responses and log messages
+# remain as CRLF terminated text lines on the same stream.
+#
+# Packet layout, before COBS encoding (all fields big-endian):
+#   type (u8), sequence (u16), body, CRC-16/CCITT-FALSE of the preceding bytes (u16)
+#
+# Usage:
+#   cdc-binstream.py /dev/ttyACM0       Enable binary mode and print decoded data
+#   cdc-binstream.py --simulate 100000  Throughput test against a simulated device
+#
+# The simulated device builds its packets with the firmware's own cdc_frame.c,
+# compiled for the host with the C compiler from $CC (default "cc") or taken
+# from --firmware-lib, so the decoder is checked against the same encoder
+# that runs on the device.
+
+import argparse
+import ctypes
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+FRAME_RAW_READING = 0x01
+FRAME_DENSITY = 0x02
+FRAME_STATUS = 0x03
+
+RAW_READING_FORMAT = ">IBBIBBHHIIII"
+DENSITY_FORMAT = ">cfff"
+STATUS_FORMAT = ">BI"
+
+RAW_READING_FIELDS = (
+    "mod0_als_data", "mod0_gain", "mod0_result",
+    "mod1_als_data", "mod1_gain", "mod1_result",
+    "sample_time", "sample_count",
+    "reading_ticks", "elapsed_ticks", "light_ticks", "reading_count")
+DENSITY_FIELDS = ("prefix", "d_value", "d_zero", "raw_value")
+STATUS_FIELDS = ("flags", "tx_bytes_dropped")
+
+# Largest encoded packet the firmware will send, used to detect corruption
+MAX_FRAME_SIZE = 64
+
+FIRMWARE_SRC_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "firmware", "src")
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            if crc & 0x8000:
+                crc = ((crc << 1) ^ 0x1021) & 0xFFFF
+            else:
+                crc = (crc << 1) & 0xFFFF
+    return crc
+
+
+def cobs_encode(data):
+    out = bytearray(b"\x00")
+    code_pos = 0
+    code = 1
+    for b in data:
+        if b == 0:
+            out[code_pos] = code
+            code_pos = len(out)
+            out.append(0)
+            code = 1
+        else:
+            out.append(b)
+            code += 1
+            if code == 0xFF:
+                out[code_pos] = code
+                code_pos = len(out)
+                out.append(0)
+                code = 1
+    out[code_pos] = code
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            raise ValueError("invalid COBS code")
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def encode_frame(frame_type, seq, body):
+    """Build a delimited packet, exactly as the firmware does."""
+    packet = struct.pack(">BH", frame_type, seq & 0xFFFF) + body
+    packet += struct.pack(">H", crc16(packet))
+    return b"\x00" + cobs_encode(packet) + b"\x00"
+
+
+class FirmwareEncoder:
+    """Host build of the firmware packet encoder, loaded with ctypes."""
+
+    def __init__(self, lib_path=None, src_dir=FIRMWARE_SRC_DIR):
+        if not lib_path:
+            self.tmpdir = tempfile.TemporaryDirectory()
+            lib_path = os.path.join(self.tmpdir.name, "libcdc_frame.so")
+            cc = os.environ.get("CC", "cc")
+            subprocess.run([cc, "-shared", "-fPIC", "-O2", "-Wall", "-I", src_dir,
+                            "-o", lib_path, os.path.join(src_dir, "cdc_frame.c")], check=True)
+
+        self.lib = ctypes.CDLL(lib_path)
+        self.lib.cdc_frame_encode.argtypes = [
+            ctypes.c_int, ctypes.c_uint16, ctypes.c_char_p, ctypes.c_size_t, ctypes.c_char_p]
+        self.lib.cdc_frame_encode.restype = ctypes.c_size_t
+        self.out = ctypes.create_string_buffer(MAX_FRAME_SIZE)
+
+    def encode_frame(self, frame_type, seq, body):
+        n = self.lib.cdc_frame_encode(frame_type, seq & 0xFFFF, body, len(body), self.out)
+        if n == 0:
+            raise ValueError("packet body too large")
+        return self.out.raw[:n]
+
+
+class Frame:
+    def __init__(self, frame_type, seq, fields):
+        self.type = frame_type
+        self.seq = seq
+        self.fields = fields
+
+    def __str__(self):
+        names = {FRAME_RAW_READING: "RAW", FRAME_DENSITY: "DENSITY", FRAME_STATUS: "STATUS"}
+        name = names.get(self.type, "0x%02X" % self.type)
+        values = ", ".join("%s=%s" % (k, v) for k, v in self.fields.items())
+        return "[%05d] %s %s" % (self.seq, name, values)
+
+
+def parse_frame(packet):
+    if len(packet) < 5:
+        raise ValueError("short packet")
+    if crc16(packet[:-2]) != struct.unpack(">H", packet[-2:])[0]:
+        raise ValueError("CRC mismatch")
+    frame_type, seq = struct.unpack(">BH", packet[:3])
+    body = packet[3:-2]
+    if frame_type == FRAME_RAW_READING:
+        fields = dict(zip(RAW_READING_FIELDS, struct.unpack(RAW_READING_FORMAT, body)))
+    elif frame_type == FRAME_DENSITY:
+        fields = dict(zip(DENSITY_FIELDS, struct.unpack(DENSITY_FORMAT, body)))
+        fields["prefix"] = fields["prefix"].decode("ascii", "replace")
+    elif frame_type == FRAME_STATUS:
+        fields = dict(zip(STATUS_FIELDS, struct.unpack(STATUS_FORMAT, body)))
+    else:
+        fields = {"body": body.hex()}
+    return Frame(frame_type, seq, fields)
+
+
+class StreamDecoder:
+    """
+    Splits the incoming byte stream into text lines and binary packets.
+
+    A zero byte outside of a packet starts a new packet, and the next zero
+    byte ends it. Anything else is text, up to the next line feed.
+    """
+
+    def __init__(self):
+        self.in_frame = False
+        self.buf = bytearray()
+        self.last_seq = None
+        self.frames = 0
+        self.lines = 0
+        self.errors = 0
+        self.lost = 0
+
+    def feed(self, data):
+        results = []
+        for b in data:
+            if self.in_frame:
+                if b != 0:
+                    self.buf.append(b)
+                    if len(self.buf) > MAX_FRAME_SIZE:
+                        self.errors += 1
+                        self.buf.clear()
+                        self.in_frame = False
+                elif self.buf:
+                    results.append(self._finish_frame())
+                    self.in_frame = False
+            elif b == 0:
+                if self.buf:
+                    results.append(self._finish_line())
+                self.in_frame = True
+            elif b == 0x0A:
+                results.append(self._finish_line())
+            elif b != 0x0D:
+                self.buf.append(b)
+        return [r for r in results if r is not None]
+
+    def _finish_line(self):
+        line = self.buf.decode("ascii", "replace")
+        self.buf.clear()
+        self.lines += 1
+        return line
+
+    def _finish_frame(self):
+        try:
+            frame = parse_frame(cobs_decode(bytes(self.buf)))
+        except (ValueError, struct.error):
+            self.errors += 1
+            return None
+        finally:
+            self.buf.clear()
+        if self.last_seq is not None:
+            self.lost += (frame.seq - self.last_seq - 1) & 0xFFFF
+        self.last_seq = frame.seq
+        self.frames += 1
+        return frame
+
+
+class SimulatedDevice:
+    """Produces the byte stream of a device streaming raw sensor readings."""
+
+    def __init__(self, encode, text_every=0, drop_every=0):
+        self.encode = encode
+        self.seq = 0
+        self.count = 0
+        self.text_every = text_every
+        self.drop_every = drop_every
+        self.rng = random.Random(1)
+
+    def next_chunk(self):
+        self.count += 1
+        body = struct.pack(RAW_READING_FORMAT,
+            self.rng.getrandbits(32), 9, 1, self.rng.getrandbits(32), 9, 1,
+            719, 99, self.count * 50, 50, 0, self.count)
+        frame = self.encode(FRAME_RAW_READING, self.seq, body)
+        self.seq = (self.seq + 1) & 0xFFFF
+        if self.drop_every and self.count % self.drop_every == 0:
+            # Simulate a packet dropped by the transmit queue
+            frame = b""
+        if self.text_every and self.count % self.text_every == 0:
+            frame += b"GD SCTL,10,250,900\r\n"
+        return frame
+
+
+def run_simulation(count, text_every, drop_every, chunk_size, python_encoder, firmware_lib):
+    if python_encoder:
+        encode = encode_frame
+        print("Encoder: Python reference")
+    else:
+        try:
+            encoder = FirmwareEncoder(firmware_lib)
+        except (OSError, subprocess.CalledProcessError) as e:
+            print("Unable to build the firmware encoder: %s" % e, file=sys.stderr)
+            return 1
+        encode = encoder.encode_frame
+        print("Encoder: firmware cdc_frame.c")
+
+    device = SimulatedDevice(encode, text_every, drop_every)
+    stream = b"".join(device.next_chunk() for _ in range(count))
+
+    decoder = StreamDecoder()
+    start = time.perf_counter()
+    for i in range(0, len(stream), chunk_size):
+        decoder.feed(stream[i:i + chunk_size])
+    elapsed = time.perf_counter() - start
+
+    expected_lost = count // drop_every if drop_every else 0
+    expected_lines = count // text_every if text_every else 0
+    print("Stream: %d bytes, %.1f bytes/reading" % (len(stream), len(stream) / count))
+    print("Decoded: %d packets, %d lines, %d lost, %d errors" %
+          (decoder.frames, decoder.lines, decoder.lost, decoder.errors))
+    print("Throughput: %.0f packets/s, %.2f MB/s" %
+          (decoder.frames / elapsed, len(stream) / elapsed / 1e6))
+
+    # A dropped final packet is not visible as a sequence gap
+    tail_drop = 1 if drop_every and count % drop_every == 0 else 0
+    ok = (decoder.errors == 0
+          and decoder.lines == expected_lines
+          and decoder.frames == count - expected_lost
+          and decoder.lost == expected_lost - tail_drop)
+    print("Result: %s" % ("PASS" if ok else "FAIL"))
+    return 0 if ok else 1
+
+
+def run_device(port, baudrate):
+    try:
+        import serial
+    except ImportError:
+        print("pyserial is required to connect to a device", file=sys.stderr)
+        return 1
+
+    decoder = StreamDecoder()
+    with serial.Serial(port, baudrate, timeout=0.1) as ser:
+        ser.write(b"SM FORMAT,BIN\r\n")
+        try:
+            while True:
+                for item in decoder.feed(ser.read(ser.in_waiting or 1)):
+                    print(item)
+        except KeyboardInterrupt:
+            ser.write(b"SM FORMAT,BASIC\r\n")
+    print("%d packets, %d lost, %d errors" % (decoder.frames, decoder.lost, decoder.errors))
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode the binary streaming mode of the CDC interface.')
+    parser.add_argument('port', nargs='?', help='serial port of the device')
+    parser.add_argument('-b', '--baudrate', type=int, default=115200, help='serial port baud rate')
+    parser.add_argument('--simulate', type=int, metavar='N', help='decode N readings from a simulated device and report throughput')
+    parser.add_argument('--text-every', type=int, default=16, help='interleave a text line every N simulated readings')
+    parser.add_argument('--drop-every', type=int, default=0, help='drop every Nth simulated packet')
+    parser.add_argument('--chunk-size', type=int, default=64, help='size of simulated USB transfers')
+    parser.add_argument('--python-encoder', action='store_true', help='encode simulated packets in Python instead of with the firmware code')
+    parser.add_argument('--firmware-lib', help='prebuilt host library of cdc_frame.c to use for the simulation')
+    args = parser.parse_args()
+
+    if args.simulate:
+        return run_simulation(args.simulate, args.text_every, args.drop_every, args.chunk_size, args.python_encoder, args.firmware_lib)
+    if not args.port:
+        parser.error("a serial port is required unless --simulate is used")
+    return run_device(args.port, args.baudrate)
+
+
+if __name__ == "__main__":
+    sys.exit(main())